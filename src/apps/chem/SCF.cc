@@ -853,7 +853,7 @@ namespace madness {
                             lbcost<double, 3>(vnucextra * 1.0, vnucextra * 8.0), false);
                 lb.add_tree(rho, lbcost<double, 3>(1.0, 8.0), true);
                 
-                FunctionDefaults < 3 > ::redistribute(world, lb.load_balance(6.0));
+                FunctionDefaults < 3 > ::redistribute(world, lb.load_balance(6.0), true);
                 END_TIMER(world, "guess loadbal");
             }
             
@@ -907,7 +907,7 @@ namespace madness {
                 for (unsigned int i = 0; i < ao.size(); ++i) {
                     lb.add_tree(ao[i], lbcost<double, 3>(1.0, 8.0), false);
                 }
-                FunctionDefaults < 3 > ::redistribute(world, lb.load_balance(6.0));
+                FunctionDefaults < 3 > ::redistribute(world, lb.load_balance(6.0), true);
                 END_TIMER(world, "guess loadbal");
             }
             START_TIMER(world);
@@ -1083,7 +1083,7 @@ namespace madness {
             vnuc = vnuc + gthpseudopotential->vlocalpot();}     
         lb.add_tree(vnuc, lbcost<double, 3>(vnucextra * 1.0, vnucextra * 8.0));
         
-        FunctionDefaults < 3 > ::redistribute(world, lb.load_balance(6.0));
+        FunctionDefaults < 3 > ::redistribute(world, lb.load_balance(6.0), true);
     }
     
     functionT SCF::make_density(World & world, const tensorT & occ,
@@ -2911,7 +2911,7 @@ namespace madness {
         }
         world.gop.fence();
         
-        FunctionDefaults < 3 > ::redistribute(world, lb.load_balance(6.0)); // 6.0 needs retuning after vnucextra
+        FunctionDefaults < 3 > ::redistribute(world, lb.load_balance(6.0), true); // 6.0 needs retuning after vnucextra
     }
     
     void SCF::rotate_subspace(World& world, const tensorT& U, subspaceT& subspace,
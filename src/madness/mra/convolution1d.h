@@ -324,6 +324,8 @@ namespace madness {
             const Tensor<Q>* p=rnlij_cache.getptr(n,lx);
             if (p) return *p;
 
+            MemTagScope cache_tag(MEM_CACHE); // Tensors made here are kept in the cache
+
             // PROFILE_MEMBER_FUNC(Convolution1D); // Too fine grain for routine profiling
 
             long twok = 2*k;
@@ -357,6 +359,8 @@ namespace madness {
             const ConvolutionData1D<Q>* p = mod_ns_cache.getptr(cache_key);
             if (p) return p;
 
+            MemTagScope cache_tag(MEM_CACHE);
+
             // for paranoid me
             MADNESS_ASSERT(sx>=0 and tx>=0);
 
@@ -414,6 +418,8 @@ namespace madness {
             const ConvolutionData1D<Q>* p = ns_cache.getptr(n,lx);
             if (p) return p;
 
+            MemTagScope cache_tag(MEM_CACHE);
+
             // PROFILE_MEMBER_FUNC(Convolution1D); // Too fine grain for routine profiling
 
             Tensor<Q> R, T;
@@ -486,6 +492,8 @@ namespace madness {
             const Tensor<Q>* p=rnlp_cache.getptr(n,lx);
             if (p) return *p;
 
+            MemTagScope cache_tag(MEM_CACHE);
+
             // PROFILE_MEMBER_FUNC(Convolution1D); // Too fine grain for routine profiling
 
             long twok = 2*k;
@@ -419,8 +419,18 @@ namespace madness {
         }
 
         /// Sets the default process map and redistributes all functions using the old map
-        static void redistribute(World& world, const std::shared_ptr< WorldDCPmapInterface< Key<NDIM> > >& newpmap) {
-            pmap->redistribute(world,newpmap);
+
+        /// With \c streaming the data of all functions is moved in bulk
+        /// messages with a single fence (see
+        /// WorldDCPmapInterface::redistribute_streaming()), which requires
+        /// that no operations on the functions are in progress, as is the
+        /// case with the result of LoadBalanceDeux::load_balance().
+        static void redistribute(World& world, const std::shared_ptr< WorldDCPmapInterface< Key<NDIM> > >& newpmap,
+                                 bool streaming = false) {
+            if (streaming)
+                pmap->redistribute_streaming(world,newpmap);
+            else
+                pmap->redistribute(world,newpmap);
             pmap = newpmap;
         }
 
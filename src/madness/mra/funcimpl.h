@@ -37,6 +37,7 @@
 
 #include <iostream>
 #include <madness/world/parallel_runtime.h>
+#include <madness/world/coroutine.h>
 #include <madness/world/print.h>
 #include <madness/world/scopedptr.h>
 #include <madness/misc/misc.h>
@@ -1132,7 +1133,7 @@ namespace madness {
             if (alpha != T(1.0)) scale_inplace(alpha,false);
             typedef Range<typename FunctionImpl<Q,NDIM>::dcT::const_iterator> rangeT;
             typedef do_gaxpy_inplace<Q,R> opT;
-            world.taskq.for_each<rangeT,opT>(rangeT(other.coeffs.begin(), other.coeffs.end()), opT(this, T(1.0), beta));
+            world.taskq.for_each<rangeT,opT>(rangeT(other.coeffs.begin(), other.coeffs.end(), rangeT::AUTO), opT(this, T(1.0), beta));
             if (fence)
                 world.gop.fence();
         }
@@ -1976,7 +1977,7 @@ namespace madness {
         void flo_unary_op_node_inplace(const opT& op, bool fence) {
             typedef Range<typename dcT::iterator> rangeT;
             typedef do_unary_op_value_inplace<opT> xopT;
-            world.taskq.for_each<rangeT,opT>(rangeT(coeffs.begin(), coeffs.end()), op);
+            world.taskq.for_each<rangeT,opT>(rangeT(coeffs.begin(), coeffs.end(), rangeT::AUTO), op);
             if (fence)
                 world.gop.fence();
         }
@@ -1987,7 +1988,7 @@ namespace madness {
         void flo_unary_op_node_inplace(const opT& op, bool fence) const {
             typedef Range<typename dcT::const_iterator> rangeT;
             typedef do_unary_op_value_inplace<opT> xopT;
-            world.taskq.for_each<rangeT,opT>(rangeT(coeffs.begin(), coeffs.end()), op);
+            world.taskq.for_each<rangeT,opT>(rangeT(coeffs.begin(), coeffs.end(), rangeT::AUTO), op);
             if (fence)
                 world.gop.fence();
         }
@@ -2440,7 +2441,7 @@ namespace madness {
         void unary_op_value_inplace(const opT& op, bool fence) {
             typedef Range<typename dcT::iterator> rangeT;
             typedef do_unary_op_value_inplace<opT> xopT;
-            world.taskq.for_each<rangeT,xopT>(rangeT(coeffs.begin(), coeffs.end()), xopT(this,op));
+            world.taskq.for_each<rangeT,xopT>(rangeT(coeffs.begin(), coeffs.end(), rangeT::AUTO), xopT(this,op));
             if (fence)
                 world.gop.fence();
         }
@@ -4011,6 +4012,14 @@ namespace madness {
 
         Future<double> norm_tree_spawn(const keyT& key);
 
+#ifdef MADNESS_HAS_COROUTINES
+        /// norm_tree of the subtree at \c key (owned by this process) as one coroutine
+        CoroTask<double> norm_tree_coro(keyT key);
+
+        /// Starts norm_tree_coro for a remote parent
+        Future<double> norm_tree_coro_start(const keyT& key);
+#endif
+
         /// truncate using a tree in reconstructed form
 
         /// must be invoked where key is local
@@ -4270,9 +4279,11 @@ namespace madness {
                     if (node.coeff().dim(0) != k || op.doleaves) {
                         ProcessID p = FunctionDefaults<NDIM>::get_apply_randomize() ? world.random_proc() : coeffs.owner(key);
 //                        woT::task(p, &implT:: template do_apply<opT,R>, &op, key, node.coeff()); //.full_tensor_copy() ????? why copy ????
-                        woT::task(p, &implT:: template do_apply<opT,R>, &op, key, node.coeff().reconstruct_tensor());
+                        woT::task(p, &implT:: template do_apply<opT,R>, &op, key, node.coeff().reconstruct_tensor(),
+                                  TaskAttributes::tree_level(key.level(), max_refine_level+1));
                     }
                 }
+                ThreadPool::throttle(); // Nothing is held here so queued tasks may run
             }
             if (fence)
                 world.gop.fence();
@@ -4405,6 +4416,7 @@ namespace madness {
                     woT::task(p, &implT:: template do_apply_directed_screening<opT,R>, &op, key, coeff, true);
                     woT::task(p, &implT:: template do_apply_directed_screening<opT,R>, &op, key, coeff, false);
                 }
+                ThreadPool::throttle(); // Nothing is held here so queued tasks may run
             }
             if (fence) world.gop.fence();
         }
@@ -4743,7 +4755,7 @@ namespace madness {
             FunctionCommonData<T,NDIM>::_init_quadrature(k+1, npt, qx, qw, quad_phi, quad_phiw, quad_phit);
 
             typedef Range<typename dcT::const_iterator> rangeT;
-            rangeT range(coeffs.begin(), coeffs.end());
+            rangeT range(coeffs.begin(), coeffs.end(), rangeT::AUTO);
             return world.taskq.reduce< double,rangeT,do_err_box<opT> >(range,
                                                                        do_err_box<opT>(this, &func, npt, qx, quad_phit, quad_phiw));
         }
@@ -4833,7 +4845,7 @@ namespace madness {
             MADNESS_ASSERT(this->is_redundant()==g.is_redundant());
             bool leaves_only=(this->is_redundant());
             return world.taskq.reduce<resultT,rangeT,do_inner_local<R> >
-                (rangeT(coeffs.begin(),coeffs.end()),do_inner_local<R>(&g, leaves_only));
+                (rangeT(coeffs.begin(),coeffs.end(),rangeT::AUTO),do_inner_local<R>(&g, leaves_only));
         }
 
         /// Type of the entry in the map returned by make_key_vec_map
@@ -5104,7 +5116,7 @@ namespace madness {
         T inner_ext_local(const std::shared_ptr< FunctionFunctorInterface<T,NDIM> > f, const bool leaf_refine) const {
             typedef Range<typename dcT::const_iterator> rangeT;
 
-            return world.taskq.reduce<T, rangeT, do_inner_ext_local_ffi>(rangeT(coeffs.begin(),coeffs.end()),
+            return world.taskq.reduce<T, rangeT, do_inner_ext_local_ffi>(rangeT(coeffs.begin(),coeffs.end(),rangeT::AUTO),
                     do_inner_ext_local_ffi(f, this, leaf_refine, false));
         }
 
@@ -5115,7 +5127,7 @@ namespace madness {
         T inner_adaptive_local(const std::shared_ptr< FunctionFunctorInterface<T,NDIM> > f, const bool leaf_refine) const {
             typedef Range<typename dcT::const_iterator> rangeT;
 
-            return world.taskq.reduce<T, rangeT, do_inner_ext_local_ffi>(rangeT(coeffs.begin(),coeffs.end()),
+            return world.taskq.reduce<T, rangeT, do_inner_ext_local_ffi>(rangeT(coeffs.begin(),coeffs.end(),rangeT::AUTO),
                     do_inner_ext_local_ffi(f, this, leaf_refine, true));
         }
 
@@ -507,6 +507,9 @@ namespace madness {
                 ar & archive::wrap((unsigned char*) &t, sizeof(t));
             }
         };
+
+        template <std::size_t NDIM>
+        struct is_bitwise_serializable< Key<NDIM> > : public std::true_type {};
     }
 
 }
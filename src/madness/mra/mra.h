@@ -2293,6 +2293,20 @@ namespace madness {
                 f.store(ar);
             }
         };
+
+        template <class T, std::size_t NDIM>
+        struct ArchiveLoadImpl< IndexedParallelInputArchive, Function<T,NDIM> > {
+            static inline void load(const IndexedParallelInputArchive& ar, Function<T,NDIM>& f) {
+                f.load(*ar.get_world(), ar);
+            }
+        };
+
+        template <class T, std::size_t NDIM>
+        struct ArchiveStoreImpl< IndexedParallelOutputArchive, Function<T,NDIM> > {
+            static inline void store(const IndexedParallelOutputArchive& ar, const Function<T,NDIM>& f) {
+                f.store(ar);
+            }
+        };
     }
 
 
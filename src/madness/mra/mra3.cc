@@ -50,30 +50,6 @@ namespace madness {
     template void fcube<std::complex<double>,3>(const Key<3>&, const FunctionFunctorInterface<std::complex<double>,3>&, const Tensor<double>&, Tensor<std::complex<double> >&);
     template Tensor<std::complex<double> > fcube<std::complex<double>, 3>(Key<3> const&, std::complex<double> (*)(Vector<double, 3> const&), Tensor<double> const&);
 
-    template <> volatile std::list<detail::PendingMsg> WorldObject<FunctionImpl<double,3> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<FunctionImpl<double,3> >::pending_mutex(0);
-    template <> volatile std::list<detail::PendingMsg> WorldObject<madness::FunctionImpl<std::complex<double>, 3> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<FunctionImpl<std::complex<double>, 3> >::pending_mutex(0);
-
-    template <> volatile std::list<detail::PendingMsg> WorldObject<WorldContainerImpl<Key<3>, FunctionNode<double, 3>, Hash<Key<3> > > >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<WorldContainerImpl<Key<3>, FunctionNode<double, 3>, Hash<Key<3> > > >::pending_mutex(0);
-    template <> volatile std::list<detail::PendingMsg> WorldObject<WorldContainerImpl<Key<3>, FunctionNode<std::complex<double>, 3>, Hash<Key<3> > > >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<WorldContainerImpl<Key<3>, FunctionNode<std::complex<double>, 3>, Hash<Key<3> > > >::pending_mutex(0);
-
-    template <> volatile std::list<detail::PendingMsg> WorldObject<DerivativeBase<double,3> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<DerivativeBase<double,3> >::pending_mutex(0);
-    template <> volatile std::list<detail::PendingMsg> WorldObject<DerivativeBase<std::complex<double>,3> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<DerivativeBase<std::complex<double>,3> >::pending_mutex(0);
-
-
-    template <> volatile std::list<detail::PendingMsg> WorldObject<madness::SeparatedConvolution<double,3> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock madness::WorldObject<madness::SeparatedConvolution<double,3> >::pending_mutex(0);
-    template <> volatile std::list<detail::PendingMsg> WorldObject<madness::SeparatedConvolution<std::complex<double>,3> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock madness::WorldObject<madness::SeparatedConvolution<std::complex<double>,3> >::pending_mutex(0);
-
-    template <> volatile std::list<detail::PendingMsg> WorldObject<WorldContainerImpl<Key<3>, LBNodeDeux<3>, Hash<Key<3> > > >::pending = std::list<detail::PendingMsg>();
-    template <>  Spinlock WorldObject<WorldContainerImpl<Key<3>, LBNodeDeux<3>, Hash<Key<3> > > >::pending_mutex(0);
-
     // These implicit instantiations must be below the explicit ones above in order not to offend LLVM
     template class FunctionDefaults<3>;
     template class Function<double, 3>;
@@ -49,29 +49,6 @@ namespace madness {
     template void fcube<std::complex<double>,6>(const Key<6>&, const FunctionFunctorInterface<std::complex<double>,6>&, const Tensor<double>&, Tensor<std::complex<double> >&);
     template Tensor<std::complex<double> > fcube<std::complex<double>, 6>(Key<6> const&, std::complex<double> (*)(Vector<double, 6> const&), Tensor<double> const&);
 
-    template <> volatile std::list<detail::PendingMsg> WorldObject<FunctionImpl<double,6> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<FunctionImpl<double,6> >::pending_mutex(0);
-    template <> volatile std::list<detail::PendingMsg> WorldObject<madness::FunctionImpl<std::complex<double>, 6> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<FunctionImpl<std::complex<double>, 6> >::pending_mutex(0);
-
-    template <> volatile std::list<detail::PendingMsg> WorldObject<WorldContainerImpl<Key<6>, FunctionNode<double, 6>, Hash<Key<6> > > >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<WorldContainerImpl<Key<6>, FunctionNode<double, 6>, Hash<Key<6> > > >::pending_mutex(0);
-    template <> volatile std::list<detail::PendingMsg> WorldObject<WorldContainerImpl<Key<6>, FunctionNode<std::complex<double>, 6>, Hash<Key<6> > > >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<WorldContainerImpl<Key<6>, FunctionNode<std::complex<double>, 6>, Hash<Key<6> > > >::pending_mutex(0);
-
-    template <> volatile std::list<detail::PendingMsg> WorldObject<DerivativeBase<double,6> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<DerivativeBase<double,6> >::pending_mutex(0);
-    template <> volatile std::list<detail::PendingMsg> WorldObject<DerivativeBase<std::complex<double>,6> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock WorldObject<DerivativeBase<std::complex<double>,6> >::pending_mutex(0);
-
-    template <> volatile std::list<detail::PendingMsg> WorldObject<madness::SeparatedConvolution<double,6> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock madness::WorldObject<madness::SeparatedConvolution<double,6> >::pending_mutex(0);
-    template <> volatile std::list<detail::PendingMsg> WorldObject<madness::SeparatedConvolution<std::complex<double>,6> >::pending = std::list<detail::PendingMsg>();
-    template <> Spinlock madness::WorldObject<madness::SeparatedConvolution<std::complex<double>,6> >::pending_mutex(0);
-
-    template <> volatile std::list<detail::PendingMsg> WorldObject<WorldContainerImpl<Key<6>, LBNodeDeux<6>, Hash<Key<6> > > >::pending = std::list<detail::PendingMsg>();
-    template <>  Spinlock WorldObject<WorldContainerImpl<Key<6>, LBNodeDeux<6>, Hash<Key<6> > > >::pending_mutex(0);
-
     // These implicit instantiations must be below the explicit ones above in order not to offend LLVM
     template class FunctionDefaults<6>;
     template class Function<double, 6>;
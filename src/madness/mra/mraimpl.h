@@ -847,7 +847,7 @@ namespace madness {
     double FunctionImpl<T,NDIM>::check_symmetry_local() const {
         PROFILE_MEMBER_FUNC(FunctionImpl);
         typedef Range<typename dcT::const_iterator> rangeT;
-        return world.taskq.reduce<double,rangeT,do_check_symmetry_local>(rangeT(coeffs.begin(),coeffs.end()),
+        return world.taskq.reduce<double,rangeT,do_check_symmetry_local>(rangeT(coeffs.begin(),coeffs.end(),rangeT::AUTO),
                                                                          do_check_symmetry_local(*this));
     }
     
@@ -1520,7 +1520,11 @@ namespace madness {
     template <typename T, std::size_t NDIM>
     void FunctionImpl<T,NDIM>::norm_tree(bool fence) {
         if (world.rank() == coeffs.owner(cdata.key0))
+#ifdef MADNESS_HAS_COROUTINES
+            norm_tree_coro(cdata.key0);
+#else
             norm_tree_spawn(cdata.key0);
+#endif
         if (fence)
             world.gop.fence();
     }
@@ -1540,6 +1544,54 @@ namespace madness {
         return sum;
     }
     
+#ifdef MADNESS_HAS_COROUTINES
+    template <typename T, std::size_t NDIM>
+    CoroTask<double> FunctionImpl<T,NDIM>::norm_tree_coro(keyT key) {
+        nodeT& node = coeffs.find(key).get()->second;
+        if (node.has_children()) {
+            // Local leaves are done here, other local children in their
+            // own coroutine, and remote children by a task at the owner
+            std::vector< Future<double> > v;
+            v.reserve(1<<NDIM);
+            for (KeyChildIterator<NDIM> kit(key); kit; ++kit) {
+                const keyT& child = kit.key();
+                if (coeffs.is_local(child)) {
+                    nodeT& cnode = coeffs.find(child).get()->second;
+                    if (cnode.has_children()) {
+                        v.push_back(norm_tree_coro(child));
+                    }
+                    else {
+                        const double norm = cnode.coeff().normf();
+                        cnode.set_norm_tree(norm);
+                        v.push_back(Future<double>(norm));
+                    }
+                }
+                else {
+                    v.push_back(woT::task(coeffs.owner(child), &implT::norm_tree_coro_start, child));
+                }
+            }
+            double sum = 0.0;
+            for (std::size_t i=0; i<v.size(); ++i) {
+                const double value = co_await v[i];
+                sum += value*value;
+            }
+            sum = sqrt(sum);
+            node.set_norm_tree(sum);
+            co_return sum;
+        }
+        else {
+            const double norm = node.coeff().normf();
+            node.set_norm_tree(norm);
+            co_return norm;
+        }
+    }
+
+    template <typename T, std::size_t NDIM>
+    Future<double> FunctionImpl<T,NDIM>::norm_tree_coro_start(const keyT& key) {
+        return norm_tree_coro(key);
+    }
+#endif
+
     template <typename T, std::size_t NDIM>
     Future<double> FunctionImpl<T,NDIM>::norm_tree_spawn(const keyT& key) {
         nodeT& node = coeffs.find(key).get()->second;
@@ -1547,9 +1599,10 @@ namespace madness {
             std::vector< Future<double> > v = future_vector_factory<double>(1<<NDIM);
             int i=0;
             for (KeyChildIterator<NDIM> kit(key); kit; ++kit,++i) {
-                v[i] = woT::task(coeffs.owner(kit.key()), &implT::norm_tree_spawn, kit.key());
+                v[i] = woT::task(coeffs.owner(kit.key()), &implT::norm_tree_spawn, kit.key(),
+                                 TaskAttributes::tree_level(kit.key().level(), max_refine_level+1));
             }
-            return woT::task(world.rank(),&implT::norm_tree_op, key, v);
+            return woT::task(world.rank(),&implT::norm_tree_op, key, v, TaskAttributes::tree_level(key.level(), max_refine_level+1));
         }
         else {
             //                return Future<double>(node.coeff().normf());
@@ -1759,7 +1812,7 @@ namespace madness {
     double FunctionImpl<T,NDIM>::norm2sq_local() const {
         PROFILE_MEMBER_FUNC(FunctionImpl);
         typedef Range<typename dcT::const_iterator> rangeT;
-        return world.taskq.reduce<double,rangeT,do_norm2sq_local>(rangeT(coeffs.begin(),coeffs.end()),
+        return world.taskq.reduce<double,rangeT,do_norm2sq_local>(rangeT(coeffs.begin(),coeffs.end(),rangeT::AUTO),
                                                                   do_norm2sq_local());
     }
     
@@ -2017,7 +2070,8 @@ namespace madness {
                     coeffT ss = copy(d(child_patch(child)));
                     ss.reduce_rank(thresh);
                     //PROFILE_BLOCK(recon_send); // Too fine grain for routine profiling
-                    woT::task(coeffs.owner(child), &implT::reconstruct_op, child, ss);
+                    woT::task(coeffs.owner(child), &implT::reconstruct_op, child, ss,
+                              TaskAttributes::tree_level(child.level(), max_refine_level+1));
                 }
             } else {
                 MADNESS_ASSERT(node.is_leaf());
@@ -3066,10 +3120,12 @@ namespace madness {
                 //PROFILE_BLOCK(compress_send); // Too fine grain for routine profiling
                 // readily available
                 v[i] = woT::task(coeffs.owner(kit.key()), &implT::compress_spawn, kit.key(),
-                                 nonstandard, keepleaves, redundant, TaskAttributes::hipri());
+                                 nonstandard, keepleaves, redundant, TaskAttributes::tree_level(kit.key().level(), max_refine_level+1));
             }
-            if (redundant) return woT::task(world.rank(),&implT::make_redundant_op, key, v);
-            return woT::task(world.rank(),&implT::compress_op, key, v, nonstandard, redundant);
+            // Ops near the root are on the critical path so they run ahead of the leaves
+            const TaskAttributes attr = TaskAttributes::tree_level(key.level(), max_refine_level+1);
+            if (redundant) return woT::task(world.rank(),&implT::make_redundant_op, key, v, attr);
+            return woT::task(world.rank(),&implT::compress_op, key, v, nonstandard, redundant, attr);
         }
         else {
             Future<coeffT > result(node.coeff());
@@ -728,6 +728,8 @@ namespace madness {
             const SeparatedConvolutionData<Q,NDIM>* p = data.getptr(n,d);
             if (p) return p;
 
+            MemTagScope cache_tag(MEM_CACHE); // Charge the operator to the cache, not to tensors
+
             // get the data for each term
             SeparatedConvolutionData<Q,NDIM> op(rank);
             for (int mu=0; mu<rank; ++mu) {
@@ -768,6 +770,8 @@ namespace madness {
             const SeparatedConvolutionData<Q,NDIM>* p = mod_data.getptr(n,key);
             if (p) return p;
 
+            MemTagScope cache_tag(MEM_CACHE);
+
             // get the data for each term
             // op.muops is of type SeparatedConvolutionInternal (1 term, all dim, 1 disp)
             // getmuop uses ConvolutionND
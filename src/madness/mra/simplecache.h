@@ -34,6 +34,7 @@
 #define MADNESS_MRA_SIMPLECACHE_H__INCLUDED
 
 #include <madness/mra/key.h>
+#include <madness/world/worldmem.h>
 
 namespace madness {
     /// Simplified interface around hash_map to cache stuff for 1D
@@ -41,15 +42,25 @@ namespace madness {
     /// This is a write once cache --- subsequent writes of elements
     /// have no effect (so that pointers/references to cached data
     /// cannot be invalidated)
+    ///
+    /// The entries are accounted as \c MEM_CACHE (see mem_tag_stats()).
+    /// Code computing what it puts here should hold a \c MemTagScope(MEM_CACHE)
+    /// so that the tensors in the cached data are accounted there too.
     template <typename Q, std::size_t NDIM>
     class SimpleCache {
     private:
+#ifdef MADNESS_USE_OPEN_HASHMAP
+        typedef ConcurrentOpenHashMap< Key<NDIM>, Q > mapT;
+#else
         typedef ConcurrentHashMap< Key<NDIM>, Q > mapT;
+#endif
         typedef std::pair<Key<NDIM>, Q> pairT;
         mapT cache;
 
     public:
-        SimpleCache() : cache() {};
+        SimpleCache() : cache() {
+            cache.set_mem_tag(MEM_CACHE);
+        };
 
         SimpleCache(const SimpleCache& c) : cache(c.cache) {};
 
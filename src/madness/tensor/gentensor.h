@@ -160,15 +160,15 @@ namespace madness {
 
 	public:
 
-		GenTensor<T>() : Tensor<T>() {}
+		GenTensor() : Tensor<T>() {}
 
-		GenTensor<T>(const Tensor<T>& t1) : Tensor<T>(t1) {}
-		GenTensor<T>(const Tensor<T>& t1, const TensorArgs& targs) : Tensor<T>(t1) {}
-		GenTensor<T>(const Tensor<T>& t1, double eps, const TensorType tt) : Tensor<T>(t1) {}
-		GenTensor<T>(const TensorType tt): Tensor<T>() {}
-		GenTensor<T>(std::vector<long> v, const TensorType& tt) : Tensor<T>(v) {}
-		GenTensor<T>(std::vector<long> v, const TensorArgs& targs) : Tensor<T>(v) {}
-		GenTensor<T>(const SRConf<T>& sr1) : Tensor<T>() {MADNESS_EXCEPTION("no ctor with SRConf: use HAVE_GENTENSOR",1);}
+		GenTensor(const Tensor<T>& t1) : Tensor<T>(t1) {}
+		GenTensor(const Tensor<T>& t1, const TensorArgs& targs) : Tensor<T>(t1) {}
+		GenTensor(const Tensor<T>& t1, double eps, const TensorType tt) : Tensor<T>(t1) {}
+		GenTensor(const TensorType tt): Tensor<T>() {}
+		GenTensor(std::vector<long> v, const TensorType& tt) : Tensor<T>(v) {}
+		GenTensor(std::vector<long> v, const TensorArgs& targs) : Tensor<T>(v) {}
+		GenTensor(const SRConf<T>& sr1) : Tensor<T>() {MADNESS_EXCEPTION("no ctor with SRConf: use HAVE_GENTENSOR",1);}
 
         /// Type conversion makes a deep copy
         template <class Q> operator GenTensor<Q>() const { // type conv => deep copy
@@ -1069,10 +1069,10 @@ namespace madness {
 		// all ctors are private, only accessible by GenTensor
 
 		/// default ctor
-		SliceGenTensor<T> () {}
+		SliceGenTensor() {}
 
 		/// ctor with a GenTensor;
-		SliceGenTensor<T> (const GenTensor<T>& gt, const std::vector<Slice>& s)
+		SliceGenTensor(const GenTensor<T>& gt, const std::vector<Slice>& s)
 				: _refGT(const_cast<GenTensor<T>& >(gt))
 				, _s(s) {}
 
@@ -38,6 +38,7 @@
 #include <madness/madness_config.h>
 #include <madness/misc/ran.h>
 #include <madness/world/posixmem.h>
+#include <madness/world/worldmem.h>
 #include <madness/world/boost_checked_delete_bits.h>
 
 #include <memory>
@@ -267,6 +268,20 @@ namespace madness {
         template <typename T> T mynorm(std::complex<T> t) {
             return std::norm(t);
         }
+
+        /// Deleter that frees tensor data and credits its bytes back to the tag they were charged to
+        template <typename T>
+        struct TaggedFree {
+            std::size_t nbyte;
+            MemTag tag;
+
+            TaggedFree(std::size_t nbyte, MemTag tag) : nbyte(nbyte), tag(tag) {}
+
+            void operator()(T* p) const {
+                mem_tag_free(tag, nbyte);
+                checked_free(p);
+            }
+        };
     }
 
     template <class T> class SliceTensor;
@@ -293,6 +308,8 @@ namespace madness {
     /// \ingroup tensor
     template <class T> class Tensor : public BaseTensor {
         template <class U> friend class SliceTensor;
+        template <class Archive, class U> friend struct archive::ArchiveStoreImpl; // For _shptr
+        template <class Archive, class U> friend struct archive::ArchiveLoadImpl; // For _shptr
 
     protected:
         T* restrict _p;
@@ -331,7 +348,9 @@ namespace madness {
                     _shptr = std::shared_ptr<T>(_p);
 #else
                     if (posix_memalign((void **) &_p, TENSOR_ALIGNMENT, sizeof(T)*_size)) throw 1;
-                    _shptr.reset(_p, &::madness::detail::checked_free<T>);
+                    const MemTag tag = mem_tag_current();
+                    mem_tag_alloc(tag, sizeof(T)*_size);
+                    _shptr.reset(_p, ::madness::detail::TaggedFree<T>(sizeof(T)*_size, tag));
 #endif
                 }
                 catch (...) {
@@ -1841,9 +1860,14 @@ namespace madness {
         template <class Archive, typename T>
         struct ArchiveStoreImpl< Archive, Tensor<T> > {
             static void store(const Archive& s, const Tensor<T>& t) {
-                if (t.iscontiguous()) {
+                // Counting only needs the sizes, so don't copy a non-contiguous tensor
+                if (t.iscontiguous() || is_count_only(s)) {
                     s & t.size() & t.id();
-                    if (t.size()) s & t.ndim() & wrap(t.dims(),TENSOR_MAXDIM) & wrap(t.ptr(),t.size());
+                    if (t.size()) {
+                        s & t.ndim() & wrap(t.dims(),TENSOR_MAXDIM);
+                        if (!store_rendezvous(s, t.ptr(), t.size()*sizeof(T), t._shptr))
+                            s & wrap(t.ptr(),t.size());
+                    }
                 }
                 else {
                     s & copy(t);
@@ -1862,9 +1886,20 @@ namespace madness {
                 if (sz) {
                     long _ndim = 0l, _dim[TENSOR_MAXDIM];
                     s & _ndim & wrap(_dim,TENSOR_MAXDIM);
-                    t = Tensor<T>(_ndim, _dim, false);
-                    if (sz != t.size()) throw "size mismatch deserializing a tensor";
-                    s & wrap(t.ptr(), t.size());
+                    std::shared_ptr<void> data;
+                    if (load_rendezvous(s, sz*sizeof(T), data)) {
+                        // Received straight into memory of its own, which the tensor takes over
+                        t = Tensor<T>();
+                        t.set_dims_and_size(_ndim, _dim);
+                        t._shptr = std::static_pointer_cast<T>(data);
+                        t._p = t._shptr.get();
+                        if (sz != t.size()) throw "size mismatch deserializing a tensor";
+                    }
+                    else {
+                        t = Tensor<T>(_ndim, _dim, false);
+                        if (sz != t.size()) throw "size mismatch deserializing a tensor";
+                        s & wrap(t.ptr(), t.size());
+                    }
                 }
                 else {
                     t = Tensor<T>();
@@ -1968,7 +2003,7 @@ namespace madness {
     /// operation and discarding.
     template <class T> class SliceTensor : public Tensor<T> {
     private:
-        SliceTensor<T>();
+        SliceTensor();
 
     public:
         SliceTensor(const Tensor<T>& t, const Slice s[])
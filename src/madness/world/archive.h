@@ -420,6 +420,7 @@
 #include <cstdio>
 #include <vector>
 #include <map>
+#include <memory>
 //#include <madness/world/worldprofile.h>
 #include <madness/world/enable_if.h>
 #include <madness/world/type_traits.h>
@@ -609,6 +610,18 @@ namespace madness {
         template <typename T>
         struct is_output_archive : public std::is_base_of<BaseOutputArchive, T> {};
 
+        /// Checks that a buffer archive stores \c T as exactly its \c sizeof(T) bytes
+
+        /// Such objects can be packed into an active message with \c memcpy
+        /// and their size is known at compile time.  True for the types
+        /// serialized by the default rules.  Types whose serialization is a
+        /// plain copy of the whole object (e.g., Key, Vector) specialize it;
+        /// being trivially copyable is not enough since a type may
+        /// serialize something other than its bytes.
+        template <typename T>
+        struct is_bitwise_serializable
+            : public std::integral_constant<bool, is_serializable<T>::value> {};
+
         // Serialize an array of fundamental stuff
         template <class Archive, class T>
         typename enable_if_c< is_serializable<T>::value && is_output_archive<Archive>::value >::type
@@ -744,6 +757,43 @@ namespace madness {
         };
 
 
+        /// Offer a contiguous array to be sent by rendezvous rather than copied into the archive
+
+        /// Returns true if the archive took the array (\c holder keeps the
+        /// memory alive until it has been sent), false if the caller must
+        /// store it as usual.  Only archives backing active messages do
+        /// anything (see BufferOutputArchive); the default declines.
+        ///
+        /// The array is sent from \c p itself some time after this
+        /// returns, so if the archive took it the caller must not modify
+        /// it in place until the message has been received (e.g., until
+        /// the next fence).  Replacing it, as Tensor assignment does, is fine.
+        template <class Archive>
+        inline bool store_rendezvous(const Archive& /*ar*/, const void* /*p*/, std::size_t /*nbyte*/,
+                                     const std::shared_ptr<const void>& /*holder*/) {
+            return false;
+        }
+
+        /// Counterpart of store_rendezvous
+
+        /// Returns true if the \c nbyte bytes of the array were received
+        /// into memory of their own, which \c data is set to hold (aligned
+        /// to at least 16 bytes), so that the caller can take it over
+        /// rather than copy it.  Returns false if the caller must load the
+        /// array as usual.
+        template <class Archive>
+        inline bool load_rendezvous(const Archive& /*ar*/, std::size_t /*nbyte*/,
+                                    std::shared_ptr<void>& /*data*/) {
+            return false;
+        }
+
+        /// Returns true if the archive only counts bytes (so data need not be valid or contiguous)
+        template <class Archive>
+        inline bool is_count_only(const Archive& /*ar*/) {
+            return false;
+        }
+
+
         // Redirect \c << to ArchiveImpl::wrap_store for output archives
         template <class Archive, class T>
         inline
@@ -930,6 +980,13 @@ namespace madness {
         };
 
 
+        /// A complex number is stored as its real and imaginary parts
+        template <typename T>
+        struct is_bitwise_serializable< std::complex<T> >
+            : public std::integral_constant<bool, is_bitwise_serializable<T>::value &&
+                                                  sizeof(std::complex<T>) == 2*sizeof(T)> {};
+
+
         /// Serialize STL vector.
         template <class Archive, typename T>
         struct ArchiveStoreImpl< Archive, std::vector<T> > {
@@ -40,6 +40,7 @@
 #include <madness/world/worldhash.h>
 #include <array>
 #include <vector>
+#include <type_traits>
 #include <algorithm>
 #include <iostream>
 
@@ -71,6 +72,8 @@ namespace madness {
         struct ArchiveStoreImpl;
         template <class Archive, class T>
         struct ArchiveLoadImpl;
+        template <typename T>
+        struct is_bitwise_serializable;
 
         template <class Archive, typename T, std::size_t N>
         struct ArchiveStoreImpl<Archive, std::array<T,N> > {
@@ -88,6 +91,11 @@ namespace madness {
             }
         };
 
+        template <typename T, std::size_t N>
+        struct is_bitwise_serializable< std::array<T,N> >
+            : public std::integral_constant<bool, is_bitwise_serializable<T>::value &&
+                                                  sizeof(std::array<T,N>) == N*sizeof(T)> {};
+
     } // namespace archive
 
     /// A simple, fixed dimension Coordinate
@@ -300,6 +308,14 @@ namespace madness {
         }
     }; // class Vector
 
+    namespace archive {
+        /// A \c Vector is stored as its elements
+        template <typename T, std::size_t N>
+        struct is_bitwise_serializable< Vector<T,N> >
+            : public std::integral_constant<bool, is_bitwise_serializable< std::array<T,N> >::value &&
+                                                  sizeof(Vector<T,N>) == sizeof(std::array<T,N>)> {};
+    } // namespace archive
+
     template <typename T, std::size_t N>
     void swap(Vector<T,N>& l, Vector<T,N>& r) {
         l.swap(r);
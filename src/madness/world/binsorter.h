@@ -6,17 +6,70 @@
 namespace madness {
 
     /// A parallel bin sort across MPI processes
+
+    /// Values are collected in a bin per process, and a bin is sent when
+    /// it holds \c bufsize values.  Optionally, a byte budget bounds the
+    /// data buffered in all bins together: once it is exceeded the
+    /// largest bin is sent, so that memory no longer grows with the
+    /// number of processes.  A bin keeps its storage after it is sent,
+    /// unless (with a budget) the storage kept by all bins is above the
+    /// budget.
     template <typename T, typename inserterT>
     class BinSorter : public WorldObject< BinSorter<T,inserterT> > {
         World* pworld;
         inserterT inserter;
         std::size_t bufsize;
+        std::size_t budget;     ///< Byte budget for all bins (0 = none)
+        std::size_t nbyte;      ///< Bytes now buffered
+        std::size_t nbyte_peak; ///< Largest value of nbyte
+        std::size_t ncapacity;  ///< Bytes of storage kept by the bins
         std::vector<T>* bins;
-        
+
+        // With a budget, processes with a non-empty bin are kept in
+        // doubly linked lists by bin size so that finding the largest
+        // bin does not scan all of them
+        std::vector<int> head;  ///< First process whose bin holds i values (-1 if none)
+        std::vector<int> next;  ///< Next process in the same list (-1 if none)
+        std::vector<int> prev;  ///< Previous process in the same list (-1 if none)
+        std::size_t maxsize;    ///< Size of the largest bin
+
+        void link(int p, std::size_t size) {
+            if (head.size() <= size) head.resize(size+1, -1);
+            prev[p] = -1;
+            next[p] = head[size];
+            if (next[p] >= 0) prev[next[p]] = p;
+            head[size] = p;
+            if (size > maxsize) maxsize = size;
+        }
+
+        void unlink(int p, std::size_t size) {
+            if (prev[p] >= 0) next[prev[p]] = next[p];
+            else head[size] = next[p];
+            if (next[p] >= 0) prev[next[p]] = prev[p];
+        }
+
         void flush(int owner) {
-            if (bins[owner].size())
-                this->send(owner, &BinSorter<T,inserterT>::sorter,  bins[owner]);
-            bins[owner].clear();
+            std::vector<T>& bin = bins[owner];
+            if (bin.size()) {
+                this->send(owner, &BinSorter<T,inserterT>::sorter,  bin);
+                nbyte -= bin.size()*sizeof(T);
+                if (budget) {
+                    unlink(owner, bin.size());
+                    // The largest size goes up by at most one per insert,
+                    // so stepping it down is cheap overall
+                    while (maxsize && head[maxsize] < 0) --maxsize;
+                }
+            }
+            bin.clear();
+            if (budget && ncapacity > budget) {
+                ncapacity -= bin.capacity()*sizeof(T);
+                std::vector<T>().swap(bin);
+            }
+        }
+
+        /// Returns the process with the largest bin (with a budget)
+        int largest() const {
+            return maxsize ? head[maxsize] : 0;
         }
         
         void sorter(const std::vector<T>& v) {
@@ -31,12 +84,18 @@ namespace madness {
         /// @param[in] world The world object that must persist during the existence of this object
         /// @param[in] inserter User provides this routine to process an item of data on remote end
         /// @param[in] bufsize Size of bin (in units of T) ... default value is as large as possible
-        BinSorter(World& world, inserterT inserter, int bufsize=0)
+        /// @param[in] budget Bytes that may be buffered in all bins together ... default is no limit
+        BinSorter(World& world, inserterT inserter, int bufsize=0, std::size_t budget=0)
             : WorldObject<BinSorter>(world)
             , pworld(&world)
             , inserter(inserter)
             , bufsize(bufsize)
+            , budget(budget)
+            , nbyte(0)
+            , nbyte_peak(0)
+            , ncapacity(0)
             , bins(new std::vector<T>[world.size()])
+            , maxsize(0)
         {
             // bufsize ... max from AM buffer size is about 512K/sizeof(T)
             // bufsize ... max from total buffer use is about 1GB/sizeof(T)/P
@@ -46,6 +105,11 @@ namespace madness {
             //     bins[i].reserve(bufsize); // Not a good idea on large process counts unless truly all to all?
             // }
 
+            if (budget) {
+                next.resize(world.size(), -1);
+                prev.resize(world.size(), -1);
+            }
+
             //print("binsorter bufsize is", this->bufsize, this->bufsize*sizeof(T));
             WorldObject< BinSorter<T,inserterT> >::process_pending();
         }
@@ -67,11 +131,27 @@ namespace madness {
         
         /// Application calls this to add a value to the bin for process p
         void insert(ProcessID p, const T& value) {
-            bins[p].push_back(value);
+            std::vector<T>& bin = bins[p];
+            const std::size_t capacity = bin.capacity();
+            bin.push_back(value);
+            ncapacity += (bin.capacity() - capacity)*sizeof(T);
+            nbyte += sizeof(T);
+            if (budget) {
+                if (bin.size() > 1) unlink(p, bin.size()-1);
+                link(p, bin.size());
+            }
+            if (nbyte > nbyte_peak) nbyte_peak = nbyte;
+
+            if (bin.size() >= bufsize) flush(p);
+            else if (budget && nbyte > budget) flush(largest());
+        }
+
+        /// Returns the largest number of bytes buffered at once on this process
 
-            // More intelligent buffer management would look at total use and flush
-            // largest buffers rather than using a fixed buffersize per process
-            if (bins[p].size() >= bufsize) flush(p);
+        /// Useful to choose the budget, e.g., for a redistribution of
+        /// function trees with many processes.
+        std::size_t get_peak_bytes() const {
+            return nbyte_peak;
         }
     };
 }
@@ -43,11 +43,72 @@
 #include <madness/world/archive.h>
 #include <madness/world/print.h>
 #include <cstring>
+#include <memory>
+#include <stdint.h>
 
 
 namespace madness {
     namespace archive {
 
+        /// What a BufferOutputArchive writes in place of an array sent by rendezvous
+        struct BufferRendezvousInfo {
+            uint64_t nbyte;     ///< Size of the array
+            int32_t src;        ///< Rank (in COMM_WORLD) of the sender ... filled in when sent
+            int32_t tag;        ///< Tag of the transfer ... filled in when sent
+        };
+
+
+        /// Lets a BufferOutputArchive hand large arrays to someone else to send
+
+        /// Implemented by the active message layer (see AmArg).
+        class BufferRendezvousSink {
+        public:
+            virtual ~BufferRendezvousSink() {}
+
+            /// Returns true if arrays may be sent by rendezvous at all
+
+            /// If false, nothing is written for offered arrays (not even a
+            /// flag), so this must agree with BufferRendezvousSource::is_enabled
+            /// on the receiver.
+            virtual bool is_enabled() const = 0;
+
+            /// Returns true if an array of \c nbyte bytes should be sent by rendezvous
+            virtual bool wants(std::size_t nbyte) const = 0;
+
+            /// Records an array whose BufferRendezvousInfo is at \c offset in \c buf
+            virtual void add(void* buf, std::size_t offset, const void* p, std::size_t nbyte,
+                             const std::shared_ptr<const void>& holder) = 0;
+        };
+
+
+        /// Lets a BufferInputArchive receive arrays sent by rendezvous
+        class BufferRendezvousSource {
+        public:
+            virtual ~BufferRendezvousSource() {}
+
+            /// Returns true if the archive may contain arrays sent by rendezvous
+            virtual bool is_enabled() const = 0;
+
+            /// Returns the memory the array described by \c info was received into (waits for it to arrive)
+            virtual std::shared_ptr<void> recv(const BufferRendezvousInfo& info) const = 0;
+        };
+
+
+        /// Gives a BufferOutputArchive a larger buffer when it fills up
+
+        /// Lets an archive be written in one pass when its size is not
+        /// known in advance (see new_am_arg).
+        class BufferGrower {
+        public:
+            virtual ~BufferGrower() {}
+
+            /// Returns a buffer of at least \c nbyte bytes starting with the \c used bytes written so far
+
+            /// On return \c nbyte is the size of the new buffer.
+            virtual unsigned char* grow(std::size_t used, std::size_t& nbyte) = 0;
+        };
+
+
         /// Wraps an archive around a memory buffer for output
 
         /// Type checking is disabled for efficiency.
@@ -55,18 +116,33 @@ namespace madness {
         /// Throws MadnessException in case of buffer overflow
         ///
         /// Default constructor can be used to count stuff.
+        ///
+        /// If given a BufferRendezvousSink, large arrays offered with
+        /// store_rendezvous may be replaced by a BufferRendezvousInfo and
+        /// sent separately; the data must then be read back by a
+        /// BufferInputArchive with a BufferRendezvousSource.
+        ///
+        /// If given a BufferGrower the buffer is replaced by a larger one
+        /// instead of overflowing.
         class BufferOutputArchive : public BaseOutputArchive {
         private:
-            unsigned char * const ptr;    // Buffer
-            const std::size_t nbyte;      // Buffer size
+            mutable unsigned char * ptr;  // Buffer
+            mutable std::size_t nbyte;    // Buffer size
             mutable std::size_t i;        // Current output location
             bool countonly;               // If true just count, don't copy
+            BufferRendezvousSink* sink;   // Takes arrays sent by rendezvous (may be null)
+            BufferGrower* grower;         // Enlarges a full buffer (may be null)
         public:
             BufferOutputArchive()
-                    : ptr(0), nbyte(0), i(0), countonly(true) {}
+                    : ptr(0), nbyte(0), i(0), countonly(true), sink(0), grower(0) {}
+
+            explicit BufferOutputArchive(BufferRendezvousSink* sink)
+                    : ptr(0), nbyte(0), i(0), countonly(true), sink(sink), grower(0) {}
 
-            BufferOutputArchive(void* ptr, std::size_t nbyte)
-                    : ptr((unsigned char *) ptr), nbyte(nbyte), i(0), countonly(false) {}
+            BufferOutputArchive(void* ptr, std::size_t nbyte, BufferRendezvousSink* sink = 0,
+                                BufferGrower* grower = 0)
+                    : ptr((unsigned char *) ptr), nbyte(nbyte), i(0), countonly(false), sink(sink)
+                    , grower(grower) {}
 
             template <class T>
             inline
@@ -75,15 +151,22 @@ namespace madness {
                 std::size_t m = n*sizeof(T);
                 if (countonly) {
                     i += m;
+                    return;
                 }
-                else if (i+m > nbyte) {
-                    madness::print("BufferOutputArchive:ptr,nbyte,i,n,m,i+m:",(void *)ptr,nbyte,i,n,m,i+m);
-                    MADNESS_ASSERT(i+m<=nbyte);
-                }
-                else {
-                    memcpy(ptr+i, t, m);
-                    i += m;
+                if (i+m > nbyte) {
+                    if (grower) {
+                        std::size_t newsize = i+m;
+                        ptr = grower->grow(i, newsize);
+                        nbyte = newsize;
+                    }
+                    else {
+                        madness::print("BufferOutputArchive:ptr,nbyte,i,n,m,i+m:",(void *)ptr,nbyte,i,n,m,i+m);
+                        MADNESS_ASSERT(i+m<=nbyte);
+                        return;
+                    }
                 }
+                memcpy(ptr+i, t, m);
+                i += m;
             }
 
             void open(std::size_t /*hint*/) {}
@@ -97,6 +180,19 @@ namespace madness {
             inline std::size_t size() const {
                 return i;
             };
+
+            /// See archive::store_rendezvous
+            bool store_rendezvous(const void* p, std::size_t n,
+                                  const std::shared_ptr<const void>& holder) const {
+                if (!sink || !sink->is_enabled()) return false;
+                const unsigned char flag = sink->wants(n);
+                store(&flag, 1);
+                if (!flag) return false;
+                BufferRendezvousInfo info = { n, -1, -1 };
+                if (!countonly) sink->add(ptr, i, p, n, holder);
+                store(reinterpret_cast<const unsigned char*>(&info), sizeof(info));
+                return true;
+            }
         };
 
 
@@ -110,10 +206,12 @@ namespace madness {
             const unsigned char* const ptr;
             const std::size_t nbyte;
             mutable std::size_t i;
+            const BufferRendezvousSource* source; // Receives arrays sent by rendezvous (may be null)
 
         public:
-            BufferInputArchive(const void* ptr, std::size_t nbyte)
-                    : ptr((const unsigned char *) ptr), nbyte(nbyte), i(0) {};
+            BufferInputArchive(const void* ptr, std::size_t nbyte,
+                               const BufferRendezvousSource* source = 0)
+                    : ptr((const unsigned char *) ptr), nbyte(nbyte), i(0), source(source) {};
 
             template <class T>
             inline
@@ -136,9 +234,37 @@ namespace madness {
             };
 
             void close() {}
+
+            /// See archive::load_rendezvous
+            bool load_rendezvous(std::size_t n, std::shared_ptr<void>& data) const {
+                if (!source || !source->is_enabled()) return false;
+                unsigned char flag = 0;
+                load(&flag, 1);
+                if (!flag) return false;
+                BufferRendezvousInfo info;
+                load(reinterpret_cast<unsigned char*>(&info), sizeof(info));
+                MADNESS_ASSERT(info.nbyte == n);
+                data = source->recv(info);
+                return true;
+            }
         };
 
 
+        inline bool store_rendezvous(const BufferOutputArchive& ar, const void* p, std::size_t nbyte,
+                                     const std::shared_ptr<const void>& holder) {
+            return ar.store_rendezvous(p, nbyte, holder);
+        }
+
+        inline bool load_rendezvous(const BufferInputArchive& ar, std::size_t nbyte,
+                                    std::shared_ptr<void>& data) {
+            return ar.load_rendezvous(nbyte, data);
+        }
+
+        inline bool is_count_only(const BufferOutputArchive& ar) {
+            return ar.count_only();
+        }
+
+
         // No type checking over Buffer stream for efficiency
         template <class T>
         struct ArchivePrePostImpl<BufferOutputArchive,T> {
@@ -0,0 +1,361 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+#ifndef MADNESS_WORLD_COROUTINE_H__INCLUDED
+#define MADNESS_WORLD_COROUTINE_H__INCLUDED
+
+/// \file coroutine.h
+/// \brief Coroutine tasks that run in the ThreadPool and \c co_await a Future
+
+/// Everything here needs a C++20 compiler (e.g., \c -std=c++20); when it
+/// is available \c MADNESS_HAS_COROUTINES is defined to 1.
+
+#include <madness/madness_config.h>
+
+#if defined(__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902L) && !defined(HAVE_INTEL_TBB)
+#define MADNESS_HAS_COROUTINES 1
+#endif
+
+#ifdef MADNESS_HAS_COROUTINES
+
+#include <madness/world/world.h>
+#include <madness/world/world_task_queue.h>
+#include <madness/world/object_pool.h>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace madness {
+
+    template <typename T> class CoroTask;
+
+    namespace detail {
+
+        /// Pool task that resumes a suspended coroutine
+
+        /// It is also the callback of the awaited future, so one small
+        /// (pooled) object is all a suspension costs.
+        class CoroResume : public PoolTaskInterface, public CallbackInterface {
+            std::coroutine_handle<> h;
+
+        public:
+            CoroResume(std::coroutine_handle<> h, const TaskAttributes& attr)
+                : PoolTaskInterface(attr), h(h) {}
+
+            /// Invoked when the awaited future is assigned
+            void notify() {
+                ThreadPool::add(this);
+            }
+
+            void run(const TaskThreadEnv&) {
+                h.resume();
+            }
+
+            virtual void get_id(std::pair<void*,unsigned short>& id) const {
+                id.first = h.address();
+                id.second = 3ul;
+            }
+        };
+
+        /// Finds the World of a coroutine from its arguments
+        template <typename A>
+        World* coro_world(A& a) {
+            if constexpr (std::is_base_of_v<World, std::remove_cv_t<A> >)
+                return const_cast<World*>(&a);
+            else if constexpr (requires { a.get_world(); })
+                return &const_cast<World&>(a.get_world());
+            else
+                return 0;
+        }
+
+        /// Reports an exception nobody will see the way ThreadBase reports one from a task
+        inline void coro_report(const std::exception_ptr& e) {
+            try {
+                std::rethrow_exception(e);
+            }
+            catch (const SafeMPI::Exception& e) {
+                print(e);
+                error("caught an MPI exception in a coroutine");
+            }
+            catch (const madness::MadnessException& e) {
+                print(e);
+                error("caught a MADNESS exception in a coroutine");
+            }
+            catch (const char* s) {
+                print(s);
+                error("caught a string exception in a coroutine");
+            }
+            catch (const std::string& s) {
+                print(s);
+                error("caught a string (class) exception in a coroutine");
+            }
+            catch (const std::exception& e) {
+                print(e.what());
+                error("caught an STL exception in a coroutine");
+            }
+            catch (...) {
+                error("caught unhandled exception in a coroutine");
+            }
+        }
+
+        /// Completion and exception of a coroutine, shared by its promise and CoroTask
+
+        /// A coroutine awaiting the CoroTask of another waits here rather
+        /// than on the result future, so that it is resumed (and the
+        /// exception rethrown) also when the other one throws.  An
+        /// exception that neither CoroTask::get() nor such an awaiter
+        /// picked up is reported with error() once the last CoroTask and
+        /// the frame are gone, as for an exception thrown by a task.
+        struct CoroState {
+            std::exception_ptr error;
+            volatile bool failed;
+            volatile bool observed;               ///< The exception was rethrown to someone
+            CallbackInterface* volatile waiter;   ///< Awaiting coroutine, or done() once finished
+
+            CoroState() : error(), failed(false), observed(false), waiter(0) {}
+
+            ~CoroState() {
+                if (failed && !observed) coro_report(error);
+            }
+
+            static CallbackInterface* done() { return reinterpret_cast<CallbackInterface*>(1); }
+
+            bool probe() const { return failed; }
+
+            bool finished() const { return waiter == done(); }
+
+            /// Registers the resumption of an awaiting coroutine ... false if already finished
+            bool wait(CallbackInterface* callback) {
+                return __sync_bool_compare_and_swap(&waiter, (CallbackInterface*)(0), callback);
+            }
+
+            /// Called as the frame is destroyed ... resumes the awaiting coroutine
+            void finish() {
+                CallbackInterface* callback = __sync_lock_test_and_set(&waiter, done());
+                if (callback) callback->notify();
+            }
+
+            /// Rethrows the exception to a caller that will see it
+            void rethrow() {
+                observed = true;
+                std::rethrow_exception(error);
+            }
+        };
+
+        /// Parts of the promise of CoroTask that do not depend on the result type
+        class CoroPromiseBase {
+            World* world;
+            TaskAttributes attr;
+
+        protected:
+            std::shared_ptr<CoroState> state;
+
+        public:
+            /// The first argument that is a World or has get_world() gives the World
+
+            /// The coroutine is counted as a pending task of that World
+            /// until it completes, so World::gop.fence() waits for it.
+            template <typename... argsT>
+            explicit CoroPromiseBase(argsT&... args) : world(0), state(std::make_shared<CoroState>()) {
+                ((world = (world ? world : coro_world(args))), ...);
+                if (!world) MADNESS_EXCEPTION("CoroTask: a World or WorldObject must be one of the arguments", 0);
+                world->taskq.register_coroutine();
+            }
+
+            ~CoroPromiseBase() {
+                state->finish();
+                world->taskq.notify_coroutine();
+            }
+
+            /// Frames come from the same pool as task objects
+            static void* operator new(std::size_t size) {
+                return SmallObjectPool::allocate(size);
+            }
+
+            static void operator delete(void* p, std::size_t size) {
+                SmallObjectPool::deallocate(p, size);
+            }
+
+            /// The coroutine starts in a task of the ThreadPool
+            auto initial_suspend() {
+                struct Schedule {
+                    TaskAttributes attr;
+                    bool await_ready() const noexcept { return false; }
+                    void await_suspend(std::coroutine_handle<> h) const {
+                        ThreadPool::add(new CoroResume(h, attr));
+                    }
+                    void await_resume() const noexcept {}
+                };
+                return Schedule{attr};
+            }
+
+            /// The frame is destroyed as soon as the coroutine returns
+            std::suspend_never final_suspend() noexcept { return {}; }
+
+            /// Keeps the exception for whoever awaits the CoroTask
+
+            /// The frame is then destroyed as on return, so the coroutine
+            /// no longer counts as pending and an awaiting coroutine is
+            /// resumed, but the result future is never set.
+            void unhandled_exception() {
+                state->error = std::current_exception();
+                __sync_synchronize(); // the exception is visible before failed
+                state->failed = true;
+            }
+
+            /// Makes co_await Future<T> resume in a task with the attributes of this coroutine
+            template <typename T>
+            auto await_transform(const Future<T>& f) {
+                struct Awaiter {
+                    Future<T> f;
+                    TaskAttributes attr;
+                    bool await_ready() const { return f.probe(); }
+                    void await_suspend(std::coroutine_handle<> h) {
+                        f.register_callback(new CoroResume(h, attr));
+                    }
+                    const T& await_resume() const { return f.get(); }
+                };
+                return Awaiter{f, attr};
+            }
+
+            /// Makes co_await CoroTask<T> resume once the other coroutine returns or throws
+
+            /// If it threw, the exception is rethrown here.
+            template <typename T>
+            auto await_transform(const CoroTask<T>& t) {
+                struct Awaiter {
+                    CoroTask<T> t;
+                    TaskAttributes attr;
+                    bool await_ready() const { return t.state->finished(); }
+                    bool await_suspend(std::coroutine_handle<> h) {
+                        CoroResume* resume = new CoroResume(h, attr);
+                        if (t.state->wait(resume)) return true;
+                        delete resume; // finished meanwhile
+                        return false;
+                    }
+                    const T& await_resume() const {
+                        if (t.state->probe()) t.state->rethrow();
+                        return t.result.get();
+                    }
+                };
+                return Awaiter{t, attr};
+            }
+        };
+    }
+
+
+    /// A task written as a coroutine that can \c co_await a Future
+
+    /// A function returning \c CoroTask<T> may \c co_await any
+    /// \c Future and \c co_return a \c T.  Calling it makes the frame and
+    /// submits it to the ThreadPool; each \c co_await of an unassigned
+    /// future suspends the frame, which is resumed in a new pool task when
+    /// the future is assigned.  Dependent work (e.g., a tree traversal)
+    /// can so be written as one function instead of a spawn/op pair of
+    /// tasks linked by futures, and a node costs one frame plus one small
+    /// object per suspension.
+    ///
+    /// One of the arguments (\c this included) must be a \c World or an
+    /// object with \c get_world() (e.g., a WorldObject); the coroutine
+    /// counts as a pending task of that World until it returns.  Pass
+    /// arguments by value since the coroutine outlives the caller.
+    ///
+    /// The result is obtained with future(), or by converting to \c Future<T>.
+    /// If the coroutine throws, the exception is kept and the future is
+    /// never assigned; get() rethrows it, failed() tells whether it
+    /// happened, and another coroutine that does \c co_await on the
+    /// CoroTask itself (not on its future) gets it rethrown there.  An
+    /// exception that none of these picks up is reported with error()
+    /// once the coroutine and every copy of its CoroTask are gone, as if
+    /// a task had thrown it.  E.g.
+    /// \code
+    /// CoroTask<double> sum(World& world, Future<double> a, Future<double> b) {
+    ///     double x = co_await a;
+    ///     double y = co_await b;
+    ///     co_return x + y;
+    /// }
+    /// \endcode
+    template <typename T>
+    class CoroTask {
+        friend class detail::CoroPromiseBase;
+
+        Future<T> result;
+        std::shared_ptr<detail::CoroState> state;
+
+        /// Probe for get() that is true once the coroutine returns or throws
+        struct Done {
+            const CoroTask<T>* task;
+            bool operator()() const { return task->result.probe() || task->state->probe(); }
+        };
+
+    public:
+        class promise_type : public detail::CoroPromiseBase {
+            Future<T> result;
+        public:
+            template <typename... argsT>
+            explicit promise_type(argsT&... args) : detail::CoroPromiseBase(args...) {}
+
+            CoroTask<T> get_return_object() { return CoroTask<T>(result, state); }
+
+            template <typename U>
+            void return_value(const U& value) { result.set(value); }
+        };
+
+        CoroTask(const Future<T>& result, const std::shared_ptr<detail::CoroState>& state)
+            : result(result), state(state) {}
+
+        /// Returns the future of the result
+        const Future<T>& future() const { return result; }
+
+        /// Returns true if the coroutine ended by throwing an exception
+        bool failed() const {
+            if (!state->probe()) return false;
+            state->observed = true;
+            return true;
+        }
+
+        /// Waits for the coroutine and returns the result, or rethrows its exception
+        const T& get() const {
+            World::await(Done{this});
+            if (state->probe()) state->rethrow();
+            return result.get();
+        }
+
+        operator Future<T>() const { return result; }
+    };
+
+} // namespace madness
+
+#endif // MADNESS_HAS_COROUTINES
+
+#endif // MADNESS_WORLD_COROUTINE_H__INCLUDED
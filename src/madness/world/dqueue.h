@@ -50,13 +50,26 @@ namespace madness {
 
     struct DQStats { // Dilly bar, blizzard, ...
         uint64_t npush_back;    ///< #calls to push_back
-        uint64_t npush_front;   ///< #calls to push_front
+        uint64_t npush_front;   ///< #calls to push_front or push_priority
         uint64_t npop_front;    ///< #calls to pop_front
+        uint64_t npop_back;     ///< #calls to pop_back (owner end of a WorkStealingDeque)
         uint64_t ngrow;         ///< #calls to grow
         uint64_t nmax;          ///< Lifetime max. entries in the queue
+        uint64_t nsteal;        ///< #tasks taken from another thread's deque
+        uint64_t nsum;          ///< Sum over pushes of the no. of entries after the push
+        uint64_t nsize;         ///< Entries in the queue when the stats were taken (ThreadPool only)
+        uint64_t nthrottle;     ///< #times a submitter found the queue over its high-water mark
+        uint64_t ninline;       ///< #tasks run by throttled submitters
 
         DQStats()
-                : npush_back(0), npush_front(0), npop_front(0), ngrow(0), nmax(0) {}
+                : npush_back(0), npush_front(0), npop_front(0), npop_back(0), ngrow(0), nmax(0), nsteal(0)
+                , nsum(0), nsize(0), nthrottle(0), ninline(0) {}
+
+        /// Mean no. of entries in the queue seen by a push
+        double mean_size() const {
+            const uint64_t npush = npush_back + npush_front;
+            return npush ? double(nsum)/npush : 0.0;
+        }
     };
 
 
@@ -68,14 +81,81 @@ namespace madness {
     /// shrink.  Had to modify STL API to make things thread safe.
     ///
     /// It is now rather heavily specialized to its only use.
+    ///
+    /// Values pushed with a priority (push_priority() and push_front())
+    /// are kept in a short FIFO lane per level and are popped before
+    /// anything in the circular buffer, highest level first.  Values
+    /// pushed at the front go to a lane of their own above all levels.
+    /// A full lane is regrown with memory allocated outside the lock.
     template <typename T>
     class DQueue : private CONDITION_VARIABLE_TYPE {
+    public:
+        static const int NPRIORITY = 8; ///< Priority levels (0 is the circular buffer)
+
+    private:
+        /// A circular buffer for one priority lane ... all access under the lock of the DQueue
+        struct Lane {
+            T* buf;        ///< Actual buffer (null until first used)
+            size_t sz;     ///< Current capacity
+            size_t front;  ///< Index of element at front
+            size_t n;      ///< Number of elements
+
+            Lane() : buf(0), sz(0), front(0), n(0) {}
+
+            ~Lane() {
+                delete [] buf;
+            }
+
+            bool full() const {
+                return n == sz;
+            }
+
+            /// Moves the elements into \c nbuf of capacity \c nsz (>n) ... returns the old buffer
+            T* replace(T* nbuf, size_t nsz) {
+                for (size_t i=0; i<n; ++i)
+                    nbuf[i] = buf[(front + i) % sz];
+                T* old = buf;
+                buf = nbuf;
+                sz = nsz;
+                front = 0;
+                return old;
+            }
+
+            void push_back(const T& value) {
+                buf[(front + n) % sz] = value;
+                ++n;
+            }
+
+            void push_front(const T& value) {
+                front = (front + sz - 1) % sz;
+                buf[front] = value;
+                ++n;
+            }
+
+            T pop_front() {
+                T value = buf[front];
+                front = (front + 1) % sz;
+                --n;
+                return value;
+            }
+
+            T* at(size_t i) {
+                return buf + (front + i) % sz;
+            }
+
+        private:
+            Lane(const Lane&);             // Verboten
+            void operator=(const Lane&);   // Verboten
+        };
+
         char pad[64]; ///< To put the lock and the data in separate cache lines
         volatile size_t n __attribute__((aligned(64)));        ///< Number of elements in the buffer
         volatile size_t sz;              ///< Current capacity
         volatile T* volatile buf;        ///< Actual buffer
         volatile int _front;  ///< Index of element at front of buffer
         volatile int _back;    ///< Index of element at back of buffer
+        volatile size_t nlane;           ///< Number of elements in the priority lanes
+        Lane lane[NPRIORITY+1];          ///< Lanes for levels 1..NPRIORITY-1 and the front
         DQStats stats;
 
         void grow() {
@@ -123,7 +203,8 @@ namespace madness {
                 ss = sz;
             }
             ++nn;
-            if (nn > stats.nmax) stats.nmax = nn;
+            if (nn + nlane > stats.nmax) stats.nmax = nn + nlane;
+            stats.nsum += nn + nlane;
             n = nn;
 
             int b = _back + 1;
@@ -135,6 +216,60 @@ namespace madness {
             signal();
         }
 
+        /// Push onto a lane, growing it with a buffer allocated while not holding the lock
+        void push_lane(const T& value, int level, bool front) {
+            T* spare = 0;      // New buffer, or the old one once replaced
+            size_t nspare = 0;
+            while (true) {
+                {
+                    madness::ScopedMutex<CONDITION_VARIABLE_TYPE> obolus(this);
+                    Lane& q = lane[level];
+                    if (q.full() && nspare > q.n) {
+                        spare = q.replace(spare, nspare);
+                        nspare = 0;
+                    }
+                    if (!q.full()) {
+                        push_lane_with_lock(value, level, front);
+                        break;
+                    }
+                    nspare = std::max(2*q.sz, size_t(64));
+                }
+                delete [] spare;
+                spare = new T[nspare];
+            }
+            delete [] spare;
+        }
+
+        void push_lane_with_lock(const T& value, int level, bool front) {
+            // ASSUME WE ALREADY HAVE THE MUTEX AND THE LANE HAS ROOM
+            if (front)
+                lane[level].push_front(value);
+            else
+                lane[level].push_back(value);
+            size_t nn = nlane + 1;
+            nlane = nn;
+            nn += n;
+            if (nn > stats.nmax) stats.nmax = nn;
+            stats.nsum += nn;
+            ++(stats.npush_front);
+
+            signal();
+        }
+
+        /// Pop from the highest non-empty lanes ... assumes nlane>0
+        int pop_lanes_with_lock(int nmax, T* r) {
+            nmax = std::min(nmax,std::max(int(nlane>>6),1));
+            int retval = 0;
+            for (int level=NPRIORITY; level>0 && retval<nmax; --level) {
+                Lane& q = lane[level];
+                while (q.n && retval<nmax) {
+                    r[retval++] = q.pop_front(); // Null pointer indicates stolen task
+                }
+            }
+            nlane -= retval;
+            return retval;
+        }
+
 
     public:
         DQueue(size_t hint=200000) // was 32768
@@ -142,7 +277,8 @@ namespace madness {
                 , sz(hint>2 ? hint : 2)
                 , buf(new T[sz])
                 , _front(sz/2)
-                , _back(_front-1) {}
+                , _back(_front-1)
+                , nlane(0) {}
 
         virtual ~DQueue() {
             delete buf;
@@ -150,28 +286,17 @@ namespace madness {
 
         /// Insert value at front of queue
         void push_front(const T& value) {
-            madness::ScopedMutex<CONDITION_VARIABLE_TYPE> obolus(this);
-            //sanity_check();
-
-            size_t nn = n;
-            size_t ss = sz;
-            if (nn == ss) {
-                grow();
-                ss = sz;
-            }
-            ++nn;
-            if (nn > stats.nmax) stats.nmax = nn;
-            n = nn;
+            push_lane(value, NPRIORITY, true);
+        }
 
-            int f = _front - 1;
-            if (f < 0) f = ss - 1;
-            buf[f] = value;
-            _front = f;
-            ++(stats.npush_front);
+        /// Insert value behind those of higher and equal level but ahead of level 0
 
-            //sanity_check();
-            signal();
-            //broadcast();
+        /// Levels outside 1..NPRIORITY-1 are clamped.
+        void push_priority(const T& value, int level) {
+            if (level <= 0)
+                push_back(value);
+            else
+                push_lane(value, std::min(level, NPRIORITY-1), false);
         }
 
         /// Insert element at back of queue (default is just one copy)
@@ -191,7 +316,13 @@ namespace madness {
             int f = _front;
             size_t nn = n;
             int size = int(sz);
-            std::cout << "IN Q " << nn << std::endl;
+            std::cout << "IN Q " << nn + nlane << std::endl;
+
+            for (int level=NPRIORITY; level>0; --level) {
+                for (size_t i=0; i<lane[level].n; ++i) {
+                    if (!op(lane[level].at(i))) return;
+                }
+            }
 
             while (nn--) {
                 T* p = const_cast<T*>(buf + f);
@@ -212,14 +343,16 @@ namespace madness {
 
             size_t nn = n;
 
-            if (nn==0 && wait) {
-                while (n == 0) // !!! Must be n (memory) not nn (local copy)
+            if (nn==0 && nlane==0 && wait) {
+                while (n == 0 && nlane == 0) // !!! Must be n (memory) not nn (local copy)
                     CONDITION_VARIABLE_TYPE::wait();
 
                 nn = n;
             }
 
             ++(stats.npop_front);
+            if (nlane) return pop_lanes_with_lock(nmax, r);
+
             if (nn) {
                 size_t thesize = sz;
                 //sanity_check();
@@ -275,11 +408,213 @@ namespace madness {
         }
 
         size_t size() const {
-            return n;
+            return n + nlane;
+        }
+
+        bool empty() const {
+            return n==0 && nlane==0;
+        }
+
+        const DQStats& get_stats() const {
+            return stats;
+        }
+    };
+
+
+    /// A double-ended queue owned by a single thread that other threads may steal from
+
+    /// The owning thread pushes and pops at the back (LIFO) so that it
+    /// works on the most recently generated (and cache-hot) tasks, while
+    /// thieves take from the front (FIFO) where the oldest and usually
+    /// largest pieces of work are found.  Each deque has its own
+    /// spinlock so the only contention is between the owner and the
+    /// occasional thief, rather than between all threads as with DQueue.
+    ///
+    /// Like DQueue this is a circular buffer that grows but does not shrink.
+    ///
+    /// Values pushed with a priority (push_priority()) are kept in a lane
+    /// per level.  Both the owner and thieves take from the highest
+    /// non-empty lane before the buffer, the owner the newest value of
+    /// the lane and a thief the oldest.
+    template <typename T>
+    class WorkStealingDeque : private Spinlock {
+    public:
+        static const int NPRIORITY = 8; ///< Priority levels (0 is the buffer)
+
+    private:
+        /// A circular buffer for one priority lane ... all access under the lock
+        struct Lane {
+            T* buf;        ///< Actual buffer (null until first used)
+            size_t sz;     ///< Current capacity (0 or a power of 2)
+            size_t front;  ///< Index of element at front
+            size_t n;      ///< Number of elements
+
+            Lane() : buf(0), sz(0), front(0), n(0) {}
+
+            ~Lane() {
+                delete [] buf;
+            }
+
+            void push_back(const T& value) {
+                if (n == sz) {
+                    const size_t nsz = std::max(2*sz, size_t(64));
+                    T* nbuf = new T[nsz];
+                    for (size_t i=0; i<n; ++i)
+                        nbuf[i] = buf[(front + i) & (sz - 1)];
+                    delete [] buf;
+                    buf = nbuf;
+                    sz = nsz;
+                    front = 0;
+                }
+                buf[(front + n) & (sz - 1)] = value;
+                ++n;
+            }
+
+            T pop_back() {
+                --n;
+                return buf[(front + n) & (sz - 1)];
+            }
+
+            T pop_front() {
+                T value = buf[front];
+                front = (front + 1) & (sz - 1);
+                --n;
+                return value;
+            }
+
+        private:
+            Lane(const Lane&);             // Verboten
+            void operator=(const Lane&);   // Verboten
+        };
+
+        char pad[64]; ///< To put the lock and the data in separate cache lines
+        volatile size_t n __attribute__((aligned(64))); ///< Number of elements in the buffer
+        size_t sz;      ///< Current capacity (always a power of 2)
+        T* buf;         ///< Actual buffer
+        size_t _front;  ///< Index of element at front of buffer
+        volatile size_t nlane;  ///< Number of elements in the priority lanes
+        Lane lane[NPRIORITY];   ///< Lanes for levels 1..NPRIORITY-1 (0 is unused)
+        DQStats stats;
+
+        /// The highest non-empty lane ... assumes nlane>0 and the lock
+        Lane& top_lane() {
+            int level = NPRIORITY-1;
+            while (lane[level].n == 0) --level;
+            return lane[level];
+        }
+
+        void grow() {
+            // ASSUME WE ALREADY HAVE THE LOCK WHEN IN HERE
+            ++(stats.ngrow);
+            T* nbuf = new T[2*sz];
+            for (size_t i=0; i<n; ++i)
+                nbuf[i] = buf[(_front + i) & (sz - 1)];
+            delete [] buf;
+            buf = nbuf;
+            sz *= 2;
+            _front = 0;
+        }
+
+        void count_push() {
+            // ASSUME WE ALREADY HAVE THE LOCK WHEN IN HERE
+            if (n == sz) grow();
+            const size_t nn = n + nlane + 1;
+            if (nn > stats.nmax) stats.nmax = nn;
+            stats.nsum += nn;
+        }
+
+    public:
+        WorkStealingDeque(size_t hint=1024)
+                : n(0), sz(2), buf(0), _front(0), nlane(0)
+        {
+            while (sz < hint) sz *= 2;
+            buf = new T[sz];
+        }
+
+        virtual ~WorkStealingDeque() {
+            delete [] buf;
+        }
+
+        /// Insert value at the back (owner end) of the deque
+        void push_back(const T& value) {
+            ScopedMutex<Spinlock> obolus(this);
+            count_push();
+            buf[(_front + n) & (sz - 1)] = value;
+            ++n;
+            ++(stats.npush_back);
+        }
+
+        /// Insert value at the front (thief end) of the deque
+        void push_front(const T& value) {
+            ScopedMutex<Spinlock> obolus(this);
+            count_push();
+            _front = (_front + sz - 1) & (sz - 1);
+            buf[_front] = value;
+            ++n;
+            ++(stats.npush_front);
+        }
+
+        /// Insert value in the lane of \c level , ahead of everything of lower level
+
+        /// Levels above NPRIORITY-1 are clamped, level 0 goes to the back.
+        void push_priority(const T& value, int level) {
+            if (level <= 0) {
+                push_back(value);
+                return;
+            }
+            ScopedMutex<Spinlock> obolus(this);
+            count_push();
+            lane[std::min(level, NPRIORITY-1)].push_back(value);
+            ++nlane;
+            ++(stats.npush_front);
+        }
+
+        /// Owner pops the most recently pushed value of the highest level ... returns false if empty
+        bool pop_back(T& value) {
+            if (n == 0 && nlane == 0) return false;
+            ScopedMutex<Spinlock> obolus(this);
+            if (nlane) {
+                value = top_lane().pop_back();
+                --nlane;
+                ++(stats.npop_back);
+                return true;
+            }
+            if (n == 0) return false;
+            --n;
+            value = buf[(_front + n) & (sz - 1)];
+            ++(stats.npop_back);
+            return true;
+        }
+
+        /// Thief takes the oldest value of the highest level ... returns false if empty or the lock is busy
+
+        /// A thief that finds the deque locked moves on to the next victim
+        /// rather than waiting behind the owner.
+        bool steal_front(T& value) {
+            if (n == 0 && nlane == 0) return false;
+            if (!try_lock()) return false;
+            bool gotit = (nlane != 0);
+            if (gotit) {
+                value = top_lane().pop_front();
+                --nlane;
+                ++(stats.nsteal);
+            }
+            else if ((gotit = (n != 0))) {
+                value = buf[_front];
+                _front = (_front + 1) & (sz - 1);
+                --n;
+                ++(stats.nsteal);
+            }
+            unlock();
+            return gotit;
+        }
+
+        size_t size() const {
+            return n + nlane;
         }
 
         bool empty() const {
-            return n==0;
+            return n==0 && nlane==0;
         }
 
         const DQStats& get_stats() const {
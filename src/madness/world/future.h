@@ -41,12 +41,14 @@
 #include <vector>
 #include <stack>
 #include <new>
+#include <stdint.h>
 #include <madness/world/nodefaults.h>
 #include <madness/world/worlddep.h>
 #include <madness/world/array.h>
 #include <madness/world/worldref.h>
 #include <madness/world/world.h>
 #include <madness/world/move.h>
+#include <madness/world/object_pool.h>
 
 /// \addtogroup futures
 /// @{
@@ -126,29 +128,74 @@ namespace madness {
     std::ostream& operator<<(std::ostream& out, const Future<T>& f);
 
 
+    namespace detail {
+
+        /// Link in the intrusive list of callbacks held by a \c FutureImpl
+
+        /// A callback may be registered with many futures (a task with
+        /// several future arguments registers itself with each), so the
+        /// link cannot live in \c CallbackInterface itself.  Each future
+        /// instead has a few links of its own and takes more from the
+        /// \c SmallObjectPool only when those are used up.
+        struct FutureCallbackNode {
+            CallbackInterface* callback; ///< The callback to notify
+            FutureCallbackNode* next;    ///< Next link in the list
+        };
+
+        /// A \c FutureCallbackNode that did not fit in the future
+        struct PooledFutureCallbackNode : public FutureCallbackNode, public SmallObject { };
+
+    } // namespace detail
+
+
     /// Implements the functionality of futures.
 
+    /// Allocated from the SmallObjectPool since one is made for nearly
+    /// every task.
+    ///
+    /// Callbacks, and futures waiting to be assigned the same value, are
+    /// kept in an intrusive singly-linked list that is pushed with
+    /// compare-and-swap.  Assignment swaps the head for a sealed marker
+    /// and then runs the list; registration that finds the list sealed
+    /// invokes the callback straight away.  Neither path takes a lock,
+    /// and the first \c MAXCALLBACKS registrations allocate nothing.
     /// \tparam T The type of future.
     template <typename T>
-    class FutureImpl : private Spinlock {
+    class FutureImpl : public SmallObject {
         friend class Future<T>;
         friend std::ostream& operator<< <T>(std::ostream& out, const Future<T>& f);
 
     private:
-        /// \todo Brief description needed.
+        /// No. of callback links stored in the future itself
         static const int MAXCALLBACKS = 4;
 
         /// \todo Brief description needed.
-        typedef std::stack<CallbackInterface*, std::vector<CallbackInterface*> > callbackT;
+        typedef detail::FutureCallbackNode nodeT;
+
+        /// Assigns another future once this one is assigned
+        class Assignment : public CallbackInterface, public SmallObject {
+            const FutureImpl<T>* from;             ///< Future being waited on
+            std::shared_ptr< FutureImpl<T> > to;   ///< Future to be assigned
+        public:
+            Assignment(const FutureImpl<T>* from, const std::shared_ptr< FutureImpl<T> >& to)
+                : from(from), to(to)
+            { }
 
-        /// \todo Brief description needed.
-        typedef Stack<std::shared_ptr< FutureImpl<T> >,MAXCALLBACKS> assignmentT;
+            void notify() {
+                // from is kept alive by whoever is assigning it
+                to->set(const_cast<const T&>(from->t));
+                delete this;
+            }
+        };
 
-        /// \todo Brief description needed.
-        volatile callbackT callbacks;
+        /// Head of the list of callbacks, or \c sealed() once assigned
+        nodeT* volatile callbacks;
 
-        /// \todo Brief description needed.
-        volatile mutable assignmentT assignments;
+        /// No. of links in \c local_nodes handed out (may exceed MAXCALLBACKS)
+        volatile int nlocal;
+
+        /// Links for the first few callbacks
+        nodeT local_nodes[MAXCALLBACKS];
 
         /// \todo Brief description needed.
         volatile bool assigned;
@@ -159,6 +206,11 @@ namespace madness {
         /// \todo Brief description needed.
         volatile T t;
 
+        /// Marks the callback list as closed to new entries
+        static nodeT* sealed() {
+            return reinterpret_cast<nodeT*>(uintptr_t(1));
+        }
+
         /// AM handler for remote set operations.
 
         /// \todo Description needed.
@@ -171,62 +223,87 @@ namespace madness {
             {
                 FutureImpl<T>* pimpl = ref.get();
 
-                ScopedMutex<Spinlock> fred(pimpl);
-                if(pimpl->remote_ref) {
-                    // Unarchive the value to a temporary since it is going to
-                    // be forwarded to another node.
-                    T value;
-                    input_arch & value;
+                // Unarchive the value of the future
+                input_arch & const_cast<T&>(pimpl->t);
 
+                if(pimpl->remote_ref) {
                     // Copy world and owner from remote_ref since sending remote_ref
                     // will invalidate it.
                     World& world = pimpl->remote_ref.get_world();
                     const ProcessID owner = pimpl->remote_ref.owner();
                     world.am.send(owner, FutureImpl<T>::set_handler,
-                            new_am_arg(pimpl->remote_ref, value));
-
-                    pimpl->set_assigned(value);
-                } else {
-                    // Unarchive the value of the future
-                    input_arch & const_cast<T&>(pimpl->t);
-
-                    pimpl->set_assigned(const_cast<const T&>(pimpl->t));
+                            new_am_arg(pimpl->remote_ref, const_cast<const T&>(pimpl->t)));
                 }
+
+                pimpl->set_assigned();
             }
             ref.reset();
         }
 
 
-        /// \todo Brief description needed.
+        /// Get a link for a new callback
+        nodeT* get_node(CallbackInterface* callback) {
+            nodeT* node;
+            const int i = __sync_fetch_and_add(&nlocal, 1);
+            if (i < MAXCALLBACKS) node = local_nodes + i;
+            else node = new detail::PooledFutureCallbackNode;
+            node->callback = callback;
+            return node;
+        }
+
+
+        /// Return a link obtained from get_node()
+        void release_node(nodeT* node) {
+            if (node < local_nodes || node >= local_nodes + MAXCALLBACKS)
+                delete static_cast<detail::PooledFutureCallbackNode*>(node);
+        }
+
+
+        /// Push \c node onto the callback list
+
+        /// \return False if the future has already been assigned, in
+        /// which case the node was not pushed.
+        bool push_node(nodeT* node) {
+            nodeT* head = callbacks;
+            while (head != sealed()) {
+                node->next = head;
+                nodeT* prev = __sync_val_compare_and_swap(&callbacks, head, node);
+                if (prev == head) return true;
+                head = prev;
+            }
+            return false;
+        }
+
 
         /// Invoked locally by set routine after assignment.
-        /// \todo Description needed.
-        /// \param[in] value Description needed.
-        inline void set_assigned(const T& value) {
+
+        /// Seals the callback list and then runs it, so anything
+        /// registered from now on is invoked by the registering thread.
+        inline void set_assigned() {
             // Assume that whoever is invoking this routine is holding
             // a copy of our shared pointer on its *stack* so that
             // if this future is destroyed as a result of a callback
             // the destructor of this object is not invoked until
             // we return.
-            //
-            // Also assume that the caller either has the lock
-            // or is sure that we are single threaded.
             MADNESS_ASSERT(!assigned);
+            __sync_synchronize(); // the value is visible before assigned
             assigned = true;
 
-            assignmentT& as = const_cast<assignmentT&>(assignments);
-            callbackT& cb = const_cast<callbackT&>(callbacks);
-
-            while (!as.empty()) {
-                MADNESS_ASSERT(as.front());
-                as.top()->set(value);
-                as.pop();
+            nodeT* head = callbacks;
+            for (;;) {
+                nodeT* prev = __sync_val_compare_and_swap(&callbacks, head, sealed());
+                if (prev == head) break;
+                head = prev;
             }
+            MADNESS_ASSERT(head != sealed());
 
-            while (!cb.empty()) {
-                MADNESS_ASSERT(cb.top());
-                cb.top()->notify();
-                cb.pop();
+            while (head) {
+                nodeT* next = head->next;
+                CallbackInterface* callback = head->callback;
+                release_node(head);
+                MADNESS_ASSERT(callback);
+                callback->notify();
+                head = next;
             }
         }
 
@@ -235,14 +312,7 @@ namespace madness {
         /// \todo Description needed.
         /// \param[in] f Description needed.
         inline void add_to_assignments(const std::shared_ptr< FutureImpl<T> > f) {
-            // ASSUME lock is already acquired
-            if (assigned) {
-                f->set(const_cast<T&>(t));
-            }
-            else {
-                assignmentT* as = const_cast<assignmentT*>(&assignments);
-                as->push(f);
-            }
+            register_callback(new Assignment(this, f));
         }
 
 
@@ -250,8 +320,8 @@ namespace madness {
 
         /// Constructor that uses a local unassigned value.
         FutureImpl()
-                : callbacks()
-                , assignments()
+                : callbacks(0)
+                , nlocal(0)
                 , assigned(false)
                 , remote_ref()
                 , t()
@@ -263,8 +333,8 @@ namespace madness {
         /// \todo Description needed.
         /// \param[in] remote_ref Description needed.
         FutureImpl(const RemoteReference< FutureImpl<T> >& remote_ref)
-                : callbacks()
-                , assignments()
+                : callbacks(0)
+                , nlocal(0)
                 , assigned(false)
                 , remote_ref(remote_ref)
                 , t()
@@ -281,15 +351,22 @@ namespace madness {
 
         /// Registers a function to be invoked when future is assigned.
 
-        /// Callbacks are invoked in the order registered. If the
-        /// future is already assigned, the callback is immediately
-        /// invoked.
+        /// Callbacks are invoked in the reverse of the order
+        /// registered. If the future is already assigned, the
+        /// callback is immediately invoked.
         /// \todo Description needed.
         /// \param callback Description needed.
         inline void register_callback(CallbackInterface* callback) {
-            ScopedMutex<Spinlock> fred(this);
-            if (assigned) callback->notify();
-            else const_cast<callbackT&>(callbacks).push(callback);
+            if (assigned) {
+                callback->notify();
+            }
+            else {
+                nodeT* node = get_node(callback);
+                if (! push_node(node)) {
+                    release_node(node);
+                    callback->notify();
+                }
+            }
         }
 
 
@@ -300,18 +377,16 @@ namespace madness {
         /// \param[in] value Description needed.
         template <typename U>
         void set(const U& value) {
-            ScopedMutex<Spinlock> fred(this);
+            const_cast<T&>(t) = value;
             if(remote_ref) {
                 // Copy world and owner from remote_ref since sending remote_ref
                 // will invalidate it.
                 World& world = remote_ref.get_world();
                 const ProcessID owner = remote_ref.owner();
                 world.am.send(owner, FutureImpl<T>::set_handler,
-                        new_am_arg(remote_ref, unwrap_move(value)));
-                set_assigned(value);
-            } else {
-                set_assigned((const_cast<T&>(t) = value));
+                        new_am_arg(remote_ref, const_cast<const T&>(t)));
             }
+            set_assigned();
         }
 
 
@@ -320,10 +395,9 @@ namespace madness {
         /// \todo Descriptions needed.
         /// \param[in] input_arch Description needed.
         void set(const archive::BufferInputArchive& input_arch) {
-            ScopedMutex<Spinlock> fred(this);
             MADNESS_ASSERT(! remote_ref);
             input_arch & const_cast<T&>(t);
-            set_assigned(const_cast<T&>(t));
+            set_assigned();
         }
 
 
@@ -383,14 +457,10 @@ namespace madness {
 
         /// \todo Perhaps a comment about its behavior.
         virtual ~FutureImpl() {
-            if (const_cast<callbackT&>(callbacks).size()) {
+            if (callbacks && callbacks != sealed()) {
                 print("Future: uninvoked callbacks being destroyed?", assigned);
                 abort();
             }
-            if (const_cast<assignmentT&>(assignments).size()) {
-                print("Future: uninvoked assignment being destroyed?", assigned);
-                abort();
-            }
         }
     }; // class FutureImpl
 
@@ -556,10 +626,7 @@ namespace madness {
                     std::shared_ptr< FutureImpl<T> > ff = f; // manage lifetime of me
                     std::shared_ptr< FutureImpl<T> > of = other.f; // manage lifetime of other
 
-                    { // BEGIN CRITICAL SECTION
-                        ScopedMutex<Spinlock> fred(of.get());
-                        of->add_to_assignments(ff); // Recheck of assigned is performed in here
-                    } // END CRITICAL SECTION
+                    of->add_to_assignments(ff); // Recheck of assigned is performed in here
                 }
             }
         }
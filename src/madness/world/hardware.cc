@@ -38,27 +38,35 @@
 */
 
 #include <madness/world/hardware.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#if defined(__linux__)
+#  include <dirent.h>
+#endif
 
 namespace madness {
 
     void Hardware::Initialize(void) {
 #if defined(__bgp__) || defined(__bgq__)
         int init = 0;
-        MPI_Is_initialized(&init);
+        MPI_Initialized(&init);
         if (init<1)
-            MADNESS_EXCEPTION("MPI is not initialized!");
+            MADNESS_EXCEPTION("MPI is not initialized!", init);
 #  if defined(__bgp__)
         /* We need MPI to initialize DCMF so DCMF_Hardware will work.
          * Alternatively, we must initialize DCMF ourselves, which is fine since the init call is not a singleton like MPI. */
-        DCMF_Hardware(&bgphw);
+        DCMF_Hardware(&bghw);
 #  elif defined(__bgq__)
         /* MPIX requires MPI, obviously. */
-        MPIX_Hardware(&bgqhw);
+        MPIX_Hardware(&bghw);
 #  endif
 #endif
         Hardware::InitializeHWThreads();
         Hardware::InitializeCPUFrequency();
         Hardware::InitializeMemorySize();
+        Hardware::InitializeNumaTopology();
 
         return;
     }
@@ -67,6 +75,16 @@ namespace madness {
         out.flush();
         out << "\n    MADNESS Hardware Information \n";
         out << "    --------------------------------\n";
+        out << "    #hardware threads    " << hwthreads << "\n";
+        out << "    memory (bytes)       " << memorysize << "\n";
+        out << "    #NUMA nodes          " << NumaNodes() << "\n";
+        for (int node=0; node<NumaNodes(); ++node) {
+            out << "      node " << node << " cpus";
+            for (std::size_t i=0; i<numacpus[node].size(); ++i)
+                out << " " << numacpus[node][i];
+            out << "\n";
+        }
+        out.flush();
     }
 
     /* Taken from ThreadBase.
@@ -83,17 +101,17 @@ namespace madness {
         /* Apple has deprecated HW_NCPU */
         int rc = sysctlbyname("hw.logicalcpu", &n, &len, NULL, 0);
         if (rc!=0) 
-            MADNESS_EXCEPTION("sysctlbyname failed");
+            MADNESS_EXCEPTION("sysctlbyname failed", rc);
 #  else
         int mib[2] = {CTL_HW, HW_NCPU};
         int rc = sysctl(mib, 2, &n, &len, NULL, 0);
         if (rc!=0) 
-            MADNESS_EXCEPTION("sysctl failed");
+            MADNESS_EXCEPTION("sysctl failed", rc);
 #  endif
 #elif defined(HARDWARE_USE_SYSCONF)
         n = (int)sysconf(_SC_NPROCESSORS_CONF);
         if (n<1) 
-            MADNESS_EXCEPTION("sysconf failed");
+            MADNESS_EXCEPTION("sysconf failed", n);
 #endif
         hwthreads = n;
         return;
@@ -118,12 +136,12 @@ namespace madness {
         f = (double) c.hz;
 #  endif
         if (rc!=0) 
-            MADNESS_EXCEPTION("sysctl failed");
+            MADNESS_EXCEPTION("sysctl failed", rc);
 #elif defined(HARDWARE_USE_SYSCONF)
         long cps = sysconf(_SC_CLK_TCK);
         f = (double)cps;
         if (cps<1) 
-            MADNESS_EXCEPTION("sysconf failed");
+            MADNESS_EXCEPTION("sysconf failed", int(cps));
 #endif
         cpufrequency = f;
     }
@@ -139,18 +157,82 @@ namespace madness {
         int mib[2] = {CTL_HW, HW_MEMSIZE};
         int rc = sysctl(mib, 2, &m, &len, NULL, 0);
         if (rc!=0) 
-            MADNESS_EXCEPTION("sysctl failed");
+            MADNESS_EXCEPTION("sysctl failed", rc);
 #elif defined(HARDWARE_USE_SYSCONF)
         long np = sysconf(_SC_PHYS_PAGES);
         long ps = sysconf(_SC_PAGESIZE);
         m = np*ps;
         if (np<1 || ps<1) 
-            MADNESS_EXCEPTION("sysconf failed");
+            MADNESS_EXCEPTION("sysconf failed", 0);
 #endif
         memorysize = m;
         return;
     }
 
+    /// Parse a Linux cpulist such as "0-3,8-11" ... returns false on a syntax error
+    static bool ParseCPUList(const char* s, std::vector<int>& cpus) {
+        while (*s && *s != '\n') {
+            char* end;
+            long lo = strtol(s, &end, 10);
+            if (end == s) return false;
+            long hi = lo;
+            s = end;
+            if (*s == '-') {
+                ++s;
+                hi = strtol(s, &end, 10);
+                if (end == s) return false;
+                s = end;
+            }
+            for (long cpu=lo; cpu<=hi; ++cpu) cpus.push_back(int(cpu));
+            if (*s == ',') ++s;
+        }
+        return true;
+    }
+
+    void Hardware::InitializeNumaTopology(void) {
+        numacpus.clear();
+#if defined(__linux__) && !defined(__bgq__)
+        // Node directories may be sparse (node0, node2, ...) so scan for them
+        DIR* dir = opendir("/sys/devices/system/node");
+        if (dir) {
+            std::vector<int> ids;
+            while (struct dirent* d = readdir(dir)) {
+                int id;
+                if (strncmp(d->d_name, "node", 4) == 0 && sscanf(d->d_name+4, "%d", &id) == 1)
+                    ids.push_back(id);
+            }
+            closedir(dir);
+            std::sort(ids.begin(), ids.end());
+
+            for (std::size_t i=0; i<ids.size(); ++i) {
+                char fname[128];
+                snprintf(fname, sizeof(fname), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+                FILE* f = fopen(fname, "r");
+                if (!f) continue;
+                char buf[4096];
+                std::vector<int> cpus;
+                bool ok = fgets(buf, sizeof(buf), f) && ParseCPUList(buf, cpus);
+                fclose(f);
+                // Memory-only nodes have no CPUs and cannot run threads
+                if (ok && !cpus.empty()) numacpus.push_back(cpus);
+            }
+        }
+#endif
+        if (numacpus.empty()) {
+            numacpus.resize(1);
+            for (int cpu=0; cpu<hwthreads; ++cpu) numacpus[0].push_back(cpu);
+        }
+
+        int maxcpu = 0;
+        for (std::size_t node=0; node<numacpus.size(); ++node)
+            for (std::size_t i=0; i<numacpus[node].size(); ++i)
+                maxcpu = std::max(maxcpu, numacpus[node][i]);
+        cpunuma.assign(maxcpu+1, 0);
+        for (std::size_t node=0; node<numacpus.size(); ++node)
+            for (std::size_t i=0; i<numacpus[node].size(); ++i)
+                cpunuma[numacpus[node][i]] = node;
+    }
+
 
 
 } // namespace madness
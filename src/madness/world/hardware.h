@@ -36,10 +36,14 @@
   email: jhammond@alcf.anl.gov
 */
 
-#ifndef MADNESS_WOLRD_HARDWARE_H__INCLUDED
-#ifndef MADNESS_WOLRD_HARDWARE_H__INCLUDED
+#ifndef MADNESS_WORLD_HARDWARE_H__INCLUDED
+#define MADNESS_WORLD_HARDWARE_H__INCLUDED
+
+/// \file hardware.h
+/// \brief Query the node hardware: threads, clock, memory and NUMA layout
 
 #include <iostream>
+#include <vector>
 #include <stdint.h>
 
 #if defined(__bgp__) || defined(__bgq__)
@@ -67,11 +71,18 @@
 
 namespace madness {
 
+  /// Information about the hardware of this node
+
+  /// The NUMA layout is read from /sys/devices/system/node on Linux.
+  /// Elsewhere, or if that fails, all CPUs are placed on a single node.
+  class Hardware {
   private:
 
     int     hwthreads;
     double  cpufrequency;
     int64_t memorysize;
+    std::vector< std::vector<int> > numacpus; ///< CPUs on each NUMA node
+    std::vector<int> cpunuma;                 ///< NUMA node of each CPU
 
 #if defined(__bgp__)
     DCMF_Hardware_t bghw;
@@ -79,13 +90,38 @@ namespace madness {
     MPIX_Hardware_t bghw;
 #endif
 
+    void InitializeHWThreads(void);
+    void InitializeCPUFrequency(void);
+    void InitializeMemorySize(void);
+    void InitializeNumaTopology(void);
+
   public:
 
-    void Hardware::Initialize(void);
-    void Hardware::Print(std::ostream & out);
+    Hardware() : hwthreads(1), cpufrequency(1.0e9), memorysize(1) { }
+
+    void Initialize(void);
+    void Print(std::ostream & out);
+
+    /// Number of hardware threads (logical CPUs)
+    int HWThreads(void) const { return hwthreads; }
+
+    /// Number of NUMA nodes (at least one after \c Initialize )
+    int NumaNodes(void) const { return numacpus.size(); }
+
+    /// CPUs belonging to NUMA node \c node
+    const std::vector<int>& NumaCPUs(int node) const {
+        MADNESS_ASSERT(node >= 0 && node < NumaNodes());
+        return numacpus[node];
+    }
+
+    /// NUMA node containing \c cpu ... zero if unknown
+    int NumaNodeOfCPU(int cpu) const {
+        if (cpu < 0 || cpu >= int(cpunuma.size())) return 0;
+        return cpunuma[cpu];
+    }
 
-}
+  }; // class Hardware
 
 } // namespace madness
 
-#endif // MADNESS_WOLRD_HARDWARE_H__INCLUDED
+#endif // MADNESS_WORLD_HARDWARE_H__INCLUDED
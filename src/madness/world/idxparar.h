@@ -0,0 +1,564 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+#ifndef MADNESS_WORLD_IDXPARAR_H__INCLUDED
+#define MADNESS_WORLD_IDXPARAR_H__INCLUDED
+
+/// \file idxparar.h
+/// \brief Implements IndexedParallelInputArchive and IndexedParallelOutputArchive
+
+#include <madness/world/archive.h>
+#include <madness/world/parar.h>
+#include <madness/world/bufar.h>
+#include <madness/world/world.h>
+#include <madness/world/worldgop.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+namespace madness {
+    namespace archive {
+
+        /// Wraps an archive around a file descriptor using positioned (pwrite) output
+
+        /// Unlike BinaryFstreamOutputArchive several processes may hold
+        /// the same file open and write disjoint regions of it
+        /// concurrently.  Sequential stores go to the current position
+        /// which is then advanced.
+        class PositionedFileOutputArchive : public BaseOutputArchive {
+            int fd;                     ///< The file descriptor (-1 if not open)
+            mutable uint64_t pos;       ///< Offset of the next sequential store
+
+        public:
+            PositionedFileOutputArchive() : fd(-1), pos(0) {}
+
+            ~PositionedFileOutputArchive() {
+                close();
+            }
+
+            template <class T>
+            inline
+            typename madness::enable_if< madness::is_serializable<T>, void >::type
+            store(const T* t, long n) const {
+                write_at(t, n*sizeof(T), pos);
+                pos += n*sizeof(T);
+            }
+
+            /// Writes \c nbyte bytes at absolute \c offset without moving the current position
+            void write_at(const void* buf, std::size_t nbyte, uint64_t offset) const {
+                MADNESS_ASSERT(fd >= 0);
+                const char* p = static_cast<const char*>(buf);
+                while (nbyte) {
+                    ssize_t n = ::pwrite(fd, p, nbyte, off_t(offset));
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        MADNESS_EXCEPTION("PositionedFileOutputArchive: pwrite failed", errno);
+                    }
+                    p += n;
+                    offset += n;
+                    nbyte -= n;
+                }
+            }
+
+            /// Opens the file for writing, creating and truncating it if \c create is true
+            void open(const char* filename, bool create) {
+                close();
+                fd = ::open(filename, create ? (O_WRONLY|O_CREAT|O_TRUNC) : O_WRONLY, 0644);
+                if (fd < 0) MADNESS_EXCEPTION("PositionedFileOutputArchive: open failed", errno);
+                pos = 0;
+            }
+
+            /// Returns the offset of the next sequential store
+            uint64_t tell() const {
+                return pos;
+            }
+
+            /// Sets the offset of the next sequential store
+            void seek(uint64_t offset) const {
+                pos = offset;
+            }
+
+            void flush() {}
+
+            void close() {
+                if (fd >= 0) {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+        };
+
+
+        /// Wraps an archive around a file descriptor using positioned (pread) input
+        class PositionedFileInputArchive : public BaseInputArchive {
+            int fd;                     ///< The file descriptor (-1 if not open)
+            mutable uint64_t pos;       ///< Offset of the next sequential load
+
+        public:
+            PositionedFileInputArchive() : fd(-1), pos(0) {}
+
+            ~PositionedFileInputArchive() {
+                close();
+            }
+
+            template <class T>
+            inline
+            typename madness::enable_if< madness::is_serializable<T>, void >::type
+            load(T* t, long n) const {
+                read_at(t, n*sizeof(T), pos);
+                pos += n*sizeof(T);
+            }
+
+            /// Reads \c nbyte bytes at absolute \c offset without moving the current position
+            void read_at(void* buf, std::size_t nbyte, uint64_t offset) const {
+                MADNESS_ASSERT(fd >= 0);
+                char* p = static_cast<char*>(buf);
+                while (nbyte) {
+                    ssize_t n = ::pread(fd, p, nbyte, off_t(offset));
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        MADNESS_EXCEPTION("PositionedFileInputArchive: pread failed", errno);
+                    }
+                    if (n == 0) MADNESS_EXCEPTION("PositionedFileInputArchive: reading past end", int(nbyte));
+                    p += n;
+                    offset += n;
+                    nbyte -= n;
+                }
+            }
+
+            /// Opens the file for reading (the second argument is for symmetry with output)
+            void open(const char* filename, bool) {
+                close();
+                fd = ::open(filename, O_RDONLY);
+                if (fd < 0) MADNESS_EXCEPTION("PositionedFileInputArchive: open failed", errno);
+                pos = 0;
+            }
+
+            /// Returns the offset of the next sequential load
+            uint64_t tell() const {
+                return pos;
+            }
+
+            /// Sets the offset of the next sequential load
+            void seek(uint64_t offset) const {
+                pos = offset;
+            }
+
+            void close() {
+                if (fd >= 0) {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+        };
+
+
+        /// Serializes (or deserializes) no more objects
+        template <class Archive>
+        inline void serialize_all(const Archive&) {}
+
+        /// Serializes (or deserializes) the objects one after the other
+        template <class Archive, typename objT, typename... restT>
+        inline void serialize_all(const Archive& ar, objT& obj, restT&... rest) {
+            ar & obj;
+            serialize_all(ar, rest...);
+        }
+
+
+        /// Serializes objects to consecutive offsets of a file through a buffer of bounded size
+
+        /// Objects are packed into a chunk of at most \c CHUNK bytes that
+        /// is written when the next object does not fit.  Objects larger
+        /// than a chunk are written on their own.
+        class PositionedChunkWriter {
+            const PositionedFileOutputArchive& ar; ///< The file
+            std::vector<unsigned char> buf;        ///< The chunk (allocated on first use)
+            std::size_t used;                      ///< Bytes in the chunk
+            uint64_t pos;                          ///< File offset of the chunk
+
+        public:
+            static const std::size_t CHUNK = 1ul<<22;
+
+            PositionedChunkWriter(const PositionedFileOutputArchive& ar, uint64_t offset)
+                : ar(ar), buf(), used(0), pos(offset) {}
+
+            /// Returns the file offset at which the next object will be stored
+            uint64_t tell() const {
+                return pos + used;
+            }
+
+            /// Stores the objects one after the other and returns the no. of bytes they took
+            template <typename... objT>
+            std::size_t store(const objT&... obj) {
+                BufferOutputArchive count;
+                serialize_all(count, obj...);
+                const std::size_t nbyte = count.size();
+                if (used + nbyte > CHUNK) flush();
+                if (nbyte > CHUNK) {
+                    std::vector<unsigned char> big(nbyte);
+                    BufferOutputArchive bar(&big[0], nbyte);
+                    serialize_all(bar, obj...);
+                    ar.write_at(&big[0], nbyte, pos);
+                    pos += nbyte;
+                }
+                else if (nbyte) {
+                    if (buf.empty()) buf.resize(CHUNK);
+                    BufferOutputArchive bar(&buf[used], nbyte);
+                    serialize_all(bar, obj...);
+                    used += nbyte;
+                }
+                return nbyte;
+            }
+
+            /// Writes out the chunk
+            void flush() {
+                if (used) {
+                    ar.write_at(&buf[0], used, pos);
+                    pos += used;
+                    used = 0;
+                }
+            }
+        };
+
+
+        /// Deserializes objects from scattered regions of a file through a buffer of bounded size
+
+        /// The caller fetches a window of up to \c CHUNK bytes that spans
+        /// several neighbouring objects so that loading them takes one
+        /// pread.  An object outside the window is read on its own.
+        class PositionedChunkReader {
+            const PositionedFileInputArchive& ar; ///< The file
+            std::vector<unsigned char> buf;       ///< The window (allocated on first use)
+            uint64_t pos;                         ///< File offset of the window
+            std::size_t len;                      ///< Bytes in the window
+            const uint64_t end;                   ///< End of the region
+
+        public:
+            static const std::size_t CHUNK = PositionedChunkWriter::CHUNK;
+
+            /// Largest gap between objects worth reading rather than skipping
+            static const std::size_t GAP = 1ul<<16;
+
+            PositionedChunkReader(const PositionedFileInputArchive& ar, uint64_t end)
+                : ar(ar), buf(), pos(0), len(0), end(end) {}
+
+            /// Reads the \c nbyte bytes at \c offset (at most \c CHUNK) into the window
+            void fetch(uint64_t offset, std::size_t nbyte) {
+                MADNESS_ASSERT(nbyte <= CHUNK && offset + nbyte <= end);
+                if (buf.empty()) buf.resize(CHUNK);
+                pos = offset;
+                len = nbyte;
+                if (len) ar.read_at(&buf[0], len, pos);
+            }
+
+            /// Loads the objects stored one after the other in \c nbyte bytes at \c offset
+            template <typename... objT>
+            void load(uint64_t offset, std::size_t nbyte, objT&... obj) {
+                MADNESS_ASSERT(offset + nbyte <= end);
+                if (offset < pos || offset + nbyte > pos + len) {
+                    std::vector<unsigned char> one(nbyte);
+                    if (nbyte) ar.read_at(&one[0], nbyte, offset);
+                    BufferInputArchive bar(nbyte ? &one[0] : 0, nbyte);
+                    serialize_all(bar, obj...);
+                    return;
+                }
+                BufferInputArchive bar(&buf[offset - pos], nbyte);
+                serialize_all(bar, obj...);
+            }
+        };
+
+
+        /// Base class for indexed input and output parallel archives
+
+        /// All data live in a single file that every process opens.
+        /// Process local (serial) objects are read/written by process
+        /// zero at the current position, exactly as with
+        /// BaseParallelArchive.  Parallel containers are written as a
+        /// block
+        /// \verbatim
+        ///   header: magic, ndata, nindex, nentry, nblock   (5 x uint64_t)
+        ///   data:   ndata bytes of serialized values, one region per process
+        ///   index:  nindex bytes of (key, offset, nbyte) entries, one region per process
+        ///   blocks: nblock x (offset, nbyte, nentry) of runs of at most IDXBLOCK index entries
+        /// \endverbatim
+        /// where each process computes the offset of its own regions
+        /// from an exclusive prefix sum and writes them with pwrite
+        /// through a bounded buffer, so there are no IO nodes and no
+        /// forwarding of data.  Offsets in the index are absolute within
+        /// the file, so a reader can fetch any value without knowing who
+        /// wrote it.  The fixed size block table lets a reader take the
+        /// index in bounded pieces.
+        template <typename Archive>
+        class BaseIndexedParallelArchive {
+            World* world;       ///< Yep, the world.
+            mutable Archive ar; ///< The local archive (opened by every process)
+            bool do_fence;      ///< If true (default) read/write of parallel objects fence before and after IO
+            char fname[256];    ///< Name of the archive
+
+        public:
+            static const bool is_parallel_archive = true;
+
+            /// Magic number at the start of the file and of each container block
+            static const uint64_t magic = 0x6d61646e65737332ull;
+
+            /// Largest no. of index entries in a block of the block table
+            static const uint64_t IDXBLOCK = 4096;
+
+            BaseIndexedParallelArchive() : world(0), ar(), do_fence(true) {}
+
+            /// Returns pointer to the world
+            World* get_world() const {
+                MADNESS_ASSERT(world);
+                return world;
+            }
+
+            /// Opens the parallel archive
+
+            /// Process zero opens (and when writing creates) the file
+            /// first and the others follow after a fence.  The number of
+            /// processes need not match that used to write the archive.
+            void open(World& world, const char* filename) {
+                this->world = &world;
+                MADNESS_ASSERT(filename);
+                MADNESS_ASSERT(strlen(filename)-1<sizeof(fname));
+                strcpy(fname,filename); // Save the filename for later
+
+                if (world.rank() == 0) {
+                    ar.open(fname, true);
+                    uint64_t cookie = magic;
+                    ar & cookie; // read/write magic from/to the archive
+                    MADNESS_ASSERT(cookie == magic);
+                }
+                world.gop.fence();
+                if (world.rank()) ar.open(fname, false);
+            }
+
+            /// Returns true if the named, unopened archive exists on disk with read access ... collective
+            static bool exists(World& world, const char* filename) {
+                bool status;
+                if (world.rank() == 0)
+                    status = (access(filename, F_OK|R_OK) == 0);
+
+                world.gop.broadcast(status);
+
+                return status;
+            }
+
+            /// Closes the parallel archive
+            void close() {
+                MADNESS_ASSERT(world);
+                ar.close();
+            }
+
+            /// Returns a reference to local archive
+            Archive& local_archive() const {
+                MADNESS_ASSERT(world);
+                return ar;
+            }
+
+            /// Same as world.gop.broadcast_serializable(obj, root)
+            template <typename objT>
+            void broadcast(objT& obj, ProcessID root) const {
+                get_world()->gop.broadcast_serializable(obj, root);
+            }
+
+            /// Deletes the file associated with the archive of the given name
+
+            /// Presently assumes a shared file system since process zero does the
+            /// deleting
+            static void remove(World& world, const char* filename) {
+                if (world.rank() == 0) ::remove(filename);
+            }
+
+            /// Removes the file associated with the current archive
+            void remove() {
+                MADNESS_ASSERT(world);
+                remove(*world, fname);
+            }
+
+            bool dofence() const {
+                return this->do_fence;
+            }
+
+            void set_dofence(bool dofence) {
+                do_fence = dofence;
+            }
+        };
+
+
+        /// A single-file parallel archive in which every process writes its own data
+
+        /// Writes of process local objects only store the data from process zero.
+        ///
+        /// Writes of parallel containers (presently WorldContainer and
+        /// hence Function) store all data together with an index
+        /// mapping each key to the location of its value.
+        class IndexedParallelOutputArchive : public BaseIndexedParallelArchive<PositionedFileOutputArchive>, public BaseOutputArchive {
+        public:
+            IndexedParallelOutputArchive() {}
+
+            /// Creates a parallel archive for output with given filename
+            IndexedParallelOutputArchive(World& world, const char* filename)  {
+                open(world, filename);
+            }
+
+            void flush() {}
+        };
+
+        /// A single-file parallel archive that reads data by key
+
+        /// Reads of process local objects load the value originally
+        /// stored by process zero which is then broadcast to all processes.
+        ///
+        /// Reads of parallel containers use the index so that each
+        /// process reads exactly the values it owns under the process
+        /// map of the container being loaded.  The archive can therefore
+        /// be read by any number of processes.
+        class IndexedParallelInputArchive : public BaseIndexedParallelArchive<PositionedFileInputArchive>, public  BaseInputArchive {
+        public:
+            IndexedParallelInputArchive() {}
+
+            /// Creates a parallel archive for input
+            IndexedParallelInputArchive(World& world, const char* filename) {
+                open(world, filename);
+            }
+        };
+
+
+        /// Disable type info for indexed parallel output archives
+        template <class T>
+        struct ArchivePrePostImpl<IndexedParallelOutputArchive,T> {
+            static void preamble_store(const IndexedParallelOutputArchive& ar) {};
+            static inline void postamble_store(const IndexedParallelOutputArchive& ar) {};
+        };
+
+        /// Disable type info for indexed parallel input archives
+        template <class T>
+        struct ArchivePrePostImpl<IndexedParallelInputArchive,T> {
+            static inline void preamble_load(const IndexedParallelInputArchive& ar) {};
+            static inline void postamble_load(const IndexedParallelInputArchive& ar) {};
+        };
+
+
+        template <class T>
+        struct ArchiveImpl<IndexedParallelOutputArchive, T> {
+            /// Parallel objects are forwarded to their implementation of parallel store
+            template <typename Q>
+            static inline
+            typename madness::enable_if<is_derived_from<Q, ParallelSerializableObject>, const IndexedParallelOutputArchive&>::type
+            wrap_store(const IndexedParallelOutputArchive& ar, const Q& t) {
+                ArchiveStoreImpl<IndexedParallelOutputArchive,T>::store(ar,t);
+                return ar;
+            }
+
+            /// Serial objects write only from process 0
+            template <typename Q>
+            static inline
+            typename madness::disable_if<is_derived_from<Q, ParallelSerializableObject>, const IndexedParallelOutputArchive&>::type
+            wrap_store(const IndexedParallelOutputArchive& ar, const Q& t) {
+                if (ar.get_world()->rank()==0) {
+                    ar.local_archive() & t;
+                }
+                return ar;
+            }
+        };
+
+        template <class T>
+        struct ArchiveImpl<IndexedParallelInputArchive, T> {
+            /// Parallel objects are forwarded to their implementation of parallel load
+            template <typename Q>
+            static inline
+            typename madness::enable_if<is_derived_from<Q, ParallelSerializableObject>, const IndexedParallelInputArchive&>::type
+            wrap_load(const IndexedParallelInputArchive& ar, const Q& t) {
+                ArchiveLoadImpl<IndexedParallelInputArchive,T>::load(ar,const_cast<T&>(t));
+                return ar;
+            }
+
+            /// Serial objects read only from process 0 and broadcast results
+            template <typename Q>
+            static inline
+            typename madness::disable_if<is_derived_from<Q, ParallelSerializableObject>, const IndexedParallelInputArchive&>::type
+            wrap_load(const IndexedParallelInputArchive& ar, const Q& t) {
+                if (ar.get_world()->rank()==0) {
+                    ar.local_archive() & t;
+                }
+                ar.broadcast(const_cast<T&>(t), 0);
+                return ar;
+            }
+        };
+
+
+        /// Write archive array only from process zero
+        template <class T>
+        struct ArchiveImpl< IndexedParallelOutputArchive, archive_array<T> > {
+            static inline const IndexedParallelOutputArchive& wrap_store(const IndexedParallelOutputArchive& ar, const archive_array<T>& t) {
+                if (ar.get_world()->rank() == 0) ar.local_archive() & t;
+                return ar;
+            }
+        };
+
+        /// Read archive array and broadcast
+        template <class T>
+        struct ArchiveImpl< IndexedParallelInputArchive, archive_array<T> > {
+            static inline const IndexedParallelInputArchive& wrap_load(const IndexedParallelInputArchive& ar, const archive_array<T>& t) {
+                if (ar.get_world()->rank() == 0) ar.local_archive() & t;
+                ar.broadcast(t, 0);
+                return ar;
+            }
+        };
+
+        /// Forward fixed size array to archive_array
+        template <class T, std::size_t n>
+        struct ArchiveImpl<IndexedParallelOutputArchive, T[n]> {
+            static inline const IndexedParallelOutputArchive& wrap_store(const IndexedParallelOutputArchive& ar, const T(&t)[n]) {
+                ar << wrap(&t[0],n);
+                return ar;
+            }
+        };
+
+        /// Forward fixed size array to archive_array
+        template <class T, std::size_t n>
+        struct ArchiveImpl<IndexedParallelInputArchive, T[n]> {
+            static inline const IndexedParallelInputArchive& wrap_load(const IndexedParallelInputArchive& ar, const T(&t)[n]) {
+                ar >> wrap(&t[0],n);
+                return ar;
+            }
+        };
+    }
+}
+
+#endif // MADNESS_WORLD_IDXPARAR_H__INCLUDED
@@ -0,0 +1,253 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+#ifndef MADNESS_WORLD_OBJECT_POOL_H__INCLUDED
+#define MADNESS_WORLD_OBJECT_POOL_H__INCLUDED
+
+/// \file object_pool.h
+/// \brief Implements ThreadCachingPool and SmallObjectPool, the thread-caching allocator for task objects and futures
+
+#include <madness/madness_config.h>
+#include <madness/world/worldmem.h>
+#include <madness/world/worldmutex.h>
+#include <cstddef>
+#include <new>
+#include <stdint.h>
+
+namespace madness {
+
+    struct ThreadCachingPoolStats {
+        uint64_t nalloc;        ///< #allocations served from the pool
+        uint64_t nfree;         ///< #objects returned to the pool
+        uint64_t nslab;         ///< #calls to malloc for new slabs of objects
+        uint64_t nlarge;        ///< #allocations too large for the pool (plain new)
+        uint64_t nbytes_slab;   ///< Total bytes held in slabs
+
+        ThreadCachingPoolStats()
+                : nalloc(0), nfree(0), nslab(0), nlarge(0), nbytes_slab(0) {}
+    };
+
+    typedef ThreadCachingPoolStats SmallObjectPoolStats;
+
+
+    /// Per-thread free lists of fixed size classes over a shared, locked depot
+
+    /// This is the allocator behind SmallObjectPool and AmArgPool.
+    /// Objects of class \c c are kept on per-thread free lists, so that
+    /// allocation and deallocation on the same thread need no lock.  A
+    /// thread whose list grows beyond two batches hands one batch to a
+    /// shared depot, and a thread with an empty list takes a whole batch
+    /// back.  Only the depot is locked.  New objects are carved out of
+    /// slabs of one batch.  The pool grows but never shrinks.
+    ///
+    /// \c classT describes the size classes: it has \c NCLASS ,
+    /// \c object_size(c) (bytes, at least two pointers), \c batch(c)
+    /// (objects per slab and per batch) and \c allocate_slab(nbyte) .
+    /// The slow paths are in object_pool_impl.h and are instantiated
+    /// once, next to the definition of \c allocate_slab .
+    template <typename classT>
+    class ThreadCachingPool {
+    public:
+        static const std::size_t NCLASS = classT::NCLASS;
+
+    private:
+        struct FreeObject {
+            FreeObject* next;
+        };
+
+        /// Per-thread free lists ... POD so it works with __thread as well
+        struct ThreadCache {
+            FreeObject* head[NCLASS];
+            int n[NCLASS];
+            uint64_t nalloc;
+            uint64_t nfree;
+        };
+
+        /// Free objects of one class shared between threads
+        struct Depot;
+
+        static Depot depot[NCLASS];
+        static Spinlock stats_lock;
+        static ThreadCachingPoolStats stats;
+
+        /// Refill the calling thread's list for class \c c from the depot or a new slab
+        static void* refill(std::size_t c);
+
+        /// Move one batch from the calling thread's list for class \c c to the depot
+        static void spill(std::size_t c);
+
+        /// The calling thread's free lists
+        static ThreadCache& thread_cache() {
+            static thread_local ThreadCache cache;
+            return cache;
+        }
+
+    public:
+        /// Allocate an object of class \c c
+        static void* allocate(std::size_t c) {
+            ThreadCache& cache = thread_cache();
+            FreeObject* p = cache.head[c];
+            ++cache.nalloc;
+            if (!p) return refill(c);
+            cache.head[c] = p->next;
+            --cache.n[c];
+            return p;
+        }
+
+        /// Return an object of class \c c obtained from \c allocate
+        static void deallocate(void* p, std::size_t c) {
+            ThreadCache& cache = thread_cache();
+            FreeObject* f = static_cast<FreeObject*>(p);
+            f->next = cache.head[c];
+            cache.head[c] = f;
+            ++cache.nfree;
+            if (++cache.n[c] > 2*classT::batch(c)) spill(c);
+        }
+
+        /// Counts an allocation that bypassed the pool
+        static void count_large();
+
+        /// Returns pool statistics
+
+        /// Counts of pooled allocations and frees are gathered from each
+        /// thread when it next visits the depot, so they lag slightly.
+        static ThreadCachingPoolStats get_stats();
+    };
+
+
+    namespace detail {
+        /// Size classes of SmallObjectPool ... multiples of 16 bytes up to 512
+        struct SmallObjectClasses {
+            static const std::size_t GRANULE = 16;
+            static const std::size_t NCLASS = 32;
+            static const int MAGAZINE = 256;
+
+            static std::size_t object_size(std::size_t c) { return (c + 1) * GRANULE; }
+
+            static int batch(std::size_t) { return MAGAZINE; }
+
+            static void* allocate_slab(std::size_t nbyte);
+        };
+    }
+
+    extern template class ThreadCachingPool<detail::SmallObjectClasses>;
+
+
+    /// A size-class pool allocator for small, short-lived runtime objects
+
+    /// Tasks, futures and remote counters are created and destroyed by the
+    /// million in apply, compress, etc.  Rather than going to malloc for
+    /// each one, objects up to \c MAX_SIZE bytes are rounded up to a
+    /// multiple of \c GRANULE bytes and kept in a ThreadCachingPool, so
+    /// that a task made by one thread and freed by another costs no lock
+    /// most of the time.  Batches hold \c MAGAZINE objects.  Objects in
+    /// use are accounted as \c MEM_TASK (see mem_tag_stats()).
+    ///
+    /// Set the environment variable MAD_POOL_ALLOC=0 to send everything
+    /// to plain \c new / \c delete for comparison.
+    class SmallObjectPool {
+        typedef detail::SmallObjectClasses classT;
+        typedef ThreadCachingPool<classT> poolT;
+
+    public:
+        static const std::size_t GRANULE = classT::GRANULE;  ///< Size class granularity in bytes
+        static const std::size_t NCLASS = classT::NCLASS;    ///< No. of size classes
+        static const std::size_t MAX_SIZE = GRANULE*NCLASS;  ///< Largest pooled object
+        static const int MAGAZINE = classT::MAGAZINE;        ///< Objects moved to/from the depot at once
+
+    private:
+        /// Reads MAD_POOL_ALLOC
+        static bool default_enabled();
+
+        static std::size_t size_class(std::size_t size) {
+            return (size - 1) / GRANULE;
+        }
+
+    public:
+
+        /// Allocate \c size bytes
+        static void* allocate(std::size_t size) {
+            mem_tag_alloc(MEM_TASK, size);
+            if (!is_enabled() || size > MAX_SIZE || size == 0) {
+                poolT::count_large();
+                return ::operator new(size);
+            }
+            return poolT::allocate(size_class(size));
+        }
+
+        /// Return an object of \c size bytes obtained from \c allocate
+        static void deallocate(void* p, std::size_t size) {
+            if (!p) return;
+            mem_tag_free(MEM_TASK, size);
+            if (!is_enabled() || size > MAX_SIZE || size == 0) {
+                ::operator delete(p);
+                return;
+            }
+            poolT::deallocate(p, size_class(size));
+        }
+
+        /// Returns true if objects are pooled (i.e., MAD_POOL_ALLOC is not 0)
+
+        /// Decided once, at the first allocation, so that an object is
+        /// always freed the same way it was allocated.
+        static bool is_enabled() {
+            static const bool enabled = default_enabled();
+            return enabled;
+        }
+
+        /// Returns pool statistics
+        static SmallObjectPoolStats get_stats() {
+            return poolT::get_stats();
+        }
+    };
+
+
+    /// Base class that routes \c new / \c delete of derived classes through SmallObjectPool
+
+    /// The class deriving from this must have a virtual destructor if
+    /// objects are deleted through a base pointer, so that the correct
+    /// size is passed to \c operator \c delete .
+    class SmallObject {
+    public:
+        static void* operator new(std::size_t size) {
+            return SmallObjectPool::allocate(size);
+        }
+
+        static void operator delete(void* p, std::size_t size) {
+            SmallObjectPool::deallocate(p, size);
+        }
+    };
+
+} // namespace madness
+
+#endif // MADNESS_WORLD_OBJECT_POOL_H__INCLUDED
@@ -0,0 +1,155 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+
+  $Id$
+*/
+
+#ifndef MADNESS_WORLD_OBJECT_POOL_IMPL_H__INCLUDED
+#define MADNESS_WORLD_OBJECT_POOL_IMPL_H__INCLUDED
+
+/// \file object_pool_impl.h
+/// \brief The shared depot and statistics of ThreadCachingPool
+
+/// Include this only where a pool is explicitly instantiated.
+
+#include <madness/world/object_pool.h>
+
+namespace madness {
+
+    /// Batches are linked lists of free objects.  The first object of
+    /// each batch holds, after its own next pointer, a pointer to the
+    /// next batch.
+    template <typename classT>
+    struct ThreadCachingPool<classT>::Depot : public Spinlock {
+        void** batches;   ///< Stack of batches
+        Depot() : batches(0) {}
+    };
+
+    template <typename classT>
+    typename ThreadCachingPool<classT>::Depot ThreadCachingPool<classT>::depot[ThreadCachingPool<classT>::NCLASS];
+
+    template <typename classT>
+    Spinlock ThreadCachingPool<classT>::stats_lock;
+
+    template <typename classT>
+    ThreadCachingPoolStats ThreadCachingPool<classT>::stats;
+
+    template <typename classT>
+    void* ThreadCachingPool<classT>::refill(std::size_t c) {
+        // nalloc was already counted for this request
+        ThreadCache& cache = thread_cache();
+        const int nb = classT::batch(c);
+        FreeObject* head = 0;
+        {
+            Depot& d = depot[c];
+            ScopedMutex<Spinlock> hold(d);
+            if (d.batches) {
+                void** b = d.batches;
+                d.batches = static_cast<void**>(b[1]);
+                head = reinterpret_cast<FreeObject*>(b);
+            }
+        }
+
+        if (!head) {
+            // Carve a new slab into a list of one batch
+            const std::size_t objsize = classT::object_size(c);
+            char* slab = static_cast<char*>(classT::allocate_slab(objsize * nb));
+            for (int i=0; i<nb-1; ++i)
+                reinterpret_cast<FreeObject*>(slab + i*objsize)->next =
+                        reinterpret_cast<FreeObject*>(slab + (i+1)*objsize);
+            reinterpret_cast<FreeObject*>(slab + (nb-1)*objsize)->next = 0;
+            head = reinterpret_cast<FreeObject*>(slab);
+
+            ScopedMutex<Spinlock> hold(stats_lock);
+            ++stats.nslab;
+            stats.nbytes_slab += objsize * nb;
+        }
+
+        // Take the first object and keep the rest
+        cache.head[c] = head->next;
+        cache.n[c] = nb - 1;
+
+        {
+            ScopedMutex<Spinlock> hold(stats_lock);
+            stats.nalloc += cache.nalloc;
+            stats.nfree += cache.nfree;
+        }
+        cache.nalloc = cache.nfree = 0;
+
+        return head;
+    }
+
+    template <typename classT>
+    void ThreadCachingPool<classT>::spill(std::size_t c) {
+        // Detach one batch from the front of our list
+        ThreadCache& cache = thread_cache();
+        const int nb = classT::batch(c);
+        FreeObject* head = cache.head[c];
+        FreeObject* last = head;
+        for (int i=1; i<nb; ++i) last = last->next;
+        cache.head[c] = last->next;
+        last->next = 0;
+        cache.n[c] -= nb;
+
+        void** b = reinterpret_cast<void**>(head);
+        {
+            Depot& d = depot[c];
+            ScopedMutex<Spinlock> hold(d);
+            b[1] = d.batches;
+            d.batches = b;
+        }
+
+        {
+            ScopedMutex<Spinlock> hold(stats_lock);
+            stats.nalloc += cache.nalloc;
+            stats.nfree += cache.nfree;
+        }
+        cache.nalloc = cache.nfree = 0;
+    }
+
+    template <typename classT>
+    void ThreadCachingPool<classT>::count_large() {
+        __sync_fetch_and_add(&stats.nlarge, uint64_t(1));
+    }
+
+    template <typename classT>
+    ThreadCachingPoolStats ThreadCachingPool<classT>::get_stats() {
+        // Include the calling thread's counts that have not been flushed yet
+        const ThreadCache& cache = thread_cache();
+        ScopedMutex<Spinlock> hold(stats_lock);
+        ThreadCachingPoolStats s = stats;
+        s.nalloc += cache.nalloc;
+        s.nfree += cache.nfree;
+        return s;
+    }
+
+} // namespace madness
+
+#endif // MADNESS_WORLD_OBJECT_POOL_IMPL_H__INCLUDED
@@ -551,6 +551,39 @@ namespace SafeMPI {
             return Intracomm(std::shared_ptr<Impl>(new Impl(group_comm, me, nproc, true)));
         }
 
+        /**
+         * This collective operation partitions this \c Intracomm into
+         * disjoint communicators, one for each value of \c color .
+         * Processes are ranked within each by \c key (ties broken by
+         * rank in this communicator).
+         */
+        Intracomm Split(int color, int key = 0) const {
+            MADNESS_ASSERT(pimpl);
+            SAFE_MPI_GLOBAL_MUTEX;
+            MPI_Comm split_comm;
+            MADNESS_MPI_TEST(MPI_Comm_split(pimpl->comm, color, key, &split_comm));
+            int me; MADNESS_MPI_TEST(MPI_Comm_rank(split_comm, &me));
+            int nproc; MADNESS_MPI_TEST(MPI_Comm_size(split_comm, &nproc));
+            return Intracomm(std::shared_ptr<Impl>(new Impl(split_comm, me, nproc, true)));
+        }
+
+#if MPI_VERSION >= 3
+        /**
+         * This collective operation partitions this \c Intracomm by
+         * \c split_type , e.g. \c MPI_COMM_TYPE_SHARED gives one
+         * communicator for the processes that can share memory.
+         */
+        Intracomm Split_type(int split_type, int key = 0) const {
+            MADNESS_ASSERT(pimpl);
+            SAFE_MPI_GLOBAL_MUTEX;
+            MPI_Comm split_comm;
+            MADNESS_MPI_TEST(MPI_Comm_split_type(pimpl->comm, split_type, key, MPI_INFO_NULL, &split_comm));
+            int me; MADNESS_MPI_TEST(MPI_Comm_rank(split_comm, &me));
+            int nproc; MADNESS_MPI_TEST(MPI_Comm_size(split_comm, &nproc));
+            return Intracomm(std::shared_ptr<Impl>(new Impl(split_comm, me, nproc, true)));
+        }
+#endif // MPI_VERSION >= 3
+
         bool operator==(const Intracomm& other) const {
             return (pimpl == other.pimpl) || ((pimpl && other.pimpl) &&
                     Comm_compare(pimpl->comm, other.pimpl->comm));
@@ -598,6 +631,14 @@ namespace SafeMPI {
             return request;
         }
 
+        bool Iprobe(const int source, const int tag, MPI_Status& status) const {
+            MADNESS_ASSERT(pimpl);
+            SAFE_MPI_GLOBAL_MUTEX;
+            int flag = 0;
+            MADNESS_MPI_TEST(MPI_Iprobe(source, tag, pimpl->comm, &flag, &status));
+            return flag != 0;
+        }
+
         void Send(const void* buf, const int count, const MPI_Datatype datatype, int dest, int tag) const {
             MADNESS_ASSERT(pimpl);
             SAFE_MPI_GLOBAL_MUTEX;
@@ -53,10 +53,47 @@ int main(int argc, char** argv) {
 
     if (world.rank() == 0) print("OK?", OK);
 
+    // Same again with a byte budget much smaller than the bins
+    local_sorted_sum = 0.0;
+    local_sum = 0.0;
+    const std::size_t budget = 64*sizeof(valueT);
+    BinSorter<valueT,void(*)(const valueT&)> budget_sorter(world,inserter,1000,budget);
+    for (unsigned int i=0; i<N; i++) {
+        const ProcessID owner = (9973u*i)%P;
+        const double value = 1.0/(i+1);
+        budget_sorter.insert(owner, valueT(owner,value));
+        local_sum += value;
+    }
+    budget_sorter.finish();
+    bool budget_OK = (budget_sorter.get_peak_bytes() <= budget + sizeof(valueT));
+    world.gop.sum(local_sum);
+    world.gop.sum(local_sorted_sum);
+    budget_OK = budget_OK && (std::abs(local_sum-local_sorted_sum) < 1e-14*local_sum);
+    if (world.rank() == 0) print("budget OK?", budget_OK, budget_sorter.get_peak_bytes());
+    OK = OK && budget_OK;
+
+    // And with bins of uneven sizes, so that the largest bin changes
+    local_sorted_sum = 0.0;
+    local_sum = 0.0;
+    BinSorter<valueT,void(*)(const valueT&)> skew_sorter(world,inserter,1000,budget);
+    for (unsigned int i=0; i<N; i++) {
+        const ProcessID owner = ((i/100)%3) ? (9973u*i)%P : (i/300)%P;
+        const double value = 1.0/(i+1);
+        skew_sorter.insert(owner, valueT(owner,value));
+        local_sum += value;
+    }
+    skew_sorter.finish();
+    bool skew_OK = (skew_sorter.get_peak_bytes() <= budget + sizeof(valueT));
+    world.gop.sum(local_sum);
+    world.gop.sum(local_sorted_sum);
+    skew_OK = skew_OK && (std::abs(local_sum-local_sorted_sum) < 1e-14*local_sum);
+    if (world.rank() == 0) print("skewed budget OK?", skew_OK, skew_sorter.get_peak_bytes());
+    OK = OK && skew_OK;
+
     world.gop.fence();
     finalize();
 
-    return 0;
+    return OK ? 0 : 1;
 }
     
 
@@ -146,6 +146,144 @@ void test1(World& world) {
     world.gop.fence();
 }
 
+void test2(World& world) {
+    // Batched find of present and absent keys, local and remote
+    WorldContainer<Key,Node> c(world);
+    for (int i=0; i<1000; i+=2) {
+        if (c.owner(Key(i)) == world.rank()) c.replace(Key(i),Node(i));
+    }
+    world.gop.fence();
+
+    std::vector<Key> keys;
+    for (int i=999; i>=0; --i) keys.push_back(Key(i));
+    std::vector< Future<WorldContainer<Key,Node>::iterator> > r = c.find(keys);
+    MADNESS_ASSERT(r.size() == keys.size());
+    for (std::size_t j=0; j<keys.size(); ++j) {
+        const int i = keys[j].k;
+        if (i%2 == 0)
+            MADNESS_ASSERT(r[j].get()->second.get() == i);
+        else
+            MADNESS_ASSERT(r[j].get() == c.end());
+    }
+
+    const WorldContainer<Key,Node>& cc = c;
+    std::vector< Future<WorldContainer<Key,Node>::const_iterator> > cr = cc.find(keys);
+    MADNESS_ASSERT(cr[1].get()->second.get() == 998);
+
+    MADNESS_ASSERT(c.find(std::vector<Key>()).empty());
+
+    world.gop.fence();
+}
+
+
+void test3(World& world) {
+    // Read cache of remote finds
+    if (world.size() == 1) {
+        print("test3 skipped (the read cache needs 2 or more processes)");
+        return;
+    }
+    WorldContainer<Key,Node> c(world);
+    for (int i=0; i<100; ++i) {
+        if (c.owner(Key(i)) == world.rank()) c.replace(Key(i),Node(i));
+    }
+    world.gop.fence();
+
+    unsigned long nremote = 0;
+    for (int i=0; i<100; ++i) {
+        if (!c.is_local(Key(i))) ++nremote;
+    }
+    MADNESS_ASSERT(nremote > 0);
+
+    c.set_read_cache(1<<20);
+    for (int pass=0; pass<2; ++pass) {
+        for (int i=0; i<100; ++i)
+            MADNESS_ASSERT(c.find(Key(i)).get()->second.get() == i);
+    }
+    WorldContainerCacheStats stats = c.get_read_cache_stats();
+    MADNESS_ASSERT(stats.nmiss == nremote && stats.nhit == nremote);
+    MADNESS_ASSERT(stats.nentry == nremote && stats.nevict == 0);
+    MADNESS_ASSERT(stats.nbyte > 0);
+
+    // Batched finds use the same cache
+    std::vector<Key> keys;
+    for (int i=0; i<100; ++i) keys.push_back(Key(i));
+    std::vector< Future<WorldContainer<Key,Node>::iterator> > r = c.find(keys);
+    for (int i=0; i<100; ++i) MADNESS_ASSERT(r[i].get()->second.get() == i);
+    MADNESS_ASSERT(c.get_read_cache_stats().nhit == 2*nremote);
+
+    // Writing a remote item drops it from the cache at once
+    for (int i=0; i<100; ++i) {
+        if (!c.is_local(Key(i))) {
+            c.replace(Key(i), Node(i));
+            MADNESS_ASSERT(c.get_read_cache_stats().nentry == nremote-1);
+            break;
+        }
+    }
+    world.gop.fence();
+
+    // The fence empties the cache without waiting for the next find
+    stats = c.get_read_cache_stats();
+    MADNESS_ASSERT(stats.nentry == 0 && stats.nbyte == 0);
+
+    // Changes made elsewhere are seen after a fence
+    if (world.rank() == 0) c.replace(Key(7), Node(-7));
+    world.gop.fence();
+    MADNESS_ASSERT(c.find(Key(7)).get()->second.get() == -7);
+    MADNESS_ASSERT(c.get_read_cache_stats().nentry == (c.is_local(Key(7)) ? 0u : 1u));
+
+    // Replies that do not fit are not kept
+    c.set_read_cache(1);
+    for (int i=0; i<100; ++i) c.find(Key(i)).get();
+    stats = c.get_read_cache_stats();
+    MADNESS_ASSERT(stats.nentry == 0 && stats.nevict == nremote);
+
+    c.set_read_cache(0);
+    world.gop.fence();
+}
+
+
+void test4(World& world) {
+    // Streaming redistribute of several containers of different types
+    std::shared_ptr< WorldDCPmapInterface<int> > pmap0(new TestPmap(world, 0));
+    std::shared_ptr< WorldDCPmapInterface<int> > pmap1(new TestPmap(world, 1));
+
+    WorldContainer<int,double> c(world,pmap0);
+    WorldContainer< int,std::vector<double> > d(world,pmap0);
+
+    // Big enough to need several messages per process
+    const int n = 400;
+    for (int i=0; i<n; ++i) {
+        if (c.is_local(i)) {
+            c.replace(i,i+1.0);
+            d.replace(i,std::vector<double>(2000,i+2.0));
+        }
+    }
+    world.gop.fence();
+
+    pmap0->redistribute_streaming(world, pmap1);
+    for (int i=0; i<n; ++i) {
+        MADNESS_ASSERT(c.owner(i) == pmap1->owner(i));
+        if (c.is_local(i)) {
+            WorldContainer<int,double>::const_accessor acc;
+            MADNESS_ASSERT(c.find(acc,i) && acc->second == i+1.0);
+            WorldContainer< int,std::vector<double> >::const_accessor dacc;
+            MADNESS_ASSERT(d.find(dacc,i) && dacc->second.size() == 2000 && dacc->second[1999] == i+2.0);
+        }
+    }
+    std::size_t nlocal = c.size();
+    world.gop.sum(nlocal);
+    MADNESS_ASSERT(nlocal == std::size_t(n));
+
+    // And back again, now registered with the new map
+    pmap1->redistribute_streaming(world, pmap0);
+    for (int i=0; i<n; ++i) {
+        MADNESS_ASSERT(c.find(i).get()->second == i+1.0);
+        MADNESS_ASSERT(d.find(i).get()->second[0] == i+2.0);
+    }
+
+    world.gop.fence();
+}
+
 
 int main(int argc, char** argv) {
     initialize(argc, argv);
@@ -156,6 +294,9 @@ int main(int argc, char** argv) {
         test1(world);
         test1(world);
         test1(world);
+        test2(world);
+        test3(world);
+        test4(world);
     }
     catch (SafeMPI::Exception e) {
         error("caught an MPI exception");
@@ -0,0 +1,160 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+
+/// \file test_future_dag.cc
+/// \brief Times dependency-heavy task trees shaped like compress and truncate
+
+/// Each interior node of an 8-ary tree spawns a task per child and then
+/// a task that combines the children's futures, as FunctionImpl does in
+/// compress_spawn (eight separate future arguments) and truncate_spawn
+/// (a vector of futures).  Spawning tasks return futures, so every edge
+/// also chains one future to another.  A third test hangs many tasks
+/// off a single future.  Every task is trivial, so the timings are
+/// dominated by future and task management.
+///
+/// Usage: test_future_dag.mpi [depth [nrepeat]]   (default 4 and 3)
+
+#define WORLD_INSTANTIATE_STATIC_TEMPLATES
+#include <madness/world/parallel_runtime.h>
+#include <cstdlib>
+using namespace std;
+using namespace madness;
+
+static World* pworld;
+
+double sum8(double a, double b, double c, double d,
+            double e, double f, double g, double h) {
+    return a + b + c + d + e + f + g + h;
+}
+
+bool any_true(int n, const vector< Future<bool> >& v) {
+    bool r = (n%3 == 0);
+    for (unsigned int i=0; i<v.size(); ++i) r = r || v[i].get();
+    return r;
+}
+
+Future<double> compress_spawn(int n, int depth) {
+    if (n == depth) return Future<double>(1.0);
+    Future<double> c[8];
+    for (int i=0; i<8; ++i)
+        c[i] = pworld->taskq.add(&compress_spawn, n+1, depth, TaskAttributes::generator());
+    return pworld->taskq.add(&sum8, c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7]);
+}
+
+Future<bool> truncate_spawn(int n, int depth) {
+    if (n == depth) return Future<bool>(false);
+    vector< Future<bool> > v = future_vector_factory<bool>(8);
+    for (int i=0; i<8; ++i)
+        v[i] = pworld->taskq.add(&truncate_spawn, n+1, depth, TaskAttributes::generator());
+    return pworld->taskq.add(&any_true, n, v);
+}
+
+double plus_one(double x) {
+    return x + 1.0;
+}
+
+/// Returns the no. of tasks made for a tree of given depth
+long ntask_tree(int depth) {
+    long nleaf = 1, ntask = 0;
+    for (int n=0; n<depth; ++n) {
+        ntask += 2*nleaf;  // spawn + combine per interior node
+        nleaf *= 8;
+    }
+    return ntask + nleaf;  // + leaf spawns
+}
+
+int main(int argc, char** argv) {
+    initialize(argc, argv);
+    World world(SafeMPI::COMM_WORLD);
+    pworld = &world;
+
+    int depth = 4, nrepeat = 3;
+    if (argc > 1) depth = atoi(argv[1]);
+    if (argc > 2) nrepeat = atoi(argv[2]);
+
+    long nleaf = 1;
+    for (int n=0; n<depth; ++n) nleaf *= 8;
+    const long ntask = ntask_tree(depth);
+
+    bool ok = true;
+    for (int r=0; r<nrepeat; ++r) {
+        double start = wall_time();
+        Future<double> sum = world.taskq.add(&compress_spawn, 0, depth);
+        const double value = sum.get();
+        world.taskq.fence();
+        double used = wall_time() - start;
+        if (value != double(nleaf)) {
+            print("compress tree: wrong sum", value, nleaf);
+            ok = false;
+        }
+        if (world.rank() == 0)
+            printf("compress tree  depth %d  %8ld tasks  %8.3fs  %8.2fus/task\n",
+                   depth, ntask, used, 1e6*used/ntask);
+
+        start = wall_time();
+        Future<bool> any = world.taskq.add(&truncate_spawn, 0, depth);
+        const bool flag = any.get();
+        world.taskq.fence();
+        used = wall_time() - start;
+        if (!flag) {
+            print("truncate tree: wrong result");
+            ok = false;
+        }
+        if (world.rank() == 0)
+            printf("truncate tree  depth %d  %8ld tasks  %8.3fs  %8.2fus/task\n",
+                   depth, ntask, used, 1e6*used/ntask);
+
+        // Many dependents of one future
+        start = wall_time();
+        Future<double> root;
+        vector< Future<double> > v(nleaf);
+        for (long i=0; i<nleaf; ++i) v[i] = world.taskq.add(&plus_one, root);
+        root.set(1.0);
+        world.taskq.fence();
+        used = wall_time() - start;
+        for (long i=0; i<nleaf; ++i) {
+            if (v[i].get() != 2.0) {
+                print("fan out: wrong value", i, v[i].get());
+                ok = false;
+                break;
+            }
+        }
+        if (world.rank() == 0)
+            printf("fan out               %8ld tasks  %8.3fs  %8.2fus/task\n",
+                   nleaf, used, 1e6*used/nleaf);
+    }
+
+    world.gop.fence();
+    if (world.rank() == 0) print(ok ? "OK!" : "FAILED");
+    finalize();
+    return ok ? 0 : 1;
+}
@@ -58,12 +58,13 @@ double drand() {
     return random()*(1.0/RAND_MAX);
 }
 
-void split(const Range<ConcurrentHashMap<int,int>::iterator>& range) {
-    typedef Range<ConcurrentHashMap<int,int>::iterator> rangeT;
+template <class iteratorT>
+void split(const Range<iteratorT>& range) {
+    typedef Range<iteratorT> rangeT;
     if (range.size() <= range.get_chunksize()) {
         int n = range.size();
         int c = 0;
-        for (rangeT::iterator it=range.begin();  it != range.end();  ++it) {
+        for (typename rangeT::iterator it=range.begin();  it != range.end();  ++it) {
             c++;
             if (c > n) throw "c > n inside range iteration";
         }
@@ -77,13 +78,15 @@ void split(const Range<ConcurrentHashMap<int,int>::iterator>& range) {
     }
 }
 
+template <template <class,class,class> class mapT>
 void test_coverage() {
     // This test aims for complete code coverage for whatever that
     // is worth, and tests for basic sequential correctness.
-    ConcurrentHashMap<int,int> a;
-    typedef ConcurrentHashMap<int,int>::datumT datumT;
-    typedef ConcurrentHashMap<int,int>::iterator iteratorT;
-    typedef ConcurrentHashMap<int,int>::const_iterator const_iteratorT;
+    typedef mapT<int,int,Hash<int> > mapiT;
+    mapiT a;
+    typedef typename mapiT::datumT datumT;
+    typedef typename mapiT::iterator iteratorT;
+    typedef typename mapiT::const_iterator const_iteratorT;
 
 
     a[-1] = -99;
@@ -107,7 +110,7 @@ void test_coverage() {
         if (it->second != 99*i) cout << "value mismatch on find" << i << " " << it->second << endl;
     }
 
-    const ConcurrentHashMap<int,int>* ca = &a;
+    const mapiT* ca = &a;
     for (int i=0; i<10000; ++i) {
         const_iteratorT it = ca->find(i);
         if (it == ca->end()) cout << "expected to find this element " << i << endl;
@@ -200,14 +203,15 @@ vector<int> random_perm(int n) {
 }
 
 
+template <template <class,class,class> class mapT>
 void test_time() {
     // Examine interaction between nbins and nentries by looping thru
     // bin sizes and measuring time to insert and then delete varying
     // number of keys in random order
-    typedef ConcurrentHashMap<int,int>::datumT datumT;
+    typedef typename mapT<int,int,Hash<int> >::datumT datumT;
     for (int nbins=100; nbins<=10000; nbins*=10) {
         for (int nentries=nbins; nentries<=nbins*100; nentries*=10) {
-            ConcurrentHashMap<int,double> a(nbins);
+            mapT<int,double,Hash<int> > a(nbins);
             vector<int> v = random_perm(nentries);
             double insert_used = madness::cpu_time();
             for (int i=0; i<nentries; ++i) {
@@ -226,9 +230,10 @@ void test_time() {
     }
 }
 
-void do_test_random(ConcurrentHashMap<int,double>& a, size_t& count, double& sum) {
-    typedef ConcurrentHashMap<int,double>::datumT datumT;
-    typedef ConcurrentHashMap<int,double>::iterator iteratorT;
+template <class mapT>
+void do_test_random(mapT& a, size_t& count, double& sum) {
+    typedef typename mapT::datumT datumT;
+    typedef typename mapT::iterator iteratorT;
     // Randomly generate keys in range 4*nbin and randomly insert or
     // delete that entry.  Maintain expected sum and count of values
     // and verify at end.
@@ -256,9 +261,11 @@ void do_test_random(ConcurrentHashMap<int,double>& a, size_t& count, double& sum
     }
 }
 
+template <template <class,class,class> class mapT>
 void test_random() {
-    ConcurrentHashMap<int,double> a(131);
-    typedef ConcurrentHashMap<int,double>::iterator iteratorT;
+    typedef mapT<int,double,Hash<int> > mapdT;
+    mapdT a(131);
+    typedef typename mapdT::iterator iteratorT;
 
     size_t count;
     double sum;
@@ -279,14 +286,15 @@ void test_random() {
 
 madness::AtomicInt ndone;
 
+template <class mapT>
 class Worker : public madness::ThreadBase {
 private:
-    ConcurrentHashMap<int,double>& a; // Better would be a shared pointer
+    mapT& a; // Better would be a shared pointer
     size_t& count;
     double& sum;
 
 public:
-    Worker(ConcurrentHashMap<int,double>& a, size_t& count, double& sum)
+    Worker(mapT& a, size_t& count, double& sum)
             : ThreadBase(), a(a), count(count), sum(sum) {
         start();
     }
@@ -300,19 +308,19 @@ public:
 
 
 
+template <template <class,class,class> class mapT>
 void test_thread() {
-    ConcurrentHashMap<int,double> a(131);
-    //typedef ConcurrentHashMap<int,double>::datumT datumT; // unused
-    typedef ConcurrentHashMap<int,double>::iterator iteratorT;
-    // typedef ConcurrentHashMap<int,double>::const_iterator const_iteratorT; // unused
+    typedef mapT<int,double,Hash<int> > mapdT;
+    mapdT a(131);
+    typedef typename mapdT::iterator iteratorT;
     const int nthread = 2;
     size_t counts[nthread];
     double sums[nthread];
 
     ndone = 0;
 
-    Worker worker1(a,counts[0],sums[0]);
-    Worker worker2(a,counts[1],sums[1]);
+    Worker<mapdT> worker1(a,counts[0],sums[0]);
+    Worker<mapdT> worker2(a,counts[1],sums[1]);
     while (ndone != 2) sched_yield();
 
     size_t count = 0;
@@ -336,19 +344,20 @@ void test_thread() {
 }
 
 
+template <class mapT>
 class Peasant : public madness::ThreadBase {
 private:
-    ConcurrentHashMap<int,double>& a; // Better would be a shared pointer
+    mapT& a; // Better would be a shared pointer
 
 public:
-    Peasant(ConcurrentHashMap<int,double>& a)
+    Peasant(mapT& a)
             : ThreadBase(), a(a) {
         start();
     }
 
     void run() {
         for (int i=0; i<10000000; ++i) {
-            ConcurrentHashMap<int,double>::accessor r;
+            typename mapT::accessor r;
             if (!a.find(r, 1)) MADNESS_EXCEPTION("OK ... where is it?", 0);
             r->second++;
         }
@@ -358,10 +367,11 @@ public:
 };
 
 
+template <template <class,class,class> class mapT>
 void test_accessors() {
-    ConcurrentHashMap<int,double> a(131);
-    // typedef ConcurrentHashMap<int,double>::datumT datumT; // unused
-    typedef ConcurrentHashMap<int,double>::accessor accessorT;
+    typedef mapT<int,double,Hash<int> > mapdT;
+    mapdT a(131);
+    typedef typename mapdT::accessor accessorT;
 
     ndone = 0;
 
@@ -377,13 +387,71 @@ void test_accessors() {
     if (result->second != 0.0) MADNESS_EXCEPTION("should have been zero", static_cast<int>(result->second));
 
 
-    Peasant a1(a),a2(a);
+    Peasant<mapdT> a1(a),a2(a);
     result.release();
     while (ndone != 2) sched_yield();
 
     if (a[1] != 20000000.0) MADNESS_EXCEPTION("Ooops", int(a[1]));
 }
 
+/// Tables replaced by insert/erase churn must all be freed by reclaim()
+void test_open_churn() {
+    typedef ConcurrentOpenHashMap<int,int,Hash<int> > mapiT;
+    mapiT a(16);
+    for (int i=0; i<100; ++i) a.insert(std::make_pair(i,i));
+
+    long nbyte = 0;
+    for (int round=0; round<4; ++round) {
+        for (int i=1000; i<201000; ++i) {
+            a.insert(std::make_pair(i,i));
+            a.erase(i);
+        }
+        a.reclaim();
+        const long n = mem_tag_stats(MEM_HASHMAP).nbyte;
+        if (round == 0) nbyte = n;
+        else if (n > nbyte + 65536) {
+            cout << "churn: hashmap memory grew from " << nbyte << " to " << n << endl;
+            MADNESS_EXCEPTION("churn: hashmap memory grew", round);
+        }
+    }
+
+    if (a.size() != 100) MADNESS_EXCEPTION("churn: wrong size", int(a.size()));
+    for (int i=0; i<100; ++i) {
+        mapiT::iterator it = a.find(i);
+        if (it == a.end() || it->second != i) MADNESS_EXCEPTION("churn: lost an entry", i);
+    }
+    cout << "churn: OK" << endl;
+}
+
+/// Inserting into the bin being iterated, so that it is compacted and grows,
+/// must not make the iterator skip or repeat entries
+void test_open_iterate_insert() {
+    typedef ConcurrentOpenHashMap<int,int,Hash<int> > mapiT;
+    mapiT a(1);
+    const int n = 1000;
+    for (int i=0; i<n; ++i) a.insert(std::make_pair(i,i));
+
+    std::vector<int> seen(n, 0);
+    int k = 0;
+    for (mapiT::iterator it=a.begin(); it!=a.end(); ++it, ++k) {
+        const int key = it->first;
+        if (key < n) ++seen[key];
+        else if (key < 2*n) MADNESS_EXCEPTION("iterate_insert: saw an erased entry", key);
+        // Churn leaves tombstones, so the bin is rehashed at the same size
+        // now and then, and the steady inserts grow the bin twice over
+        for (int j=0; j<8; ++j) {
+            const int c = n + (8*k + j)%n;
+            a.insert(std::make_pair(c, j));
+            a.erase(c);
+        }
+        if (k < 2*n) a.insert(std::make_pair(2*n + k, k));
+    }
+    for (int i=0; i<n; ++i)
+        if (seen[i] != 1) MADNESS_EXCEPTION("iterate_insert: entry not seen exactly once", i);
+    a.reclaim();
+    cout << "iterate_insert: OK" << endl;
+}
+
 void test_integer_range() {
     int start(12), end(start+30);
 
@@ -398,11 +466,21 @@ void test_integer_range() {
 int main(int argc, char** argv) {
     madness::initialize(argc,argv);
     try {
-        test_coverage();
-        test_random();
-        test_time();
-        test_thread();
-        test_accessors();
+        test_coverage<ConcurrentHashMap>();
+        test_random<ConcurrentHashMap>();
+        test_time<ConcurrentHashMap>();
+        test_thread<ConcurrentHashMap>();
+        test_accessors<ConcurrentHashMap>();
+
+        cout << "\nConcurrentOpenHashMap\n";
+        test_coverage<ConcurrentOpenHashMap>();
+        test_random<ConcurrentOpenHashMap>();
+        test_time<ConcurrentOpenHashMap>();
+        test_thread<ConcurrentOpenHashMap>();
+        test_accessors<ConcurrentOpenHashMap>();
+        test_open_churn();
+        test_open_iterate_insert();
+
         test_integer_range();
 
         cout << "Things seem to be working!\n";
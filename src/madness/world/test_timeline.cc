@@ -0,0 +1,164 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+#include <madness/world/parallel_runtime.h>
+#include <madness/world/worldtimeline.h>
+#include <madness/world/atomicint.h>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace madness;
+
+// Every thread keeps only this many events
+static const int RING = 64;
+
+AtomicInt ndone;
+volatile bool again = false;
+
+/// Records nevent AM_SEND events, tagged with its id as the peer and the sequence number as the size
+
+/// Does so twice, the second time once \c again is set, so that the
+/// thread records into a timeline begun after it recorded the first.
+class Recorder : public ThreadBase {
+    const int id;
+    const int nevent;
+
+public:
+    Recorder(int id, int nevent) : ThreadBase(), id(id), nevent(nevent) {
+        start();
+    }
+
+    void run() {
+        Timeline::name_thread("recorder");
+        for (int round=0; round<2; ++round) {
+            while (round && !again) myusleep(100);
+            for (int i=0; i<nevent; ++i)
+                Timeline::record(Timeline::AM_SEND, 1.0+i, 1.5+i, 0, 1000+id, i);
+            ndone++;
+        }
+    }
+};
+
+/// Returns the number after "key": in line, or -1 if absent
+double field(const std::string& line, const char* key) {
+    const std::string k = std::string("\"") + key + "\":";
+    const std::size_t pos = line.find(k);
+    if (pos == std::string::npos) return -1.0;
+    return std::atof(line.c_str() + pos + k.size());
+}
+
+struct Seen {
+    std::vector<long> nbyte;
+    std::vector<double> ts;
+    std::vector<long> tid;
+};
+
+/// Checks the events of the recorders in the file written by finalize()
+bool check(const std::string& file_name, const int* nevent, int nrecorder) {
+    std::ifstream in(file_name.c_str());
+    if (in.fail()) {
+        print("could not open", file_name);
+        return false;
+    }
+    std::map<long, Seen> seen;
+    int nrecorder_names = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find("\"recorder ") != std::string::npos) ++nrecorder_names;
+        if (line.find("\"cat\":\"am_send\"") == std::string::npos) continue;
+        const long dest = long(field(line, "dest"));
+        if (dest < 1000) continue;
+        Seen& s = seen[dest];
+        s.nbyte.push_back(long(field(line, "nbyte")));
+        s.ts.push_back(field(line, "ts"));
+        s.tid.push_back(long(field(line, "tid")));
+    }
+
+    bool ok = (nrecorder_names == nrecorder) && (int(seen.size()) == nrecorder);
+    std::map<long, long> owner; // tid -> recorder
+    for (int id=0; id<nrecorder && ok; ++id) {
+        const Seen& s = seen[1000+id];
+        // Only the most recent RING events survive, oldest first
+        const long n = std::min(nevent[id], RING);
+        ok = ok && (long(s.nbyte.size()) == n);
+        for (long i=0; ok && i<n; ++i) {
+            ok = ok && (s.nbyte[i] == nevent[id] - n + i) && (s.tid[i] == s.tid[0]);
+            if (i) ok = ok && (s.ts[i] > s.ts[i-1]);
+        }
+        // Each recorder has a thread of its own
+        ok = ok && owner.insert(std::make_pair(s.tid[0], long(id))).second;
+        if (!ok) print("recorder", id, "has", s.nbyte.size(), "events, expected", n);
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    setenv("MAD_TIMELINE", "test_timeline", 0);
+    setenv("MAD_TIMELINE_EVENTS", "64", 0);
+    initialize(argc,argv);
+    const int rank = SafeMPI::COMM_WORLD.Get_rank();
+
+    // Two recorders fit in their rings and two wrap around
+    const int nevent[] = {20, RING, 3*RING+5, 1000};
+    const int nrecorder = sizeof(nevent)/sizeof(int);
+    std::ostringstream file_name;
+    file_name << getenv("MAD_TIMELINE") << "." << rank << ".json";
+    bool ok;
+    {
+        World world(SafeMPI::COMM_WORLD);
+        ndone = 0;
+        std::vector<Recorder*> recorders;
+        for (int id=0; id<nrecorder; ++id) recorders.push_back(new Recorder(id, nevent[id]));
+        while (ndone != nrecorder) myusleep(100);
+        world.gop.fence();
+
+        // A second timeline, into which the same threads record again
+        Timeline::end();
+        ok = check(file_name.str(), nevent, nrecorder);
+        Timeline::begin(rank);
+        again = true;
+        while (ndone != 2*nrecorder) myusleep(100);
+        world.gop.fence();
+        for (int id=0; id<nrecorder; ++id) delete recorders[id];
+    }
+
+    finalize(); // Writes the second timeline
+
+    ok = check(file_name.str(), nevent, nrecorder) && ok;
+    if (ok) std::remove(file_name.str().c_str());
+    std::printf("%d: timeline %s\n", rank, ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
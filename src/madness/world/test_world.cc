@@ -33,6 +33,9 @@
 #include <madness/world/parallel_runtime.h>
 #include <madness/world/world_object.h>
 #include <madness/world/worlddc.h>
+#include <madness/world/coroutine.h>
+#include <cstdlib>
+#include <stdexcept>
 
 #if MADNESS_CATCH_SIGNALS
 # include <csignal>
@@ -1051,6 +1054,1067 @@ void test13(World& world) {
     world.gop.fence();
 }
 
+volatile long test14_count = 0;
+
+void test14_inc(int n) {
+    __sync_fetch_and_add(&test14_count, n);
+}
+
+void test14(World& world) {
+    PROFILE_FUNC;
+    // Split-phase fence: remote tasks must all have run once it completes
+    ProcessID right = (world.rank()+1)%world.size();
+    test14_count = 0;
+    world.gop.fence();
+
+    for (int rep=0; rep<3; ++rep) {
+        for (int i=0; i<100; ++i) world.taskq.add(right, test14_inc, 1);
+        Future<bool> done = world.gop.fence_begin();
+        double work = 0.0;  // Local work overlapped with the fence
+        for (int i=1; i<10000; ++i) work += 1.0/i;
+        world.gop.fence_end();
+        MADNESS_ASSERT(done.probe() && work > 0.0);
+        // Neighbors may already be sending the next batch
+        MADNESS_ASSERT(test14_count >= 100*(rep+1));
+    }
+    world.gop.fence();
+    MADNESS_ASSERT(test14_count == 300);
+
+    std::vector<FenceSiteStats> stats = WorldGopInterface::fence_stats();
+    MADNESS_ASSERT(!stats.empty());
+    print("Test14 OK");
+    world.gop.fence();
+}
+
+void test15(World& world) {
+    PROFILE_FUNC;
+    // Reductions and broadcasts long enough to be split into pieces
+    // (run with MAD_GOP_RANKS_PER_NODE=2 and MAD_GOP_SHM_BYTES=1024 to
+    // exercise both levels of the node-aware collectives on one machine)
+    const long n = 100000;
+    const long me = world.rank(), nproc = world.size();
+    std::vector<double> v(n);
+    std::vector<long> m(n);
+    for (long i=0; i<n; ++i) {
+        v[i] = i + me;
+        m[i] = (i + me) % nproc;
+    }
+    world.gop.sum(&v[0], n);
+    world.gop.max(&m[0], n);
+    for (long i=0; i<n; ++i) {
+        MADNESS_ASSERT(v[i] == double(i*nproc + nproc*(nproc-1)/2));
+        MADNESS_ASSERT(m[i] == nproc-1);
+    }
+
+    std::vector<int> b(n);
+    for (ProcessID root=0; root<std::min(world.size(),2); ++root) {
+        for (long i=0; i<n; ++i) b[i] = (me == root) ? int(i) : -1;
+        world.gop.broadcast(&b[0], n, root);
+        for (long i=0; i<n; ++i) MADNESS_ASSERT(b[i] == i);
+    }
+
+    // Many short ones in a row reuse the same shared slots
+    for (long rep=0; rep<100; ++rep) {
+        long r = rep + me;
+        world.gop.sum(r);
+        MADNESS_ASSERT(r == rep*nproc + nproc*(nproc-1)/2);
+    }
+
+    print("Test15 OK");
+    world.gop.fence();
+}
+
+void test16(World& world) {
+    PROFILE_FUNC;
+    // Memory accounting by tag (numbers above detail::MEM_TAG_FLUSH are
+    // used so that this thread's counts reach the global ones)
+    const MemTagStats before = mem_tag_stats(MEM_CACHE);
+    mem_tag_alloc(MEM_CACHE, 10000000);
+    {
+        MemTagScope scope(MEM_CACHE);
+        MADNESS_ASSERT(mem_tag_current() == MEM_CACHE);
+    }
+    MADNESS_ASSERT(mem_tag_current() == MEM_TENSOR);
+    MemTagStats s = mem_tag_stats(MEM_CACHE);
+    MADNESS_ASSERT(s.nbyte == before.nbyte + 10000000);
+    MADNESS_ASSERT(s.peak >= s.nbyte);
+    mem_tag_free(MEM_CACHE, 10000000);
+    s = mem_tag_stats(MEM_CACHE);
+    MADNESS_ASSERT(s.nbyte == before.nbyte && s.peak >= before.nbyte + 10000000);
+
+    // Hash map entries are charged to the map's tag
+    const long nhash = mem_tag_stats(MEM_HASHMAP).nbyte;
+    {
+        ConcurrentHashMap<int,double> h;
+        for (int i=0; i<100000; ++i) h.insert(std::make_pair(i,1.0*i));
+        MADNESS_ASSERT(mem_tag_stats(MEM_HASHMAP).nbyte > nhash);
+        for (int i=0; i<50000; ++i) h.erase(i);
+    }
+    MADNESS_ASSERT(mem_tag_stats(MEM_HASHMAP).nbyte == nhash);
+
+    print("Test16 OK");
+    world.gop.fence();
+}
+
+typedef ConcurrentHashMap<int,long> test18mapT;
+typedef Range<test18mapT::const_iterator> test18rangeT;
+
+struct Test18Sum {
+    long operator()(const test18rangeT::iterator& it) const { return it->second; }
+    long operator()(long left, long right) const { return left + right; }
+    template <typename Archive> void serialize(const Archive& ar) {}
+};
+
+struct Test18Count {
+    AtomicInt* count;
+    Test18Count(AtomicInt* count = 0) : count(count) {}
+    bool operator()(const test18rangeT::iterator& it) const {
+        (*count)++;
+        return it->second >= 0;
+    }
+    template <typename Archive> void serialize(const Archive& ar) {}
+};
+
+// Splits down to single items, checking that each split about halves the
+// range and that the pieces cover it; returns the no. of items
+template <typename rangeT>
+long test18_split(rangeT& range) {
+    const long n = range.size();
+    if (!range.is_divisible()) {
+        long m = 0;
+        for (typename rangeT::iterator it=range.begin(); it!=range.end(); ++it) ++m;
+        MADNESS_ASSERT(m == n);
+        return n;
+    }
+    rangeT right(range, Split());
+    const long nleft = range.size();
+    MADNESS_ASSERT(nleft + long(right.size()) == n);
+    MADNESS_ASSERT(nleft >= (n+1)/2 && nleft <= (n+1)/2 + (n+1)/16);
+    MADNESS_ASSERT(range.end() == right.begin());
+    return test18_split(range) + test18_split(right);
+}
+
+void test18(World& world) {
+    PROFILE_FUNC;
+    // Reduce and for_each with the chunk size chosen by the task queue
+    test18mapT h;
+    const int n = 100000;
+    for (int i=0; i<n; ++i) h.insert(std::make_pair(i,long(i)));
+    for (int rep=0; rep<3; ++rep) { // The first time the cost is not known
+        test18rangeT range(h.begin(), h.end(), test18rangeT::AUTO);
+        MADNESS_ASSERT(range.is_adaptive());
+        long sum = world.taskq.reduce<long,test18rangeT,Test18Sum>(range, Test18Sum()).get();
+        MADNESS_ASSERT(sum == long(n)*(n-1)/2);
+
+        AtomicInt count;
+        count = 0;
+        Future<bool> ok = world.taskq.for_each<test18rangeT,Test18Count>(range, Test18Count(&count));
+        MADNESS_ASSERT(ok.get());
+        MADNESS_ASSERT(count == n);
+    }
+    MADNESS_ASSERT(detail::GrainSize<Test18Sum>::chunk(n) >= 1);
+
+    // Aligning splits to bins keeps them balanced
+    test18rangeT whole(h.begin(), h.end(), 16);
+    MADNESS_ASSERT(test18_split(whole) == n);
+    typedef ConcurrentOpenHashMap<int,long> openmapT;
+    openmapT oh;
+    for (int i=0; i<n; ++i) oh.insert(std::make_pair(i,long(i)));
+    Range<openmapT::const_iterator> owhole(oh.begin(), oh.end(), 16);
+    MADNESS_ASSERT(test18_split(owhole) == n);
+
+    // ... and so do splits of a container's local items
+    typedef WorldContainer<int,long> dcT;
+    MADNESS_ASSERT(detail::has_align_to_bin<dcT::iterator>::value);
+    dcT dc(world);
+    for (int i=world.rank(); i<n; i+=world.size()) dc.replace(i,long(i));
+    world.gop.fence();
+    Range<dcT::iterator> dwhole(dc.begin(), dc.end(), 16);
+    MADNESS_ASSERT(test18_split(dwhole) == long(dc.size()));
+
+    print("Test18 OK");
+    world.gop.fence();
+}
+
+void test19_inc(AtomicInt* count) {
+    (*count)++;
+}
+
+volatile bool test19_release = false;
+volatile bool test19_done = false;
+AtomicInt test19_nblocked;
+AtomicInt test19_nrun;
+int test19_order[64];
+
+// Keeps a pool thread busy until released
+void test19_block() {
+    test19_nblocked++;
+    while (!test19_release) cpu_relax();
+}
+
+void test19_record(int level) {
+    test19_order[test19_nrun++] = level;
+}
+
+// Runs on the one free pool thread: queues tasks of every level (from
+// here they go on this thread's own deque with the work-stealing
+// schedulers) and runs them, which must happen highest level first
+void test19_run_order(World* world) {
+    test19_nrun = 0;
+    for (int level=1; level<TaskAttributes::NPRIORITY; ++level) {
+        for (int i=0; i<2; ++i) {
+            world->taskq.add(test19_record, 0);
+            world->taskq.add(test19_record, level, TaskAttributes::priority(level));
+        }
+    }
+    const int ntask = 4*(TaskAttributes::NPRIORITY-1);
+    while (test19_nrun < ntask) ThreadPool::run_task();
+    for (int i=0; i<ntask; ++i) {
+        const int expected = (i < ntask/2 ? TaskAttributes::NPRIORITY-1-i/2 : 0);
+        MADNESS_ASSERT(test19_order[i] == expected);
+    }
+    test19_release = true;
+    test19_done = true;
+}
+
+void test19(World& world) {
+    PROFILE_FUNC;
+    // Prioritized values leave the queue highest level first, FIFO
+    // within a level, after those pushed at the front
+    DQueue<long> q(16);
+    q.push_back(1);
+    q.push_priority(2, 2);
+    q.push_priority(3, 5);
+    q.push_priority(4, 2);
+    q.push_front(5);
+    q.push_priority(6, 0);
+    MADNESS_ASSERT(q.size() == 6);
+    const long expected[] = {5, 3, 2, 4, 1, 6};
+    for (int i=0; i<6; ++i) {
+        std::pair<long,bool> r = q.pop_front(false);
+        MADNESS_ASSERT(r.second && r.first == expected[i]);
+    }
+    MADNESS_ASSERT(q.empty());
+
+    // Lanes grow and keep their order
+    for (long i=0; i<1000; ++i) q.push_priority(i, 3);
+    for (long i=0; i<1000; ++i) q.push_front(-i);
+    for (long i=999; i>=0; --i) MADNESS_ASSERT(q.pop_front(false).first == -i);
+    for (long i=0; i<1000; ++i) MADNESS_ASSERT(q.pop_front(false).first == i);
+    MADNESS_ASSERT(q.empty());
+
+    // The lanes of a work-stealing deque ... the owner takes the newest
+    // value of the highest level, a thief the oldest
+    WorkStealingDeque<long> dq(4);
+    dq.push_back(1);
+    dq.push_priority(2, 2);
+    dq.push_priority(3, 5);
+    dq.push_priority(4, 2);
+    dq.push_front(5);
+    dq.push_priority(6, 0);
+    dq.push_priority(7, 2);
+    MADNESS_ASSERT(dq.size() == 7);
+    long v = 0;
+    MADNESS_ASSERT(dq.pop_back(v) && v == 3);
+    MADNESS_ASSERT(dq.steal_front(v) && v == 2);
+    MADNESS_ASSERT(dq.pop_back(v) && v == 7);
+    MADNESS_ASSERT(dq.pop_back(v) && v == 4);
+    MADNESS_ASSERT(dq.steal_front(v) && v == 5);
+    MADNESS_ASSERT(dq.pop_back(v) && v == 6);
+    MADNESS_ASSERT(dq.pop_back(v) && v == 1);
+    MADNESS_ASSERT(dq.empty() && !dq.pop_back(v) && !dq.steal_front(v));
+    for (long i=0; i<1000; ++i) dq.push_priority(i, 1+i%7);
+    for (int level=7; level>0; --level)
+        for (long i=0; i<1000; ++i)
+            if (1+i%7 == level) MADNESS_ASSERT(dq.steal_front(v) && v == i);
+    MADNESS_ASSERT(dq.empty());
+
+    // Every priority is used from the root down to the deepest level
+    MADNESS_ASSERT(TaskAttributes::tree_level(0, 31).get_priority() == TaskAttributes::NPRIORITY-1);
+    MADNESS_ASSERT(TaskAttributes::tree_level(30, 31).get_priority() == 0);
+    MADNESS_ASSERT(TaskAttributes::tree_level(40, 31).get_priority() == 0);
+    int nused = 1;
+    for (int level=1; level<31; ++level) {
+        const int p = TaskAttributes::tree_level(level, 31).get_priority();
+        const int prev = TaskAttributes::tree_level(level-1, 31).get_priority();
+        MADNESS_ASSERT(p <= prev);
+        if (p < prev) ++nused;
+    }
+    MADNESS_ASSERT(nused == TaskAttributes::NPRIORITY);
+    MADNESS_ASSERT(!TaskAttributes::tree_level(0).is_high_priority());
+
+    // Tasks at every level all run
+    AtomicInt count;
+    count = 0;
+    const int n = 1000;
+    for (int i=0; i<n; ++i)
+        world.taskq.add(test19_inc, &count, TaskAttributes::tree_level(i%10));
+    world.taskq.fence();
+    MADNESS_ASSERT(count == n);
+
+    // Tasks run highest level first with whatever scheduler is in use ...
+    // all but one pool thread are kept busy so that nobody steals
+    const int nblock = int(ThreadPool::size()) - 1;
+    if (nblock >= 0) {
+        test19_release = test19_done = false;
+        test19_nblocked = 0;
+        for (int i=0; i<nblock; ++i) world.taskq.add(test19_block);
+        while (test19_nblocked < nblock) cpu_relax();
+        world.taskq.add(test19_run_order, &world);
+        while (!test19_done) cpu_relax();
+        world.taskq.fence();
+    }
+
+    print("Test19 OK");
+    world.gop.fence();
+}
+
+class Test20Obj : public WorldObject<Test20Obj> {
+    std::vector<int> seen;
+public:
+    // Does not process pending messages until told to
+    Test20Obj(World& world) : WorldObject<Test20Obj>(world) {}
+
+    virtual ~Test20Obj() {}
+
+    void start() {
+        process_pending();
+    }
+
+    int push(int i) {
+        seen.push_back(i);
+        return i;
+    }
+
+    bool in_order(int n) const {
+        if (int(seen.size()) != n) return false;
+        for (int i=0; i<n; ++i)
+            if (seen[i] != i) return false;
+        return true;
+    }
+};
+
+void test20(World& world) {
+    PROFILE_FUNC;
+    // Messages to objects created in a burst are queued until each object
+    // is ready and then run in the order they were sent
+    const int nobj = 20, nmsg = 50;
+    std::vector< std::shared_ptr<Test20Obj> > objs;
+    for (int i=0; i<nobj; ++i)
+        objs.push_back(std::shared_ptr<Test20Obj>(new Test20Obj(world)));
+
+    std::vector< Future<int> > results;
+    for (int m=0; m<nmsg; ++m)
+        for (int i=0; i<nobj; ++i)
+            results.push_back(objs[i]->send(world.rank(), &Test20Obj::push, m));
+    for (int i=0; i<nobj; ++i) objs[i]->start();
+    for (int m=nmsg; m<2*nmsg; ++m)
+        for (int i=0; i<nobj; ++i)
+            results.push_back(objs[i]->send(world.rank(), &Test20Obj::push, m));
+
+    for (std::size_t i=0; i<results.size(); ++i)
+        MADNESS_ASSERT(results[i].get() == int(i/nobj));
+    for (int i=0; i<nobj; ++i)
+        MADNESS_ASSERT(objs[i]->in_order(2*nmsg));
+
+    world.gop.fence();
+    print("Test20 OK");
+}
+
+void test21(World& world) {
+    PROFILE_FUNC;
+    // A notify with nobody parked is a no-op and one sent after
+    // prepare_park is not lost
+    ParkingLot lot;
+    lot.notify_one();
+    MADNESS_ASSERT(lot.get_stats().nwake == 0);
+    const int key = lot.prepare_park();
+    MADNESS_ASSERT(lot.num_parked() == 1);
+    lot.notify_one();
+    MADNESS_ASSERT(lot.park(key));
+    MADNESS_ASSERT(lot.num_parked() == 0);
+    MADNESS_ASSERT(!lot.park(lot.prepare_park(), 100)); // Times out
+    MADNESS_ASSERT(lot.get_stats().npark == 2 && lot.get_stats().nwake == 1);
+
+    // Tasks added while the pool is parked are all run
+    AtomicInt count;
+    count = 0;
+    const int n = 100;
+    for (int rep=0; rep<5; ++rep) {
+        myusleep(20000); // Long enough for idle threads to park
+        for (int i=0; i<n; ++i)
+            world.taskq.add(test19_inc, &count);
+        world.taskq.fence();
+    }
+    MADNESS_ASSERT(count == 5*n);
+
+#if !HAVE_INTEL_TBB
+    const ParkStats& stats = ThreadPool::get_park_stats();
+    if (ThreadPool::size() > 0) MADNESS_ASSERT(stats.npark > 0);
+    MADNESS_ASSERT(stats.nwoken <= stats.npark && stats.max_wake_ns*stats.nwoken >= stats.wake_ns);
+#endif
+
+    world.gop.fence();
+    print("Test21 OK");
+}
+
+void test22(World& world) {
+    PROFILE_FUNC;
+    // Arguments stored as their bytes are copied in without a size pass
+    MADNESS_ASSERT(archive::is_bitwise_serializable<double>::value);
+    MADNESS_ASSERT((archive::is_bitwise_serializable< Vector<double,3> >::value));
+    MADNESS_ASSERT(archive::is_bitwise_serializable< std::complex<float> >::value);
+    MADNESS_ASSERT(!archive::is_bitwise_serializable< std::vector<int> >::value);
+
+    const Vector<double,3> v(1.5);
+    const std::complex<float> z(1.0f, -2.0f);
+    AmArg* arg = new_am_arg(7, v, z);
+    MADNESS_ASSERT(arg->size() == sizeof(int) + sizeof(v) + sizeof(z));
+    int i = 0;
+    Vector<double,3> w(0.0);
+    std::complex<float> y;
+    *arg & i & w & y;
+    MADNESS_ASSERT(i == 7 && w == v && y == z);
+    free_am_arg(arg);
+
+    // Others are serialized in one pass into a buffer that grows,
+    // including past the largest pooled buffer
+    const int sizes[] = {0, 5, 100, 20000, 100000};
+    for (int k=0; k<5; ++k) {
+        std::vector<int> x(sizes[k]);
+        for (int j=0; j<sizes[k]; ++j) x[j] = j;
+        const std::string s("hello");
+        arg = new_am_arg(s, x, v);
+
+        archive::BufferOutputArchive count;
+        count & s & x & v;
+        MADNESS_ASSERT(arg->size() == count.size());
+
+        std::string t;
+        std::vector<int> xx;
+        *arg & t & xx & w;
+        MADNESS_ASSERT(t == s && xx == x && w == v);
+        free_am_arg(arg);
+    }
+
+    world.gop.fence();
+    print("Test22 OK");
+}
+
+void test23(World& world) {
+    PROFILE_FUNC;
+    // Submitting alone never runs tasks inline
+    const std::size_t high = 64, low = 16;
+    ThreadPool::set_water_marks(high, low);
+    const uint64_t ninline = ThreadPool::get_stats().ninline;
+    AtomicInt count;
+    count = 0;
+    const int n = 10000;
+    for (int i=0; i<n; ++i)
+        world.taskq.add(test19_inc, &count);
+    MADNESS_ASSERT(ThreadPool::get_stats().ninline == ninline);
+    world.taskq.fence();
+    MADNESS_ASSERT(count == n);
+    MADNESS_ASSERT(ThreadPool::queue_size() == 0);
+
+    // A loop that throttles at its safe point keeps the queue under the mark
+    const uint64_t nthrottle = ThreadPool::get_stats().nthrottle;
+    count = 0;
+    std::size_t maxq = 0;
+    for (int i=0; i<n; ++i) {
+        world.taskq.add(test19_inc, &count);
+        ThreadPool::throttle();
+        maxq = std::max(maxq, ThreadPool::queue_size());
+    }
+    world.taskq.fence();
+    ThreadPool::set_water_marks(0, 0);
+    MADNESS_ASSERT(count == n);
+#if !HAVE_INTEL_TBB
+    MADNESS_ASSERT(maxq <= high);
+#endif
+
+    const DQStats& stats = ThreadPool::get_stats();
+    MADNESS_ASSERT(stats.nthrottle >= nthrottle);
+    MADNESS_ASSERT(stats.mean_size() <= double(stats.nmax));
+
+    world.gop.fence();
+    print("Test23 OK");
+}
+
+// Deals keys out in the opposite order from writing to mimic a restart on a different layout
+class test24_pmap : public WorldDCPmapInterface<int> {
+    const int nproc;
+public:
+    test24_pmap(World& world) : nproc(world.size()) {}
+
+    ProcessID owner(const int& key) const {
+        return nproc - 1 - key%nproc;
+    }
+};
+
+void test24(World& world) {
+    PROFILE_FUNC;
+    ProcessID me = world.rank();
+    // Enough entries for several index blocks per process, one value
+    // larger than a chunk, and process 1 (if any) writing nothing to e
+    const int n = 10000;
+    const std::size_t nbig = archive::PositionedChunkWriter::CHUNK/sizeof(double) + 10;
+    WorldContainer<int,double> d(world);
+    WorldContainer<int,std::vector<double> > e(world);
+    for (int i=0; i<n; ++i) {
+        int key = me*n+i;
+        d.replace(key, double(key));
+        if (me != 1 && i < 100) e.replace(key, std::vector<double>(i ? i%7 : nbig, double(key)));
+    }
+    world.gop.fence();
+
+    archive::IndexedParallelOutputArchive fout(world, "fred.idx");
+    fout & 1.0 & d & "hello" & e & 2;
+    fout.close();
+
+    double v;
+    char s[6];
+    int t;
+    std::shared_ptr< WorldDCPmapInterface<int> > pmap(new test24_pmap(world));
+    WorldContainer<int,double> c(world, pmap);
+    WorldContainer<int,std::vector<double> > f(world, pmap);
+    archive::IndexedParallelInputArchive fin(world, "fred.idx");
+    fin & v & c & s & f & t;
+    fin.close();
+    fin.remove();
+    MADNESS_ASSERT(v == 1.0 && strcmp(s, "hello") == 0 && t == 2);
+
+    // Each process read back exactly the keys it owns under the new map
+    std::size_t nlocal = 0;
+    for (WorldContainer<int,double>::iterator it=c.begin(); it!=c.end(); ++it, ++nlocal) {
+        MADNESS_ASSERT(pmap->owner(it->first) == me);
+        MADNESS_ASSERT(it->second == it->first);
+    }
+    std::size_t ntotal = nlocal;
+    world.gop.sum(ntotal);
+    MADNESS_ASSERT(ntotal == std::size_t(n*world.size()));
+
+    nlocal = 0;
+    for (WorldContainer<int,std::vector<double> >::iterator it=f.begin(); it!=f.end(); ++it, ++nlocal) {
+        MADNESS_ASSERT(pmap->owner(it->first) == me);
+        const int i = it->first%n;
+        MADNESS_ASSERT(it->first/n != 1 && i < 100);
+        MADNESS_ASSERT(it->second.size() == (i ? std::size_t(i%7) : nbig));
+        for (std::size_t j=0; j<it->second.size(); ++j)
+            MADNESS_ASSERT(it->second[j] == it->first);
+    }
+    ntotal = nlocal;
+    world.gop.sum(ntotal);
+    MADNESS_ASSERT(ntotal == std::size_t(100*(world.size() > 1 ? world.size()-1 : 1)));
+
+    // Restart on a different no. of processes: all but the last write, all read
+    if (world.size() > 1) {
+        const bool writer = me < world.size()-1;
+        SafeMPI::Intracomm comm = world.mpi.comm().Split(writer ? 0 : 1, me);
+        {
+            World subworld(comm);
+            if (writer) {
+                WorldContainer<int,double> w(subworld);
+                for (int i=0; i<n; ++i) w.replace(subworld.rank()*n+i, double(subworld.rank()*n+i));
+                subworld.gop.fence();
+                archive::IndexedParallelOutputArchive wout(subworld, "fred2.idx");
+                wout & w;
+                wout.close();
+            }
+            subworld.gop.fence();
+        }
+        world.gop.fence();
+
+        WorldContainer<int,double> r(world, pmap);
+        const WorldAmStats before = world.am.get_stats();
+        archive::IndexedParallelInputArchive rin(world, "fred2.idx");
+        rin & r;
+        rin.close();
+        const WorldAmStats& after = world.am.get_stats();
+        // Each process read the values it owns, so none were forwarded
+        MADNESS_ASSERT(after.nraw == before.nraw && after.ncoalesced == before.ncoalesced);
+        rin.remove();
+
+        nlocal = 0;
+        for (WorldContainer<int,double>::iterator it=r.begin(); it!=r.end(); ++it, ++nlocal) {
+            MADNESS_ASSERT(pmap->owner(it->first) == me);
+            MADNESS_ASSERT(it->second == it->first);
+        }
+        ntotal = nlocal;
+        world.gop.sum(ntotal);
+        MADNESS_ASSERT(ntotal == std::size_t(n*(world.size()-1)));
+    }
+
+    // Exclusive prefix sum used for the offsets
+    long sums[2] = {me + 1, 1};
+    world.gop.exclusive_sum(sums, 2);
+    MADNESS_ASSERT(sums[0] == long(me)*(me+1)/2 && sums[1] == me);
+
+    world.gop.fence();
+    print("Test24 OK");
+}
+
+volatile long test25_count = 0;
+
+// Each task spawns two more until depth runs out, so tasks are pushed
+// from pool threads onto their own deques and can be stolen
+void test25_spawn(World* world, int depth) {
+    __sync_fetch_and_add(&test25_count, 1L);
+    if (depth > 0) {
+        world->taskq.add(test25_spawn, world, depth-1);
+        world->taskq.add(test25_spawn, world, depth-1);
+    }
+}
+
+void test25_inc(long n) {
+    __sync_fetch_and_add(&test25_count, n);
+}
+
+void test25(World& world) {
+    PROFILE_FUNC;
+    // The owner pops the newest value, a thief takes the oldest
+    WorkStealingDeque<long> dq(4);
+    for (long i=1; i<=9; ++i) dq.push_back(i);
+    long v = 0;
+    MADNESS_ASSERT(dq.pop_back(v) && v == 9);
+    MADNESS_ASSERT(dq.steal_front(v) && v == 1);
+    MADNESS_ASSERT(dq.size() == 7);
+    MADNESS_ASSERT(dq.get_stats().npop_back == 1 && dq.get_stats().nsteal == 1);
+    MADNESS_ASSERT(dq.get_stats().npop_front == 0 && dq.get_stats().nmax == 9);
+
+    if (!ThreadPool::is_work_stealing()) {
+        print("Test25 skipped the pool checks (set MAD_SCHEDULER=steal or numa)");
+        world.gop.fence();
+        return;
+    }
+
+    // Trees of local tasks plus tasks sent to the next process
+    const DQStats before = ThreadPool::get_stats();
+    const int depth = 12;
+    const long ntree = (2L << depth) - 1;
+    ProcessID right = (world.rank()+1)%world.size();
+    test25_count = 0;
+    world.gop.fence();
+    for (int i=0; i<4; ++i) world.taskq.add(test25_spawn, &world, depth);
+    for (int i=0; i<100; ++i) world.taskq.add(right, test25_inc, 1L);
+    world.gop.fence();
+    MADNESS_ASSERT(test25_count == 4*ntree + 100);
+
+    const DQStats& after = ThreadPool::get_stats();
+    MADNESS_ASSERT(after.npush_back >= before.npush_back + 4*ntree);
+    if (ThreadPool::size() > 0)
+        MADNESS_ASSERT(after.npop_back + after.nsteal > before.npop_back + before.nsteal);
+
+    long total = test25_count;
+    world.gop.sum(total);
+    MADNESS_ASSERT(total == world.size()*(4*ntree + 100));
+    print("Test25 OK");
+    world.gop.fence();
+}
+
+class Test26Counter {
+    long n;
+public:
+    Test26Counter() : n(0) {}
+
+    long add(long i) {
+        n += i;
+        return n;
+    }
+
+    long get() const {
+        return n;
+    }
+
+    template <typename Archive> void serialize(Archive& ar) {
+        ar & n;
+    }
+};
+
+void test26(World& world) {
+    PROFILE_FUNC;
+    if (!ThreadPool::is_numa()) {
+        print("Test26 skipped (set MAD_SCHEDULER=numa)");
+        world.gop.fence();
+        return;
+    }
+    MADNESS_ASSERT(ThreadPool::is_work_stealing());
+    MADNESS_ASSERT(ThreadPool::num_numa_nodes() >= 1);
+    MADNESS_ASSERT(ThreadPool::num_numa_nodes() <= std::max(1, int(ThreadPool::size())));
+
+    // Container tasks carry the hash bin of their key as a locality hint;
+    // every process updates every key so most tasks arrive by message
+    const int nkey = 1000;
+    WorldContainer<int,Test26Counter> c(world);
+    for (int key=world.rank(); key<nkey; key+=world.size())
+        c.replace(key, Test26Counter());
+    world.gop.fence();
+    for (int key=0; key<nkey; ++key)
+        c.task(key, &Test26Counter::add, 1L);
+
+    // Plain tasks with explicit hints, more than there are nodes
+    test25_count = 0;
+    for (int i=0; i<200; ++i) {
+        TaskAttributes attr;
+        attr.set_locality(i);
+        world.taskq.add(test25_inc, 1L, attr);
+    }
+    world.gop.fence();
+    MADNESS_ASSERT(test25_count == 200);
+
+    long nlocal = 0;
+    for (WorldContainer<int,Test26Counter>::iterator it=c.begin(); it!=c.end(); ++it, ++nlocal)
+        MADNESS_ASSERT(it->second.get() == world.size());
+    world.gop.sum(nlocal);
+    MADNESS_ASSERT(nlocal == nkey);
+
+    print("Test26 OK on", ThreadPool::num_numa_nodes(), "NUMA nodes");
+    world.gop.fence();
+}
+
+// Frees on a pool thread an object allocated by the main thread
+void test27_free(long* p, long size) {
+    for (long i=0; i<long(size/sizeof(long)); ++i) MADNESS_ASSERT(p[i] == size);
+    SmallObjectPool::deallocate(p, size);
+}
+
+long test27_square(long i) {
+    return i*i;
+}
+
+void test27(World& world) {
+    PROFILE_FUNC;
+    if (!SmallObjectPool::is_enabled()) {
+        print("Test27 skipped (MAD_POOL_ALLOC=0)");
+        world.gop.fence();
+        return;
+    }
+
+    // Objects freed by other threads spill to the depot and come back
+    // to this thread; none may overlap another live object
+    const int n = 4*SmallObjectPool::MAGAZINE;
+    const long sizes[] = {8, 40, 136, long(SmallObjectPool::MAX_SIZE)};
+    for (int rep=0; rep<3; ++rep) {
+        for (long size : sizes) {
+            std::vector<long*> p(n);
+            for (int i=0; i<n; ++i) {
+                p[i] = static_cast<long*>(SmallObjectPool::allocate(size));
+                for (long j=0; j<long(size/sizeof(long)); ++j) p[i][j] = size;
+            }
+            for (int i=0; i<n; ++i) world.taskq.add(test27_free, p[i], size);
+        }
+        world.taskq.fence();
+    }
+    const SmallObjectPoolStats stats = SmallObjectPool::get_stats();
+    MADNESS_ASSERT(stats.nslab > 0 && stats.nbytes_slab > 0);
+
+    // Pooled tasks, futures and remote counters across processes
+    ProcessID right = (world.rank()+1)%world.size();
+    std::vector< Future<long> > r(1000);
+    for (long i=0; i<long(r.size()); ++i) r[i] = world.taskq.add(right, test27_square, i);
+    for (long i=0; i<long(r.size()); ++i) MADNESS_ASSERT(r[i].get() == i*i);
+    world.gop.fence();
+
+    MADNESS_ASSERT(SmallObjectPool::get_stats().nalloc >= stats.nalloc);
+    print("Test27 OK");
+    world.gop.fence();
+}
+
+double test28_sum(const std::vector<double>& v) {
+    double sum = 0.0;
+    for (std::size_t i=0; i<v.size(); ++i) sum += v[i];
+    return sum;
+}
+
+void test28(World& world) {
+    PROFILE_FUNC;
+    // Size classes double from MIN_SIZE; larger buffers bypass the slabs
+    MADNESS_ASSERT(AmArgPool::size_class(1) == 0);
+    MADNESS_ASSERT(AmArgPool::size_class(AmArgPool::MIN_SIZE) == 0);
+    MADNESS_ASSERT(AmArgPool::size_class(AmArgPool::MIN_SIZE+1) == 1);
+    MADNESS_ASSERT(AmArgPool::size_class(AmArgPool::MAX_SIZE) == AmArgPool::NCLASS-1);
+    MADNESS_ASSERT(AmArgPool::size_class(AmArgPool::MAX_SIZE+1) == AmArgPool::NCLASS);
+
+    // Live buffers of every class (and a large one) never overlap
+    std::vector<unsigned char*> p;
+    std::vector<std::size_t> sz;
+    for (std::size_t size=AmArgPool::MIN_SIZE/2; size<=2*AmArgPool::MAX_SIZE; size*=2) {
+        for (int i=0; i<20; ++i) {
+            p.push_back(static_cast<unsigned char*>(AmArgPool::allocate(size)));
+            sz.push_back(size);
+            memset(p.back(), int(p.size() & 0xff), size);
+        }
+    }
+    for (std::size_t i=0; i<p.size(); ++i) {
+        for (std::size_t j=0; j<sz[i]; j+=61) MADNESS_ASSERT(p[i][j] == ((i+1) & 0xff));
+        AmArgPool::deallocate(p[i], sz[i]);
+    }
+
+    if (world.size() == 1) {
+        print("Test28 skipped the message checks (needs 2 or more processes)");
+        world.gop.fence();
+        return;
+    }
+
+    // Messages of every size class, and larger, to the next process
+    const AmArgPoolStats before = AmArgPool::get_stats();
+    ProcessID right = (world.rank()+1)%world.size();
+    std::vector< Future<double> > r;
+    std::vector<double> expect;
+    for (std::size_t n=1; n*sizeof(double)<=4*AmArgPool::MAX_SIZE; n*=2) {
+        for (int rep=0; rep<10; ++rep) {
+            std::vector<double> v(n, double(rep+1));
+            r.push_back(world.taskq.add(right, test28_sum, v));
+            expect.push_back(double(n*(rep+1)));
+        }
+    }
+    for (std::size_t i=0; i<r.size(); ++i) MADNESS_ASSERT(r[i].get() == expect[i]);
+    world.gop.fence();
+
+    const AmArgPoolStats after = AmArgPool::get_stats();
+    MADNESS_ASSERT(after.nlarge > before.nlarge);
+    MADNESS_ASSERT(after.nslab >= before.nslab && after.nbytes_slab > 0);
+    print("Test28 OK");
+    world.gop.fence();
+}
+
+void test29(World& world) {
+    PROFILE_FUNC;
+    if (!world.am.is_coalescing() || world.size() == 1) {
+        print("Test29 skipped (set MAD_AM_COALESCE and use 2 or more processes)");
+        world.gop.fence();
+        return;
+    }
+
+    // A burst of small remote tasks, one large argument and a few
+    // stragglers that only leave when the fence flushes their bundle
+    ProcessID right = (world.rank()+1)%world.size();
+    const WorldAmStats before = world.am.get_stats();
+    test25_count = 0;
+    world.gop.fence();
+    std::vector< Future<long> > r(2000);
+    for (long i=0; i<long(r.size()); ++i) r[i] = world.taskq.add(right, test27_square, i);
+    Future<double> big = world.taskq.add(right, test28_sum, std::vector<double>(100000, 1.0));
+    for (long i=0; i<long(r.size()); ++i) MADNESS_ASSERT(r[i].get() == i*i);
+    MADNESS_ASSERT(big.get() == 100000.0);
+    for (int i=0; i<3; ++i) world.taskq.add(right, test25_inc, 1L);
+    world.gop.fence();
+    MADNESS_ASSERT(test25_count == 3);
+
+    const WorldAmStats& after = world.am.get_stats();
+    MADNESS_ASSERT(after.ncoalesced > before.ncoalesced);
+    MADNESS_ASSERT(after.nbundle > before.nbundle);
+    MADNESS_ASSERT(after.nbundle - before.nbundle < after.ncoalesced - before.ncoalesced);
+    MADNESS_ASSERT(after.nraw > before.nraw);
+    print("Test29 OK");
+    world.gop.fence();
+}
+
+/// Array that offers its data for rendezvous, as Tensor does
+struct Test30Array {
+    std::shared_ptr<double> p;
+    long n;
+
+    Test30Array() : n(0) {}
+
+    Test30Array(long n, double value) : p(new double[n], std::default_delete<double[]>()), n(n) {
+        for (long i=0; i<n; ++i) p.get()[i] = value + i;
+    }
+
+    double sum() const {
+        double s = 0.0;
+        for (long i=0; i<n; ++i) s += p.get()[i];
+        return s;
+    }
+};
+
+namespace madness {
+    namespace archive {
+        template <class Archive>
+        struct ArchiveStoreImpl<Archive, Test30Array> {
+            static void store(const Archive& s, const Test30Array& a) {
+                s & a.n;
+                if (!store_rendezvous(s, a.p.get(), a.n*sizeof(double), a.p))
+                    s & wrap(a.p.get(), a.n);
+            }
+        };
+
+        template <class Archive>
+        struct ArchiveLoadImpl<Archive, Test30Array> {
+            static void load(const Archive& s, Test30Array& a) {
+                long n;
+                s & n;
+                std::shared_ptr<void> data;
+                if (load_rendezvous(s, n*sizeof(double), data)) {
+                    a.p = std::static_pointer_cast<double>(data);
+                    a.n = n;
+                }
+                else {
+                    a = Test30Array(n, 0.0);
+                    s & wrap(a.p.get(), n);
+                }
+            }
+        };
+    }
+}
+
+double test30_sum(const Test30Array& a, const Test30Array& b) {
+    return a.sum() + b.sum();
+}
+
+void test30_ignore(const AmArg&) {}
+
+std::vector<long> test30_order;
+
+void test30_record(const AmArg& arg) {
+    long i;
+    Test30Array a;
+    arg & i & a;
+    MADNESS_ASSERT(a.sum() == Test30Array(a.n, double(i)).sum());
+    test30_order.push_back(i);
+}
+
+void test30(World& world) {
+    PROFILE_FUNC;
+    if (!AmRendezvous::instance().is_enabled() || world.size() == 1) {
+        print("Test30 skipped (set MAD_RENDEZVOUS_BYTES and use 2 or more processes)");
+        world.gop.fence();
+        return;
+    }
+
+    // Pairs of arrays above and below the threshold to the next process
+    ProcessID right = (world.rank()+1)%world.size();
+    const uint64_t before = RMI::get_stats().nrendezvous_sent;
+    std::vector< Future<double> > r;
+    std::vector<double> expect;
+    for (long n=1; n<=(1l<<16); n*=4) {
+        Test30Array a(n, 1.0), b(2*n, -1.0);
+        r.push_back(world.taskq.add(right, test30_sum, a, b));
+        expect.push_back(a.sum() + b.sum());
+    }
+    for (std::size_t i=0; i<r.size(); ++i) MADNESS_ASSERT(r[i].get() == expect[i]);
+    world.gop.fence();
+    MADNESS_ASSERT(RMI::get_stats().nrendezvous_sent > before);
+
+    // A message that is never deserialized must not hold up its sender
+    std::weak_ptr<double> sent;
+    {
+        Test30Array a(1l<<16, 2.0);
+        sent = a.p;
+        world.am.send(right, test30_ignore, new_am_arg(a));
+    }
+    for (int i=0; i<1000 && !sent.expired(); ++i) world.gop.fence();
+    MADNESS_ASSERT(sent.expired());
+
+    // ... nor keep the memory it was received into (charged to the RMI
+    // thread's tag) once its handler has returned
+    const long nbyte = mem_tag_stats(MEM_TENSOR).nbyte;
+    for (int i=0; i<8; ++i)
+        world.am.send(right, test30_ignore, new_am_arg(Test30Array(1l<<16, 2.0)));
+    world.gop.fence();
+    MADNESS_ASSERT(mem_tag_stats(MEM_TENSOR).nbyte - nbyte < 4*detail::MEM_TAG_FLUSH);
+
+    // Messages that wait for their arrays still run in the order they were sent
+    test30_order.clear();
+    world.gop.fence();
+    for (long i=0; i<100; ++i)
+        world.am.send(right, test30_record, new_am_arg(i, Test30Array(i%2 ? 1 : 4096, double(i))));
+    world.gop.fence();
+    MADNESS_ASSERT(test30_order.size() == 100);
+    for (long i=0; i<100; ++i) MADNESS_ASSERT(test30_order[i] == i);
+    print("Test30 OK");
+    world.gop.fence();
+}
+
+#ifdef MADNESS_HAS_COROUTINES
+CoroTask<long> coro_sum(World& world, Future<long> a, Future<long> b) {
+    const long x = co_await a;
+    const long y = co_await b;
+    co_return x + y;
+}
+
+// Sum of 1..n over a binary tree of coroutines
+CoroTask<long> coro_tree(World& world, long lo, long hi) {
+    if (lo == hi) co_return lo;
+    const long mid = (lo + hi)/2;
+    Future<long> left = coro_tree(world, lo, mid);
+    Future<long> right = coro_tree(world, mid+1, hi);
+    const long l = co_await left;
+    co_return l + co_await right;
+}
+
+CoroTask<long> coro_throw(World& world, Future<long> a) {
+    const long x = co_await a;
+    if (x < 0) throw std::runtime_error("coro_throw");
+    co_return x;
+}
+
+// Awaits a coroutine that throws, and rethrows or recovers
+CoroTask<long> coro_nested(World& world, Future<long> a, bool recover) {
+    CoroTask<long> inner = coro_throw(world, a);
+    try {
+        co_return 1 + co_await inner;
+    }
+    catch (const std::runtime_error&) {
+        if (!recover) throw;
+    }
+    co_return 0;
+}
+
+void test17(World& world) {
+    PROFILE_FUNC;
+    // Suspends on futures assigned after the coroutine is started
+    Future<long> a, b;
+    Future<long> c = coro_sum(world, a, b);
+    b.set(2);
+    a.set(40);
+    MADNESS_ASSERT(c.get() == 42);
+
+    // The fence waits for suspended coroutines
+    Future<long> t = coro_tree(world, 1, 10000);
+    world.taskq.fence();
+    MADNESS_ASSERT(t.probe() && t.get() == 10000l*10001l/2);
+
+    // A coroutine that throws no longer counts as pending, so the fence
+    // completes, and the exception comes back from get()
+    Future<long> d;
+    CoroTask<long> e = coro_throw(world, d);
+    d.set(-1);
+    world.taskq.fence();
+    MADNESS_ASSERT(e.failed() && !e.future().probe());
+    bool caught = false;
+    try {
+        e.get();
+    }
+    catch (const std::runtime_error&) {
+        caught = true;
+    }
+    MADNESS_ASSERT(caught);
+
+    // A coroutine awaiting one that throws is resumed and gets the
+    // exception, which it may pass on to its own caller
+    Future<long> f;
+    CoroTask<long> g = coro_nested(world, f, false);
+    CoroTask<long> h = coro_nested(world, f, true);
+    CoroTask<long> k = coro_nested(world, Future<long>(41), true);
+    f.set(-1);
+    world.taskq.fence();
+    caught = false;
+    try {
+        g.get();
+    }
+    catch (const std::runtime_error&) {
+        caught = true;
+    }
+    MADNESS_ASSERT(caught && g.failed());
+    MADNESS_ASSERT(!h.failed() && h.get() == 0);
+    MADNESS_ASSERT(!k.failed() && k.get() == 42);
+
+    print("Test17 OK");
+    world.gop.fence();
+}
+#endif
+
 inline bool is_odd(int i) {
     return i & 0x1;
 }
@@ -1146,6 +2210,15 @@ void mad_signal_handler( int signum ) {
 
 int main(int argc, char** argv) {
 
+#ifdef MADNESS_TEST_WORLD_MODES
+    // Same tests with the optional runtime modes turned on (unless the
+    // environment already chooses otherwise)
+    setenv("MAD_SCHEDULER", "numa", 0);
+    setenv("MAD_POOL_ALLOC", "1", 0);
+    setenv("MAD_AM_COALESCE", "256", 0);
+    setenv("MAD_RENDEZVOUS_BYTES", "4096", 0);
+#endif
+
 #if  MADNESS_CATCH_SIGNALS
     signal(SIGSEGV, mad_signal_handler);
 #endif
@@ -1183,6 +2256,25 @@ int main(int argc, char** argv) {
         //test11(world);
         test12(world);
         test13(world);
+        test14(world);
+        test15(world);
+        test16(world);
+#ifdef MADNESS_HAS_COROUTINES
+        test17(world);
+#endif
+        test18(world);
+        test19(world);
+        test20(world);
+        test21(world);
+        test22(world);
+        test23(world);
+        test24(world);
+        test25(world);
+        test26(world);
+        test27(world);
+        test28(world);
+        test29(world);
+        test30(world);
 
         for (int i=0; i<10; ++i) {
           print("REPETITION",i);
@@ -49,9 +49,52 @@ void fred(int i) {
     dave(i);
 }
 
+void profiled_calls(int id, int ncall) {
+    for (int i=0; i<ncall; ++i) {
+        WorldProfileObj obj(id);
+    }
+}
+
+/// Merges and clears the statistics while tasks on other threads are profiling
+void test_threads(World& world) {
+    const int id = WorldProfile::register_id("test_threads");
+    const int ntask = 64, ncall = 1000;
+    const unsigned long sample = WorldProfile::get_sample();
+    WorldProfile::set_sample(1);
+
+    for (int t=0; t<ntask; ++t) world.taskq.add(profiled_calls, id, ncall);
+    for (int i=0; i<100; ++i) {
+        WorldProfile::merge();
+        if (i%10 == 0) WorldProfile::clear();
+    }
+    world.taskq.fence();
+
+    WorldProfile::clear();
+    WorldProfile::merge();
+    MADNESS_ASSERT(WorldProfile::get_entry(id).count.value == 0);
+
+    for (int t=0; t<ntask; ++t) world.taskq.add(profiled_calls, id, ncall);
+    unsigned long last = 0;
+    for (int i=0; i<100; ++i) {
+        WorldProfile::merge();
+        const unsigned long count = WorldProfile::get_entry(id).count.value;
+        MADNESS_ASSERT(count >= last && count <= (unsigned long)(ntask*ncall));
+        last = count;
+    }
+    world.taskq.fence();
+
+    WorldProfile::merge();
+    MADNESS_ASSERT(WorldProfile::get_entry(id).count.value == (unsigned long)(ntask*ncall));
+    WorldProfile::clear();
+    WorldProfile::set_sample(sample);
+    if (world.rank() == 0) print("test_threads OK");
+}
+
 void realmain(int argc, char** argv)
 {
     World world(SafeMPI::COMM_WORLD);
+    test_threads(world);
+
     for (int i=0; i<1000; ++i)
         fred(i);
 
@@ -41,6 +41,7 @@
 #include <madness/world/worldam.h>
 #include <madness/world/world_task_queue.h>
 #include <madness/world/worldgop.h>
+#include <madness/world/worldtimeline.h>
 #include <cstdlib>
 #include <sstream>
 
@@ -177,6 +178,7 @@ namespace madness {
 	ThreadBase::set_hpm_thread_env(hpm_thread_id);
 #endif
         detail::WorldMpi::initialize(argc, argv, MADNESS_MPI_THREAD_LEVEL);
+        Timeline::begin(SafeMPI::COMM_WORLD.Get_rank());
         start_cpu_time = cpu_time();
         start_wall_time = wall_time();
         ThreadPool::begin();        // Must have thread pool before any AM arrives
@@ -197,7 +199,9 @@ namespace madness {
         madness_initialized_ = true;
         if(SafeMPI::COMM_WORLD.Get_rank() == 0)
             std::cout << "MADNESS runtime initialized with " << ThreadPool::size()
-                << " threads in the pool and affinity " << sbind << "\n";
+                << " threads in the pool and affinity " << sbind
+                << (ThreadPool::is_numa() ? " (NUMA work stealing)" :
+                    ThreadPool::is_work_stealing() ? " (work stealing)" : "") << "\n";
 
         return * World::default_world;
     }
@@ -216,6 +220,7 @@ namespace madness {
         if(SafeMPI::COMM_WORLD.Get_size() > 1)
             RMI::end();
         ThreadPool::end();
+        Timeline::end();
         detail::WorldMpi::finalize();
         madness_initialized_ = false;
     }
@@ -261,11 +266,65 @@ namespace madness {
         world.gop.min(min_nbyte_sent);
         world.gop.min(min_nbyte_recv);
 
+        double nrendezvous = rmi.nrendezvous_sent;
+        double nbyte_rendezvous = rmi.nbyte_rendezvous_sent;
+        double max_nrendezvous = nrendezvous, min_nrendezvous = nrendezvous;
+        double max_nbyte_rendezvous = nbyte_rendezvous, min_nbyte_rendezvous = nbyte_rendezvous;
+        world.gop.sum(nrendezvous);
+        world.gop.sum(nbyte_rendezvous);
+        world.gop.max(max_nrendezvous);
+        world.gop.max(max_nbyte_rendezvous);
+        world.gop.min(min_nrendezvous);
+        world.gop.min(min_nbyte_rendezvous);
+
+        const WorldAmStats& amstats = world.am.get_stats();
+        double nam_raw = amstats.nraw;
+        double nam_coalesced = amstats.ncoalesced;
+        double nam_bundle = amstats.nbundle;
+        double max_nam_raw = nam_raw, min_nam_raw = nam_raw;
+        double max_nam_coalesced = nam_coalesced, min_nam_coalesced = nam_coalesced;
+        double max_nam_bundle = nam_bundle, min_nam_bundle = nam_bundle;
+        world.gop.sum(nam_raw);
+        world.gop.sum(nam_coalesced);
+        world.gop.sum(nam_bundle);
+        world.gop.max(max_nam_raw);
+        world.gop.max(max_nam_coalesced);
+        world.gop.max(max_nam_bundle);
+        world.gop.min(min_nam_raw);
+        world.gop.min(min_nam_coalesced);
+        world.gop.min(min_nam_bundle);
+
+        AmArgPoolStats ampool = AmArgPool::get_stats();
+        double nam_malloc = ampool.nslab + ampool.nlarge;
+        double max_nam_malloc = nam_malloc, min_nam_malloc = nam_malloc;
+        world.gop.sum(nam_malloc);
+        world.gop.max(max_nam_malloc);
+        world.gop.min(min_nam_malloc);
+
         double npush_back = q.npush_back;
         double npush_front = q.npush_front;
         double npop_front = q.npop_front;
         double ntask = q.npush_back + q.npush_front;
         double nmax = q.nmax;
+        double nsteal = q.nsteal;
+        double npop_back = q.npop_back;
+        double mean_q = q.mean_size();
+        double nthrottle = q.nthrottle;
+        double ninline = q.ninline;
+        double max_mean_q = mean_q, min_mean_q = mean_q;
+        double max_nthrottle = nthrottle, min_nthrottle = nthrottle;
+        double max_ninline = ninline, min_ninline = ninline;
+        world.gop.sum(mean_q);
+        world.gop.sum(nthrottle);
+        world.gop.sum(ninline);
+        world.gop.max(max_mean_q);
+        world.gop.max(max_nthrottle);
+        world.gop.max(max_ninline);
+        world.gop.min(min_mean_q);
+        world.gop.min(min_nthrottle);
+        world.gop.min(min_ninline);
+        world.gop.sum(nsteal);
+        world.gop.sum(npop_back);
         world.gop.sum(npush_back);
         world.gop.sum(npush_front);
         world.gop.sum(npop_front);
@@ -277,6 +336,10 @@ namespace madness {
         double max_npop_front = q.npop_front;
         double max_ntask = q.npush_back + q.npush_front;
         double max_nmax = q.nmax;
+        double max_nsteal = q.nsteal;
+        double max_npop_back = q.npop_back;
+        world.gop.max(max_nsteal);
+        world.gop.max(max_npop_back);
         world.gop.max(max_npush_back);
         world.gop.max(max_npush_front);
         world.gop.max(max_npop_front);
@@ -288,12 +351,52 @@ namespace madness {
         double min_npop_front = q.npop_front;
         double min_ntask = q.npush_back + q.npush_front;
         double min_nmax = q.nmax;
+        double min_nsteal = q.nsteal;
+        double min_npop_back = q.npop_back;
+        world.gop.min(min_nsteal);
+        world.gop.min(min_npop_back);
         world.gop.min(min_npush_back);
         world.gop.min(min_npush_front);
         world.gop.min(min_npop_front);
         world.gop.min(min_ntask);
         world.gop.min(min_nmax);
 
+        SmallObjectPoolStats pool = SmallObjectPool::get_stats();
+        double npool_alloc = pool.nalloc;
+        double npool_malloc = pool.nslab + pool.nlarge;
+        double max_npool_alloc = npool_alloc, min_npool_alloc = npool_alloc;
+        double max_npool_malloc = npool_malloc, min_npool_malloc = npool_malloc;
+        world.gop.sum(npool_alloc);
+        world.gop.sum(npool_malloc);
+        world.gop.max(max_npool_alloc);
+        world.gop.max(max_npool_malloc);
+        world.gop.min(min_npool_alloc);
+        world.gop.min(min_npool_malloc);
+
+        // Idle threads: spin seconds, park seconds, #parks, #wake-ups,
+        // mean and max wake latency (us)
+        const ParkStats& park = ThreadPool::get_park_stats();
+        const int NIDLE = 6;
+        double idle[NIDLE], max_idle[NIDLE], min_idle[NIDLE];
+        idle[0] = park.spin_ns*1e-9;
+        idle[1] = park.park_ns*1e-9;
+        idle[2] = park.npark;
+        idle[3] = park.nwake;
+        idle[4] = park.nwoken ? park.wake_ns*1e-3/park.nwoken : 0.0;
+        idle[5] = park.max_wake_ns*1e-3;
+        for (int i=0; i<NIDLE; ++i) max_idle[i] = min_idle[i] = idle[i];
+        world.gop.sum(idle, NIDLE);
+        world.gop.max(max_idle, NIDLE);
+        world.gop.min(min_idle, NIDLE);
+
+        double mem_peak[NMEM_TAG], max_mem_peak[NMEM_TAG], min_mem_peak[NMEM_TAG];
+        for (int tag=0; tag<NMEM_TAG; ++tag) {
+            mem_peak[tag] = max_mem_peak[tag] = min_mem_peak[tag] = mem_tag_stats(MemTag(tag)).peak;
+        }
+        world.gop.sum(mem_peak, NMEM_TAG);
+        world.gop.max(max_mem_peak, NMEM_TAG);
+        world.gop.min(min_mem_peak, NMEM_TAG);
+
 #ifdef HAVE_PAPI
         double val[NUMEVENTS], max_val[NUMEVENTS], min_val[NUMEVENTS];
         for (int i=0; i<NUMEVENTS; ++i) {
@@ -329,6 +432,22 @@ namespace madness {
                    min_nmsg_recv, nmsg_recv/world.size(), max_nmsg_recv);
             printf("    #bytes recv per node    %.2e / %.2e / %.2e\n",
                    min_nbyte_recv, nbyte_recv/world.size(), max_nbyte_recv);
+            printf("   #buf mallocs per node    %.2e / %.2e / %.2e\n",
+                   min_nam_malloc, nam_malloc/world.size(), max_nam_malloc);
+            if (AmRendezvous::instance().is_enabled()) {
+                printf("    #rendezvous per node    %.2e / %.2e / %.2e\n",
+                       min_nrendezvous, nrendezvous/world.size(), max_nrendezvous);
+                printf(" #rv bytes sent per node    %.2e / %.2e / %.2e\n",
+                       min_nbyte_rendezvous, nbyte_rendezvous/world.size(), max_nbyte_rendezvous);
+            }
+            if (world.am.is_coalescing()) {
+                printf("        #raw AM per node    %.2e / %.2e / %.2e\n",
+                       min_nam_raw, nam_raw/world.size(), max_nam_raw);
+                printf("  #coalesced AM per node    %.2e / %.2e / %.2e\n",
+                       min_nam_coalesced, nam_coalesced/world.size(), max_nam_coalesced);
+                printf("       #bundles per node    %.2e / %.2e / %.2e\n",
+                       min_nam_bundle, nam_bundle/world.size(), max_nam_bundle);
+            }
             printf("        #msgs systemwide    %.2e\n", nmsg_sent);
             printf("       #bytes systemwide    %.2e\n", nbyte_sent);
             printf("\n");
@@ -338,9 +457,59 @@ namespace madness {
                    min_ntask, ntask/world.size(), max_ntask);
             printf("     #max q len per node    %.2e / %.2e / %.2e\n",
                    min_nmax, nmax/world.size(), max_nmax);
+            printf("    #mean q len per node    %.2e / %.2e / %.2e\n",
+                   min_mean_q, mean_q/world.size(), max_mean_q);
+            if (nthrottle > 0) {
+                printf("     #throttles per node    %.2e / %.2e / %.2e\n",
+                       min_nthrottle, nthrottle/world.size(), max_nthrottle);
+                printf(" #inline tasks per node    %.2e / %.2e / %.2e\n",
+                       min_ninline, ninline/world.size(), max_ninline);
+            }
             printf("  #hi-pri tasks per node    %.2e / %.2e / %.2e\n",
                    min_npush_front, npush_front/world.size(), max_npush_front);
+            if (ThreadPool::is_work_stealing()) {
+                printf("    #owner pops per node    %.2e / %.2e / %.2e\n",
+                       min_npop_back, npop_back/world.size(), max_npop_back);
+                printf("  #stolen tasks per node    %.2e / %.2e / %.2e\n",
+                       min_nsteal, nsteal/world.size(), max_nsteal);
+            }
+            printf("\n");
+            printf("  Idle thread statistics (min / avg / max)\n");
+            printf("  ----------------------\n");
+            const char* idle_name[NIDLE] = {"spin secs", "parked secs", "#parks",
+                                            "#wake-ups", "mean wake us", "max wake us"};
+            for (int i=0; i<NIDLE; ++i) {
+                printf("  %13s per node    %.2e / %.2e / %.2e\n", idle_name[i],
+                       min_idle[i], idle[i]/world.size(), max_idle[i]);
+            }
+            printf("\n");
+            printf("  Task/future pool statistics (min / avg / max)\n");
+            printf("  ---------------------------\n");
+            printf(" #pooled allocs per node    %.2e / %.2e / %.2e\n",
+                   min_npool_alloc, npool_alloc/world.size(), max_npool_alloc);
+            printf("  #malloc calls per node    %.2e / %.2e / %.2e\n",
+                   min_npool_malloc, npool_malloc/world.size(), max_npool_malloc);
+            printf("\n");
+            printf("  Peak memory by subsystem (min / avg / max)\n");
+            printf("  ------------------------\n");
+            for (int tag=0; tag<NMEM_TAG; ++tag) {
+                printf("  %8s bytes per node    %.2e / %.2e / %.2e\n", mem_tag_name(MemTag(tag)),
+                       min_mem_peak[tag], mem_peak[tag]/world.size(), max_mem_peak[tag]);
+            }
             printf("\n");
+
+            // Sites are per process, so these are the times seen by node 0
+            std::vector<FenceSiteStats> fences = WorldGopInterface::fence_stats();
+            if (!fences.empty()) {
+                printf("  Fence statistics on node 0 (#fence / wait / max wait / overlapped)\n");
+                printf("  ----------------\n");
+                for (std::size_t i=0; i<fences.size() && i<10; ++i) {
+                    const FenceSiteStats& f = fences[i];
+                    printf("  %22s    %8lu / %.2e / %.2e / %.2e\n", f.site.c_str(), f.nfence,
+                           f.wait, f.max_wait, f.elapsed - f.wait);
+                }
+                printf("\n");
+            }
 #ifdef HAVE_PAPI
             printf("         PAPI statistics (min / avg / max)\n");
             printf("         ---------------\n");
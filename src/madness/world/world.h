@@ -141,6 +141,9 @@ namespace madness {
     /// \param[in] world The World to analyze.
     void print_stats(World& world);
 
+    /// Sends the active messages being coalesced by all worlds (see WorldAmInterface)
+    void flush_coalesced_am();
+
     /// \todo Brief description needed.
 
     /// \todo Detailed description needed.
@@ -491,7 +494,7 @@ namespace madness {
         /// \param[in,out] request The MPI request on which to wait.
         /// \param dowork Description needed. I'm guessing this has to do with blocking/nonblocking options.
         static void inline await(SafeMPI::Request& request, bool dowork = true) {
-            ThreadPool::await(MpiRequestTester(request), dowork);
+            await(MpiRequestTester(request), dowork);
         }
 
         /// Gracefully wait for a condition to become true.
@@ -503,6 +506,8 @@ namespace madness {
         /// \param dowork Description needed. I'm guessing this has to do with blocking/nonblocking options.
         template <typename Probe>
         static void inline await(const Probe& probe, bool dowork = true) {
+            // Whatever we are waiting for may depend on a coalesced message
+            if (!probe()) flush_coalesced_am();
             ThreadPool::await(probe, dowork);
         }
 
@@ -70,10 +70,34 @@ namespace madness {
 
             void invokehandler() {
                 handler(*arg);
+                WorldAmInterface::release_rendezvous(arg);
                 free_am_arg(arg);
             }
         };
 
+        /// Link in the lock-free queue of pending messages of a \c WorldObject
+        struct PendingMsgNode : public SmallObject {
+            PendingMsg msg;
+            PendingMsgNode* next;
+
+            PendingMsgNode(uniqueidT id, am_handlerT handler, const AmArg& arg)
+                    : msg(id, handler, arg), next(0) {}
+        };
+
+        /// Messages for objects that were not yet registered when they arrived
+
+        /// Objects are spread over \c NBIN bins by id, so the lock is
+        /// only contended by objects created at the same time that also
+        /// hash to the same bin.
+        struct PendingBin {
+            static const int NBIN = 64;
+            Spinlock mutex;
+            std::list<PendingMsg> msgs;
+        };
+
+        /// Returns the bin holding the early messages for object \c id
+        PendingBin& pending_bin(const uniqueidT& id);
+
         /// \todo Brief description needed.
 
         /// We cannot use the normal task forwarding stuff here because pending
@@ -360,6 +384,9 @@ namespace madness {
         /// \todo Description needed.
         typedef std::list<detail::PendingMsg> pendingT;
 
+        /// Link in the queue of pending messages
+        typedef detail::PendingMsgNode nodeT;
+
         /// \todo Description needed.
         typedef detail::voidT voidT;
 
@@ -368,11 +395,38 @@ namespace madness {
         // The order here matters in a multi-threaded world
         volatile bool ready; ///< True if ready to rock 'n roll.
         ProcessID me; ///< Rank of self.
+        nodeT* volatile pending; ///< Messages queued while not ready, or \c sealed() once ready
         uniqueidT objid; ///< Sense of self.
 
 
-        static Spinlock pending_mutex; ///< \todo Description needed.
-        static volatile pendingT pending; ///< Buffer for pending messages.
+        /// Marks the queue of pending messages as closed once the object is ready
+        static nodeT* sealed() {
+            return reinterpret_cast<nodeT*>(uintptr_t(1));
+        }
+
+
+        /// Queue a message unless the object has just become ready
+
+        /// The message is pushed with compare-and-swap, as callbacks are
+        /// onto a \c FutureImpl.
+        /// \return True if the object is ready, in which case nothing was queued.
+        bool queue_pending(const uniqueidT& id, am_handlerT ptr, const AmArg& arg) {
+            if (pending == sealed()) return true;
+            const_cast<AmArg&>(arg).set_pending();
+            nodeT* node = new nodeT(id, ptr, arg);
+            nodeT* head = pending;
+            while (head != sealed()) {
+                node->next = head;
+                nodeT* prev = __sync_val_compare_and_swap(&pending, head, node);
+                if (prev == head) return false;
+                head = prev;
+            }
+            // The handler runs now, on arg rather than on the copy
+            const_cast<AmArg&>(arg).clear_pending();
+            free_am_arg(node->msg.arg);
+            delete node;
+            return true;
+        }
 
 
         /// \todo Complete: Determine if [unknown] is ready (for ...).
@@ -381,12 +435,15 @@ namespace madness {
         /// processing pending messages. If a new message arrives
         /// while processing incoming messages it must be queued.
         ///
-        /// - If the object does not exist ---> not ready.
+        /// - If the object does not exist ---> not ready; the message is
+        ///   put in its \c detail::PendingBin.
         /// - If the object exists and is ready ---> ready.
         /// - If the object exists and is not ready then
         ///      - if we are doing a queued/pending message --> ready.
-        ///      - else this is a new message --> not ready.
+        ///      - else this is a new message --> not ready; it is pushed
+        ///        onto the lock-free queue of the object.
         ///
+        /// A ready object, the common case, is found without taking any lock.
         /// \param[in] id Description needed.
         /// \param[in,out] obj Description needed.
         /// \param[in] arg Description needed.
@@ -399,18 +456,19 @@ namespace madness {
             if (obj) {
                 if (obj->ready || arg.is_pending()) return true;
             }
-
-            ScopedMutex<Spinlock> lock(pending_mutex); // BEGIN CRITICAL SECTION
-            if (!obj) obj = static_cast<objT*>(arg.get_world()->template ptr_from_id<Derived>(id));
-
-            if (obj) {
-                if (obj->ready || arg.is_pending())
-                    return true; // END CRITICAL SECTION
+            else {
+                // The bin lock orders this with the sweep in process_pending()
+                detail::PendingBin& bin = detail::pending_bin(id);
+                ScopedMutex<Spinlock> lock(bin.mutex); // BEGIN CRITICAL SECTION
+                obj = static_cast<objT*>(arg.get_world()->template ptr_from_id<Derived>(id));
+                if (!obj) {
+                    const_cast<AmArg&>(arg).set_pending();
+                    bin.msgs.push_back(detail::PendingMsg(id, ptr, arg));
+                    return false; // END CRITICAL SECTION
+                }
             }
-            const_cast<AmArg&>(arg).set_pending();
-            const_cast<pendingT&>(pending).push_back(detail::PendingMsg(id, ptr, arg));
 
-            return false; // END CRITICAL SECTION
+            return obj->queue_pending(id, ptr, arg);
         }
 
 
@@ -613,35 +671,52 @@ namespace madness {
         /// invoked; the derived class may rely upon a well defined state
         /// until this routine is invoked.
         void process_pending() {
-            // Messages may be arriving while we are processing the
-            // pending queue.  To maximize concurrency copy messages
-            // out of queue before processing outside critical section.
-            //int ndone = 0;
-            while (!ready) {
-                pendingT tmp;
-
-                pending_mutex.lock(); // BEGIN CRITICAL SECTION
-                pendingT& nv = const_cast<pendingT&>(pending);
-                for (pendingT::iterator it=nv.begin(); it!=nv.end();) {
-                    detail::PendingMsg& p = *it;
-                    if (p.id == objid) {
-                        tmp.push_back(p);
-                        it = nv.erase(it);
+            // First the messages that arrived before we were registered.
+            // None can be added to the bin once we are registered.
+            pendingT early;
+            {
+                detail::PendingBin& bin = detail::pending_bin(objid);
+                ScopedMutex<Spinlock> lock(bin.mutex); // BEGIN CRITICAL SECTION
+                for (pendingT::iterator it=bin.msgs.begin(); it!=bin.msgs.end();) {
+                    if (it->id == objid) {
+                        early.push_back(*it);
+                        it = bin.msgs.erase(it);
                     }
                     else {
                         ++it;
                     }
                 }
-                if (tmp.size() == 0) ready=true;
-                pending_mutex.unlock(); // END CRITICAL SECTION
+            } // END CRITICAL SECTION
+            while (early.size()) {
+                early.front().invokehandler();
+                early.pop_front();
+            }
 
-                while (tmp.size()) {
-                    tmp.front().invokehandler();
-                    tmp.pop_front();
-                    //++ndone;
+            // Then those queued since.  Messages may be arriving while we
+            // are processing, so take the queue until it is found empty and
+            // can be sealed; anything arriving after that runs directly.
+            for (;;) {
+                nodeT* head = pending;
+                if (head == sealed()) break; // Already processed
+                nodeT* prev = __sync_val_compare_and_swap(&pending, head, head ? 0 : sealed());
+                if (prev != head) continue;
+                if (!head) break;
+
+                nodeT* fifo = 0; // The queue is LIFO
+                while (head) {
+                    nodeT* next = head->next;
+                    head->next = fifo;
+                    fifo = head;
+                    head = next;
+                }
+                while (fifo) {
+                    nodeT* next = fifo->next;
+                    fifo->msg.invokehandler();
+                    delete fifo;
+                    fifo = next;
                 }
             }
-            //if (ndone) std::cout << world.rank() << ":pending:" << ndone << std::endl;
+            ready = true;
         }
 
 
@@ -658,6 +733,7 @@ namespace madness {
                 : world(world)
                 , ready(false)
                 , me(world.rank())
+                , pending(0)
                 , objid(world.register_ptr(static_cast<Derived*>(this))) {};
 
 
@@ -1418,15 +1494,6 @@ namespace madness {
     }
 }
 
-#ifdef WORLD_INSTANTIATE_STATIC_TEMPLATES
-template <typename Derived>
-volatile std::list<madness::detail::PendingMsg> madness::WorldObject<Derived>::pending;
-
-template <typename Derived>
-madness::Spinlock madness::WorldObject<Derived>::pending_mutex;
-
-#endif
-
 #endif // MADNESS_WORLD_WORLD_OBJECT_H__INCLUDED
 
 /// @}
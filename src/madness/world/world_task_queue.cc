@@ -37,8 +37,31 @@
 
 #include <madness/world/world_task_queue.h>
 
+#include <sstream>
+
 namespace madness {
 
+    namespace {
+        double read_grain_target() {
+            const char* mad_grain_us = getenv("MAD_TASK_GRAIN_US");
+            double us = 100.0;
+            if (mad_grain_us) {
+                std::stringstream ss(mad_grain_us);
+                ss >> us;
+                if (ss.fail() || us <= 0.0) {
+                    std::cerr << "!!! WARNING: MAD_TASK_GRAIN_US is not a positive number ... using 100\n";
+                    us = 100.0;
+                }
+            }
+            return us*1e-6;
+        }
+    }
+
+    double detail::grain_target() {
+        static const double target = read_grain_target();
+        return target;
+    }
+
     bool TaskInterface::debug = false;
 
     // This is what thread pool will invoke
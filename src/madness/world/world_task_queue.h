@@ -69,6 +69,53 @@ namespace madness {
         template <typename, typename>
         class ForEachRootTask;
 
+        class CoroPromiseBase;
+
+        /// Seconds a leaf task of an adaptive for_each or reduce should take (\c MAD_TASK_GRAIN_US)
+        double grain_target();
+
+        /// Chooses chunk sizes of adaptive ranges from the measured cost of an operation
+
+        /// The leaf tasks of WorldTaskQueue::for_each() and reduce() over a
+        /// Range made with chunk size \c Range::AUTO time their loop and
+        /// add it into a running average of the cost per item of \c opT.
+        /// The chunk size is then the no. of items that take grain_target()
+        /// seconds (\c MAD_TASK_GRAIN_US microseconds, default 100), but
+        /// no more than gives each thread of the pool four tasks, which is
+        /// also the chunk size until \c opT has been timed.
+        template <typename opT>
+        class GrainSize {
+            static volatile double& cost() {
+                static volatile double c = 0.0; // Seconds per item, 0 if not timed yet
+                return c;
+            }
+
+        public:
+            /// Returns the chunk size for a range of \c n items
+            static int chunk(std::size_t n) {
+                const std::size_t nthread = std::max<std::size_t>(ThreadPool::size(), 1);
+                const double maxchunk = std::max<std::size_t>(n/(4*nthread), 1);
+                const double c = cost();
+                const double chunk = (c > 0.0) ? std::min(grain_target()/c, maxchunk) : maxchunk;
+                return std::max(int(chunk), 1);
+            }
+
+            /// Returns a copy of \c range with the chunk size chosen if it is adaptive
+            template <typename rangeT>
+            static rangeT sized(const rangeT& range) {
+                rangeT r(range);
+                if (r.is_adaptive()) r.set_chunksize(chunk(r.size()));
+                return r;
+            }
+
+            /// Adds a leaf task that did \c nitem items in \c seconds to the average cost
+            static void record(std::size_t nitem, double seconds) {
+                if (nitem == 0) return;
+                const double c = cost(), t = seconds/nitem;
+                cost() = (c > 0.0) ? 0.75*c + 0.25*t : t;
+            }
+        };
+
         /// Serialization container for sending tasks to remote nodes.
 
         /// \attention This struct is for internal use only. You should not
@@ -284,6 +331,7 @@ namespace madness {
     /// \todo A concise description of the inner workings...
     class WorldTaskQueue : public CallbackInterface, private NO_DEFAULTS {
         friend class TaskInterface;
+        friend class detail::CoroPromiseBase;
     private:
         World& world; ///< The communication context.
         const ProcessID me; ///< This process.
@@ -294,6 +342,16 @@ namespace madness {
             nregistered--;
         }
 
+        /// Counts a coroutine task (see CoroTask) as pending
+        void register_coroutine() {
+            nregistered++;
+        }
+
+        /// Called when a coroutine task completes
+        void notify_coroutine() {
+            nregistered--;
+        }
+
         /// \todo Brief description needed.
 
         /// This template is used in the reduce kernel.
@@ -486,7 +544,9 @@ namespace madness {
         /// \note The serialize method does not actually have to
         /// work unless you want to have the task be stealable.
         ///
-        /// Adjust the chunksize in the range to control granularity.
+        /// Adjust the chunksize in the range to control granularity, or
+        /// make the range with \c Range::AUTO to have it chosen from the
+        /// measured cost of \c op (see detail::GrainSize).
         /// \todo Descriptions needed and/or verified.
         /// \tparam resultT The result type of the operation.
         /// \tparam rangeT Description needed.
@@ -496,20 +556,31 @@ namespace madness {
         /// \return Description needed.
         template <typename resultT, typename rangeT, typename opT>
         Future<resultT> reduce(const rangeT& range, const opT& op) {
+            return reduce_range<resultT,rangeT,opT>(detail::GrainSize<opT>::sized(range), op);
+        }
+
+    private:
+        /// Reduces over \c range, whose chunk size has been chosen, by recursive splitting
+        template <typename resultT, typename rangeT, typename opT>
+        Future<resultT> reduce_range(const rangeT& range, const opT& op) {
             if (range.size() <= range.get_chunksize()) {
+                const double start = (range.is_adaptive() ? wall_time() : 0.0);
                 resultT sum = resultT();
                 for (typename rangeT::iterator it=range.begin(); it != range.end(); ++it) sum = op(sum,op(it));
+                if (range.is_adaptive()) detail::GrainSize<opT>::record(range.size(), wall_time() - start);
                 return Future<resultT>(sum);
             } else {
                 rangeT left = range;
                 rangeT right(left,Split());
 
-                Future<resultT>  leftsum = add(*this, &WorldTaskQueue::reduce<resultT,rangeT,opT>, left,  op);
-                Future<resultT> rightsum = add(*this, &WorldTaskQueue::reduce<resultT,rangeT,opT>, right, op);
+                Future<resultT>  leftsum = add(*this, &WorldTaskQueue::reduce_range<resultT,rangeT,opT>, left,  op);
+                Future<resultT> rightsum = add(*this, &WorldTaskQueue::reduce_range<resultT,rangeT,opT>, right, op);
                 return add(&WorldTaskQueue::sum<resultT,opT>, leftsum, rightsum, op);
             }
         }
 
+    public:
+
         /// Apply `op(item)` on all items in range.
 
         /// The operation must provide the following interface, of
@@ -526,7 +597,9 @@ namespace madness {
         /// \note The serialize method does not actually have to
         /// work unless you want to have the task be stealable.
         ///
-        /// Adjust the chunksize in the range to control granularity.
+        /// Adjust the chunksize in the range to control granularity, or
+        /// make the range with \c Range::AUTO to have it chosen from the
+        /// measured cost of \c op (see detail::GrainSize).
         ///
         /// Your operation should return true/false for success failure
         /// and the logical and of all results is returned as the
@@ -544,7 +617,7 @@ namespace madness {
         template <typename rangeT, typename opT>
         Future<bool> for_each(const rangeT& range, const opT& op) {
             detail::ForEachRootTask<rangeT, opT>* for_each_root =
-                    new detail::ForEachRootTask<rangeT, opT>(world, range, op);
+                    new detail::ForEachRootTask<rangeT, opT>(world, detail::GrainSize<opT>::sized(range), op);
             Future<bool> result = for_each_root->result();
             add(for_each_root);
             return result;
@@ -1382,10 +1455,12 @@ namespace madness {
                 }
 
                 // Iterate over the remaining chunck of range and call op_ for each element
+                const double start = (range_.is_adaptive() ? wall_time() : 0.0);
                 int status = 0;
                 for(typename rangeT::iterator it = range_.begin(); it != range_.end();  ++it)
                     if(op_(it))
                         ++status;
+                if (range_.is_adaptive()) GrainSize<opT>::record(range_.size(), wall_time() - start);
 
                 // Notify the root task that this task is done give the status
                 root_.complete(status);
@@ -30,13 +30,162 @@
 */
 
 #include <madness/world/worldam.h>
+#include <madness/world/object_pool_impl.h>
 #include <madness/world/parallel_runtime.h>
 #include <madness/world/worldmpi.h>
+#include <madness/world/posixmem.h>
+#include <madness/world/timers.h>
 #include <sstream>
+#include <algorithm>
+#include <list>
+#include <map>
 
 namespace madness {
 
+    namespace {
 
+        /// Instances that coalesce messages, for the RMI progress hook
+        Spinlock coalescing_lock;
+        std::vector<WorldAmInterface*> coalescing;
+        volatile bool any_coalescing = false; ///< Lets flush_coalesced_am skip the lock
+
+        /// Rendezvous sends in progress and the memory they read from
+        Spinlock rendezvous_lock;
+        std::list< std::pair<RMI::Request, std::shared_ptr<const void> > > rendezvous_sends;
+
+        /// Deleter of memory that arrays are received into
+        struct RendezvousFree {
+            std::size_t nbyte;
+            MemTag tag;
+
+            RendezvousFree(std::size_t nbyte, MemTag tag) : nbyte(nbyte), tag(tag) {}
+
+            void operator()(void* p) const {
+                mem_tag_free(tag, nbyte);
+                free(p);
+            }
+        };
+
+        /// Arrays received by rendezvous (by source and tag) that are yet to be deserialized
+        Spinlock rendezvous_recv_lock;
+        std::map< std::pair<ProcessID, int>, std::pair<RMI::Request, std::shared_ptr<void> > > rendezvous_recvs;
+
+        /// Messages waiting for their rendezvous arrays, by source in COMM_WORLD (only used by the RMI thread)
+        std::map< ProcessID, std::list<AmArg*> > rendezvous_waiting;
+
+    } // namespace
+
+    AmRendezvous::AmRendezvous() : threshold(0) {
+        const char* mad_rendezvous = getenv("MAD_RENDEZVOUS_BYTES");
+        if(mad_rendezvous) {
+            std::stringstream ss(mad_rendezvous);
+            ss >> threshold;
+        }
+    }
+
+    AmRendezvous& AmRendezvous::instance() {
+        static AmRendezvous rv;
+        return rv;
+    }
+
+    void AmRendezvous::add(void* buf, std::size_t offset, const void* p, std::size_t nbyte,
+                           const std::shared_ptr<const void>& holder)
+    {
+        // The buffer is the payload of an AmArg (see AmArg::make_output_arch)
+        AmArg* arg = reinterpret_cast<AmArg*>(static_cast<unsigned char*>(buf) - sizeof(AmArg));
+        if (!arg->rv) arg->rv = new AmArgRendezvous;
+        AmArgRendezvous::Entry e = { offset, p, nbyte, holder };
+        arg->rv->entries.push_back(e);
+    }
+
+    std::shared_ptr<void> AmRendezvous::recv(const archive::BufferRendezvousInfo& info) const {
+        std::pair<RMI::Request, std::shared_ptr<void> > r;
+        {
+            ScopedMutex<Spinlock> hold(rendezvous_recv_lock);
+            std::map< std::pair<ProcessID, int>, std::pair<RMI::Request, std::shared_ptr<void> > >::iterator it =
+                    rendezvous_recvs.find(std::make_pair(ProcessID(info.src), int(info.tag)));
+            // The handler only runs once all its receives are posted (see WorldAmInterface::dispatch)
+            MADNESS_ASSERT(it != rendezvous_recvs.end());
+            r = it->second;
+            rendezvous_recvs.erase(it);
+        }
+        // The send was matched when the receive was posted, so this only waits for the data
+        MutexWaiter waiter;
+        while (!r.first.Test()) waiter.wait();
+        return r.second;
+    }
+
+    bool AmRendezvous::post(ProcessID src, int tag, unsigned int n, bool first) {
+        bool all = true;
+        for (unsigned int k=0; k<n; ++k) {
+            const std::pair<ProcessID, int> key(src, RMI::rendezvous_tag(tag, k));
+            {
+                ScopedMutex<Spinlock> hold(rendezvous_recv_lock);
+                if (rendezvous_recvs.count(key)) {
+                    // Else the tags have wrapped around onto an array still held
+                    MADNESS_ASSERT(!first);
+                    continue;
+                }
+            }
+
+            std::size_t nbyte = 0;
+            if (!RMI::iprobe_rendezvous(src, key.second, nbyte)) {
+                all = false;
+                continue;
+            }
+
+            // Memory of its own that deserialization hands over (see archive::load_rendezvous)
+            void* p = 0;
+            if (posix_memalign(&p, RMI::ALIGNMENT, std::max(nbyte, std::size_t(1))))
+                throw std::bad_alloc();
+            const MemTag mtag = mem_tag_current();
+            mem_tag_alloc(mtag, nbyte);
+            std::shared_ptr<void> data(p, RendezvousFree(nbyte, mtag));
+            RMI::Request req = RMI::irecv_rendezvous(p, nbyte, src, key.second);
+
+            ScopedMutex<Spinlock> hold(rendezvous_recv_lock);
+            rendezvous_recvs.insert(std::make_pair(key, std::make_pair(req, data)));
+        }
+        return all;
+    }
+
+    void AmRendezvous::discard(ProcessID src, int tag, unsigned int n) {
+        MutexWaiter waiter;
+        for (unsigned int k=0; k<n; ++k) {
+            std::pair<RMI::Request, std::shared_ptr<void> > r;
+            {
+                ScopedMutex<Spinlock> hold(rendezvous_recv_lock);
+                std::map< std::pair<ProcessID, int>, std::pair<RMI::Request, std::shared_ptr<void> > >::iterator it =
+                        rendezvous_recvs.find(std::make_pair(src, RMI::rendezvous_tag(tag, k)));
+                if (it == rendezvous_recvs.end()) continue; // Deserialized
+                r = it->second;
+                rendezvous_recvs.erase(it);
+            }
+            // The memory is freed (as r goes) only once the data is in it
+            while (!r.first.Test()) waiter.wait();
+        }
+    }
+
+    template class ThreadCachingPool<detail::AmArgClasses>;
+
+    void* detail::AmArgClasses::allocate_slab(std::size_t nbyte) {
+        void* slab = 0;
+        if (posix_memalign(&slab, RMI::ALIGNMENT, nbyte))
+            throw std::bad_alloc();
+        return slab;
+    }
+
+    void* AmArgPool::allocate_large(std::size_t size) {
+        void* p = 0;
+        if (posix_memalign(&p, RMI::ALIGNMENT, size))
+            throw std::bad_alloc();
+        poolT::count_large();
+        return p;
+    }
+
+    void AmArgPool::deallocate_large(void* p) {
+        free(p);
+    }
 
     WorldAmInterface::WorldAmInterface(World& world)
             : msg_len(RMI::max_msg_len() - sizeof(AmArg))
@@ -50,9 +199,46 @@ namespace madness {
             , nsent(0)
             , nrecv(0)
             , map_to_comm_world(nproc)
+            , coalesce_max(0)
+            , coalesce_timeout(100e-6)
+            , bundle_len(std::min<std::size_t>(msg_len, AmArgPool::MAX_SIZE - sizeof(AmArg)))
+            , bundles()
     {
         lock();
 
+        nbundle_pending = 0;
+
+        // Coalescing of small messages is enabled by giving the largest payload to coalesce
+        const char* mad_coalesce = getenv("MAD_AM_COALESCE");
+        if(mad_coalesce) {
+            std::stringstream ss(mad_coalesce);
+            ss >> coalesce_max;
+            // A bundle must be able to hold several messages
+            if(coalesce_max > bundle_len/4) {
+                coalesce_max = bundle_len/4;
+                std::cerr << "!!! WARNING: MAD_AM_COALESCE must be at most " << coalesce_max << ".\n"
+                          << "!!! WARNING: Decreasing MAD_AM_COALESCE to " << coalesce_max << ".\n";
+            }
+        }
+        const char* mad_coalesce_us = getenv("MAD_AM_COALESCE_US");
+        if(mad_coalesce_us) {
+            std::stringstream ss(mad_coalesce_us);
+            double us = 100.0;
+            ss >> us;
+            if(us < 0.0) us = 0.0;
+            coalesce_timeout = us*1e-6;
+        }
+        if(coalesce_max) {
+            bundles.reset(new Bundle[nproc]);
+            ScopedMutex<Spinlock> hold(coalescing_lock);
+            coalescing.push_back(this);
+            any_coalescing = true;
+            RMI::add_progress_hook(&WorldAmInterface::flush_all_expired);
+        }
+
+        if(AmRendezvous::instance().is_enabled())
+            RMI::add_progress_hook(&WorldAmInterface::dispatch_waiting);
+
         // Initialize the number of send buffers
         const char* mad_send_buffs = getenv("MAD_SEND_BUFFERS");
         if(mad_send_buffs) {
@@ -86,6 +272,16 @@ namespace madness {
     }
 
     WorldAmInterface::~WorldAmInterface() {
+        if(! SafeMPI::Is_finalized())
+            test_rendezvous_sends(true);
+
+        if(coalesce_max) {
+            ScopedMutex<Spinlock> hold(coalescing_lock);
+            coalescing.erase(std::find(coalescing.begin(), coalescing.end(), this));
+            for(int i=0; i < nproc; ++i)
+                if(bundles[i].arg) free_am_arg(bundles[i].arg);
+        }
+
         if(SafeMPI::Is_finalized()) {
             for(int i=0; i < nsend; ++i)
                 free_managed_send_buf(i);
@@ -99,4 +295,160 @@ namespace madness {
         }
     }
 
+    void WorldAmInterface::post_rendezvous(ProcessID dest, AmArg* arg) {
+        const ProcessID me = SafeMPI::COMM_WORLD.Get_rank();
+        const ProcessID to = map_to_comm_world[dest];
+        std::vector<AmArgRendezvous::Entry>& entries = arg->rv->entries;
+        // The receiver finds the arrays from the tags before deserializing (see AmRendezvous::arrive)
+        arg->nrv = entries.size();
+        arg->rvtag = RMI::reserve_rendezvous_tags(arg->nrv);
+        for (std::size_t i=0; i<entries.size(); ++i) {
+            archive::BufferRendezvousInfo info = { entries[i].nbyte, me, RMI::rendezvous_tag(arg->rvtag, i) };
+            RMI::Request req = RMI::isend_rendezvous(entries[i].p, entries[i].nbyte, to, info.tag);
+            memcpy(arg->buf() + entries[i].offset, &info, sizeof(info));
+            ScopedMutex<Spinlock> hold(rendezvous_lock);
+            rendezvous_sends.push_back(std::make_pair(req, entries[i].holder));
+        }
+        delete arg->rv;
+        arg->rv = 0;
+        test_rendezvous_sends(false);
+    }
+
+    void WorldAmInterface::test_rendezvous_sends(bool wait) {
+        MutexWaiter waiter;
+        while (true) {
+            {
+                ScopedMutex<Spinlock> hold(rendezvous_lock);
+                std::list< std::pair<RMI::Request, std::shared_ptr<const void> > >::iterator it =
+                        rendezvous_sends.begin();
+                while (it != rendezvous_sends.end()) {
+                    if (it->first.Test())
+                        it = rendezvous_sends.erase(it);
+                    else
+                        ++it;
+                }
+                if (!wait || rendezvous_sends.empty()) return;
+            }
+            waiter.wait();
+        }
+    }
+
+    std::size_t WorldAmInterface::nrendezvous_waiting = 0;
+
+    bool WorldAmInterface::wait_for_rendezvous(ProcessID src, const AmArg* arg) {
+        // Post what has arrived even if the message must wait anyway, so its sends can complete
+        const bool posted = AmRendezvous::instance().post(src, arg->rvtag, arg->nrv, true);
+        std::list<AmArg*>& waiting = rendezvous_waiting[src];
+        if (posted && waiting.empty()) return false;
+
+        waiting.push_back(copy_am_arg(*arg));
+        ++nrendezvous_waiting;
+        return true;
+    }
+
+    void WorldAmInterface::dispatch_waiting() {
+        if (!nrendezvous_waiting) return;
+        for (std::map< ProcessID, std::list<AmArg*> >::iterator it = rendezvous_waiting.begin();
+             it != rendezvous_waiting.end(); ++it) {
+            // Messages from one process run in the order they arrived
+            std::list<AmArg*>& waiting = it->second;
+            while (!waiting.empty() &&
+                   AmRendezvous::instance().post(it->first, waiting.front()->rvtag, waiting.front()->nrv, false)) {
+                AmArg* arg = waiting.front();
+                waiting.pop_front();
+                --nrendezvous_waiting;
+                invoke(arg);
+                free_am_arg(arg);
+            }
+        }
+    }
+
+    void WorldAmInterface::release_rendezvous(const AmArg* arg) {
+        if (!arg->nrv) return;
+        const ProcessID src = arg->get_world()->am.map_to_comm_world[arg->src];
+        AmRendezvous::instance().discard(src, arg->rvtag, arg->nrv);
+    }
+
+    void WorldAmInterface::bundle_handler(void *buf, std::size_t nbyte) {
+        // Messages follow the bundle header, each aligned to BUNDLE_ALIGN
+        unsigned char* p = static_cast<AmArg*>(buf)->buf();
+        const unsigned char* end = static_cast<unsigned char*>(buf) + nbyte;
+        while (p < end) {
+            AmArg* arg = reinterpret_cast<AmArg*>(p);
+            p += bundle_entry_size(arg);
+            dispatch(arg);
+        }
+    }
+
+    void WorldAmInterface::add_to_bundle(ProcessID dest, Bundle& b, const AmArg* arg) {
+        // WE ASSUME WE HOLD THE LOCK ON b WHEN IN HERE
+        const std::size_t n = bundle_entry_size(arg);
+        if (b.arg && b.used + n > bundle_len) send_bundle(dest, b);
+
+        if (!b.arg) {
+            b.arg = alloc_am_arg(bundle_len);
+            b.used = 0;
+            b.start = wall_time();
+            nbundle_pending++;
+        }
+
+        memcpy(b.arg->buf() + b.used, arg, arg->size() + sizeof(AmArg));
+        b.used += n;
+        free_am_arg(const_cast<AmArg*>(arg));
+        __sync_fetch_and_add(&stats.ncoalesced, uint64_t(1));
+
+        if (b.used + sizeof(AmArg) + coalesce_max > bundle_len ||
+                wall_time() - b.start > coalesce_timeout)
+            send_bundle(dest, b);
+    }
+
+    void WorldAmInterface::send_bundle(ProcessID dest, Bundle& b) {
+        // WE ASSUME WE HOLD THE LOCK ON b WHEN IN HERE
+        AmArg* arg = b.arg;
+        arg->set_worldid(worldid);
+        arg->set_src(rank);
+        arg->clear_flags();
+        // The bundle is not itself counted in nsent/nrecv ... its messages are
+        send_managed(dest, arg, b.used + sizeof(AmArg), bundle_handler, RMI::ATTR_ORDERED);
+        b.arg = 0;
+        b.used = 0;
+        nbundle_pending--;
+        __sync_fetch_and_add(&stats.nbundle, uint64_t(1));
+    }
+
+    void WorldAmInterface::flush() {
+        if (!coalesce_max) return;
+        for (int i=0; i<nproc; ++i) {
+            Bundle& b = bundles[i];
+            ScopedMutex<Spinlock> hold(b);
+            if (b.arg) send_bundle(i, b);
+        }
+    }
+
+    void WorldAmInterface::flush_older_than(double age) {
+        if (nbundle_pending == 0) return;
+        const double now = wall_time();
+        for (int i=0; i<nproc; ++i) {
+            Bundle& b = bundles[i];
+            if (!b.try_lock()) continue;
+            if (b.arg && now - b.start >= age) send_bundle(i, b);
+            b.unlock();
+        }
+    }
+
+    void flush_coalesced_am() {
+        // Never wait here ... if another thread is flushing leave it to them
+        if (!any_coalescing || !coalescing_lock.try_lock()) return;
+        for (std::size_t i=0; i<coalescing.size(); ++i)
+            coalescing[i]->flush_older_than(0.0);
+        coalescing_lock.unlock();
+    }
+
+    void WorldAmInterface::flush_all_expired() {
+        if (!coalescing_lock.try_lock()) return;
+        for (std::size_t i=0; i<coalescing.size(); ++i)
+            coalescing[i]->flush_older_than(coalescing[i]->coalesce_timeout);
+        coalescing_lock.unlock();
+    }
+
 } // namespace madness
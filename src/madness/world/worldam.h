@@ -37,9 +37,13 @@
 
 #include <madness/world/bufar.h>
 #include <madness/world/worldrmi.h>
+#include <madness/world/worldmem.h>
+#include <madness/world/object_pool.h>
 #include <madness/world/world.h>
 #include <vector>
 #include <cstddef>
+#include <new>
+#include <algorithm>
 
 namespace madness {
 
@@ -70,7 +74,83 @@ namespace madness {
 
     template <class Derived> class WorldObject;
 
+    /// Arrays of an outgoing AmArg that will be sent by rendezvous
+    struct AmArgRendezvous {
+        struct Entry {
+            std::size_t offset;     ///< Offset of the BufferRendezvousInfo in the payload
+            const void* p;          ///< The array
+            std::size_t nbyte;      ///< Size of the array
+            std::shared_ptr<const void> holder; ///< Keeps the array alive
+        };
+
+        std::vector<Entry> entries;
+    };
+
+
+    /// Sends large arrays in active messages by rendezvous instead of copying them
+
+    /// Arrays of at least MAD_RENDEZVOUS_BYTES bytes (default 0, i.e.,
+    /// disabled) that are offered with archive::store_rendezvous (as
+    /// Tensor does) are not copied into the AmArg.  When the message is
+    /// sent each array is posted straight from its own memory.  When the
+    /// message arrives the receiver allocates memory for each array that
+    /// has also arrived and posts its receive, so the sends complete even
+    /// if the message is never deserialized.  Deserialization hands that
+    /// memory over (e.g., it becomes the data of the Tensor) rather than
+    /// copying it, and arrays the handler did not deserialize are freed
+    /// once it returns.  Since the server thread never waits for an array, a
+    /// message whose arrays are yet to arrive is set aside, along with any
+    /// later messages from the same process, and run from the RMI progress
+    /// loop once they have.
+    ///
+    /// With MAD_RENDEZVOUS_BYTES set, the sender must not modify an array
+    /// it has sent (e.g., a Tensor passed to a remote task) in place until
+    /// the message has been received (e.g., until the next fence), since
+    /// the data is read from it after the send returns.  Replacing the
+    /// array, as Tensor assignment does, is fine.  All processes must
+    /// agree on whether rendezvous is enabled.
+    class AmRendezvous : public archive::BufferRendezvousSink,
+                         public archive::BufferRendezvousSource {
+        std::size_t threshold;  ///< Smallest array sent by rendezvous (0 if disabled)
+
+        AmRendezvous();
+
+    public:
+        /// Returns the single instance
+        static AmRendezvous& instance();
+
+        /// Returns true if rendezvous is enabled
+        bool is_enabled() const { return threshold != 0; }
+
+        bool wants(std::size_t nbyte) const {
+            return threshold && nbyte >= threshold;
+        }
+
+        void add(void* buf, std::size_t offset, const void* p, std::size_t nbyte,
+                 const std::shared_ptr<const void>& holder);
+
+        std::shared_ptr<void> recv(const archive::BufferRendezvousInfo& info) const;
+
+        /// Posts receives for those of the \c n arrays of a message from \c src that have arrived
+
+        /// \c src is in COMM_WORLD and \c tag is the first tag of the block
+        /// (see RMI::reserve_rendezvous_tags).  Returns true once the
+        /// receives of all \c n arrays are posted.  Never waits, so the
+        /// RMI thread calls it again later for a message that returned
+        /// false; \c first is true only on the first call for a message.
+        bool post(ProcessID src, int tag, unsigned int n, bool first);
+
+        /// Frees those of the \c n arrays of a message from \c src that were not deserialized
+
+        /// Takes the same arguments as post().
+        void discard(ProcessID src, int tag, unsigned int n);
+    };
+
+
     class AmArg;
+    namespace detail {
+        class AmArgGrower;
+    }
     /// Type of AM handler functions
     typedef void (*am_handlerT)(const AmArg&);
 
@@ -81,6 +161,10 @@ namespace madness {
         template <class Derived> friend class WorldObject;
 
         friend AmArg* alloc_am_arg(std::size_t nbyte);
+        friend AmArg* copy_am_arg(const AmArg& arg);
+        friend void free_am_arg(AmArg* arg);
+        friend class AmRendezvous;
+        friend class detail::AmArgGrower;
 
         unsigned char header[RMI::HEADER_LEN]; // !!!!!!!!!  MUST BE FIRST !!!!!!!!!!
         std::size_t nbyte;      // Size of user payload
@@ -88,9 +172,12 @@ namespace madness {
         am_handlerT func;       // User function to call
         ProcessID src;          // Rank of process sending the message
         unsigned int flags;     // Misc. bit flags
+        AmArgRendezvous* rv;    // Arrays to send by rendezvous (sender only)
+        unsigned int nrv;       // Number of arrays sent by rendezvous
+        int rvtag;              // Tag of the first of them
 
-        // On 32 bit machine AmArg is HEADER_LEN+4+4+4+4+4=84 bytes
-        // On 64 bit machine AmArg is HEADER_LEN+8+8+8+4+4=96 bytes
+        // On 32 bit machine AmArg is HEADER_LEN+4+4+4+4+4+4+4+4=96 bytes
+        // On 64 bit machine AmArg is HEADER_LEN+8+8+8+4+4+8+4+4=112 bytes
 
         // No copy constructor or assignment
         AmArg(const AmArg&);
@@ -109,6 +196,8 @@ namespace madness {
 
         void set_pending() { flags |= 0x1ul; }
 
+        void clear_pending() { flags &= ~0x1ul; }
+
         bool is_pending() const { return flags & 0x1ul; }
 
         void clear_flags() { flags = 0; }
@@ -116,11 +205,11 @@ namespace madness {
         am_handlerT get_func() const { return func; }
 
         archive::BufferInputArchive make_input_arch() const {
-            return archive::BufferInputArchive(buf(),size());
+            return archive::BufferInputArchive(buf(),size(),&AmRendezvous::instance());
         }
 
         archive::BufferOutputArchive make_output_arch() const {
-            return archive::BufferOutputArchive(buf(),size());
+            return archive::BufferOutputArchive(buf(),size(),&AmRendezvous::instance());
         }
 
     public:
@@ -156,24 +245,119 @@ namespace madness {
     };
 
 
+    typedef ThreadCachingPoolStats AmArgPoolStats;
+
+    namespace detail {
+        /// Size classes of AmArgPool ... powers of two from 128 bytes to 64 kB
+        struct AmArgClasses {
+            static const std::size_t MIN_SIZE = 128;        // >= sizeof(AmArg)
+            static const std::size_t NCLASS = 10;
+            static const std::size_t SLAB_SIZE = MIN_SIZE << (NCLASS-1);
+
+            static std::size_t object_size(std::size_t c) { return MIN_SIZE << c; }
+
+            static int batch(std::size_t c) { return int(SLAB_SIZE / object_size(c)); }
+
+            /// Slabs are aligned like the RMI receive buffers
+            static void* allocate_slab(std::size_t nbyte);
+        };
+    }
+
+    extern template class ThreadCachingPool<detail::AmArgClasses>;
+
+
+    /// Size-classed slab allocator for active message buffers
+
+    /// Every remote task or AM needs a buffer that is allocated by the
+    /// sending thread and freed, once the MPI request has completed, by
+    /// whichever thread next recycles the send slot.  Buffers are rounded
+    /// up to a power of two between \c MIN_SIZE and \c MAX_SIZE bytes and
+    /// kept in a ThreadCachingPool, so the common path takes no lock.  A
+    /// batch is one slab of \c SLAB_SIZE bytes, aligned like the RMI
+    /// receive buffers.  Larger buffers go straight to malloc.
+    class AmArgPool {
+        typedef detail::AmArgClasses classT;
+        typedef ThreadCachingPool<classT> poolT;
+
+    public:
+        static const std::size_t MIN_SIZE = classT::MIN_SIZE;   ///< Smallest buffer (>= sizeof(AmArg))
+        static const std::size_t NCLASS = classT::NCLASS;       ///< No. of size classes
+        static const std::size_t MAX_SIZE = MIN_SIZE << (NCLASS-1); ///< Largest pooled buffer
+        static const std::size_t SLAB_SIZE = classT::SLAB_SIZE; ///< Bytes obtained from malloc at once
+
+    private:
+        static void* allocate_large(std::size_t size);
+
+        static void deallocate_large(void* p);
+
+    public:
+        /// Returns the size class for a buffer of \c size bytes (NCLASS if too big)
+        static std::size_t size_class(std::size_t size) {
+            std::size_t c = 0;
+            std::size_t s = MIN_SIZE;
+            while (s < size && c < NCLASS) {
+                s <<= 1;
+                ++c;
+            }
+            return c;
+        }
+
+        /// Allocate a buffer of at least \c size bytes
+        static void* allocate(std::size_t size) {
+            const std::size_t c = size_class(size);
+            if (c == NCLASS) return allocate_large(size);
+            return poolT::allocate(c);
+        }
+
+        /// Return a buffer of \c size bytes obtained from \c allocate
+        static void deallocate(void* p, std::size_t size) {
+            const std::size_t c = size_class(size);
+            if (c == NCLASS) {
+                deallocate_large(p);
+                return;
+            }
+            poolT::deallocate(p, c);
+        }
+
+        /// Returns pool statistics (per-thread counts are gathered lazily)
+        static AmArgPoolStats get_stats() {
+            return poolT::get_stats();
+        }
+    };
+
+
     /// Allocates a new AmArg with nbytes of user data ... delete with free_am_arg
     inline AmArg* alloc_am_arg(std::size_t nbyte) {
-        std::size_t narg = 1 + (nbyte+sizeof(AmArg)-1)/sizeof(AmArg);
-        AmArg *arg = new AmArg[narg];
+        AmArg *arg = new (AmArgPool::allocate(nbyte + sizeof(AmArg))) AmArg;
+        mem_tag_alloc(MEM_AM_ARG, nbyte + sizeof(AmArg));
         arg->set_size(nbyte);
+        arg->rv = 0;
+        arg->nrv = 0;
         return arg;
     }
 
 
     inline AmArg* copy_am_arg(const AmArg& arg) {
         AmArg* r = alloc_am_arg(arg.size());
-        memcpy(r, &arg, arg.size()+sizeof(AmArg));
+        // The RMI header is filled in when sent, so only the fields are copied
+        r->worldid = arg.worldid;
+        r->func = arg.func;
+        r->src = arg.src;
+        r->flags = arg.flags;
+        // Each copy sends its own rendezvous arrays, and a copy of a
+        // received message can deserialize the arrays that it was sent
+        if (arg.rv) r->rv = new AmArgRendezvous(*arg.rv);
+        r->nrv = arg.nrv;
+        r->rvtag = arg.rvtag;
+        memcpy(r->buf(), arg.buf(), arg.size());
         return r;
     }
 
     /// Frees an AmArg allocated with alloc_am_arg
     inline void free_am_arg(AmArg* arg) {
-        delete [] arg;
+        delete arg->rv;
+        mem_tag_free(MEM_AM_ARG, arg->size() + sizeof(AmArg));
+        AmArgPool::deallocate(arg, arg->size() + sizeof(AmArg));
     }
 
     /// Terminate argument serialization
@@ -186,23 +370,154 @@ namespace madness {
         serialize_am_args(archive & t, std::forward<argT>(args)...);
     }
 
+    namespace detail {
+
+        /// Serialized size of arguments if known at compile time
+
+        /// Arguments that a buffer archive stores as their bytes (see
+        /// archive::is_bitwise_serializable) take exactly sizeof(T) bytes,
+        /// so no counting pass over them is needed.
+        template <typename... argT>
+        struct am_arg_size {
+            static const bool known = true;
+            static const std::size_t value = 0;
+        };
+
+        template <typename T, typename... argT>
+        struct am_arg_size<T, argT...> {
+            static const bool known = archive::is_bitwise_serializable<T>::value && am_arg_size<argT...>::known;
+            static const std::size_t value = sizeof(T) + am_arg_size<argT...>::value;
+        };
+
+        /// Terminate packing of arguments stored as their bytes
+        inline void pack_am_args(unsigned char*) { }
+
+        /// Copy arguments stored as their bytes into \c p
+        template <typename T, typename... argT>
+        inline void pack_am_args(unsigned char* p, const T& t, const argT&... args) {
+            memcpy(p, &t, sizeof(T));
+            pack_am_args(p + sizeof(T), args...);
+        }
+
+
+        /// Enlarges the AmArg being written by a BufferOutputArchive
+
+        /// Each new buffer fills the next size class of AmArgPool, and the
+        /// payload is copied over along with any rendezvous arrays.
+        class AmArgGrower : public archive::BufferGrower {
+            AmArg* arg;
+
+            /// Payload size that fills the smallest buffer holding \c nbyte
+            static std::size_t capacity(std::size_t nbyte) {
+                const std::size_t c = AmArgPool::size_class(nbyte + sizeof(AmArg));
+                if (c == AmArgPool::NCLASS) return nbyte;
+                return (AmArgPool::MIN_SIZE << c) - sizeof(AmArg);
+            }
+
+            /// Move the first \c used bytes of payload into a new AmArg of \c nbyte bytes
+            void move(std::size_t used, std::size_t nbyte) {
+                AmArg* r = alloc_am_arg(nbyte);
+                memcpy(r->buf(), arg->buf(), used);
+                r->rv = arg->rv;
+                arg->rv = 0;
+                free_am_arg(arg);
+                arg = r;
+            }
+
+        public:
+            /// Starts with a buffer for at least \c nbyte bytes of payload
+            explicit AmArgGrower(std::size_t nbyte)
+                : arg(alloc_am_arg(capacity(nbyte))) {}
+
+            virtual ~AmArgGrower() {
+                if (arg) free_am_arg(arg);
+            }
+
+            unsigned char* buf() const { return arg->buf(); }
+
+            std::size_t size() const { return arg->size(); }
+
+            unsigned char* grow(std::size_t used, std::size_t& nbyte) {
+                const std::size_t newsize = capacity(std::max(nbyte, 2*arg->size()));
+                move(used, newsize);
+                nbyte = newsize;
+                return arg->buf();
+            }
+
+            /// Returns the AmArg with its size set to the \c nbyte bytes written
+            AmArg* release(std::size_t nbyte) {
+                const std::size_t have = arg->size();
+                if (AmArgPool::size_class(nbyte + sizeof(AmArg)) == AmArgPool::size_class(have + sizeof(AmArg))) {
+                    // Same buffer serves ... just trim the size
+                    mem_tag_free(MEM_AM_ARG, have - nbyte);
+                    arg->set_size(nbyte);
+                }
+                else {
+                    move(nbyte, nbyte);
+                }
+                AmArg* r = arg;
+                arg = 0;
+                return r;
+            }
+        };
+
+
+        /// Arguments all stored as their bytes are copied straight in
+        template <typename... argT>
+        inline AmArg* new_am_arg_impl(std::true_type, const argT&... args) {
+            AmArg* am_args = alloc_am_arg(am_arg_size<argT...>::value);
+            pack_am_args(am_args->buf(), args...);
+            return am_args;
+        }
+
+        /// Otherwise serialize in one pass into a buffer that grows as needed
+        template <typename... argT>
+        inline AmArg* new_am_arg_impl(std::false_type, const argT&... args) {
+            // Start from the size of the arguments themselves
+            AmArgGrower grower(am_arg_size<argT...>::value);
+            archive::BufferOutputArchive ar(grower.buf(), grower.size(), &AmRendezvous::instance(), &grower);
+            serialize_am_args(ar, args...);
+            return grower.release(ar.size());
+        }
+
+    } // namespace detail
+
     /// Convenience template for serializing arguments into a new AmArg
     template <typename... argT>
     inline AmArg* new_am_arg(const argT&... args) {
-        // compute size
-        archive::BufferOutputArchive count;
-        serialize_am_args(count, args...);
-
-        // Serialize arguments
-        AmArg* am_args = alloc_am_arg(count.size());
-        serialize_am_args(*am_args, args...);
-        return am_args;
+        return detail::new_am_arg_impl(std::integral_constant<bool, detail::am_arg_size<argT...>::known>(),
+                                       args...);
     }
 
 
+    // Holds active message coalescing statistics
+    namespace detail {
+        struct SplitFence;
+    }  // namespace detail
+
+    struct WorldAmStats {
+        uint64_t nraw;          ///< #AM sent in a message of their own
+        uint64_t ncoalesced;    ///< #AM packed into bundles
+        uint64_t nbundle;       ///< #bundles sent
+
+        WorldAmStats()
+                : nraw(0), ncoalesced(0), nbundle(0) {}
+    };
+
+
     /// Implements AM interface
+
+    /// Optionally (set MAD_AM_COALESCE to the largest payload in bytes
+    /// to aggregate) small messages to the same destination are packed
+    /// into one bundle that is sent as a single RMI message.  A bundle
+    /// is sent when it is full, when its first message is older than
+    /// MAD_AM_COALESCE_US microseconds (default 100; checked on each
+    /// send and by the RMI server thread), before any larger message to
+    /// the same destination, and in gop.fence().  The receiver unpacks
+    /// the bundle and invokes each handler in the order sent.
     class WorldAmInterface : private SCALABLE_MUTEX_TYPE {
         friend class WorldGopInterface;
+        friend struct detail::SplitFence;
         friend class World;
     public:
         const int msg_len;                  ///< Max length of user payload in message
@@ -230,6 +545,24 @@ namespace madness {
 
         std::vector<int> map_to_comm_world; ///< Maps rank in current MPI communicator to SafeMPI::COMM_WORLD
 
+        /// Per-destination buffer of coalesced messages
+        struct Bundle : public Spinlock {
+            AmArg* arg;         ///< Bundle being filled (null if none)
+            std::size_t used;   ///< Bytes of payload used
+            double start;       ///< Time the first message was added
+
+            Bundle() : arg(0), used(0), start(0.0) {}
+        };
+
+        static const std::size_t BUNDLE_ALIGN = 16; ///< Alignment of messages in a bundle
+
+        std::size_t coalesce_max;       ///< Largest payload that is coalesced (0 if disabled)
+        double coalesce_timeout;        ///< Max. seconds a message waits in a bundle
+        std::size_t bundle_len;         ///< Payload capacity of a bundle
+        ScopedArray<Bundle> bundles;    ///< Bundles indexed by destination
+        AtomicInt nbundle_pending;      ///< No. of bundles not yet sent
+        WorldAmStats stats;
+
         void free_managed_send_buf(int i) {
             // WE ASSUME WE ARE INSIDE A CRITICAL SECTION WHEN IN HERE
             if (managed_send_buf[i]) {
@@ -238,25 +571,126 @@ namespace madness {
             }
         }
 
-        /// This handles all incoming RMI messages for all instances
-        static void handler(void *buf, std::size_t nbyte) {
+        /// Detach the buffer of a completed send so it can be freed outside the lock
+        AmArg* take_managed_send_buf(int i) {
+            // WE ASSUME WE ARE INSIDE A CRITICAL SECTION WHEN IN HERE
+            AmArg* old = managed_send_buf[i];
+            managed_send_buf[i] = 0;
+            return old;
+        }
+
+        /// Invokes the handler of one incoming AM (or sets it aside until its rendezvous arrays arrive)
+        static void dispatch(AmArg* arg) {
             // It will be singled threaded since only the RMI receiver
             // thread will invoke it ... however note that nrecv will
             // be read by the main thread during fence operations.
-            AmArg* arg = static_cast<AmArg*>(buf);
-            am_handlerT func = arg->get_func();
+            arg->rv = 0; // Meaningless here, but copy_am_arg looks at it
             World* w = arg->get_world();
-            MADNESS_ASSERT(arg->size() + sizeof(AmArg) == nbyte);
             MADNESS_ASSERT(w);
-            MADNESS_ASSERT(func);
-            func(*arg);
+            MADNESS_ASSERT(arg->get_func());
+            if ((arg->nrv || nrendezvous_waiting) &&
+                    wait_for_rendezvous(w->am.map_to_comm_world[arg->src], arg))
+                return;
+            invoke(arg);
+        }
+
+        /// Invokes the handler of one incoming AM
+        static void invoke(AmArg* arg) {
+            World* w = arg->get_world();
+            arg->get_func()(*arg);
+            // A message set aside by its handler runs later from a copy
+            if (!arg->is_pending()) release_rendezvous(arg);
             //world->am.nrecv++;  // Must be AFTER execution of the function
             w->am.nrecv++;  // Must be AFTER execution of the function
         }
 
+        /// No. of messages set aside by wait_for_rendezvous (only used by the RMI thread)
+        static std::size_t nrendezvous_waiting;
+
+        /// Returns true if a copy of arg, from src in COMM_WORLD, was set aside to wait for rendezvous arrays
+
+        /// A message waits if its arrays are yet to arrive or if earlier
+        /// messages from src are still waiting.
+        static bool wait_for_rendezvous(ProcessID src, const AmArg* arg);
+
+        /// Progress hook that runs messages set aside once their arrays have arrived
+        static void dispatch_waiting();
+
+        /// This handles all incoming RMI messages for all instances
+        static void handler(void *buf, std::size_t nbyte) {
+            AmArg* arg = static_cast<AmArg*>(buf);
+            MADNESS_ASSERT(arg->size() + sizeof(AmArg) == nbyte);
+            dispatch(arg);
+        }
+
+        /// This handles incoming bundles of coalesced messages
+        static void bundle_handler(void *buf, std::size_t nbyte);
+
+        /// Rounds the size of a message in a bundle up to BUNDLE_ALIGN
+        static std::size_t bundle_entry_size(const AmArg* arg) {
+            return (arg->size() + sizeof(AmArg) + BUNDLE_ALIGN - 1) & ~(BUNDLE_ALIGN - 1);
+        }
+
+        /// Sends nbyte bytes of arg in a managed buffer ... arg is freed once the send completes
+        void send_managed(ProcessID dest, const AmArg* arg, std::size_t nbyte,
+                rmi_handlerT func, const int attr)
+        {
+            // Map dest from world's communicator to comm_world
+            dest = map_to_comm_world[dest];
+
+            lock();    // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+            // Wait for oldest request to complete
+            while (!send_req[cur_msg].Test()) {
+                // If the oldest message has still not completed then there is likely
+                // severe network or end-point congestion, so pause for 100us in a rather
+                // arbitrary attempt to decrease the injection rate.  The server thread
+                // is still polling every 1us (which is required to suck data off the net
+                // and by some engines to ensure progress on sends).
+                myusleep(100);
+            }
+
+            AmArg* old = take_managed_send_buf(cur_msg);
+            const int i = cur_msg;
+            cur_msg = (cur_msg + 1) % nsend;
+
+            send_req[i] = RMI::isend(arg, nbyte, dest, func, attr);
+            managed_send_buf[i] = (AmArg*)(arg);
+            unlock();  // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+
+            // The completed buffer goes back to the pool without holding the lock
+            if (old) free_am_arg(old);
+        }
+
+        /// Posts the rendezvous arrays of arg to dest and records their tags in arg
+        void post_rendezvous(ProcessID dest, AmArg* arg);
+
+        /// Copies arg into the bundle for dest (whose lock we hold) and frees arg
+        void add_to_bundle(ProcessID dest, Bundle& b, const AmArg* arg);
+
+        /// Sends the bundle for dest (whose lock we hold)
+        void send_bundle(ProcessID dest, Bundle& b);
+
+        /// Sends bundles whose first message is at least age seconds old ... skips busy ones
+        void flush_older_than(double age);
+
+        friend void flush_coalesced_am();
+
+        /// Progress hook for the RMI server thread
+        static void flush_all_expired();
+
+        /// Releases arrays whose rendezvous sends have completed (all of them if wait)
+        static void test_rendezvous_sends(bool wait);
+
     public:
         WorldAmInterface(World& world);
 
+        /// Frees the rendezvous arrays of a received message that its handler did not deserialize
+
+        /// Called once the handler of \c arg has returned, which for a
+        /// message set aside by WorldObject is when it runs from the copy.
+        static void release_rendezvous(const AmArg* arg);
+
         virtual ~WorldAmInterface();
 
         /// Currently a noop
@@ -273,47 +707,59 @@ namespace madness {
                 argx->set_src(rank);
                 argx->set_func(op);
                 argx->clear_flags(); // Is this the right place for this?
+                argx->nrv = 0;       // Set by post_rendezvous if it has arrays
             }
 
             MADNESS_ASSERT(arg->get_world());
             MADNESS_ASSERT(arg->get_func());
 
-            // Map dest from world's communicator to comm_world
-            dest = map_to_comm_world[dest];
+            __sync_fetch_and_add(&nsent, 1ul);
 
-            lock();    // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-            nsent++;
+            if (arg->rv) post_rendezvous(dest, const_cast<AmArg*>(arg));
 
-            // Wait for oldest request to complete
-            while (!send_req[cur_msg].Test()) {
-                // If the oldest message has still not completed then there is likely
-                // severe network or end-point congestion, so pause for 100us in a rather
-                // arbitrary attempt to decrease the injection rate.  The server thread
-                // is still polling every 1us (which is required to suck data off the net
-                // and by some engines to ensure progress on sends).
-                myusleep(100);
+            if (coalesce_max) {
+                Bundle& b = bundles[dest];
+                ScopedMutex<Spinlock> hold(b);
+                if (arg->size() <= coalesce_max) {
+                    add_to_bundle(dest, b, arg);
+                    return;
+                }
+                // Preserve order ... earlier small messages go first
+                if (b.arg) send_bundle(dest, b);
+                __sync_fetch_and_add(&stats.nraw, uint64_t(1));
+                send_managed(dest, arg, arg->size()+sizeof(AmArg), handler, attr);
+                return;
             }
 
-            free_managed_send_buf(cur_msg);
-            const int i = cur_msg;
-            cur_msg = (cur_msg + 1) % nsend;
-
-            send_req[i] = RMI::isend(arg, arg->size()+sizeof(AmArg), dest, handler, attr);
-            managed_send_buf[i] = (AmArg*)(arg);
-            unlock();  // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+            __sync_fetch_and_add(&stats.nraw, uint64_t(1));
+            send_managed(dest, arg, arg->size()+sizeof(AmArg), handler, attr);
         }
 
+        /// Sends all partially filled bundles of coalesced messages
+        void flush();
+
+        /// Returns true if small messages are being coalesced
+        bool is_coalescing() const { return coalesce_max != 0; }
+
+        /// Returns coalescing statistics
+        const WorldAmStats& get_stats() const { return stats; }
+
         /// Frees as many send buffers as possible
         void free_managed_buffers() {
+            test_rendezvous_sends(false);
             ScopedArray<int> ind(new int[nsend]);
+            ScopedArray<AmArg*> done(new AmArg*[nsend]);
+            int ndone = 0;
             lock(); // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
             int n = SafeMPI::Request::Testsome(nsend, send_req.get(), ind.get());
             if (n != MPI_UNDEFINED) {
                 for (int i=0; i<n; ++i) {
-                    free_managed_send_buf(ind[i]);
+                    AmArg* old = take_managed_send_buf(ind[i]);
+                    if (old) done[ndone++] = old;
                 }
             }
             unlock(); // <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
+            for (int i=0; i<ndone; ++i) free_am_arg(done[i]);
         }
 
 //        RMI::Request isend(ProcessID dest, am_handlerT op, const AmArg* arg, int attr) {
@@ -45,10 +45,16 @@
 */
 
 #include <madness/world/parar.h>
+#include <madness/world/idxparar.h>
 #include <madness/world/worldhashmap.h>
 #include <madness/world/mpiar.h>
 #include <madness/world/world_object.h>
+#include <algorithm>
+#include <cstring>
+#include <map>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 namespace madness {
 
@@ -64,14 +70,150 @@ namespace madness {
     template <typename keyT>
     class WorldDCPmapInterface;
 
+    namespace detail {
+        template <typename keyT>
+        class DCRedistributeSorter;
+    }
+
     template <typename keyT>
     class WorldDCRedistributeInterface {
     public:
         virtual void redistribute_phase1(const std::shared_ptr< WorldDCPmapInterface<keyT> >& newmap) = 0;
         virtual void redistribute_phase2() = 0;
+        /// Id shared by all instances of the container (used to address bulk messages)
+        virtual const uniqueidT& redistribute_id() const = 0;
+        /// Moves the data listed by redistribute_phase1 through \c sorter
+        virtual void redistribute_send(detail::DCRedistributeSorter<keyT>& sorter) = 0;
+        /// Inserts \c n items read from \c ar (counterpart of redistribute_send)
+        virtual void redistribute_recv(const archive::BufferInputArchive& ar, std::size_t n) = 0;
 	virtual ~WorldDCRedistributeInterface() {};
     };
 
+    namespace detail {
+
+        /// Packs the data moved by WorldDCPmapInterface::redistribute_streaming into bulk messages
+
+        /// As in BinSorter, items going to a process are appended to a
+        /// buffer that is sent once it reaches the largest AM message.
+        /// The items of all containers share the buffers; a buffer holds
+        /// runs of items of one container, each headed by the container
+        /// id and the number of items.  Messages arriving before this
+        /// process has made its sorter wait in the WorldObject pending
+        /// queue, so that they are not inserted while the containers are
+        /// still being scanned.
+        template <typename keyT>
+        class DCRedistributeSorter : public WorldObject< DCRedistributeSorter<keyT> > {
+        public:
+            typedef WorldDCRedistributeInterface<keyT>* ptrT;
+
+        private:
+            typedef DCRedistributeSorter<keyT> sorterT;
+            static const std::size_t npos = ~std::size_t(0);
+
+            World& world;
+            const std::vector<ptrT> targets;               ///< Containers being redistributed
+            std::size_t bufsize;                           ///< Buffer bytes that trigger a send
+            std::vector< std::vector<unsigned char> > bins; ///< Buffer per process
+            std::vector<std::size_t> run;                  ///< Offset of the item count of the open run (or npos)
+            std::vector<uniqueidT> runid;                  ///< Container of the open run
+            std::size_t nitem;                             ///< Items sent
+            std::size_t nmsg;                              ///< Messages sent
+
+            void flush(ProcessID p) {
+                if (bins[p].size()) {
+                    this->send(p, &sorterT::sorter, bins[p]);
+                    bins[p].clear();
+                    ++nmsg;
+                }
+                run[p] = npos;
+            }
+
+            /// Appends the serialization of \c t to the buffer for \c p
+            template <typename T>
+            void append(ProcessID p, const T& t) {
+                archive::BufferOutputArchive count;
+                count & t;
+                std::vector<unsigned char>& bin = bins[p];
+                const std::size_t n = bin.size();
+                bin.resize(n + count.size());
+                archive::BufferOutputArchive ar(&bin[n], count.size());
+                ar & t;
+            }
+
+            void sorter(const std::vector<unsigned char>& buf) {
+                archive::BufferInputArchive ar(&buf[0], buf.size());
+                while (ar.nbyte_avail()) {
+                    uniqueidT id;
+                    std::size_t n;
+                    ar & id & n;
+                    target(id)->redistribute_recv(ar, n);
+                }
+            }
+
+            ptrT target(const uniqueidT& id) const {
+                for (std::size_t i=0; i<targets.size(); ++i) {
+                    if (targets[i]->redistribute_id() == id) return targets[i];
+                }
+                MADNESS_EXCEPTION("DCRedistributeSorter: data for a container not being redistributed", 0);
+                return 0;
+            }
+
+        public:
+            /// Constructs the sorter (collective)
+
+            /// @param[in] world The world, which must outlive the sorter
+            /// @param[in] targets The containers being redistributed, the same on every process
+            DCRedistributeSorter(World& world, const std::vector<ptrT>& targets)
+                : WorldObject<sorterT>(world)
+                , world(world)
+                , targets(targets)
+                , bufsize(RMI::max_msg_len()-1024)
+                , bins(world.size())
+                , run(world.size(), std::size_t(npos))
+                , runid(world.size())
+                , nitem(0)
+                , nmsg(0)
+            {
+                WorldObject<sorterT>::process_pending();
+            }
+
+            virtual ~DCRedistributeSorter() {}
+
+            /// Adds an item of container \c id for process \c p
+            template <typename T>
+            void insert(ProcessID p, const uniqueidT& id, const T& item) {
+                if (run[p] == npos || !(runid[p] == id)) {
+                    append(p, id);
+                    run[p] = bins[p].size();
+                    runid[p] = id;
+                    append(p, std::size_t(0));
+                }
+                append(p, item);
+                std::size_t n;
+                std::memcpy(&n, &bins[p][run[p]], sizeof(n));
+                ++n;
+                std::memcpy(&bins[p][run[p]], &n, sizeof(n));
+                ++nitem;
+                if (bins[p].size() >= bufsize) flush(p);
+            }
+
+            /// Sends what is left in the buffers and fences, after which all data has arrived
+            void finish() {
+                for (int i=0; i<world.size(); i++) {
+                    flush(i);
+                    MADNESS_ASSERT(bins[i].size() == 0);
+                }
+                world.gop.fence();
+            }
+
+            /// Returns the number of items sent by this process
+            std::size_t get_nitem() const { return nitem; }
+
+            /// Returns the number of messages sent by this process
+            std::size_t get_nmsg() const { return nmsg; }
+        };
+    }
+
 
     /// Interface to be provided by any process map
 
@@ -130,6 +272,45 @@ namespace madness {
             ptrs.clear();
             world.gop.fence();
         }
+
+        /// Like redistribute() but moves the data in bulk with a single fence
+
+        /// Rather than sending each item on its own, the items of all
+        /// registered containers going to a process are packed together
+        /// into a few large messages (see detail::DCRedistributeSorter),
+        /// and there is only the fence at the end instead of three.
+        /// No operations on the registered containers may be in progress
+        /// on entry, as is the case right after a fence (e.g., after
+        /// LoadBalanceDeux::load_balance()).
+        /// @param[in] world The associated world
+        /// @param[in] newpmap The new process map
+        void redistribute_streaming(World& world, const std::shared_ptr< WorldDCPmapInterface<keyT> >& newpmap) {
+            // Every process must see the containers in the same order
+            std::vector<ptrT> targets(ptrs.begin(), ptrs.end());
+            std::sort(targets.begin(), targets.end(), redistribute_id_less);
+            for (std::size_t i=0; i<targets.size(); ++i) {
+                targets[i]->redistribute_phase1(newpmap);
+            }
+            {
+                detail::DCRedistributeSorter<keyT> sorter(world, targets);
+                for (std::size_t i=0; i<targets.size(); ++i) {
+                    targets[i]->redistribute_send(sorter);
+                }
+                sorter.finish();
+            }
+            for (std::size_t i=0; i<targets.size(); ++i) {
+                newpmap->register_callback(targets[i]);
+            }
+            ptrs.clear();
+        }
+
+    private:
+        static bool redistribute_id_less(ptrT a, ptrT b) {
+            const uniqueidT& ida = a->redistribute_id();
+            const uniqueidT& idb = b->redistribute_id();
+            if (ida.get_world_id() != idb.get_world_id()) return ida.get_world_id() < idb.get_world_id();
+            return ida.get_obj_id() < idb.get_obj_id();
+        }
     };
 
     /// Default process map is "random" using madness::hash(key)
@@ -258,6 +439,16 @@ namespace madness {
             return value != NULL;
         }
 
+        /// Moves a local iterator to the start of the next hash bin if that is at most \c nmax entries on
+
+        /// Returns the no. of entries moved over (always zero for a
+        /// cached value).  This lets Range split container iterations
+        /// between bins.
+        int align_to_bin(int nmax) {
+            if (is_cached()) return 0;
+            return it.align_to_bin(nmax);
+        }
+
         template <typename Archive>
         void serialize(const Archive&) {
             MADNESS_EXCEPTION("Serializing DC iterator ... why?", false);
@@ -282,6 +473,21 @@ namespace madness {
         }
     };
 
+    /// Counters for the read cache of a distributed container (see WorldContainer::set_read_cache())
+    struct WorldContainerCacheStats {
+        unsigned long nhit;       ///< Remote finds answered from the cache
+        unsigned long nmiss;      ///< Remote finds sent to the owner
+        unsigned long nfull;      ///< Misses not cached because the cache was full
+        unsigned long nevict;     ///< Replies dropped from the cache for exceeding the cap
+        unsigned long ninvalidate;///< Times a non-empty cache was emptied
+        std::size_t nentry;       ///< Entries now cached
+        std::size_t nbyte;        ///< Bytes now charged to the cache
+
+        WorldContainerCacheStats()
+            : nhit(0), nmiss(0), nfull(0), nevict(0), ninvalidate(0), nentry(0), nbyte(0) {}
+    };
+
+
     /// Internal implementation of distributed container to facilitate shallow copy
 
     /// \ingroup worlddc
@@ -289,6 +495,7 @@ namespace madness {
     class WorldContainerImpl
         : public WorldObject< WorldContainerImpl<keyT, valueT, hashfunT> >
         , public WorldDCRedistributeInterface<keyT>
+        , public FenceCleanupInterface
 #ifndef MADNESS_DISABLE_SHARED_FROM_THIS
         , public std::enable_shared_from_this<WorldContainerImpl<keyT, valueT, hashfunT> >
 #endif // MADNESS_DISABLE_SHARED_FROM_THIS
@@ -299,7 +506,11 @@ namespace madness {
         typedef const pairT const_pairT;
         typedef WorldContainerImpl<keyT,valueT,hashfunT> implT;
 
+#ifdef MADNESS_USE_OPEN_HASHMAP
+        typedef ConcurrentOpenHashMap< keyT,valueT,hashfunT > internal_containerT;
+#else
         typedef ConcurrentHashMap< keyT,valueT,hashfunT > internal_containerT;
+#endif
 
 	//typedef WorldObject< WorldContainerImpl<keyT, valueT, hashfunT> > worldobjT;
 
@@ -366,6 +577,137 @@ namespace madness {
             return None;
         }
 
+        /// Futures waiting on one batched find request
+        typedef std::vector< Future<iterator> > find_batchT;
+
+        /// Handles a batched find request, answering all keys in one reply
+        Void find_batch_handler(ProcessID requestor, const std::vector<keyT>& keys,
+                                const RemoteReference<find_batchT>& ref) {
+            std::vector<unsigned char> found(keys.size(), 0);
+            std::vector< std::pair<keyT,valueT> > data;
+            data.reserve(keys.size());
+            for (std::size_t i=0; i<keys.size(); ++i) {
+                internal_iteratorT r = local.find(keys[i]);
+                if (r != local.end()) {
+                    found[i] = 1;
+                    data.push_back(std::pair<keyT,valueT>(r->first, r->second));
+                }
+            }
+            this->send(requestor, &implT::find_batch_reply_handler, ref, found, data);
+            return None;
+        }
+
+        /// Handles the reply to a batched find, in the order requested
+        Void find_batch_reply_handler(const RemoteReference<find_batchT>& ref,
+                                      const std::vector<unsigned char>& found,
+                                      const std::vector< std::pair<keyT,valueT> >& data) {
+            find_batchT& futures = *ref.get();
+            MADNESS_ASSERT(futures.size() == found.size());
+            std::size_t j = 0;
+            for (std::size_t i=0; i<found.size(); ++i) {
+                if (found[i]) {
+                    futures[i].set(iterator(pairT(data[j].first, data[j].second)));
+                    ++j;
+                }
+                else {
+                    futures[i].set(end());
+                }
+            }
+            return None;
+        }
+
+        /// Entry of the read cache
+        struct read_cache_entryT {
+            Future<iterator> f;     ///< Result of the remote find
+            unsigned long ticket;   ///< Identifies this entry to its ReadCacheCharge
+            std::size_t nbyte;      ///< Bytes charged once the reply arrived (0 until then)
+        };
+
+        /// Remote find results kept for reuse, keyed by key
+        typedef std::unordered_map< keyT, read_cache_entryT, hashfunT > read_cacheT;
+
+        mutable Spinlock read_cache_mutex;       ///< Guards all read cache state
+        read_cacheT read_cache;                  ///< Cached remote find results
+        std::size_t read_cache_max;              ///< Byte cap of the cache (0 = disabled)
+        unsigned long read_cache_ticket;         ///< Ticket of the latest entry
+        WorldContainerCacheStats read_cache_stats; ///< Counters (nentry is filled on demand)
+
+        /// Charges a cached find result to the cache when its reply arrives
+
+        /// The serialized size of the reply stands in for the memory it
+        /// holds.  A result that takes the cache over its cap is dropped
+        /// from the cache (the future itself remains valid).
+        class ReadCacheCharge : public CallbackInterface {
+            implT* impl;
+            const keyT key;
+            const Future<iterator> f;
+            const unsigned long ticket;
+        public:
+            ReadCacheCharge(implT* impl, const keyT& key, const Future<iterator>& f, unsigned long ticket)
+                : impl(impl), key(key), f(f), ticket(ticket) {}
+
+            void notify() {
+                const iterator& it = f.get();
+                std::size_t nbyte = sizeof(typename read_cacheT::value_type) + sizeof(FutureImpl<iterator>);
+                if (it != impl->end()) {
+                    archive::BufferOutputArchive count;
+                    count & it->first & it->second;
+                    nbyte += count.size();
+                }
+                impl->charge_read_cache(key, nbyte, ticket);
+                delete this;
+            }
+        };
+
+        void charge_read_cache(const keyT& key, std::size_t nbyte, unsigned long ticket) {
+            ScopedMutex<Spinlock> hold(read_cache_mutex);
+            typename read_cacheT::iterator it = read_cache.find(key);
+            if (it == read_cache.end() || it->second.ticket != ticket) return; // Invalidated since the request
+            if (read_cache_stats.nbyte + nbyte > read_cache_max) {
+                read_cache.erase(it);
+                ++read_cache_stats.nevict;
+            }
+            else {
+                it->second.nbyte = nbyte;
+                read_cache_stats.nbyte += nbyte;
+                mem_tag_alloc(MEM_CACHE, nbyte);
+            }
+        }
+
+        /// Empties the read cache (caller holds read_cache_mutex)
+        void clear_read_cache_locked() {
+            if (!read_cache.empty()) {
+                read_cache.clear();
+                ++read_cache_stats.ninvalidate;
+            }
+            mem_tag_free(MEM_CACHE, read_cache_stats.nbyte);
+            read_cache_stats.nbyte = 0;
+        }
+
+        /// Looks up a remote key in the read cache (caller holds read_cache_mutex)
+
+        /// On a miss \c result is entered in the cache unless it is full, and
+        /// false is returned so that the caller sends the request (after
+        /// releasing the lock).
+        bool read_cache_lookup(const keyT& key, Future<iterator>& result) {
+            typename read_cacheT::const_iterator it = read_cache.find(key);
+            if (it != read_cache.end()) {
+                ++read_cache_stats.nhit;
+                result = it->second.f;
+                return true;
+            }
+            ++read_cache_stats.nmiss;
+            if (read_cache_stats.nbyte < read_cache_max) {
+                read_cache_entryT entry = { result, ++read_cache_ticket, 0 };
+                read_cache.insert(std::make_pair(key, entry));
+                result.register_callback(new ReadCacheCharge(this, key, result, entry.ticket));
+            }
+            else {
+                ++read_cache_stats.nfull;
+            }
+            return false;
+        }
+
     public:
 
         WorldContainerImpl(World& world,
@@ -374,12 +716,31 @@ namespace madness {
                 : WorldObject< WorldContainerImpl<keyT, valueT, hashfunT> >(world)
                 , pmap(pm)
                 , me(world.mpi.rank())
-                , local(5011, hf) {
+                , local(5011, hf)
+                , read_cache(16, hf)
+                , read_cache_max(0)
+                , read_cache_ticket(0) {
             pmap->register_callback(this);
+            world.gop.add_fence_cleanup(this);
         }
 
         virtual ~WorldContainerImpl() {
+            this->get_world().gop.remove_fence_cleanup(this);
             pmap->deregister_callback(this);
+            ScopedMutex<Spinlock> hold(read_cache_mutex);
+            clear_read_cache_locked();
+        }
+
+        /// Local work at the end of every fence (see FenceCleanupInterface)
+
+        /// Remote items may have changed, so the read cache is emptied.
+        /// No tasks or AM can be using the local map, so the tables it
+        /// left behind when bins were rehashed are freed.
+        void fence_cleanup() {
+            invalidate_read_cache();
+#ifdef MADNESS_USE_OPEN_HASHMAP
+            local.reclaim();
+#endif
         }
 
         const std::shared_ptr< WorldDCPmapInterface<keyT> >& get_pmap() const {
@@ -396,6 +757,18 @@ namespace madness {
             return pmap->owner(key);
         }
 
+        /// Adds the hash bin of \c key to \c attr as a locality hint
+
+        /// With the NUMA-aware scheduler, tasks on items in the same bin then
+        /// run on the same NUMA node, so that the data they allocate (e.g.,
+        /// tensor coefficients) is first touched on that node.  A hint
+        /// already set by the caller is kept.
+        TaskAttributes locality(const keyT& key, TaskAttributes attr) const {
+            if (attr.get_locality() < 0 && ThreadPool::is_numa())
+                attr.set_locality(local.bin_of(key));
+            return attr;
+        }
+
         bool probe(const keyT& key) const {
             ProcessID dest = owner(key);
             if (dest == me)
@@ -408,6 +781,45 @@ namespace madness {
             return local.size();
         }
 
+        /// Enables (max_bytes > 0) or disables the read cache, emptying it
+        void set_read_cache(std::size_t max_bytes) {
+            ScopedMutex<Spinlock> hold(read_cache_mutex);
+            clear_read_cache_locked();
+            read_cache_max = max_bytes;
+        }
+
+        /// Empties the read cache if it is enabled
+        void invalidate_read_cache() {
+            if (read_cache_max) {
+                ScopedMutex<Spinlock> hold(read_cache_mutex);
+                clear_read_cache_locked();
+            }
+        }
+
+        /// Drops \c key from the read cache if it is enabled
+
+        /// Called by every operation of this process that modifies a
+        /// remote item, so that its own updates are seen by later finds.
+        /// Local items are never cached.
+        void invalidate_read_cache(const keyT& key) {
+            if (read_cache_max) {
+                ScopedMutex<Spinlock> hold(read_cache_mutex);
+                typename read_cacheT::iterator it = read_cache.find(key);
+                if (it != read_cache.end()) {
+                    read_cache_stats.nbyte -= it->second.nbyte;
+                    mem_tag_free(MEM_CACHE, it->second.nbyte);
+                    read_cache.erase(it);
+                }
+            }
+        }
+
+        WorldContainerCacheStats get_read_cache_stats() const {
+            ScopedMutex<Spinlock> hold(read_cache_mutex);
+            WorldContainerCacheStats result = read_cache_stats;
+            result.nentry = read_cache.size();
+            return result;
+        }
+
         Void insert(const pairT& datum) {
             ProcessID dest = owner(datum.first);
             if (dest == me) {
@@ -417,6 +829,7 @@ namespace madness {
                 acc->second = datum.second;
             }
             else {
+                invalidate_read_cache(datum.first);
                 this->send(dest, &implT::insert, datum);
             }
             return None;
@@ -433,6 +846,7 @@ namespace madness {
         }
 
         void clear() {
+            invalidate_read_cache();
             local.clear();
         }
 
@@ -443,6 +857,7 @@ namespace madness {
                 local.erase(key);
             }
             else {
+                invalidate_read_cache(key);
                 Void(implT::*eraser)(const keyT&) = &implT::erase;
                 this->send(dest, eraser, key);
             }
@@ -499,11 +914,69 @@ namespace madness {
                 return Future<iterator>(iterator(local.find(key)));
             } else {
                 Future<iterator> result;
+                if (read_cache_max) {
+                    ScopedMutex<Spinlock> hold(read_cache_mutex);
+                    if (read_cache_lookup(key, result)) return result;
+                }
                 this->send(dest, &implT::find_handler, me, key, result.remote_ref(this->get_world()));
                 return result;
             }
         }
 
+        std::vector< Future<const_iterator> > find(const std::vector<keyT>& keys) const {
+            // Same ugliness as for the single key find
+            std::vector< Future<iterator> > r = const_cast<implT*>(this)->find(keys);
+            return *(std::vector< Future<const_iterator> >*)(&r);
+        }
+
+
+        std::vector< Future<iterator> > find(const std::vector<keyT>& keys) {
+            std::vector< Future<iterator> > result(keys.size());
+
+            // Local keys are looked up now, remote keys sorted by owner
+            std::map<ProcessID, std::vector<std::size_t> > remote;
+            for (std::size_t i=0; i<keys.size(); ++i) {
+                ProcessID dest = owner(keys[i]);
+                if (dest == me)
+                    result[i] = Future<iterator>(iterator(local.find(keys[i])));
+                else
+                    remote[dest].push_back(i);
+            }
+
+            // Remote keys found in the read cache are not requested
+            if (read_cache_max && !remote.empty()) {
+                ScopedMutex<Spinlock> hold(read_cache_mutex);
+                for (typename std::map<ProcessID, std::vector<std::size_t> >::iterator it = remote.begin();
+                     it != remote.end(); ) {
+                    std::vector<std::size_t>& index = it->second;
+                    std::size_t n = 0;
+                    for (std::size_t i=0; i<index.size(); ++i) {
+                        if (!read_cache_lookup(keys[index[i]], result[index[i]]))
+                            index[n++] = index[i];
+                    }
+                    index.resize(n);
+                    if (n) ++it;
+                    else remote.erase(it++);
+                }
+            }
+
+            // One request per owner, whose reply sets its futures in order
+            for (typename std::map<ProcessID, std::vector<std::size_t> >::const_iterator it = remote.begin();
+                 it != remote.end(); ++it) {
+                const std::vector<std::size_t>& index = it->second;
+                std::shared_ptr<find_batchT> batch(new find_batchT(index.size()));
+                std::vector<keyT> batch_keys;
+                batch_keys.reserve(index.size());
+                for (std::size_t i=0; i<index.size(); ++i) {
+                    batch_keys.push_back(keys[index[i]]);
+                    (*batch)[i] = result[index[i]];
+                }
+                this->send(it->first, &implT::find_batch_handler, me, batch_keys,
+                           RemoteReference<find_batchT>(this->get_world(), batch));
+            }
+            return result;
+        }
+
         bool find(accessor& acc, const keyT& key) {
             if (owner(key) != me) return false;
             return local.find(acc,key);
@@ -591,6 +1064,7 @@ namespace madness {
 
         // First phase of redistributions changes pmap and makes list of stuff to move
         void redistribute_phase1(const std::shared_ptr< WorldDCPmapInterface<keyT> >& newpmap) {
+            invalidate_read_cache();
             pmap = newpmap;
             move_list = new std::vector<keyT>();
             for (typename internal_containerT::iterator iter=local.begin(); iter!=local.end(); ++iter) {
@@ -598,6 +1072,33 @@ namespace madness {
             }
         }
 
+        const uniqueidT& redistribute_id() const {
+            return this->id();
+        }
+
+        // Streaming alternative to redistribute_phase2, packing the data to move in bulk
+        void redistribute_send(detail::DCRedistributeSorter<keyT>& sorter) {
+            std::vector<keyT>& mvlist = *move_list;
+            for (unsigned int i=0; i<mvlist.size(); ++i) {
+                typename internal_containerT::iterator iter = local.find(mvlist[i]);
+                MADNESS_ASSERT(iter != local.end());
+                sorter.insert(owner(iter->first), this->id(), *iter);
+                local.erase(iter);
+            }
+            delete move_list;
+        }
+
+        void redistribute_recv(const archive::BufferInputArchive& ar, std::size_t n) {
+            for (std::size_t i=0; i<n; ++i) {
+                keyT key;
+                ar & key;
+                MADNESS_ASSERT(owner(key) == me);
+                accessor acc;
+                local.insert(acc, key);
+                ar & acc->second;
+            }
+        }
+
         // Second phase moves data and cleans up
         void redistribute_phase2() {
             std::vector<keyT>& mvlist = *move_list;
@@ -826,6 +1327,61 @@ namespace madness {
         }
 
 
+        /// Returns future iterators for many keys at once (non-blocking communication)
+
+        /// Keys owned by this process are looked up immediately.  The
+        /// rest are grouped by owner into one request and one reply per
+        /// process, which is far cheaper than a find() per key when many
+        /// keys live on the same process.  The futures are in the same
+        /// order as \c keys.
+        std::vector< Future<iterator> > find(const std::vector<keyT>& keys) {
+            check_initialized();
+            return p->find(keys);
+        }
+
+
+        /// Returns future iterators for many keys at once (non-blocking communication)
+
+        /// See the non-const version.
+        std::vector< Future<const_iterator> > find(const std::vector<keyT>& keys) const {
+            check_initialized();
+            return const_cast<const implT*>(p.get())->find(keys);
+        }
+
+
+        /// Keeps the results of remote finds on this process for reuse (no communication)
+
+        /// With \c max_bytes > 0, later finds of the same remote key
+        /// return the cached future instead of sending a message, which
+        /// pays off when many tasks read the same neighbours.  Cached data
+        /// is read-only and may be stale: a modification by another
+        /// process is seen only after the next fence, which empties the
+        /// cache.  Modifications of remote items made by this process
+        /// (replace(), erase(), send(), task()) drop the item from the
+        /// cache immediately.  Once the replies held reach \c max_bytes
+        /// (measured by their serialized size, and charged to MEM_CACHE)
+        /// further misses are not cached.  Zero disables the cache, which
+        /// is the default.
+        void set_read_cache(std::size_t max_bytes) {
+            check_initialized();
+            p->set_read_cache(max_bytes);
+        }
+
+
+        /// Empties the read cache of this process (no communication)
+        void clear_read_cache() {
+            check_initialized();
+            p->invalidate_read_cache();
+        }
+
+
+        /// Returns the hit/miss counters of the read cache on this process (no communication)
+        WorldContainerCacheStats get_read_cache_stats() const {
+            check_initialized();
+            return p->get_read_cache_stats();
+        }
+
+
         /// Returns an iterator to the beginning of the \em local data (no communication)
         iterator begin() {
             check_initialized();
@@ -926,6 +1482,7 @@ namespace madness {
         Future< MEMFUN_RETURNT(memfunT) >
         send(const keyT& key, memfunT memfun) {
             check_initialized();
+            p->invalidate_read_cache(key);
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT) = &implT:: template itemfun<memfunT>;
             return p->send(owner(key), itemfun, key, memfun);
         }
@@ -944,6 +1501,7 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         send(const keyT& key, const memfunT& memfun, const arg1T& arg1) {
             check_initialized();
+            p->invalidate_read_cache(key);
             // To work around bug in g++ 4.3.* use static cast as alternative mechanism to force type deduction
             MEMFUN_RETURNT(memfunT) (implT::*itemfun)(const keyT&, memfunT, const arg1T&) = &implT:: template itemfun<memfunT,arg1T>;
             return p->send(owner(key), itemfun, key, memfun, arg1);
@@ -966,6 +1524,7 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         send(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2) {
             check_initialized();
+            p->invalidate_read_cache(key);
             // To work around bug in g++ 4.3.* use static cast as alternative mechanism to force type deduction
             MEMFUN_RETURNT(memfunT) (implT::*itemfun)(const keyT&, memfunT, const arg1T&, const arg2T&) = &implT:: template itemfun<memfunT,arg1T,arg2T>;
             return p->send(owner(key), itemfun, key, memfun, arg1, arg2);
@@ -987,6 +1546,7 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         send(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3) {
             check_initialized();
+            p->invalidate_read_cache(key);
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const arg1T&, const arg2T&, const arg3T&) = &implT:: template itemfun<memfunT,arg1T,arg2T,arg3T>;
             return p->send(owner(key), itemfun, key, memfun, arg1, arg2, arg3);
         }
@@ -1005,6 +1565,7 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         send(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3, const arg4T& arg4) {
             check_initialized();
+            p->invalidate_read_cache(key);
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const arg1T&, const arg2T&, const arg3T&, const arg4T&) = &implT:: template itemfun<memfunT,arg1T,arg2T,arg3T,arg4T>;
             return p->send(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4);
         }
@@ -1023,6 +1584,7 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         send(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3, const arg4T& arg4, const arg5T& arg5) {
             check_initialized();
+            p->invalidate_read_cache(key);
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const arg1T&, const arg2T&, const arg3T&, const arg4T&, const arg5T&) = &implT:: template itemfun<memfunT,arg1T,arg2T,arg3T,arg4T,arg5T>;
             return p->send(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5);
         }
@@ -1041,6 +1603,7 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         send(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3, const arg4T& arg4, const arg5T& arg5, const arg6T& arg6) {
             check_initialized();
+            p->invalidate_read_cache(key);
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const arg1T&, const arg2T&, const arg3T&, const arg4T&, const arg5T&, const arg6T&) = &implT:: template itemfun<memfunT,arg1T,arg2T,arg3T,arg4T,arg5T,arg6T>;
             return p->send(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6);
         }
@@ -1060,6 +1623,7 @@ namespace madness {
         send(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3, const arg4T& arg4,
 		     const arg5T& arg5, const arg6T& arg6, const arg7T& arg7) {
             check_initialized();
+            p->invalidate_read_cache(key);
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const arg1T&, const arg2T&, const arg3T&, const arg4T&, const arg5T&, const arg6T&, const arg7T&) = &implT:: template itemfun<memfunT,arg1T,arg2T,arg3T,arg4T,arg5T,arg6T,arg7T>;
             return p->send(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6, arg7);
         }
@@ -1155,8 +1719,9 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         task(const keyT& key, memfunT memfun, const TaskAttributes& attr = TaskAttributes()) {
             check_initialized();
+            p->invalidate_read_cache(key);
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT) = &implT:: template itemfun<memfunT>;
-            return p->task(owner(key), itemfun, key, memfun, attr);
+            return p->task(owner(key), itemfun, key, memfun, p->locality(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T)" in process owning item (non-blocking comm if remote)
@@ -1173,9 +1738,10 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         task(const keyT& key, memfunT memfun, const arg1T& arg1, const TaskAttributes& attr = TaskAttributes()) {
             check_initialized();
+            p->invalidate_read_cache(key);
             typedef REMFUTURE(arg1T) a1T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&) = &implT:: template itemfun<memfunT,a1T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, p->locality(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T)" in process owning item (non-blocking comm if remote)
@@ -1192,10 +1758,11 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         task(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const TaskAttributes& attr = TaskAttributes()) {
             check_initialized();
+            p->invalidate_read_cache(key);
             typedef REMFUTURE(arg1T) a1T;
             typedef REMFUTURE(arg2T) a2T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&) = &implT:: template itemfun<memfunT,a1T,a2T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, p->locality(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T)" in process owning item (non-blocking comm if remote)
@@ -1212,11 +1779,12 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         task(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3, const TaskAttributes& attr = TaskAttributes()) {
             check_initialized();
+            p->invalidate_read_cache(key);
             typedef REMFUTURE(arg1T) a1T;
             typedef REMFUTURE(arg2T) a2T;
             typedef REMFUTURE(arg3T) a3T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, p->locality(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T,arg4T)" in process owning item (non-blocking comm if remote)
@@ -1233,12 +1801,13 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         task(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3, const arg4T& arg4, const TaskAttributes& attr = TaskAttributes()) {
             check_initialized();
+            p->invalidate_read_cache(key);
             typedef REMFUTURE(arg1T) a1T;
             typedef REMFUTURE(arg2T) a2T;
             typedef REMFUTURE(arg3T) a3T;
             typedef REMFUTURE(arg4T) a4T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&, const a4T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T,a4T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, p->locality(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T,arg4T,arg5T)" in process owning item (non-blocking comm if remote)
@@ -1255,13 +1824,14 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         task(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3, const arg4T& arg4, const arg5T& arg5, const TaskAttributes& attr = TaskAttributes()) {
             check_initialized();
+            p->invalidate_read_cache(key);
             typedef REMFUTURE(arg1T) a1T;
             typedef REMFUTURE(arg2T) a2T;
             typedef REMFUTURE(arg3T) a3T;
             typedef REMFUTURE(arg4T) a4T;
             typedef REMFUTURE(arg5T) a5T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&, const a4T&, const a5T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T,a4T,a5T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, p->locality(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T,arg4T,arg5T,arg6T)" in process owning item (non-blocking comm if remote)
@@ -1278,6 +1848,7 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         task(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3, const arg4T& arg4, const arg5T& arg5, const arg6T& arg6, const TaskAttributes& attr = TaskAttributes()) {
             check_initialized();
+            p->invalidate_read_cache(key);
             typedef REMFUTURE(arg1T) a1T;
             typedef REMFUTURE(arg2T) a2T;
             typedef REMFUTURE(arg3T) a3T;
@@ -1285,7 +1856,7 @@ namespace madness {
             typedef REMFUTURE(arg5T) a5T;
             typedef REMFUTURE(arg6T) a6T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&, const a4T&, const a5T&, const a6T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T,a4T,a5T,a6T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6, p->locality(key, attr));
         }
 
         /// Adds task "resultT memfun(arg1T,arg2T,arg3T,arg4T,arg5T,arg6T,arg7T)" in process owning item (non-blocking comm if remote)
@@ -1302,6 +1873,7 @@ namespace madness {
         Future< REMFUTURE(MEMFUN_RETURNT(memfunT)) >
         task(const keyT& key, memfunT memfun, const arg1T& arg1, const arg2T& arg2, const arg3T& arg3, const arg4T& arg4, const arg5T& arg5, const arg6T& arg6, const arg7T& arg7, const TaskAttributes& attr = TaskAttributes()) {
             check_initialized();
+            p->invalidate_read_cache(key);
             typedef REMFUTURE(arg1T) a1T;
             typedef REMFUTURE(arg2T) a2T;
             typedef REMFUTURE(arg3T) a3T;
@@ -1310,7 +1882,7 @@ namespace madness {
             typedef REMFUTURE(arg6T) a6T;
             typedef REMFUTURE(arg7T) a7T;
             MEMFUN_RETURNT(memfunT)(implT::*itemfun)(const keyT&, memfunT, const a1T&, const a2T&, const a3T&, const a4T&, const a5T&, const a6T&, const a7T&) = &implT:: template itemfun<memfunT,a1T,a2T,a3T,a4T,a5T,a6T,a7T>;
-            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6, arg7, attr);
+            return p->task(owner(key), itemfun, key, memfun, arg1, arg2, arg3, arg4, arg5, arg6, arg7, p->locality(key, attr));
         }
 
         /// Adds task "resultT memfun() const" in process owning item (non-blocking comm if remote)
@@ -1562,6 +2134,160 @@ namespace madness {
                 if (ar.dofence()) world->gop.fence();
             }
         };
+
+        /// Write container to indexed parallel archive with optional fence
+
+        /// \ingroup worlddc
+        /// A first pass over the local values only counts the bytes of
+        /// the data, of the index and of each index block.  An exclusive
+        /// prefix sum of these gives every process the offsets of its own
+        /// regions, and a second pass serializes the values and index
+        /// entries through buffers of bounded size written with pwrite.
+        /// Process zero also writes the block header.  See
+        /// BaseIndexedParallelArchive for the layout of the block.
+        template <class keyT, class valueT>
+        struct ArchiveStoreImpl< IndexedParallelOutputArchive, WorldContainer<keyT,valueT> > {
+            static void store(const IndexedParallelOutputArchive& ar, const WorldContainer<keyT,valueT>& t) {
+                typedef WorldContainer<keyT,valueT> dcT;
+                typedef typename dcT::const_iterator iterator;
+                const uint64_t IDXBLOCK = IndexedParallelOutputArchive::IDXBLOCK;
+                World* world = ar.get_world();
+                const ProcessID me = world->rank();
+                PositionedFileOutputArchive& localar = ar.local_archive();
+                if (ar.dofence()) world->gop.fence();
+
+                // Sizes of my data, index, entries and index blocks
+                uint64_t mine[4] = {0, 0, 0, 0};
+                std::vector<uint64_t> blockbytes;
+                for (iterator it=t.begin(); it!=t.end(); ++it) {
+                    BufferOutputArchive data, index;
+                    data & it->second;
+                    index & it->first & uint64_t(0) & uint64_t(0);
+                    if (mine[2]%IDXBLOCK == 0) blockbytes.push_back(0);
+                    blockbytes.back() += index.size();
+                    mine[0] += data.size();
+                    mine[1] += index.size();
+                    ++mine[2];
+                }
+                mine[3] = blockbytes.size();
+
+                uint64_t before[4], total[4];
+                std::copy(mine, mine+4, before);
+                std::copy(mine, mine+4, total);
+                world->gop.exclusive_sum(before, 4);
+                world->gop.sum(total, 4);
+
+                uint64_t start = localar.tell();
+                world->gop.broadcast(start, 0);
+                const uint64_t header[5] = {IndexedParallelOutputArchive::magic, total[0], total[1], total[2], total[3]};
+                const uint64_t datastart = start + sizeof(header);
+                const uint64_t indexstart = datastart + total[0];
+                const uint64_t blockstart = indexstart + total[1];
+
+                // Index entries hold absolute offsets so the reader need not know the writer
+                PositionedChunkWriter data(localar, datastart + before[0]);
+                PositionedChunkWriter index(localar, indexstart + before[1]);
+                std::vector<uint64_t> blocks(3*blockbytes.size());
+                uint64_t i = 0;
+                for (iterator it=t.begin(); it!=t.end(); ++it, ++i) {
+                    if (i%IDXBLOCK == 0) {
+                        uint64_t* block = &blocks[3*(i/IDXBLOCK)];
+                        block[0] = index.tell();
+                        block[1] = blockbytes[i/IDXBLOCK];
+                        block[2] = std::min(IDXBLOCK, mine[2] - i);
+                    }
+                    const uint64_t offset = data.tell();
+                    const uint64_t nbyte = data.store(it->second);
+                    index.store(it->first, offset, nbyte);
+                }
+                MADNESS_ASSERT(i == mine[2]);
+                data.flush();
+                index.flush();
+                MADNESS_ASSERT(data.tell() == datastart + before[0] + mine[0]);
+                MADNESS_ASSERT(index.tell() == indexstart + before[1] + mine[1]);
+
+                if (me == 0) localar.write_at(header, sizeof(header), start);
+                if (blocks.size()) localar.write_at(&blocks[0], blocks.size()*sizeof(uint64_t), blockstart + 3*sizeof(uint64_t)*before[3]);
+                localar.seek(blockstart + 3*sizeof(uint64_t)*total[3]);
+
+                if (ar.dofence()) world->gop.fence();
+            }
+        };
+
+        template <class keyT, class valueT>
+        struct ArchiveLoadImpl< IndexedParallelInputArchive, WorldContainer<keyT,valueT> > {
+            /// Read container from indexed parallel archive
+
+            /// \ingroup worlddc
+            /// Every process scans the index one block at a time and
+            /// reads only the values it owns under the process map of
+            /// \c t, fetching neighbouring values with one pread, and
+            /// inserts them locally.  Hence no values are forwarded and the
+            /// number of processes need not match that used to write the
+            /// archive.
+            static void load(const IndexedParallelInputArchive& ar, WorldContainer<keyT,valueT>& t) {
+                World* world = ar.get_world();
+                const ProcessID me = world->rank();
+                PositionedFileInputArchive& localar = ar.local_archive();
+                if (ar.dofence()) world->gop.fence();
+
+                uint64_t start = localar.tell();
+                world->gop.broadcast(start, 0);
+                uint64_t header[5];
+                localar.read_at(header, sizeof(header), start);
+                MADNESS_ASSERT(header[0] == IndexedParallelInputArchive::magic);
+                const uint64_t datastart = start + sizeof(header);
+                const uint64_t blockstart = datastart + header[1] + header[2];
+
+                std::vector<uint64_t> blocks(3*header[4]);
+                if (blocks.size()) localar.read_at(&blocks[0], blocks.size()*sizeof(uint64_t), blockstart);
+
+                const std::size_t CHUNK = PositionedChunkReader::CHUNK;
+                const std::size_t GAP = PositionedChunkReader::GAP;
+                PositionedChunkReader values(localar, datastart + header[1]);
+                std::vector<unsigned char> index;
+                std::vector<keyT> keys;
+                std::vector<uint64_t> where; // (offset, nbyte) of the values of keys
+                for (uint64_t b=0; b<header[4]; ++b) {
+                    const uint64_t* block = &blocks[3*b];
+                    index.resize(block[1]);
+                    if (block[1]) localar.read_at(&index[0], block[1], block[0]);
+                    BufferInputArchive indexar(index.size() ? &index[0] : 0, index.size());
+                    keys.clear();
+                    where.clear();
+                    for (uint64_t i=0; i<block[2]; ++i) {
+                        keyT key;
+                        uint64_t offset = 0, nbyte = 0;
+                        indexar & key & offset & nbyte;
+                        if (t.owner(key) != me) continue;
+                        keys.push_back(key);
+                        where.push_back(offset);
+                        where.push_back(nbyte);
+                    }
+
+                    // The values of a block were written in order by one process
+                    for (std::size_t i=0; i<keys.size(); ) {
+                        const uint64_t first = where[2*i];
+                        uint64_t last = first + where[2*i+1];
+                        std::size_t j = i + 1;
+                        while (j < keys.size() && where[2*j] >= last && where[2*j] - last <= GAP &&
+                               where[2*j] + where[2*j+1] - first <= CHUNK) {
+                            last = where[2*j] + where[2*j+1];
+                            ++j;
+                        }
+                        if (last - first <= CHUNK) values.fetch(first, last - first);
+                        for (; i<j; ++i) {
+                            valueT value;
+                            values.load(where[2*i], where[2*i+1], value);
+                            t.replace(keys[i], value); // Local since we own the key
+                        }
+                    }
+                }
+                localar.seek(blockstart + 3*sizeof(uint64_t)*header[4]);
+
+                if (ar.dofence()) world->gop.fence();
+            }
+        };
     }
 
 }
@@ -34,8 +34,367 @@
 #ifdef MADNESS_HAS_GOOGLE_PERF_MINIMAL
 #include <gperftools/malloc_extension.h>
 #endif
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 namespace madness {
 
+    namespace {
+
+        /// Fence timings by call site, guarded by fence_stats_lock
+        Spinlock fence_stats_lock;
+        std::map<std::string, FenceSiteStats> fence_site_stats;
+
+        /// Fences started by fence_begin that the RMI thread is advancing
+        Spinlock split_fence_lock;
+        std::vector<detail::SplitFence*> split_fences;
+
+        void record_fence(const char* file, int line, double wait, double elapsed) {
+            // Just the file name keeps the report readable
+            const char* base = file;
+            for (const char* p = file; *p; ++p)
+                if (*p == '/') base = p + 1;
+            std::ostringstream site;
+            site << base << ":" << line;
+
+            ScopedMutex<Spinlock> hold(fence_stats_lock);
+            FenceSiteStats& s = fence_site_stats[site.str()];
+            if (s.nfence == 0) s.site = site.str();
+            ++s.nfence;
+            s.wait += wait;
+            s.elapsed += elapsed;
+            s.max_wait = std::max(s.max_wait, wait);
+        }
+
+        bool larger_wait(const FenceSiteStats& a, const FenceSiteStats& b) {
+            return a.wait > b.wait;
+        }
+
+        /// Probe for World::await() on a flag in shared memory
+        struct SharedFlagProbe {
+            const volatile uint64_t* flag;
+            uint64_t value;
+            SharedFlagProbe(const volatile uint64_t* flag, uint64_t value)
+                : flag(flag), value(value) {}
+            bool operator()() const { return *flag == value; }
+        };
+
+        int nnode_segment = 0; ///< Makes the names of shared segments unique
+
+    } // namespace
+
+
+    namespace detail {
+
+        /// The termination algorithm of WorldGopInterface::fence() as a state machine
+
+        /// Each call to progress() advances as far as it can without
+        /// blocking, testing rather than waiting on each message, and
+        /// reports whether the fence is complete.  It is called by the
+        /// RMI server thread and by the thread waiting in fence_end().
+        struct SplitFence : private Spinlock {
+            enum {RECV_CHILDREN, QUIESCE, SEND_PARENT, RECV_RESULT, SEND_RESULT, DONE};
+
+            World& world;
+            ProcessID parent, child0, child1;
+            Tag gfence_tag, bcast_tag;
+            int phase;
+            uint64_t sum0[2], sum1[2], sum[2];
+            uint64_t nsent_prev, nrecv_prev;
+            SafeMPI::Request req0, req1;
+            Future<bool> done;
+            const char* file;
+            int line;
+            double start;
+
+            SplitFence(World& world, const char* file, int line)
+                : world(world)
+                , phase(RECV_CHILDREN)
+                , nsent_prev(0)
+                , nrecv_prev(1) // invalid initial condition
+                , file(file)
+                , line(line)
+                , start(wall_time())
+            {
+                world.mpi.binary_tree_info(0, parent, child0, child1);
+                // Tags are taken here, in program order, so other
+                // collectives started before fence_end() still match up
+                gfence_tag = world.mpi.unique_tag();
+                bcast_tag = world.mpi.unique_tag();
+                post_recv_children();
+            }
+
+            void post_recv_children() {
+                sum0[0] = sum0[1] = sum1[0] = sum1[1] = 0;
+                if (child0 != -1) req0 = world.mpi.Irecv((void*) &sum0, sizeof(sum0), MPI_BYTE, child0, gfence_tag);
+                if (child1 != -1) req1 = world.mpi.Irecv((void*) &sum1, sizeof(sum1), MPI_BYTE, child1, gfence_tag);
+                phase = RECV_CHILDREN;
+            }
+
+            /// True if no tasks are pending and the AM counts are steady
+            bool quiescent(uint64_t& nsent, uint64_t& nrecv) {
+                world.am.flush(); // Send any coalesced messages
+                const uint64_t ntask1 = world.taskq.size();
+                const uint64_t nsent1 = world.am.nsent;
+                const uint64_t nrecv1 = world.am.nrecv;
+                __asm__ __volatile__ (" " : : : "memory");
+                const uint64_t ntask2 = world.taskq.size();
+                nsent = world.am.nsent;
+                nrecv = world.am.nrecv;
+                __asm__ __volatile__ (" " : : : "memory");
+                return (ntask2==0) && (ntask1==0) && (nsent1==nsent) && (nrecv1==nrecv);
+            }
+
+            bool progress() {
+                if (phase == DONE) return true;
+                if (!try_lock()) return false;
+                for (bool moved = true; moved; ) {
+                    moved = false;
+                    switch (phase) {
+                    case RECV_CHILDREN:
+                        if ((child0 == -1 || req0.Test()) && (child1 == -1 || req1.Test())) {
+                            phase = QUIESCE;
+                            moved = true;
+                        }
+                        break;
+
+                    case QUIESCE:
+                        {
+                            uint64_t nsent, nrecv;
+                            if (quiescent(nsent, nrecv)) {
+                                sum[0] = sum0[0] + sum1[0] + nsent;
+                                sum[1] = sum0[1] + sum1[1] + nrecv;
+                                if (parent != -1) {
+                                    req0 = world.mpi.Isend(&sum, sizeof(sum), MPI_BYTE, parent, gfence_tag);
+                                    phase = SEND_PARENT;
+                                }
+                                else {
+                                    phase = RECV_RESULT;
+                                }
+                                moved = true;
+                            }
+                        }
+                        break;
+
+                    case SEND_PARENT:
+                        if (req0.Test()) {
+                            req0 = world.mpi.Irecv(&sum, sizeof(sum), MPI_BYTE, parent, bcast_tag);
+                            phase = RECV_RESULT;
+                            moved = true;
+                        }
+                        break;
+
+                    case RECV_RESULT:
+                        if (parent == -1 || req0.Test()) {
+                            if (child0 != -1) req0 = world.mpi.Isend(&sum, sizeof(sum), MPI_BYTE, child0, bcast_tag);
+                            if (child1 != -1) req1 = world.mpi.Isend(&sum, sizeof(sum), MPI_BYTE, child1, bcast_tag);
+                            phase = SEND_RESULT;
+                            moved = true;
+                        }
+                        break;
+
+                    case SEND_RESULT:
+                        if ((child0 == -1 || req0.Test()) && (child1 == -1 || req1.Test())) {
+                            if (sum[0]==sum[1] && sum[0]==nsent_prev && sum[1]==nrecv_prev) {
+                                phase = DONE;
+                                done.set(true);
+                            }
+                            else {
+                                nsent_prev = sum[0];
+                                nrecv_prev = sum[1];
+                                post_recv_children();
+                                moved = true;
+                            }
+                        }
+                        break;
+                    }
+                }
+                const bool finished = (phase == DONE);
+                unlock();
+                return finished;
+            }
+        };
+
+        GopNode* GopNode::create(SafeMPI::Intracomm& comm) {
+            const int nproc = comm.Get_size();
+            const int me = comm.Get_rank();
+            if (nproc == 1) return 0;
+
+#if MPI_VERSION >= 3
+            // Options come from process 0 so that everyone agrees
+            long opt[3] = {1, 0, 65536}; // enabled, ranks per node, slot bytes
+            if (me == 0) {
+                const char* mad_gop_node = getenv("MAD_GOP_NODE");
+                if (mad_gop_node) {
+                    std::stringstream ss(mad_gop_node);
+                    ss >> opt[0];
+                }
+                const char* mad_ranks_per_node = getenv("MAD_GOP_RANKS_PER_NODE");
+                if (mad_ranks_per_node) {
+                    std::stringstream ss(mad_ranks_per_node);
+                    ss >> opt[1];
+                    if (opt[1] < 0) opt[1] = 0;
+                }
+                const char* mad_shm_bytes = getenv("MAD_GOP_SHM_BYTES");
+                if (mad_shm_bytes) {
+                    std::stringstream ss(mad_shm_bytes);
+                    ss >> opt[2];
+                    if (opt[2] < 64) {
+                        opt[2] = 64;
+                        std::cerr << "!!! WARNING: MAD_GOP_SHM_BYTES must be at least 64.\n"
+                                  << "!!! WARNING: Increasing MAD_GOP_SHM_BYTES to 64.\n";
+                    }
+                }
+            }
+            comm.Bcast(opt, 3, MPI_LONG, 0);
+            if (!opt[0]) return 0;
+
+            SafeMPI::Intracomm shared = comm.Split_type(MPI_COMM_TYPE_SHARED, me);
+            SafeMPI::Intracomm node = (opt[1] > 0) ? shared.Split(me/opt[1], me) : shared;
+            const int nlocal = node.Get_size();
+            const int lrank = node.Get_rank();
+
+            // Nothing to gain with one process per node
+            int maxlocal = nlocal;
+            comm.Allreduce(&nlocal, &maxlocal, 1, MPI_INT, MPI_MAX);
+            if (maxlocal == 1) return 0;
+
+            GopNode* p = new GopNode;
+            p->nlocal_ = nlocal;
+            p->lrank_ = lrank;
+            p->nbyte_ = ((opt[2] + 63)/64)*64; // Keeps every slot aligned
+            p->stride_ = sizeof(SlotHeader) + p->nbyte_;
+            p->size_ = nlocal*p->stride_;
+
+            // The leader makes the segment, the others map it by name,
+            // and it is unlinked as soon as everyone has it open
+            char name[64] = {0};
+            int ok = 0;
+            if (lrank == 0) {
+                snprintf(name, sizeof(name), "/madness_gop_%d_%d", int(getpid()), nnode_segment++);
+                int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+                if (fd >= 0) {
+                    if (ftruncate(fd, p->size_) == 0) {
+                        void* base = mmap(0, p->size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                        if (base != MAP_FAILED) {
+                            p->base_ = static_cast<char*>(base); // Zero filled by ftruncate
+                            ok = 1;
+                        }
+                    }
+                    close(fd);
+                    if (!ok) shm_unlink(name);
+                }
+                if (!ok) name[0] = 0;
+            }
+            node.Bcast(name, sizeof(name), MPI_CHAR, 0);
+            if (lrank != 0 && name[0]) {
+                int fd = shm_open(name, O_RDWR, 0600);
+                if (fd >= 0) {
+                    void* base = mmap(0, p->size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                    if (base != MAP_FAILED) {
+                        p->base_ = static_cast<char*>(base);
+                        ok = 1;
+                    }
+                    close(fd);
+                }
+            }
+            node.Barrier();
+            if (lrank == 0 && name[0]) shm_unlink(name);
+
+            int allok = ok;
+            comm.Allreduce(&ok, &allok, 1, MPI_INT, MPI_MIN);
+            if (!allok) {
+                if (me == 0)
+                    std::cerr << "!!! WARNING: could not map shared memory for collectives.\n"
+                              << "!!! WARNING: Using a binary tree over all processes.\n";
+                delete p;
+                return 0;
+            }
+
+            // Leaders ranked in world order, so process 0 is the root
+            SafeMPI::Intracomm leaders = comm.Split(lrank == 0 ? 0 : 1, me);
+            if (lrank == 0) {
+                const int nleader = leaders.Get_size();
+                std::vector<int> mine(nleader, 0), all(nleader, 0);
+                mine[leaders.Get_rank()] = me;
+                leaders.Allreduce(&mine[0], &all[0], nleader, MPI_INT, MPI_SUM);
+                p->leaders_.assign(all.begin(), all.end());
+                p->ileader_ = leaders.Get_rank();
+            }
+            return p;
+#else
+            return 0;
+#endif // MPI_VERSION >= 3
+        }
+
+        GopNode::~GopNode() {
+            if (base_) munmap(base_, size_);
+        }
+
+        void GopNode::leader_tree_info(ProcessID& parent, ProcessID& child0, ProcessID& child1) const {
+            parent = child0 = child1 = -1;
+            if (ileader_ < 0) return;
+            const int nleader = leaders_.size();
+            if (ileader_ > 0) parent = leaders_[(ileader_ - 1)/2];
+            if (2*ileader_ + 1 < nleader) child0 = leaders_[2*ileader_ + 1];
+            if (2*ileader_ + 2 < nleader) child1 = leaders_[2*ileader_ + 2];
+        }
+
+        void GopNode::post(const void* buf, std::size_t nbyte, uint64_t s) {
+            MADNESS_ASSERT(nbyte <= nbyte_);
+            memcpy(data(lrank_), buf, nbyte);
+            __sync_synchronize();
+            header(lrank_).seq = s;
+        }
+
+        const void* GopNode::contribution(int i, uint64_t s, bool dowork) {
+            World::await(SharedFlagProbe(&header(i).seq, s), dowork);
+            __sync_synchronize();
+            return data(i);
+        }
+
+        void GopNode::publish(const void* buf, std::size_t nbyte, uint64_t s, bool dowork) {
+            MADNESS_ASSERT(nbyte <= nbyte_);
+            // Everyone must have copied out the previous result
+            for (int i=1; i<nlocal_; ++i)
+                World::await(SharedFlagProbe(&header(i).ack, s-1), dowork);
+            memcpy(data(0), buf, nbyte);
+            __sync_synchronize();
+            header(0).seq = s;
+        }
+
+        void GopNode::fetch(void* buf, std::size_t nbyte, uint64_t s, bool dowork) {
+            World::await(SharedFlagProbe(&header(0).seq, s), dowork);
+            __sync_synchronize();
+            memcpy(buf, data(0), nbyte);
+            __sync_synchronize();
+            header(lrank_).ack = s;
+        }
+
+        /// Probe for World::await() in fence_end
+        struct SplitFenceProbe {
+            SplitFence* f;
+            SplitFenceProbe(SplitFence* f) : f(f) {}
+            bool operator()() const { return f->progress(); }
+        };
+
+        /// RMI progress hook that advances every fence in progress
+        void progress_split_fences() {
+            if (!split_fence_lock.try_lock()) return;
+            for (std::size_t i=0; i<split_fences.size(); ++i)
+                split_fences[i]->progress();
+            split_fence_lock.unlock();
+        }
+
+    } // namespace detail
+
 
     /// Synchronizes all processes in communicator AND globally ensures no pending AM or tasks
 
@@ -46,8 +405,10 @@ namespace madness {
     /// constant over two traversals.  We are then we are sure
     /// that all tasks and AM are processed and there no AM in
     /// flight.
-    void WorldGopInterface::fence() {
+    void WorldGopInterface::fence(const char* file, int line) {
         PROFILE_MEMBER_FUNC(WorldGopInterface);
+        if (split_fence_) MADNESS_EXCEPTION("fence: fence_begin() has not been matched by fence_end()", 0);
+        const double start = wall_time();
         unsigned long nsent_prev=0, nrecv_prev=1; // invalid initial condition
         SafeMPI::Request req0, req1;
         ProcessID parent, child0, child1;
@@ -70,6 +431,7 @@ namespace madness {
             uint64_t ntask1, nsent1, nrecv1, ntask2, nsent2, nrecv2;
             do {
                 world_.taskq.fence();
+                world_.am.flush(); // Send any coalesced messages
 
                 // Since the number of outstanding tasks and number of AM sent/recv
                 // don't share a critical section read each twice and ensure they
@@ -128,8 +490,22 @@ namespace madness {
             nrecv_prev = sum[1];
 
         };
+        fence_cleanup();
+        const double stop = wall_time();
+        if (Timeline::enabled()) Timeline::record(Timeline::FENCE, start, stop, file, line);
+        record_fence(file, line, stop - start, stop - start);
+    }
+
+
+    /// Local work done at the end of every fence
+    void WorldGopInterface::fence_cleanup() {
         world_.am.free_managed_buffers(); // free up communication buffers
         deferred_->do_cleanup();
+        {
+            ScopedMutex<Spinlock> hold(fence_cleanups_lock_);
+            for (std::size_t i=0; i<fence_cleanups_.size(); ++i) fence_cleanups_[i]->fence_cleanup();
+        }
+        ++nfence_;
 #ifdef MADNESS_HAS_GOOGLE_PERF_MINIMAL
         MallocExtension::instance()->ReleaseFreeMemory();
 //        print("clearing memory");
@@ -137,15 +513,66 @@ namespace madness {
     }
 
 
+    Future<bool> WorldGopInterface::fence_begin(const char* file, int line) {
+        PROFILE_MEMBER_FUNC(WorldGopInterface);
+        if (split_fence_) MADNESS_EXCEPTION("fence_begin: a fence is already in progress", 0);
+        split_fence_ = new detail::SplitFence(world_, file, line);
+        {
+            ScopedMutex<Spinlock> hold(split_fence_lock);
+            split_fences.push_back(split_fence_);
+        }
+        RMI::add_progress_hook(&detail::progress_split_fences);
+        return split_fence_->done;
+    }
+
+
+    void WorldGopInterface::fence_end() {
+        PROFILE_MEMBER_FUNC(WorldGopInterface);
+        detail::SplitFence* f = split_fence_;
+        if (!f) MADNESS_EXCEPTION("fence_end: no fence in progress", 0);
+        const double start = wall_time();
+        World::await(detail::SplitFenceProbe(f));
+        {
+            // Once removed the RMI thread no longer touches it
+            ScopedMutex<Spinlock> hold(split_fence_lock);
+            split_fences.erase(std::find(split_fences.begin(), split_fences.end(), f));
+        }
+        split_fence_ = 0;
+        fence_cleanup();
+        const double end = wall_time();
+        if (Timeline::enabled()) Timeline::record(Timeline::FENCE, start, end, f->file, f->line);
+        record_fence(f->file, f->line, end - start, end - f->start);
+        delete f;
+    }
+
+
+    std::vector<FenceSiteStats> WorldGopInterface::fence_stats() {
+        std::vector<FenceSiteStats> result;
+        {
+            ScopedMutex<Spinlock> hold(fence_stats_lock);
+            for (std::map<std::string, FenceSiteStats>::const_iterator it = fence_site_stats.begin();
+                 it != fence_site_stats.end(); ++it)
+                result.push_back(it->second);
+        }
+        std::stable_sort(result.begin(), result.end(), larger_wait);
+        return result;
+    }
+
+
     /// Broadcasts bytes from process root while still processing AM & tasks
 
     /// Optimizations can be added for long messages
     void WorldGopInterface::broadcast(void* buf, size_t nbyte, ProcessID root, bool dowork, Tag bcast_tag) {
+        if(bcast_tag < 0)
+            bcast_tag = world_.mpi.unique_tag();
+        if (node_ && root == 0) {
+            node_broadcast(buf, nbyte, dowork, bcast_tag);
+            return;
+        }
+
         SafeMPI::Request req0, req1;
         ProcessID parent, child0, child1;
         world_.mpi.binary_tree_info(root, parent, child0, child1);
-        if(bcast_tag < 0)
-            bcast_tag = world_.mpi.unique_tag();
 
         //print("BCAST TAG", bcast_tag);
 
@@ -161,4 +588,32 @@ namespace madness {
         if (child1 != -1) World::await(req1, dowork);
     }
 
+
+    void WorldGopInterface::node_broadcast(void* buf, size_t nbyte, bool dowork, Tag bcast_tag) {
+        detail::GopNode& node = *node_;
+        ProcessID parent, child0, child1;
+        node.leader_tree_info(parent, child0, child1);
+        char* cbuf = static_cast<char*>(buf);
+
+        for (size_t off=0; off<nbyte; off+=node.max_bytes()) {
+            const size_t n = std::min(node.max_bytes(), nbyte-off);
+            const uint64_t s = node.next();
+            if (node.is_leader()) {
+                SafeMPI::Request req0, req1;
+                if (parent != -1) {
+                    req0 = world_.mpi.Irecv(cbuf+off, n, MPI_BYTE, parent, bcast_tag);
+                    World::await(req0, dowork);
+                }
+                if (child0 != -1) req0 = world_.mpi.Isend(cbuf+off, n, MPI_BYTE, child0, bcast_tag);
+                if (child1 != -1) req1 = world_.mpi.Isend(cbuf+off, n, MPI_BYTE, child1, bcast_tag);
+                node.publish(cbuf+off, n, s, dowork);
+                if (child0 != -1) World::await(req0, dowork);
+                if (child1 != -1) World::await(req1, dowork);
+            }
+            else {
+                node.fetch(cbuf+off, n, s, dowork);
+            }
+        }
+    }
+
 } // namespace madness
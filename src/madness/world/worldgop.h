@@ -49,6 +49,10 @@
 #include <madness/world/world_task_queue.h>
 #include <madness/world/group.h>
 #include <madness/world/dist_cache.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 
 namespace madness {
@@ -60,9 +64,32 @@ namespace madness {
     namespace detail {
 
         class DeferredCleanup;
+        struct SplitFence;
 
     }  // namespace detail
 
+// Default arguments that capture the caller's file and line, so fences
+// can be timed per call site without changing every caller
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER) && \
+    (!defined(__clang__) || __clang_major__ >= 9)
+#define MADNESS_CALLER_FILE __builtin_FILE()
+#define MADNESS_CALLER_LINE __builtin_LINE()
+#else
+#define MADNESS_CALLER_FILE "unknown"
+#define MADNESS_CALLER_LINE 0
+#endif
+
+    /// Fence timings accumulated for one call site (file:line)
+    struct FenceSiteStats {
+        std::string site;       ///< File name and line of the call
+        unsigned long nfence;   ///< No. of fences
+        double wait;            ///< Total wall time the caller was blocked
+        double max_wait;        ///< Longest single wait
+        double elapsed;         ///< Total wall time from start to completion
+
+        FenceSiteStats() : nfence(0), wait(0.0), max_wait(0.0), elapsed(0.0) {}
+    };
+
     template <typename T>
     struct WorldSumOp {
         inline T operator()(const T& a, const T& b) const {
@@ -141,6 +168,107 @@ namespace madness {
     };
 
 
+    namespace detail {
+
+        /// The processes of a world that share a node, for two-level collectives
+
+        /// Each node elects its lowest rank as leader.  Contributions are
+        /// combined on the node through a shared-memory segment holding one
+        /// slot per local process, the leaders combine theirs over a binary
+        /// tree, and each leader then publishes the result in its own slot
+        /// for the others to copy out.  Every shared-memory step is stamped
+        /// with a sequence number, which all processes advance in step
+        /// since collectives are called in the same order everywhere.
+        class GopNode {
+            /// Flags at the head of a slot, padded to a cache line
+            struct SlotHeader {
+                volatile uint64_t seq;  ///< Step whose data is in the slot
+                volatile uint64_t ack;  ///< Last step whose result was copied out
+                char pad[48];
+            };
+
+            std::vector<ProcessID> leaders_; ///< World ranks of the leaders (leaders only)
+            int ileader_;               ///< Index among the leaders (-1 if not a leader)
+            int nlocal_;                ///< No. of processes on this node
+            int lrank_;                 ///< Rank on this node (0 is the leader)
+            std::size_t nbyte_;         ///< Bytes of data in each slot
+            std::size_t stride_;        ///< Bytes between slots
+            char* base_;                ///< The mapped segment
+            std::size_t size_;          ///< Length of the segment
+            uint64_t seq_;              ///< Last step started
+
+            GopNode() : ileader_(-1), nlocal_(0), lrank_(0), nbyte_(0), stride_(0),
+                        base_(0), size_(0), seq_(0) {}
+
+            GopNode(const GopNode&);
+            GopNode& operator=(const GopNode&);
+
+            SlotHeader& header(int i) const {
+                return *reinterpret_cast<SlotHeader*>(base_ + i*stride_);
+            }
+
+            char* data(int i) const {
+                return base_ + i*stride_ + sizeof(SlotHeader);
+            }
+
+        public:
+            /// Discovers the node layout and maps the segment (collective)
+
+            /// Returns null on every process if collectives would not
+            /// gain from it (one process, or one process per node), if
+            /// disabled by MAD_GOP_NODE=0, or if any node could not set
+            /// up its segment.  MAD_GOP_RANKS_PER_NODE=n further divides
+            /// each node into groups of n consecutive ranks, which lets
+            /// the inter-node steps be tested on one machine.
+            /// MAD_GOP_SHM_BYTES sets the data bytes per slot (default
+            /// 64K); longer messages are processed in pieces.
+            static GopNode* create(SafeMPI::Intracomm& comm);
+
+            ~GopNode();
+
+            /// True on the node leader
+            bool is_leader() const { return lrank_ == 0; }
+
+            /// No. of processes on this node
+            int nlocal() const { return nlocal_; }
+
+            /// Largest number of bytes combined in one step
+            std::size_t max_bytes() const { return nbyte_; }
+
+            /// Binary tree over the leaders rooted at rank 0 (world ranks, -1 if none)
+            void leader_tree_info(ProcessID& parent, ProcessID& child0, ProcessID& child1) const;
+
+            /// Starts a step, returning its sequence number
+            uint64_t next() { return ++seq_; }
+
+            /// Non-leader puts its contribution to step \c s in its slot
+            void post(const void* buf, std::size_t nbyte, uint64_t s);
+
+            /// Leader waits for local process \c i to post step \c s and returns its data
+            const void* contribution(int i, uint64_t s, bool dowork = true);
+
+            /// Leader publishes the result of step \c s to the node
+            void publish(const void* buf, std::size_t nbyte, uint64_t s, bool dowork = true);
+
+            /// Non-leader waits for and copies out the result of step \c s
+            void fetch(void* buf, std::size_t nbyte, uint64_t s, bool dowork = true);
+        };
+
+    } // namespace detail
+
+
+    /// Local state that is tidied up at the end of every fence
+
+    /// See WorldGopInterface::add_fence_cleanup.
+    class FenceCleanupInterface {
+    public:
+        virtual ~FenceCleanupInterface() {}
+
+        /// Called by the fencing thread once all tasks and AM of the world are done
+        virtual void fence_cleanup() = 0;
+    };
+
+
     /// Provides collectives that interoperate with the AM and task interfaces
 
     /// If native AM interoperates with MPI we probably should map these to MPI.
@@ -149,9 +277,119 @@ namespace madness {
         World& world_; ///< MPI interface
         std::shared_ptr<detail::DeferredCleanup> deferred_; ///< Deferred cleanup object.
         bool debug_; ///< Debug mode
+        detail::SplitFence* split_fence_; ///< Fence started by fence_begin (or null)
+        detail::GopNode* node_; ///< Node layout for two-level collectives (or null)
+        volatile unsigned long nfence_; ///< Number of fences completed
+        Spinlock fence_cleanups_lock_; ///< Guards fence_cleanups_
+        std::vector<FenceCleanupInterface*> fence_cleanups_; ///< Called at the end of every fence
 
         friend class detail::DeferredCleanup;
 
+        /// Local work done at the end of every fence
+        void fence_cleanup();
+
+        /// Two-level broadcast from process 0
+        void node_broadcast(void* buf, size_t nbyte, bool dowork, Tag bcast_tag);
+
+        /// Two-level inplace global reduction
+        template <typename T, class opT>
+        void node_reduce(T* buf, size_t nelem, opT op) {
+            detail::GopNode& node = *node_;
+            const size_t maxelem = std::max<size_t>(node.max_bytes()/sizeof(T), 1);
+            if (maxelem*sizeof(T) > node.max_bytes()) {
+                // Elements too big for a slot
+                flat_reduce(buf, nelem, op);
+                return;
+            }
+            ProcessID parent, child0, child1;
+            node.leader_tree_info(parent, child0, child1);
+            Tag gsum_tag = world_.mpi.unique_tag();
+
+            const size_t nbuf = std::min(nelem, maxelem);
+            T* buf0 = (child0 != -1) ? new T[nbuf] : 0;
+            T* buf1 = (child1 != -1) ? new T[nbuf] : 0;
+
+            for (size_t off=0; off<nelem; off+=maxelem) {
+                const size_t n = std::min(maxelem, nelem-off);
+                const size_t nbyte = n*sizeof(T);
+                T* b = buf + off;
+                const uint64_t s = node.next();
+
+                if (!node.is_leader()) {
+                    node.post(b, nbyte, s);
+                    node.fetch(b, nbyte, s);
+                    continue;
+                }
+
+                // Combine the node in local rank order so all leaders agree
+                for (int i=1; i<node.nlocal(); ++i) {
+                    const T* in = static_cast<const T*>(node.contribution(i, s));
+                    for (size_t j=0; j<n; ++j) b[j] = op(b[j],in[j]);
+                }
+
+                // Then the leaders, up the tree and back down
+                SafeMPI::Request req0, req1;
+                if (child0 != -1) req0 = world_.mpi.Irecv(buf0, nbyte, MPI_BYTE, child0, gsum_tag);
+                if (child1 != -1) req1 = world_.mpi.Irecv(buf1, nbyte, MPI_BYTE, child1, gsum_tag);
+                if (child0 != -1) {
+                    World::await(req0);
+                    for (size_t j=0; j<n; ++j) b[j] = op(b[j],buf0[j]);
+                }
+                if (child1 != -1) {
+                    World::await(req1);
+                    for (size_t j=0; j<n; ++j) b[j] = op(b[j],buf1[j]);
+                }
+                if (parent != -1) {
+                    req0 = world_.mpi.Isend(b, nbyte, MPI_BYTE, parent, gsum_tag);
+                    World::await(req0);
+                    req0 = world_.mpi.Irecv(b, nbyte, MPI_BYTE, parent, gsum_tag);
+                    World::await(req0);
+                }
+                if (child0 != -1) req0 = world_.mpi.Isend(b, nbyte, MPI_BYTE, child0, gsum_tag);
+                if (child1 != -1) req1 = world_.mpi.Isend(b, nbyte, MPI_BYTE, child1, gsum_tag);
+                node.publish(b, nbyte, s);
+                if (child0 != -1) World::await(req0);
+                if (child1 != -1) World::await(req1);
+            }
+
+            delete [] buf0;
+            delete [] buf1;
+        }
+
+        /// Inplace global reduction over a binary tree of all processes
+        template <typename T, class opT>
+        void flat_reduce(T* buf, size_t nelem, opT op) {
+            SafeMPI::Request req0, req1;
+            ProcessID parent, child0, child1;
+            world_.mpi.binary_tree_info(0, parent, child0, child1);
+            Tag gsum_tag = world_.mpi.unique_tag();
+
+            T* buf0 = new T[nelem];
+            T* buf1 = new T[nelem];
+
+            if (child0 != -1) req0 = world_.mpi.Irecv(buf0, nelem*sizeof(T), MPI_BYTE, child0, gsum_tag);
+            if (child1 != -1) req1 = world_.mpi.Irecv(buf1, nelem*sizeof(T), MPI_BYTE, child1, gsum_tag);
+
+            if (child0 != -1) {
+                World::await(req0);
+                for (long i=0; i<(long)nelem; ++i) buf[i] = op(buf[i],buf0[i]);
+            }
+            if (child1 != -1) {
+                World::await(req1);
+                for (long i=0; i<(long)nelem; ++i) buf[i] = op(buf[i],buf1[i]);
+            }
+
+            delete [] buf0;
+            delete [] buf1;
+
+            if (parent != -1) {
+                req0 = world_.mpi.Isend(buf, nelem*sizeof(T), MPI_BYTE, parent, gsum_tag);
+                World::await(req0);
+            }
+
+            broadcast(buf, nelem, 0);
+        }
+
         // Message tags
         struct PointToPointTag { };
         struct LazySyncTag { };
@@ -621,12 +859,14 @@ namespace madness {
 
         // In the World constructor can ONLY rely on MPI and MPI being initialized
         WorldGopInterface(World& world) :
-            world_(world), deferred_(new detail::DeferredCleanup()), debug_(false)
+            world_(world), deferred_(new detail::DeferredCleanup()), debug_(false),
+            split_fence_(0), node_(detail::GopNode::create(world.mpi.comm())), nfence_(0)
         { }
 
         ~WorldGopInterface() {
             deferred_->destroy(true);
             deferred_->do_cleanup();
+            delete node_;
         }
 
 
@@ -654,12 +894,67 @@ namespace madness {
         /// constant over two traversals.  We are then we are sure
         /// that all tasks and AM are processed and there no AM in
         /// flight.
-        void fence();
+        ///
+        /// The wait is recorded against the calling file and line (see
+        /// fence_stats()); the arguments are filled in by the compiler.
+        void fence(const char* file = MADNESS_CALLER_FILE, int line = MADNESS_CALLER_LINE);
+
+
+        /// Starts a fence that completes in the background
+
+        /// The termination algorithm of fence() is advanced by the RMI
+        /// server thread, so the caller can get on with work that neither
+        /// makes tasks or AM nor touches data being modified by them.
+        /// Tasks and AM still pending are processed by the thread pool,
+        /// and by the caller once it reaches fence_end().  Only one fence
+        /// can be in progress per world.  With a single process there is
+        /// no server thread and nothing to overlap, so the fence only
+        /// advances in fence_end().
+        /// \return Set to true once the fence is complete.  Local cleanup
+        /// (deferred destruction, freeing buffers) waits for fence_end().
+        Future<bool> fence_begin(const char* file = MADNESS_CALLER_FILE, int line = MADNESS_CALLER_LINE);
+
+
+        /// Completes the fence started by fence_begin(), waiting if necessary
+        void fence_end();
+
+
+        /// Returns the number of fences (plain or split) completed by this world
+
+        /// Data cached from other processes between two fences can be
+        /// checked for staleness by comparing counts.
+        unsigned long fence_count() const {
+            return nfence_;
+        }
+
+
+        /// Calls \c p->fence_cleanup() at the end of every fence of this world
+
+        /// \c p must be removed with remove_fence_cleanup() before it is
+        /// destroyed, and must not add or remove cleanups from its callback.
+        void add_fence_cleanup(FenceCleanupInterface* p) {
+            ScopedMutex<Spinlock> hold(fence_cleanups_lock_);
+            fence_cleanups_.push_back(p);
+        }
+
+
+        /// Stops calling \c p at fences
+        void remove_fence_cleanup(FenceCleanupInterface* p) {
+            ScopedMutex<Spinlock> hold(fence_cleanups_lock_);
+            std::vector<FenceCleanupInterface*>::iterator it =
+                    std::find(fence_cleanups_.begin(), fence_cleanups_.end(), p);
+            if (it != fence_cleanups_.end()) fence_cleanups_.erase(it);
+        }
+
+
+        /// Returns fence timings by call site on this process, largest total wait first
+        static std::vector<FenceSiteStats> fence_stats();
 
 
         /// Broadcasts bytes from process root while still processing AM & tasks
 
-        /// Optimizations can be added for long messages
+        /// Broadcasts from process 0 go in two levels when several
+        /// processes share a node (see reduce()).
         void broadcast(void* buf, size_t nbyte, ProcessID root, bool dowork = true, Tag bcast_tag = -1);
 
 
@@ -712,38 +1007,15 @@ namespace madness {
 
         /// Inplace global reduction (like MPI all_reduce) while still processing AM & tasks
 
-        /// Optimizations can be added for long messages and to reduce the memory footprint
+        /// When several processes share a node the reduction is done in
+        /// two levels (see detail::GopNode): through shared memory on
+        /// each node, then over a tree of one process per node.
         template <typename T, class opT>
         void reduce(T* buf, size_t nelem, opT op) {
-            SafeMPI::Request req0, req1;
-            ProcessID parent, child0, child1;
-            world_.mpi.binary_tree_info(0, parent, child0, child1);
-            Tag gsum_tag = world_.mpi.unique_tag();
-
-            T* buf0 = new T[nelem];
-            T* buf1 = new T[nelem];
-
-            if (child0 != -1) req0 = world_.mpi.Irecv(buf0, nelem*sizeof(T), MPI_BYTE, child0, gsum_tag);
-            if (child1 != -1) req1 = world_.mpi.Irecv(buf1, nelem*sizeof(T), MPI_BYTE, child1, gsum_tag);
-
-            if (child0 != -1) {
-                World::await(req0);
-                for (long i=0; i<(long)nelem; ++i) buf[i] = op(buf[i],buf0[i]);
-            }
-            if (child1 != -1) {
-                World::await(req1);
-                for (long i=0; i<(long)nelem; ++i) buf[i] = op(buf[i],buf1[i]);
-            }
-
-            delete [] buf0;
-            delete [] buf1;
-
-            if (parent != -1) {
-                req0 = world_.mpi.Isend(buf, nelem*sizeof(T), MPI_BYTE, parent, gsum_tag);
-                World::await(req0);
-            }
-
-            broadcast(buf, nelem, 0);
+            if (node_)
+                node_reduce(buf, nelem, op);
+            else
+                flat_reduce(buf, nelem, op);
         }
 
         /// Inplace global sum while still processing AM & tasks
@@ -825,6 +1097,42 @@ namespace madness {
             min(&a, 1);
         }
 
+        /// Inplace exclusive prefix sum over ranks (like MPI_Exscan) while still processing AM & tasks
+
+        /// On return \c buf on process \c p holds the sum of the values
+        /// on processes \c 0..p-1 (zero on process 0).  Takes log2(nproc)
+        /// rounds of point-to-point messages (recursive doubling).
+        template <typename T>
+        void exclusive_sum(T* buf, size_t nelem) {
+            const ProcessID me = world_.rank();
+            const ProcessID nproc = world_.size();
+            Tag scan_tag = world_.mpi.unique_tag();
+
+            T* partial = new T[nelem]; // Sum of the values on me-d+1..me
+            T* in = new T[nelem];
+            for (size_t i=0; i<nelem; ++i) {
+                partial[i] = buf[i];
+                buf[i] = T(0);
+            }
+
+            for (ProcessID d=1; d<nproc; d*=2) {
+                SafeMPI::Request req0, req1;
+                if (me >= d) req0 = world_.mpi.Irecv(in, nelem*sizeof(T), MPI_BYTE, me-d, scan_tag);
+                if (me+d < nproc) req1 = world_.mpi.Isend(partial, nelem*sizeof(T), MPI_BYTE, me+d, scan_tag);
+                if (me+d < nproc) World::await(req1);
+                if (me >= d) {
+                    World::await(req0);
+                    for (size_t i=0; i<nelem; ++i) {
+                        buf[i] += in[i];
+                        partial[i] += in[i];
+                    }
+                }
+            }
+
+            delete [] partial;
+            delete [] in;
+        }
+
         /// Concatenate an STL vector of serializable stuff onto node 0
         template <typename T>
         std::vector<T> concat0(const std::vector<T>& v, size_t bufsz=1024*1024) {
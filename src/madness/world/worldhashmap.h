@@ -34,7 +34,7 @@
 #define MADNESS_WORLD_WORLDHASHMAP_H__INCLUDED
 
 /// \file worldhashmap.h
-/// \brief Defines and implements a concurrent hashmap
+/// \brief Defines and implements concurrent hashmaps
 
 
 // Why does this exist?  It's a bridge from where we are to where we
@@ -48,8 +48,11 @@
 #include <madness/world/madness_exception.h>
 #include <madness/world/worldhash.h>
 #include <madness/world/enable_if.h>
+#include <madness/world/worldmem.h>
 #include <new>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <map>
 
 namespace madness {
@@ -59,6 +62,9 @@ namespace madness {
     template <class keyT, class valueT, class hashfunT>
     class ConcurrentHashMap;
 
+    template <class keyT, class valueT, class hashfunT>
+    class ConcurrentOpenHashMap;
+
     namespace Hash_private {
 
         // A hashtable is an array of nbin bins.
@@ -95,16 +101,20 @@ namespace madness {
                 clear();
             }
 
-            void clear() {
+            /// Deletes all entries and returns how many there were
+            std::size_t clear() {
+                std::size_t n = 0;
                 lock();             // BEGIN CRITICAL SECTION
                 while (p) {
-                    entryT* n=p->next;
+                    entryT* next=p->next;
                     delete p;
-                    p=n;
+                    p=next;
                     ninbin--;
+                    ++n;
                 }
                 MADNESS_ASSERT(ninbin == 0);
                 unlock();           // END CRITICAL SECTION
+                return n;
             }
 
             entryT* find(const keyT& key, const int lockmode) const {
@@ -306,6 +316,24 @@ namespace madness {
                 return;
             }
 
+            /// Moves to the first entry of the next non-empty bin if that is at most \c nmax entries on
+
+            /// Returns the no. of entries moved over, which is zero if
+            /// already at the first entry of a bin or if the next bin is
+            /// further away.  This exists so that ranges for parallel
+            /// iteration can be split between bins; the walk takes at
+            /// most \c nmax steps.
+            int align_to_bin(int nmax) {
+                if (!entry || entry == h->bins[bin].p) return 0;
+                int n = 0;
+                entryT* p = entry;
+                for (; p; p=p->next)
+                    if (++n > nmax) return 0;
+                entry = p;
+                next_non_null_entry();
+                return n;
+            }
+
 
             bool operator==(const HashIterator& a) const {
                 return entry==a.entry;
@@ -331,6 +359,7 @@ namespace madness {
         template <class hashT, int lockmode>
         class HashAccessor : private NO_DEFAULTS {
             template <class a,class b,class c> friend class madness::ConcurrentHashMap;
+            template <class a,class b,class c> friend class madness::ConcurrentOpenHashMap;
         public:
             typedef typename madness::if_<std::is_const<hashT>,
                     typename std::add_const<typename hashT::entryT>::type,
@@ -415,6 +444,7 @@ namespace madness {
 
     private:
         hashfunT hashfun;
+        MemTag mem_tag;             // Tag charged for entries and bins
 
         //unsigned int hash(const keyT& key) const {return hashfunT::hash(key)%nbins;}
 
@@ -438,23 +468,52 @@ namespace madness {
             return hashfun(key)%nbins;
         }
 
+        /// Counts an entry inserted (if \c inserted is true) against the tag
+        void charge_insert(bool inserted) {
+            if (inserted) mem_tag_alloc(mem_tag, sizeof(entryT));
+        }
+
+        /// Credits an entry erased (if \c erased is true) back to the tag
+        void credit_erase(bool erased) {
+            if (erased) mem_tag_free(mem_tag, sizeof(entryT));
+        }
+
     public:
         ConcurrentHashMap(int n=1021, const hashfunT& hf = hashfunT())
                 : nbins(hashT::nbins_prime(n))
                 , bins(new binT[nbins])
-                , hashfun(hf) {}
+                , hashfun(hf)
+                , mem_tag(MEM_HASHMAP)
+        {
+            mem_tag_alloc(mem_tag, nbins*sizeof(binT));
+        }
 
         ConcurrentHashMap(const  hashT& h)
                 : nbins(h.nbins)
                 , bins(new binT[nbins])
-                , hashfun(h.hashfun) {
+                , hashfun(h.hashfun)
+                , mem_tag(h.mem_tag)
+        {
+            mem_tag_alloc(mem_tag, nbins*sizeof(binT));
             *this = h;
         }
 
         virtual ~ConcurrentHashMap() {
+            clear();
+            mem_tag_free(mem_tag, nbins*sizeof(binT));
             delete [] bins;
         }
 
+        /// Charges the memory of this map to \c tag (\c MEM_HASHMAP by default)
+
+        /// Must be called while the map is empty (e.g., right after construction).
+        void set_mem_tag(MemTag tag) {
+            MADNESS_ASSERT(size() == 0);
+            mem_tag_free(mem_tag, nbins*sizeof(binT));
+            mem_tag_alloc(tag, nbins*sizeof(binT));
+            mem_tag = tag;
+        }
+
         hashT& operator=(const  hashT& h) {
             if (this != &h) {
                 this->clear();
@@ -469,6 +528,7 @@ namespace madness {
         std::pair<iterator,bool> insert(const datumT& datum) {
             int bin = hash_to_bin(datum.first);
             std::pair<entryT*,bool> result = bins[bin].insert(datum,entryT::NOLOCK);
+            charge_insert(result.second);
             return std::pair<iterator,bool>(iterator(this,bin,result.first),result.second);
         }
 
@@ -477,6 +537,7 @@ namespace madness {
             result.release();
             int bin = hash_to_bin(datum.first);
             std::pair<entryT*,bool> r = bins[bin].insert(datum,entryT::WRITELOCK);
+            charge_insert(r.second);
             result.set(r.first);
             return r.second;
         }
@@ -486,6 +547,7 @@ namespace madness {
             result.release();
             int bin = hash_to_bin(datum.first);
             std::pair<entryT*,bool> r = bins[bin].insert(datum,entryT::READLOCK);
+            charge_insert(r.second);
             result.set(r.first);
             return r.second;
         }
@@ -501,8 +563,9 @@ namespace madness {
         }
 
         std::size_t erase(const keyT& key) {
-            if (bins[hash_to_bin(key)].del(key,entryT::NOLOCK)) return 1;
-            else return 0;
+            const bool erased = bins[hash_to_bin(key)].del(key,entryT::NOLOCK);
+            credit_erase(erased);
+            return erased ? 1 : 0;
         }
 
         void erase(const iterator& it) {
@@ -511,13 +574,13 @@ namespace madness {
         }
 
         void erase(accessor& item) {
-            bins[hash_to_bin(item->first)].del(item->first,entryT::WRITELOCK);
+            credit_erase(bins[hash_to_bin(item->first)].del(item->first,entryT::WRITELOCK));
             item.unset();
         }
 
         void erase(const_accessor& item) {
             item.convert_read_lock_to_write_lock();
-            bins[hash_to_bin(item->first)].del(item->first,entryT::WRITELOCK);
+            credit_erase(bins[hash_to_bin(item->first)].del(item->first,entryT::WRITELOCK));
             item.unset();
         }
 
@@ -554,7 +617,9 @@ namespace madness {
         }
 
         void clear() {
-            for (unsigned int i=0; i<nbins; ++i) bins[i].clear();
+            std::size_t n = 0;
+            for (unsigned int i=0; i<nbins; ++i) n += bins[i].clear();
+            mem_tag_free(mem_tag, n*sizeof(entryT));
         }
 
         size_t size() const {
@@ -586,6 +651,9 @@ namespace madness {
 
         hashfunT& get_hash() const { return hashfun; }
 
+        /// Index of the bin that holds (or would hold) \c key
+        unsigned int bin_of(const keyT& key) const { return hash_to_bin(key); }
+
         void print_stats() const {
             for (unsigned int i=0; i<nbins; ++i) {
                 if (i && (i%10)==0) printf("\n");
@@ -594,6 +662,752 @@ namespace madness {
             printf("\n");
         }
     };
+
+    namespace Hash_private {
+
+        // An open hashtable is an array of nbins bins, like the one above,
+        // but each bin is a small open-addressed table of slots rather
+        // than a linked list.  A slot holds the hash of the key beside a
+        // pointer to the entry, so linear probing walks a contiguous
+        // array and only touches an entry whose hash matches.  Entries
+        // themselves stay where they were allocated so that iterators,
+        // accessors and pointers into the table survive growth.
+
+        template <typename keyT, typename valueT>
+        class open_entry : public madness::MutexReaderWriter {
+        public:
+            typedef std::pair<const keyT, valueT> datumT;
+            datumT datum;
+
+            open_entry(const datumT& datum) : datum(datum) {}
+        };
+
+        template <class entryT>
+        struct open_slot {
+            hashT hash;             // Hash of key (with the bin bits removed)
+            entryT* volatile entry; // Zero if empty, open_tombstone() if erased
+        };
+
+        /// Marks a slot whose entry was erased, so probing continues past it
+        template <class entryT>
+        inline entryT* open_tombstone() {
+            return reinterpret_cast<entryT*>(uintptr_t(1));
+        }
+
+        template <class entryT>
+        struct open_table {
+            std::size_t cap;        // No. of slots (a power of 2)
+            open_table* retired;    // Table this one replaced
+            open_slot<entryT> slot[1];
+
+            /// Bytes of a table of \c cap slots
+            static std::size_t nbyte(std::size_t cap) {
+                return sizeof(open_table) + (cap-1)*sizeof(open_slot<entryT>);
+            }
+
+            static open_table* create(std::size_t cap) {
+                open_table* t = static_cast<open_table*>(calloc(nbyte(cap),1));
+                if (!t) MADNESS_EXCEPTION("ConcurrentOpenHashMap: failed to allocate table", int(cap));
+                t->cap = cap;
+                return t;
+            }
+
+            /// Frees this table and those it replaced
+            static void destroy(open_table* t) {
+                while (t) {
+                    open_table* next = t->retired;
+                    free(t);
+                    t = next;
+                }
+            }
+        };
+
+        template <class keyT, class valueT>
+        class open_bin : private madness::Spinlock {
+        public:
+            typedef open_entry<keyT,valueT> entryT;
+            typedef open_table<entryT> tableT;
+            typedef std::pair<const keyT, valueT> datumT;
+
+            static const std::size_t MINCAP = 8;
+
+            tableT* volatile t;
+        private:
+            std::size_t ninbin;             // No. of entries (guarded by the lock)
+            std::size_t nused;              // No. of entries + tombstones
+            // Pad to a cache line so neighbouring bins' locks do not share one
+            char pad[64 - (sizeof(madness::Spinlock) + 3*sizeof(std::size_t)) % 64];
+
+            static entryT* tombstone() { return open_tombstone<entryT>(); }
+
+        public:
+            open_bin() : t(tableT::create(MINCAP)), ninbin(0), nused(0) {}
+
+            ~open_bin() {
+                clear();
+                tableT::destroy(t);
+            }
+
+            /// Deletes all entries and shrinks the table (not thread safe w.r.t. iterators)
+
+            /// Returns the bytes freed (entries and tables beyond the smallest table)
+            std::size_t clear() {
+                lock();             // BEGIN CRITICAL SECTION
+                tableT* tab = t;
+                std::size_t nbyte = ninbin*sizeof(entryT);
+                for (std::size_t i=0; i<tab->cap; ++i) {
+                    entryT* p = tab->slot[i].entry;
+                    if (p && p != tombstone()) delete p;
+                }
+                for (const tableT* r=tab; r; r=r->retired) nbyte += tableT::nbyte(r->cap);
+                tableT::destroy(tab);
+                t = tableT::create(MINCAP);
+                ninbin = nused = 0;
+                unlock();           // END CRITICAL SECTION
+                return nbyte - tableT::nbyte(MINCAP);
+            }
+
+            entryT* find(const keyT& key, hashT hash, const int lockmode) const {
+                bool gotlock;
+                entryT* result;
+                madness::MutexWaiter waiter;
+                do {
+                    lock();             // BEGIN CRITICAL SECTION
+                    std::size_t i;
+                    result = match(key, hash, i);
+                    if (result) {
+                        gotlock = result->try_lock(lockmode);
+                    }
+                    else {
+                        gotlock = true;
+                    }
+                    unlock();           // END CRITICAL SECTION
+                    if (!gotlock) waiter.wait();
+                }
+                while (!gotlock);
+
+                return result;
+            }
+
+            /// Inserts \c datum if its key is not present, charging new memory to \c tag
+            std::pair<entryT*,bool> insert(const datumT& datum, hashT hash, int lockmode, MemTag tag) {
+                bool gotlock;
+                entryT* result;
+                bool notfound;
+                madness::MutexWaiter waiter;
+                do {
+                    lock();             // BEGIN CRITICAL SECTION
+                    std::size_t i;
+                    result = match(datum.first, hash, i);
+                    notfound = !result;
+                    if (notfound) {
+                        if (t->slot[i].entry == 0) { // Not reusing a tombstone
+                            if (3*(nused+1) > 2*t->cap) {
+                                mem_tag_alloc(tag, grow());
+                                match(datum.first, hash, i);
+                            }
+                            ++nused;
+                        }
+                        result = new entryT(datum);
+                        mem_tag_alloc(tag, sizeof(entryT));
+                        t->slot[i].hash = hash;
+                        t->slot[i].entry = result;
+                        ++ninbin;
+                    }
+                    gotlock = result->try_lock(lockmode);
+                    unlock();           // END CRITICAL SECTION
+                    if (!gotlock) waiter.wait();
+                }
+                while (!gotlock);
+
+                return std::pair<entryT*,bool>(result,notfound);
+            }
+
+            /// Erases the entry of \c key, crediting its memory back to \c tag
+            bool del(const keyT& key, hashT hash, int lockmode, MemTag tag) {
+                bool status = false;
+                lock();             // BEGIN CRITICAL SECTION
+                std::size_t i;
+                entryT* p = match(key, hash, i);
+                if (p) {
+                    // Entries are not moved up into the hole so that
+                    // iterators elsewhere in the bin stay put
+                    t->slot[i].entry = tombstone();
+                    p->unlock(lockmode);
+                    delete p;
+                    mem_tag_free(tag, sizeof(entryT));
+                    --ninbin;
+                    status = true;
+                }
+                unlock();           // END CRITICAL SECTION
+                return status;
+            }
+
+            std::size_t size() const {
+                lock();
+                const std::size_t n = ninbin;
+                unlock();
+                return n;
+            };
+
+            /// Frees the tables replaced by growth (not thread safe w.r.t. iterators)
+
+            /// Returns the bytes freed
+            std::size_t reclaim() {
+                lock();             // BEGIN CRITICAL SECTION
+                tableT* tab = t;
+                std::size_t nbyte = 0;
+                for (const tableT* r=tab->retired; r; r=r->retired) nbyte += tableT::nbyte(r->cap);
+                tableT::destroy(tab->retired);
+                tab->retired = 0;
+                unlock();           // END CRITICAL SECTION
+                return nbyte;
+            }
+
+            std::size_t capacity() const {
+                return t->cap;
+            }
+
+        private:
+            /// Probes for \c key
+
+            /// Returns the entry, or zero with \c i set to the slot where
+            /// the key would go (the first tombstone passed, if any).
+            entryT* match(const keyT& key, hashT hash, std::size_t& i) const {
+                const tableT* tab = t;
+                const std::size_t mask = tab->cap - 1;
+                std::size_t hole = tab->cap;
+                for (i = hash & mask; ; i = (i+1) & mask) {
+                    entryT* p = tab->slot[i].entry;
+                    if (!p) break;
+                    if (p == tombstone()) {
+                        if (hole == tab->cap) hole = i;
+                    }
+                    else if (tab->slot[i].hash == hash && p->datum.first == key) {
+                        return p;
+                    }
+                }
+                if (hole != tab->cap) i = hole;
+                return 0;
+            }
+
+            /// Rehashes into a new table twice the size, or the same size if mostly tombstones
+
+            /// Either way the old table is kept (unchanged) until reclaim()
+            /// or clear() since iterators may still be reading it.  Returns
+            /// the bytes of the new table.
+            std::size_t grow() {
+                tableT* old = t;
+                const std::size_t cap = (3*(ninbin+1) <= old->cap) ? old->cap : 2*old->cap;
+                tableT* tab = tableT::create(cap);
+                const std::size_t mask = cap - 1;
+                for (std::size_t j=0; j<old->cap; ++j) {
+                    entryT* p = old->slot[j].entry;
+                    if (p && p != tombstone()) {
+                        std::size_t i = old->slot[j].hash & mask;
+                        while (tab->slot[i].entry) i = (i+1) & mask;
+                        tab->slot[i] = old->slot[j];
+                    }
+                }
+                tab->retired = old;
+                nused = ninbin;
+                __sync_synchronize(); // Table is complete before it is visible
+                t = tab;
+                return tableT::nbyte(cap);
+            }
+        };
+
+        /// iterator for open hash
+        template <class hashT> class OpenHashIterator {
+        public:
+            typedef typename madness::if_<std::is_const<hashT>,
+                    typename std::add_const<typename hashT::entryT>::type,
+                    typename hashT::entryT>::type entryT;
+            typedef typename madness::if_<std::is_const<hashT>,
+                    typename std::add_const<typename hashT::datumT>::type,
+                    typename hashT::datumT>::type datumT;
+            typedef typename hashT::tableT tableT;
+            typedef std::forward_iterator_tag iterator_category;
+            typedef datumT value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef datumT* pointer;
+            typedef datumT& reference;
+
+        private:
+            hashT* h;               // Associated hash table
+            int bin;                // Current bin
+            const tableT* tab;      // Table of the bin when we got to it
+            std::size_t slot;       // Current slot in tab
+            entryT* entry;          // Current entry ... zero means at end
+
+            template <class otherHashT>
+            friend class OpenHashIterator;
+
+            static bool occupied(const entryT* p) {
+                return p && p != open_tombstone<typename hashT::entryT>();
+            }
+
+            /// True if the entry in slot \c i of \c tab is still in the bin
+
+            /// Once the bin has been rehashed we keep walking the old table,
+            /// which is not changed or freed until reclaim(), so that entries
+            /// are neither skipped nor visited twice.  Entries erased since
+            /// are then no longer in the current table.  Only pointers are
+            /// compared since such an entry has been deleted.
+            bool live(std::size_t i) const {
+                const tableT* cur = h->bins[bin].t;
+                if (cur == tab) return true;
+                const entryT* p = tab->slot[i].entry;
+                const std::size_t mask = cur->cap - 1;
+                for (std::size_t j = tab->slot[i].hash & mask; cur->slot[j].entry; j = (j+1) & mask)
+                    if (cur->slot[j].entry == p) return true;
+                return false;
+            }
+
+            /// Moves to the next entry at or after slot \c i of \c tab , going on to later bins
+            void next_occupied(std::size_t i) {
+                for (;;) {
+                    for (; i<tab->cap; ++i) {
+                        entryT* p = tab->slot[i].entry;
+                        if (occupied(p) && live(i)) {
+                            slot = i;
+                            entry = p;
+                            return;
+                        }
+                    }
+                    if (!first_in_bin(bin+1)) return;
+                    i = 0;
+                }
+            }
+
+            /// Moves to bin \c b and its table ... returns false (at end) if there is no such bin
+            bool first_in_bin(int b) {
+                bin = b;
+                if ((unsigned) bin == h->nbins) {
+                    entry = 0;
+                    return false;
+                }
+                tab = h->bins[bin].t;
+                return true;
+            }
+
+        public:
+
+            /// Makes invalid iterator
+            OpenHashIterator() : h(0), bin(-1), tab(0), slot(0), entry(0) {}
+
+            /// Makes begin/end iterator
+            OpenHashIterator(hashT* h, bool begin)
+                    : h(h), bin(0), tab(h->bins[0].t), slot(0), entry(0) {
+                if (begin) next_occupied(0);
+            }
+
+            /// Makes iterator to specific entry (\c slot is a hint)
+            OpenHashIterator(hashT* h, int bin, std::size_t slot, entryT* entry)
+                    : h(h), bin(bin), tab(h->bins[bin].t), slot(slot), entry(entry) {
+                if (slot < tab->cap && tab->slot[slot].entry == entry) return;
+                const std::size_t mask = tab->cap - 1;
+                const madness::hashT hash = h->bin_hash(entry->datum.first);
+                for (std::size_t i = hash & mask; tab->slot[i].entry; i = (i+1) & mask) {
+                    if (tab->slot[i].entry == entry) {
+                        this->slot = i;
+                        return;
+                    }
+                }
+                this->slot = std::min(slot, tab->cap); // Erased meanwhile: carry on from about here
+            }
+
+            /// Copy constructor
+            OpenHashIterator(const OpenHashIterator& other)
+                    : h(other.h), bin(other.bin), tab(other.tab), slot(other.slot), entry(other.entry) {}
+
+            /// Implicit conversion of another hash type to this hash type
+
+            /// This allows implicit conversion from hash types to const hash
+            /// types.
+            template <class otherHashT>
+            OpenHashIterator(const OpenHashIterator<otherHashT>& other)
+                    : h(other.h), bin(other.bin), tab(other.tab), slot(other.slot), entry(other.entry) {}
+
+            OpenHashIterator& operator++() {
+                if (!entry) return *this;
+                next_occupied(slot + 1);
+                return *this;
+            }
+
+            OpenHashIterator operator++(int) {
+                OpenHashIterator old(*this);
+                operator++();
+                return old;
+            }
+
+            /// Difference between iterators \em only supported for this=start and other=end
+
+            /// This exists to support construction of range for parallel iteration
+            /// over the entire container.
+            int distance(const OpenHashIterator& other) const {
+                MADNESS_ASSERT(h == other.h  &&  other == h->end()  &&  *this == h->begin());
+                return h->size();
+            }
+
+            /// Only positive increments are supported
+
+            /// This exists to support splitting of range for parallel iteration.
+            void advance(int n) {
+                if (n==0 || !entry) return;
+                MADNESS_ASSERT(n>=0);
+
+                // Linear increment up to end of this bin
+                for (std::size_t i=slot+1; i<tab->cap; ++i) {
+                    if (occupied(tab->slot[i].entry) && live(i)) {
+                        if (--n == 0) {
+                            slot = i;
+                            entry = tab->slot[i].entry;
+                            return;
+                        }
+                    }
+                }
+
+                // Skip whole bins then step to the target
+                for (int b=bin+1; (unsigned) b < h->nbins; ++b) {
+                    if (unsigned(n) > h->bins[b].size()) {
+                        n -= h->bins[b].size();
+                    }
+                    else {
+                        first_in_bin(b);
+                        next_occupied(0);
+                        while (--n && entry) operator++();
+                        return;
+                    }
+                }
+                first_in_bin(h->nbins); // end
+            }
+
+            /// Moves to the first entry of the next non-empty bin if that is at most \c nmax slots on
+
+            /// Returns the no. of entries moved over, which is zero if
+            /// already at the first entry of a bin or if the next bin is
+            /// further away.  This exists so that ranges for parallel
+            /// iteration can be split between bins; the walk looks at
+            /// no more than \c nmax slots on either side of the entry.
+            int align_to_bin(int nmax) {
+                if (!entry || nmax <= 0) return 0;
+                const std::size_t cur = slot;
+                if (tab->cap - cur - 1 > std::size_t(nmax)) return 0;
+                std::size_t i = cur;
+                while (i > 0 && cur - i < std::size_t(nmax) && !(occupied(tab->slot[i-1].entry) && live(i-1))) --i;
+                if (i == 0 || !(occupied(tab->slot[i-1].entry) && live(i-1))) return 0; // First entry, or too far to tell
+                int n = 1;
+                for (i=cur+1; i<tab->cap; ++i)
+                    if (occupied(tab->slot[i].entry) && live(i)) ++n;
+                if (first_in_bin(bin+1)) next_occupied(0);
+                return n;
+            }
+
+
+            bool operator==(const OpenHashIterator& a) const {
+                return entry==a.entry;
+            }
+
+            bool operator!=(const OpenHashIterator& a) const {
+                return entry!=a.entry;
+            }
+
+            reference operator*() const {
+                MADNESS_ASSERT(entry);
+                return entry->datum;
+            }
+
+            pointer operator->() const {
+                MADNESS_ASSERT(entry);
+                return &entry->datum;
+            }
+        };
+
+    } // End of namespace Hash_private
+
+    /// Concurrent hash map with open-addressed bins that grow as needed
+
+    /// A drop-in alternative to \c ConcurrentHashMap (same accessor,
+    /// iterator and range API) for tables with far more entries than
+    /// bins, such as the coefficient trees of 6D functions.  The number
+    /// of bins (a power of 2) is fixed by the size hint, but each bin is
+    /// an open-addressed array of (hash, entry pointer) slots probed
+    /// linearly and doubled in size under the bin's lock when more than
+    /// 2/3 full, so chains never grow long and bins grow independently
+    /// of each other.  Entries are never moved, so accessors and
+    /// pointers to data are as stable as in \c ConcurrentHashMap.
+    ///
+    /// Iterators read the table without locking as in \c ConcurrentHashMap.
+    /// An iterator walks the table that its bin had when the iterator
+    /// reached the bin, passing over entries that have since been erased,
+    /// so inserts into the bin meanwhile (even ones that rehash it) do not
+    /// make it skip or revisit entries.  Each entry present when the walk
+    /// reached the bin and not erased since is visited exactly once;
+    /// entries inserted meanwhile may or may not be.  The tables that a
+    /// rehash replaces are freed by \c reclaim(), which \c WorldContainer
+    /// calls at the end of every fence, so an iterator must not be kept
+    /// across a fence (or a call to \c reclaim() or \c clear()).
+    ///
+    /// Selected for \c WorldContainer and \c SimpleCache by configuring
+    /// with \c --enable-open-hashmap.
+    template < class keyT, class valueT, class hashfunT = Hash<keyT> >
+    class ConcurrentOpenHashMap {
+    public:
+        typedef ConcurrentOpenHashMap<keyT,valueT,hashfunT> hashT;
+        typedef std::pair<const keyT,valueT> datumT;
+        typedef Hash_private::open_entry<keyT,valueT> entryT;
+        typedef Hash_private::open_bin<keyT,valueT> binT;
+        typedef typename binT::tableT tableT;
+        typedef Hash_private::OpenHashIterator<hashT> iterator;
+        typedef Hash_private::OpenHashIterator<const hashT> const_iterator;
+        typedef Hash_private::HashAccessor<hashT,entryT::WRITELOCK> accessor;
+        typedef Hash_private::HashAccessor<const hashT,entryT::READLOCK> const_accessor;
+
+        friend class Hash_private::OpenHashIterator<hashT>;
+        friend class Hash_private::OpenHashIterator<const hashT>;
+
+    protected:
+        const size_t nbins;         // Number of bins (a power of 2)
+        binT* bins;                 // Array of bins
+
+    private:
+        const unsigned int logbins;
+        mutable hashfunT hashfun;
+        MemTag mem_tag;             // Tag charged for entries, bins and tables
+
+        static unsigned int nbins_log2(int n) {
+            // n is a user provided estimate of the no. of elements.
+            // Bins grow, so they only need to be numerous enough to
+            // keep threads from contending for the same bin.
+            unsigned int log = 4;
+            while (log < 16  &&  (std::size_t(16) << log) < std::size_t(n)) ++log;
+            return log;
+        }
+
+        /// Hash of key with the bits well mixed (bins and slots use different bits)
+        madness::hashT mix(const keyT& key) const {
+            uint64_t h = hashfun(key);
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            return madness::hashT(h);
+        }
+
+        /// Hash used within the bin
+        madness::hashT bin_hash(const keyT& key) const {
+            return mix(key) >> logbins;
+        }
+
+        unsigned int hash_to_bin(const keyT& key) const {
+            return mix(key) & (nbins-1);
+        }
+
+        /// Bytes of the bins when empty
+        std::size_t base_nbyte() const {
+            return nbins*(sizeof(binT) + tableT::nbyte(binT::MINCAP));
+        }
+
+    public:
+        ConcurrentOpenHashMap(int n=1021, const hashfunT& hf = hashfunT())
+                : nbins(std::size_t(1) << nbins_log2(n))
+                , bins(new binT[nbins])
+                , logbins(nbins_log2(n))
+                , hashfun(hf)
+                , mem_tag(MEM_HASHMAP)
+        {
+            mem_tag_alloc(mem_tag, base_nbyte());
+        }
+
+        ConcurrentOpenHashMap(const  hashT& h)
+                : nbins(h.nbins)
+                , bins(new binT[nbins])
+                , logbins(h.logbins)
+                , hashfun(h.hashfun)
+                , mem_tag(h.mem_tag)
+        {
+            mem_tag_alloc(mem_tag, base_nbyte());
+            *this = h;
+        }
+
+        virtual ~ConcurrentOpenHashMap() {
+            clear();
+            mem_tag_free(mem_tag, base_nbyte());
+            delete [] bins;
+        }
+
+        /// Charges the memory of this map to \c tag (\c MEM_HASHMAP by default)
+
+        /// Must be called while the map is empty and has not grown (e.g.,
+        /// right after construction).
+        void set_mem_tag(MemTag tag) {
+            MADNESS_ASSERT(size() == 0);
+            mem_tag_free(mem_tag, base_nbyte());
+            mem_tag_alloc(tag, base_nbyte());
+            mem_tag = tag;
+        }
+
+        hashT& operator=(const  hashT& h) {
+            if (this != &h) {
+                this->clear();
+                hashfun = h.hashfun;
+                for (const_iterator p=h.begin(); p!=h.end(); ++p) {
+                    insert(*p);
+                }
+            }
+            return *this;
+        }
+
+        std::pair<iterator,bool> insert(const datumT& datum) {
+            const madness::hashT h = mix(datum.first);
+            const int bin = h & (nbins-1);
+            std::pair<entryT*,bool> result = bins[bin].insert(datum,h >> logbins,entryT::NOLOCK,mem_tag);
+            return std::pair<iterator,bool>(iterator(this,bin,0,result.first),result.second);
+        }
+
+        /// Returns true if new pair was inserted; false if key is already in the map and the datum was not inserted
+        bool insert(accessor& result, const datumT& datum) {
+            result.release();
+            const madness::hashT h = mix(datum.first);
+            std::pair<entryT*,bool> r = bins[h & (nbins-1)].insert(datum,h >> logbins,entryT::WRITELOCK,mem_tag);
+            result.set(r.first);
+            return r.second;
+        }
+
+        /// Returns true if new pair was inserted; false if key is already in the map and the datum was not inserted
+        bool insert(const_accessor& result, const datumT& datum) {
+            result.release();
+            const madness::hashT h = mix(datum.first);
+            std::pair<entryT*,bool> r = bins[h & (nbins-1)].insert(datum,h >> logbins,entryT::READLOCK,mem_tag);
+            result.set(r.first);
+            return r.second;
+        }
+
+        /// Returns true if new pair was inserted; false if key is already in the map
+        inline bool insert(accessor& result, const keyT& key) {
+            return insert(result, datumT(key,valueT()));
+        }
+
+        /// Returns true if new pair was inserted; false if key is already in the map
+        inline bool insert(const_accessor& result, const keyT& key) {
+            return insert(result, datumT(key,valueT()));
+        }
+
+        std::size_t erase(const keyT& key) {
+            const madness::hashT h = mix(key);
+            if (bins[h & (nbins-1)].del(key,h >> logbins,entryT::NOLOCK,mem_tag)) return 1;
+            else return 0;
+        }
+
+        void erase(const iterator& it) {
+            if (it == end()) MADNESS_EXCEPTION("ConcurrentOpenHashMap: erase(iterator): at end", true);
+            erase(it->first);
+        }
+
+        void erase(accessor& item) {
+            const madness::hashT h = mix(item->first);
+            bins[h & (nbins-1)].del(item->first,h >> logbins,entryT::WRITELOCK,mem_tag);
+            item.unset();
+        }
+
+        void erase(const_accessor& item) {
+            item.convert_read_lock_to_write_lock();
+            const madness::hashT h = mix(item->first);
+            bins[h & (nbins-1)].del(item->first,h >> logbins,entryT::WRITELOCK,mem_tag);
+            item.unset();
+        }
+
+        iterator find(const keyT& key) {
+            const madness::hashT h = mix(key);
+            const int bin = h & (nbins-1);
+            entryT* entry = bins[bin].find(key,h >> logbins,entryT::NOLOCK);
+            if (!entry) return end();
+            else return iterator(this,bin,0,entry);
+        }
+
+        const_iterator find(const keyT& key) const {
+            const madness::hashT h = mix(key);
+            const int bin = h & (nbins-1);
+            const entryT* entry = bins[bin].find(key,h >> logbins,entryT::NOLOCK);
+            if (!entry) return end();
+            else return const_iterator(this,bin,0,entry);
+        }
+
+        bool find(accessor& result, const keyT& key) {
+            result.release();
+            const madness::hashT h = mix(key);
+            entryT* entry = bins[h & (nbins-1)].find(key,h >> logbins,entryT::WRITELOCK);
+            bool foundit = entry;
+            if (foundit) result.set(entry);
+            return foundit;
+        }
+
+        bool find(const_accessor& result, const keyT& key) const {
+            result.release();
+            const madness::hashT h = mix(key);
+            entryT* entry = bins[h & (nbins-1)].find(key,h >> logbins,entryT::READLOCK);
+            bool foundit = entry;
+            if (foundit) result.set(entry);
+            return foundit;
+        }
+
+        void clear() {
+            std::size_t nbyte = 0;
+            for (unsigned int i=0; i<nbins; ++i) nbyte += bins[i].clear();
+            mem_tag_free(mem_tag, nbyte);
+        }
+
+        /// Frees the tables left behind when bins grew or dropped their tombstones
+
+        /// Not thread safe w.r.t. iterators, which may still be reading an
+        /// old table, so call it when no other thread can be using the map
+        /// (e.g., at the end of a fence, see WorldContainerImpl).
+        void reclaim() {
+            std::size_t nbyte = 0;
+            for (unsigned int i=0; i<nbins; ++i) nbyte += bins[i].reclaim();
+            mem_tag_free(mem_tag, nbyte);
+        }
+
+        size_t size() const {
+            size_t sum = 0;
+            for (size_t i=0; i<nbins; ++i) sum += bins[i].size();
+            return sum;
+        }
+
+        valueT& operator[](const keyT& key) {
+            std::pair<iterator,bool> it = insert(datumT(key,valueT()));
+            return it.first->second;
+        }
+
+        iterator begin() {
+            return iterator(this,true);
+        }
+
+        const_iterator begin() const {
+            return const_iterator(this,true);
+        }
+
+        iterator end() {
+            return iterator(this,false);
+        }
+
+        const_iterator end() const {
+            return const_iterator(this,false);
+        }
+
+        hashfunT& get_hash() const { return hashfun; }
+
+        /// Index of the bin that holds (or would hold) \c key
+        unsigned int bin_of(const keyT& key) const { return hash_to_bin(key); }
+
+        void print_stats() const {
+            for (unsigned int i=0; i<nbins; ++i) {
+                if (i && (i%10)==0) printf("\n");
+                printf("%8d/%-8d", int(bins[i].size()), int(bins[i].capacity()));
+            }
+            printf("\n");
+        }
+    };
 }
 
 namespace std {
@@ -609,6 +1423,16 @@ namespace std {
         //std::cout << " in custom distance \n";
         return it.distance(jt);
     }
+
+    template <typename hashT, typename distT>
+    inline void advance( madness::Hash_private::OpenHashIterator<hashT>& it, const distT& dist ) {
+        it.advance(dist);
+    }
+
+    template <typename hashT>
+    inline int distance(const madness::Hash_private::OpenHashIterator<hashT>& it, const madness::Hash_private::OpenHashIterator<hashT>& jt) {
+        return it.distance(jt);
+    }
 }
 
 #endif // MADNESS_WORLD_WORLDHASHMAP_H__INCLUDED
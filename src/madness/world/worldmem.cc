@@ -109,6 +109,54 @@ namespace madness {
         max_num_bytes = 0;
     }
 
+
+    namespace detail {
+        thread_local long mem_tag_delta[NMEM_TAG];
+        thread_local MemTag mem_tag_now = MEM_TENSOR;
+    }
+
+    namespace {
+        long mem_tag_nbyte[NMEM_TAG];
+        long mem_tag_peak[NMEM_TAG];
+
+        /// Raises the peak of \c tag to \c nbyte if it is higher
+        void mem_tag_raise_peak(MemTag tag, long nbyte) {
+            long peak = mem_tag_peak[tag];
+            while (nbyte > peak) {
+                const long old = __sync_val_compare_and_swap(&mem_tag_peak[tag], peak, nbyte);
+                if (old == peak) break;
+                peak = old;
+            }
+        }
+    }
+
+    void detail::mem_tag_flush(MemTag tag) {
+        const long delta = mem_tag_delta[tag];
+        mem_tag_delta[tag] = 0;
+        mem_tag_raise_peak(tag, __sync_add_and_fetch(&mem_tag_nbyte[tag], delta));
+    }
+
+    MemTagStats mem_tag_stats(MemTag tag) {
+        // Include the calling thread's bytes that are not counted yet
+        detail::mem_tag_flush(tag);
+        MemTagStats s;
+        s.nbyte = mem_tag_nbyte[tag];
+        s.peak = mem_tag_peak[tag];
+        return s;
+    }
+
+    const char* mem_tag_name(MemTag tag) {
+        static const char* names[NMEM_TAG] = {"tensor", "hashmap", "am_arg", "task", "cache"};
+        return (tag >= 0 && tag < NMEM_TAG) ? names[tag] : "unknown";
+    }
+
+    void mem_tag_reset_peaks() {
+        for (int tag=0; tag<NMEM_TAG; ++tag) {
+            mem_tag_peak[tag] = 0;
+            mem_tag_raise_peak(MemTag(tag), mem_tag_nbyte[tag]);
+        }
+    }
+
 }
 
 #ifdef WORLD_GATHER_MEM_STATS
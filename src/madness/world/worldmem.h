@@ -93,5 +93,91 @@ namespace madness {
 
     /// Returns pointer to internal structure
     WorldMemInfo* world_mem_info();
+
+
+    /// Subsystems whose memory is accounted separately by mem_tag_alloc() and mem_tag_free()
+    enum MemTag {
+        MEM_TENSOR,     ///< Tensor data (Tensor::allocate)
+        MEM_HASHMAP,    ///< Entries and bins of ConcurrentHashMap and ConcurrentOpenHashMap
+        MEM_AM_ARG,     ///< Active message buffers (alloc_am_arg)
+        MEM_TASK,       ///< Task objects and futures (SmallObjectPool)
+        MEM_CACHE,      ///< Cached operators and other data (SimpleCache)
+        NMEM_TAG        ///< No. of tags
+    };
+
+    /// Current and peak bytes of one tag
+    struct MemTagStats {
+        long nbyte;     ///< Bytes in use
+        long peak;      ///< High-water mark of nbyte
+    };
+
+    namespace detail {
+        /// Bytes a thread may allocate or free before the global counts are updated
+        static const long MEM_TAG_FLUSH = 1l<<18;
+
+        /// Bytes allocated (less those freed) by this thread not yet in the global counts
+        extern thread_local long mem_tag_delta[NMEM_TAG];
+
+        /// Tag charged for tensors made by this thread (see MemTagScope)
+        extern thread_local MemTag mem_tag_now;
+
+        /// Adds this thread's delta for \c tag to the global counts and updates the peak
+        void mem_tag_flush(MemTag tag);
+    }
+
+    /// Charges \c nbyte bytes to \c tag
+
+    /// Each thread accumulates into its own counts and adds them to the
+    /// global counts only after \c detail::MEM_TAG_FLUSH bytes, so this is
+    /// cheap enough to leave on.  In exchange the global counts, and so
+    /// the peaks, can be off by that much per thread.
+    inline void mem_tag_alloc(MemTag tag, std::size_t nbyte) {
+        long& delta = detail::mem_tag_delta[tag];
+        delta += long(nbyte);
+        if (delta > detail::MEM_TAG_FLUSH) detail::mem_tag_flush(tag);
+    }
+
+    /// Credits \c nbyte bytes back to \c tag (which need not be done by the thread that allocated them)
+    inline void mem_tag_free(MemTag tag, std::size_t nbyte) {
+        long& delta = detail::mem_tag_delta[tag];
+        delta -= long(nbyte);
+        if (delta < -detail::MEM_TAG_FLUSH) detail::mem_tag_flush(tag);
+    }
+
+    /// Returns the tag to be charged for tensors made by this thread
+    inline MemTag mem_tag_current() {
+        return detail::mem_tag_now;
+    }
+
+    /// Returns current and peak bytes of \c tag in this process
+    MemTagStats mem_tag_stats(MemTag tag);
+
+    /// Returns the name of \c tag (e.g., "tensor")
+    const char* mem_tag_name(MemTag tag);
+
+    /// Sets the peak of every tag to its current value
+    void mem_tag_reset_peaks();
+
+    /// Charges tensors made by this thread to another tag while in scope
+
+    /// E.g., code computing data to be put into an operator cache makes a
+    /// \c MemTagScope(MEM_CACHE) so that the tensors it keeps are
+    /// accounted as cache rather than as tensor data.  Tensors remember
+    /// the tag they were charged to, so they can be freed anywhere.
+    class MemTagScope {
+        const MemTag prev;
+
+        MemTagScope(const MemTagScope&);
+        MemTagScope& operator=(const MemTagScope&);
+
+    public:
+        explicit MemTagScope(MemTag tag) : prev(detail::mem_tag_now) {
+            detail::mem_tag_now = tag;
+        }
+
+        ~MemTagScope() {
+            detail::mem_tag_now = prev;
+        }
+    };
 }
 #endif // MADNESS_WORLD_WORLDMEM_H__INCLUDED
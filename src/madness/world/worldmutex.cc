@@ -32,6 +32,13 @@
 */
 
 #include <madness/world/worldmutex.h>
+#include <time.h>
+#include <limits.h>
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 /// \file worldmutex.h
 /// \brief Implements Mutex, MutexFair, Spinlock, ConditionVariable
@@ -81,6 +88,100 @@ namespace madness {
     }
 
 
+    ParkingLot::ParkingLot() : epoch(0), nparked(0), wake_ns(0) {
+#if !defined(__linux__)
+        pthread_mutex_init(&mutex, 0);
+        pthread_cond_init(&cv, NULL);
+#endif
+    }
+
+    ParkingLot::~ParkingLot() {
+#if !defined(__linux__)
+        pthread_cond_destroy(&cv);
+        pthread_mutex_destroy(&mutex);
+#endif
+    }
+
+    uint64_t ParkingLot::now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec)*1000000000ul + uint64_t(ts.tv_nsec);
+    }
+
+    void ParkingLot::sleep(int key, long timeout_us) {
+#if defined(__linux__)
+        struct timespec ts;
+        struct timespec* pts = NULL;
+        if (timeout_us >= 0) {
+            ts.tv_sec = timeout_us/1000000;
+            ts.tv_nsec = (timeout_us%1000000)*1000;
+            pts = &ts;
+        }
+        // Returns at once if epoch is no longer key
+        syscall(SYS_futex, &epoch, FUTEX_WAIT_PRIVATE, key, pts, NULL, 0);
+#else
+        pthread_mutex_lock(&mutex);
+        if (epoch == key) {
+            if (timeout_us >= 0) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += timeout_us/1000000;
+                ts.tv_nsec += (timeout_us%1000000)*1000;
+                if (ts.tv_nsec >= 1000000000) {
+                    ts.tv_nsec -= 1000000000;
+                    ++ts.tv_sec;
+                }
+                pthread_cond_timedwait(&cv, &mutex, &ts);
+            }
+            else {
+                pthread_cond_wait(&cv, &mutex);
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+#endif
+    }
+
+    void ParkingLot::wake(bool all) {
+        wake_ns = now_ns();
+        __sync_fetch_and_add(&stats.nwake, uint64_t(1));
+#if defined(__linux__)
+        __sync_fetch_and_add(&epoch, 1);
+        syscall(SYS_futex, &epoch, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+#else
+        pthread_mutex_lock(&mutex);
+        __sync_fetch_and_add(&epoch, 1);
+        if (all) pthread_cond_broadcast(&cv);
+        else pthread_cond_signal(&cv);
+        pthread_mutex_unlock(&mutex);
+#endif
+    }
+
+    bool ParkingLot::park(int key, long timeout_us) {
+        const uint64_t start = now_ns();
+        sleep(key, timeout_us);
+        const uint64_t end = now_ns();
+        const bool woken = (epoch != key);
+        __sync_fetch_and_sub(&nparked, 1);
+
+        __sync_fetch_and_add(&stats.npark, uint64_t(1));
+        __sync_fetch_and_add(&stats.park_ns, end - start);
+        if (woken) {
+            const uint64_t sent = wake_ns;
+            if (sent >= start && end >= sent) {
+                const uint64_t latency = end - sent;
+                __sync_fetch_and_add(&stats.nwoken, uint64_t(1));
+                __sync_fetch_and_add(&stats.wake_ns, latency);
+                uint64_t max = stats.max_wake_ns;
+                while (latency > max) {
+                    const uint64_t old = __sync_val_compare_and_swap(&stats.max_wake_ns, max, latency);
+                    if (old == max) break;
+                    max = old;
+                }
+            }
+        }
+        return woken;
+    }
+
     namespace detail {
         Mutex printmutex;
     }
@@ -672,6 +672,99 @@ namespace madness {
         }
     }; // class Barrier
 
+
+    /// Statistics of the waits in a \c ParkingLot
+    struct ParkStats {
+        uint64_t nspin;          ///< #waits that found work while spinning
+        uint64_t npark;          ///< #waits that parked
+        uint64_t nwake;          ///< #wake-ups sent to parked threads
+        uint64_t nwoken;         ///< #parks ended by a wake-up (latency samples)
+        uint64_t spin_ns;        ///< Total time spent spinning (CPU burnt while idle)
+        uint64_t park_ns;        ///< Total time spent parked
+        uint64_t wake_ns;        ///< Total latency from a wake-up until the parked thread ran
+        uint64_t max_wake_ns;    ///< Longest such latency
+
+        ParkStats()
+            : nspin(0), npark(0), nwake(0), nwoken(0), spin_ns(0), park_ns(0), wake_ns(0), max_wake_ns(0) {}
+    };
+
+
+    /// Idle threads spin for a while and then sleep here until woken
+
+    /// An event count.  A waiter calls \c prepare_park(), checks once more
+    /// for work, and then calls \c park() (or \c cancel_park() if it found
+    /// some).  A thread that makes work available calls \c notify_one()
+    /// afterwards, which costs a memory fence and one read when nobody is
+    /// parked and otherwise wakes exactly one parked thread.  No wake-up
+    /// can be lost between the check and parking since \c park() returns
+    /// at once if anyone notified after \c prepare_park().
+    ///
+    /// Parking uses a futex on Linux and a pthread condition variable
+    /// elsewhere.
+    class ParkingLot : private NO_DEFAULTS {
+        volatile int epoch;         ///< Bumped by each notify that finds a parked thread
+        volatile int nparked;       ///< #threads between prepare_park() and return from park()
+        volatile uint64_t wake_ns;  ///< now_ns() when the last wake-up was sent
+        ParkStats stats;
+#if !defined(__linux__)
+        mutable pthread_mutex_t mutex;
+        mutable pthread_cond_t cv;
+#endif
+
+        void sleep(int key, long timeout_us);
+        void wake(bool all);
+
+    public:
+        ParkingLot();
+
+        virtual ~ParkingLot();
+
+        /// Monotonic time in nanoseconds that is comparable between threads
+        static uint64_t now_ns();
+
+        /// Announce the intent to park ... returns the key to pass to \c park()
+        int prepare_park() {
+            __sync_fetch_and_add(&nparked, 1);
+            return epoch;
+        }
+
+        /// Do not park after all
+        void cancel_park() {
+            __sync_fetch_and_sub(&nparked, 1);
+        }
+
+        /// Sleep until notified (or \c timeout_us microseconds if not negative)
+
+        /// Returns true if woken by a notify rather than a timeout
+        bool park(int key, long timeout_us=-1);
+
+        /// Wake one parked thread, if any
+        void notify_one() {
+            __sync_synchronize(); // Work is visible before we look for sleepers
+            if (nparked) wake(false);
+        }
+
+        /// Wake all parked threads
+        void notify_all() {
+            __sync_synchronize();
+            if (nparked) wake(true);
+        }
+
+        /// Count time spent spinning before finding work (\c found) or parking
+        void record_spin(uint64_t ns, bool found) {
+            __sync_fetch_and_add(&stats.spin_ns, ns);
+            if (found) __sync_fetch_and_add(&stats.nspin, uint64_t(1));
+        }
+
+        int num_parked() const {
+            return nparked;
+        }
+
+        const ParkStats& get_stats() const {
+            return stats;
+        }
+    }; // class ParkingLot
+
     namespace detail {
         extern Mutex printmutex;
     }
@@ -32,34 +32,138 @@
 #include <madness/world/worldprofile.h>
 #include <madness/world/mpiar.h>
 #include <madness/world/parallel_runtime.h>
-#include <madness/world/atomicint.h>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
 
 namespace madness {
 
-    static AtomicInt threadcounter; // Used to assign unique ID to threads
+    namespace {
+
+        /// Statistics of one id accumulated by one thread
+
+        /// Only the owning thread writes the totals, each with a single
+        /// relaxed atomic store, so that merge() may read them with relaxed
+        /// atomic loads while the thread is still profiling.
+        struct ThreadStat {
+            unsigned long count;
+            double xcpu, icpu;
+            unsigned long xnmsg_sent, inmsg_sent, xnmsg_recv, inmsg_recv;
+            unsigned long xnbyt_sent, inbyt_sent, xnbyt_recv, inbyt_recv;
+            int depth;    // Depth of recursive calls (0 if no active calls), private to the owner
+        };
+
+        /// Adds v to a total of the calling thread's own ThreadStat
+        template <typename T, typename U>
+        inline void stat_add(T& total, U v) {
+            T sum = total + T(v); // Only the owner writes so a plain read is current
+            __atomic_store(&total, &sum, __ATOMIC_RELAXED);
+        }
+
+        /// Reads a total of any thread's ThreadStat
+        template <typename T>
+        inline T stat_load(const T& total) {
+            T v;
+            __atomic_load(&total, &v, __ATOMIC_RELAXED);
+            return v;
+        }
+
+        /// Statistics of one thread indexed by id
+
+        /// Allocated in blocks as ids are first used so that print() can
+        /// read them while the thread adds more.
+        struct ThreadStats {
+            static const int BLOCK = 64;
+            static const int NBLOCK = (WorldProfile::MAX_NID + BLOCK - 1)/BLOCK;
+            ThreadStat* volatile blocks[NBLOCK];
+
+            ThreadStats() {
+                for (int i=0; i<NBLOCK; ++i) blocks[i] = 0;
+            }
+
+            /// Returns the statistics of id, only to be called by the owning thread
+            ThreadStat& get(int id) {
+                ThreadStat* block = blocks[id/BLOCK];
+                if (!block) {
+                    block = new ThreadStat[BLOCK]();
+                    __sync_synchronize(); // Zeros must be seen before the block
+                    blocks[id/BLOCK] = block;
+                }
+                return block[id%BLOCK];
+            }
+        };
+
+        Spinlock threads_lock;                 // Guards threads
+        std::vector<ThreadStats*> threads;     // Statistics of every thread that profiled, kept until exit
+        thread_local ThreadStats* my_stats = 0;
+        std::vector<WorldProfileEntry> cleared; // Sums of all threads at the last clear(), guarded by WorldProfile::mutex
+
+        ThreadStat& thread_stat(int id) {
+            if (!my_stats) {
+                ScopedMutex<Spinlock> hold(threads_lock);
+                my_stats = new ThreadStats;
+                threads.push_back(my_stats);
+            }
+            return my_stats->get(id);
+        }
+
+        /// Sets the values of d to the sums over all threads of the statistics of id
+
+        /// Must hold threads_lock
+        void sum_threads(int id, WorldProfileEntry& d) {
+            d.clear();
+            for (unsigned int t=0; t<threads.size(); ++t) {
+                const ThreadStat* block = threads[t]->blocks[id/ThreadStats::BLOCK];
+                if (!block) continue;
+                const ThreadStat& s = block[id%ThreadStats::BLOCK];
+                d.count.value += stat_load(s.count);
+                d.xcpu.value += stat_load(s.xcpu);
+                d.icpu.value += stat_load(s.icpu);
+                d.xnmsg_sent.value += stat_load(s.xnmsg_sent);
+                d.inmsg_sent.value += stat_load(s.inmsg_sent);
+                d.xnmsg_recv.value += stat_load(s.xnmsg_recv);
+                d.inmsg_recv.value += stat_load(s.inmsg_recv);
+                d.xnbyt_sent.value += stat_load(s.xnbyt_sent);
+                d.inbyt_sent.value += stat_load(s.inbyt_sent);
+                d.xnbyt_recv.value += stat_load(s.xnbyt_recv);
+                d.inbyt_recv.value += stat_load(s.inbyt_recv);
+            }
+        }
+
+        unsigned long read_sample() {
+            const char* ssample = getenv("MAD_PROFILE_SAMPLE");
+            if (!ssample) return 1;
+            std::istringstream s(ssample);
+            long n = 0;
+            s >> n;
+            if (s.fail() || n <= 0) {
+                std::cerr << "!!! WARNING: MAD_PROFILE_SAMPLE is not a positive number ... recording every call\n";
+                return 1;
+            }
+            return n;
+        }
+    }
 
     thread_local WorldProfileObj* WorldProfileObj::call_stack = 0;
-    thread_local int WorldProfileObj::mythreadid = -1; // means not initialized
+    thread_local unsigned long WorldProfileObj::ncall = 0;
+    thread_local int WorldProfileObj::nskip = 0;
 
     Spinlock WorldProfile::mutex;
     volatile std::vector<WorldProfileEntry> WorldProfile::items;
     double WorldProfile::cpu_start = madness::cpu_time();
     double WorldProfile::wall_start = madness::wall_time();
+    unsigned long WorldProfile::sample = read_sample();
 
     WorldProfileEntry::WorldProfileEntry(const char* name)
-            : name(name) 
-    {
-        for (int i=0; i<MAX_NTHREAD; i++) depth[i] = 0;
-    };
+            : name(name)
+    {}
 
-    WorldProfileEntry::WorldProfileEntry(const WorldProfileEntry& other)
-            : Spinlock() {
+    WorldProfileEntry::WorldProfileEntry(const WorldProfileEntry& other) {
         *this = other;
     }
 
     WorldProfileEntry& WorldProfileEntry::operator=(const WorldProfileEntry& other) {
         name = other.name;
-        for (int i=0; i<MAX_NTHREAD; i++) depth[i] = other.depth[i];
         count = other.count;
         xcpu = other.xcpu;
         icpu = other.icpu;
@@ -143,8 +247,8 @@ namespace madness {
         // ASSUME WE HAVE THE MUTEX ALREADY
         std::vector<WorldProfileEntry>& nv = nvitems();
         size_t sz = nv.size();
-        if (sz == 0) nv.reserve(1000); // Avoid resizing during execution ... stupid code somewhere below not thread safe?
-        if (sz >=1000) MADNESS_EXCEPTION("WorldProfile: did not reserve enough space!", sz);
+        if (sz == 0) nv.reserve(MAX_NID); // Avoid resizing while print() or another thread reads entries
+        if (sz >= size_t(MAX_NID)) MADNESS_EXCEPTION("WorldProfile: did not reserve enough space!", sz);
         for (unsigned int i=0; i<nv.size(); ++i) {
             if (name == nv[i].name) return i;
         }
@@ -185,6 +289,53 @@ namespace madness {
         for (unsigned int i=0; i<nv.size(); ++i) {
             nv[i].clear();
         }
+        // Other threads may still be adding to their statistics so rather
+        // than zeroing them remember their current sums for merge() to subtract
+        cleared.resize(nv.size());
+        ScopedMutex<Spinlock> hold(threads_lock);
+        for (unsigned int id=0; id<nv.size(); ++id) {
+            sum_threads(id, cleared[id]);
+        }
+    }
+
+    void WorldProfile::set_sample(unsigned long n) {
+        sample = (n ? n : 1);
+    }
+
+    void WorldProfile::merge() {
+        ScopedMutex<Spinlock> fred(mutex);
+        ScopedMutex<Spinlock> hold(threads_lock);
+        std::vector<WorldProfileEntry>& nv = nvitems();
+        const unsigned long n = sample;
+        for (unsigned int id=0; id<nv.size(); ++id) {
+            WorldProfileEntry& d = nv[id];
+            sum_threads(id, d);
+            if (id < cleared.size()) {
+                const WorldProfileEntry& c = cleared[id];
+                d.count.value -= c.count.value;
+                d.xcpu.value -= c.xcpu.value;
+                d.icpu.value -= c.icpu.value;
+                d.xnmsg_sent.value -= c.xnmsg_sent.value;
+                d.inmsg_sent.value -= c.inmsg_sent.value;
+                d.xnmsg_recv.value -= c.xnmsg_recv.value;
+                d.inmsg_recv.value -= c.inmsg_recv.value;
+                d.xnbyt_sent.value -= c.xnbyt_sent.value;
+                d.inbyt_sent.value -= c.inbyt_sent.value;
+                d.xnbyt_recv.value -= c.xnbyt_recv.value;
+                d.inbyt_recv.value -= c.inbyt_recv.value;
+            }
+            d.count.value *= n;
+            d.xcpu.value *= n;
+            d.icpu.value *= n;
+            d.xnmsg_sent.value *= n;
+            d.inmsg_sent.value *= n;
+            d.xnmsg_recv.value *= n;
+            d.inmsg_recv.value *= n;
+            d.xnbyt_sent.value *= n;
+            d.inbyt_sent.value *= n;
+            d.xnbyt_recv.value *= n;
+            d.inbyt_recv.value *= n;
+        }
     }
 
     /// Returns a reference to the specified entry.  Throws if id is invalid.
@@ -296,6 +447,8 @@ namespace madness {
 #ifdef WORLD_PROFILE_ENABLE
         for (int i=0; i<100; ++i) est_profile_overhead();
 
+        merge();
+
         std::vector<WorldProfileEntry>& nv = const_cast<std::vector<WorldProfileEntry>&>(items);
 
         ProcessID me = world.rank();
@@ -313,13 +466,16 @@ namespace madness {
         else {
             double overhead = 0.0;
             int overid = find("WorldProfile::est_profile_overhead");
-            if (overid != -1) {
+            if (overid != -1 && get_entry(overid).count.sum) {
                 overhead = get_entry(overid).xcpu.sum/get_entry(overid).count.sum;
             }
 
             std::printf("\n    MADNESS global parallel profile\n");
             std::printf("    -------------------------------\n\n");
             std::printf("    o  estimated profiling overhead %.1e seconds per call\n", overhead);
+            if (sample > 1) {
+                std::printf("    o  sampled 1 of every %lu outermost calls ... totals are estimates\n", sample);
+            }
             std::printf("    o  total  cpu time on process zero %.1f seconds\n", madness::cpu_time()-WorldProfile::cpu_start);
             std::printf("    o  total wall time on process zero %.1f seconds\n", madness::wall_time()-WorldProfile::wall_start);
             std::printf("    o  exclusive cpu time excludes called profiled routines\n");
@@ -404,27 +560,42 @@ namespace madness {
         }
     }
 
-    WorldProfileObj::WorldProfileObj(int id) : prev(call_stack), id(id), cpu_base(madness::cpu_time()), stats_base(::madness::RMI::get_stats()) {
-        int tid = mythreadid;
-        if (tid == -1) tid = mythreadid = ++threadcounter;
-        MADNESS_ASSERT(mythreadid < 64);
+    int WorldProfileObj::sampled(int id) {
+        if (nskip) { // Inside a call that is not sampled
+            ++nskip;
+            return -1;
+        }
+        if (!call_stack) {
+            const unsigned long n = WorldProfile::get_sample();
+            if (n > 1 && (ncall++ % n)) {
+                nskip = 1;
+                return -1;
+            }
+        }
+        return id;
+    }
+
+    WorldProfileObj::WorldProfileObj(int id)
+            : prev(call_stack), id(sampled(id))
+            , cpu_base(this->id < 0 ? 0.0 : madness::cpu_time())
+            , stats_base(this->id < 0 ? RMIStats() : ::madness::RMI::get_stats())
+    {
+        if (this->id < 0) return;
         cpu_start = cpu_base;
         stats_start = stats_base;
         call_stack = this;
-        ++(WorldProfile::get_entry(id).depth[tid]); // Keep track of recursive calls to avoid double counting time in self
+        ++(thread_stat(this->id).depth); // Keep track of recursive calls to avoid double counting time in self
         if (prev) prev->pause(cpu_start,stats_start);
     }
 
     /// Pause profiling while we are not executing ... accumulate time in self
     void WorldProfileObj::pause(double now, const RMIStats& stats) {
-        ScopedMutex<Spinlock> martha(WorldProfile::get_entry(id));
-        WorldProfileEntry& d = WorldProfile::get_entry(id);
-
-        d.xcpu.value += (now - cpu_start);
-        d.xnmsg_sent.value += (stats.nmsg_sent - stats_start.nmsg_sent);
-        d.xnmsg_recv.value += (stats.nmsg_recv - stats_start.nmsg_recv);
-        d.xnbyt_sent.value += (stats.nbyte_sent - stats_start.nbyte_sent);
-        d.xnbyt_recv.value += (stats.nbyte_recv - stats_start.nbyte_recv);
+        ThreadStat& d = thread_stat(id);
+        stat_add(d.xcpu, now - cpu_start);
+        stat_add(d.xnmsg_sent, stats.nmsg_sent - stats_start.nmsg_sent);
+        stat_add(d.xnmsg_recv, stats.nmsg_recv - stats_start.nmsg_recv);
+        stat_add(d.xnbyt_sent, stats.nbyte_sent - stats_start.nbyte_sent);
+        stat_add(d.xnbyt_recv, stats.nbyte_recv - stats_start.nbyte_recv);
     }
 
     /// Resume profiling
@@ -434,27 +605,27 @@ namespace madness {
     }
 
     WorldProfileObj::~WorldProfileObj() {
+        if (id < 0) {
+            --nskip;
+            return;
+        }
         // if (call_stack != this) throw "WorldProfileObject: call stack confused\n"; // destructors should not throw
         double now = madness::cpu_time();
         RMIStats stats = RMI::get_stats();
-        WorldProfileEntry& d = WorldProfile::get_entry(id);
-        int tid = mythreadid;
-        {
-            ScopedMutex<Spinlock> martha(d);
-            ++(d.count.value);
-            d.xcpu.value += (now - cpu_start);
-            d.xnmsg_sent.value += (stats.nmsg_sent - stats_start.nmsg_sent);
-            d.xnmsg_recv.value += (stats.nmsg_recv - stats_start.nmsg_recv);
-            d.xnbyt_sent.value += (stats.nbyte_sent - stats_start.nbyte_sent);
-            d.xnbyt_recv.value += (stats.nbyte_recv - stats_start.nbyte_recv);
-            d.depth[tid]--;
-            if (d.depth[tid] == 0) { // Don't double count recursive calls
-                d.icpu.value += (now - cpu_base);
-                d.inmsg_sent.value += (stats.nmsg_sent - stats_base.nmsg_sent);
-                d.inmsg_recv.value += (stats.nmsg_recv - stats_base.nmsg_recv);
-                d.inbyt_sent.value += (stats.nbyte_sent - stats_base.nbyte_sent);
-                d.inbyt_recv.value += (stats.nbyte_recv - stats_base.nbyte_recv);
-            }
+        ThreadStat& d = thread_stat(id);
+        stat_add(d.count, 1ul);
+        stat_add(d.xcpu, now - cpu_start);
+        stat_add(d.xnmsg_sent, stats.nmsg_sent - stats_start.nmsg_sent);
+        stat_add(d.xnmsg_recv, stats.nmsg_recv - stats_start.nmsg_recv);
+        stat_add(d.xnbyt_sent, stats.nbyte_sent - stats_start.nbyte_sent);
+        stat_add(d.xnbyt_recv, stats.nbyte_recv - stats_start.nbyte_recv);
+        d.depth--;
+        if (d.depth == 0) { // Don't double count recursive calls
+            stat_add(d.icpu, now - cpu_base);
+            stat_add(d.inmsg_sent, stats.nmsg_sent - stats_base.nmsg_sent);
+            stat_add(d.inmsg_recv, stats.nmsg_recv - stats_base.nmsg_recv);
+            stat_add(d.inbyt_sent, stats.nbyte_sent - stats_base.nbyte_sent);
+            stat_add(d.inbyt_recv, stats.nbyte_recv - stats_base.nbyte_recv);
         }
         call_stack = prev;
         if (call_stack) call_stack->resume(now, stats);
@@ -87,10 +87,8 @@ namespace madness {
     }; // struct ProfileStat
 
     /// Used to store profiler info
-    struct WorldProfileEntry : public Spinlock {
+    struct WorldProfileEntry {
         std::string name;          ///< name of the entry
-        static const int MAX_NTHREAD=64;
-        int depth[MAX_NTHREAD];             ///< depth of recursive calls by thread (0 if no active calls)
 
         ProfileStat<unsigned long> count;   ///< count of times called
         ProfileStat<double> xcpu; ///< exclusive cpu time (i.e., excluding calls)
@@ -126,7 +124,7 @@ namespace madness {
 
         template <class Archive>
         void serialize(const Archive& ar) {
-            ar & name & depth & count & xcpu & icpu & xnmsg_sent & inmsg_sent & xnmsg_recv & inmsg_recv & xnbyt_sent & inbyt_sent & xnbyt_recv & inbyt_recv;
+            ar & name & count & xcpu & icpu & xnmsg_sent & inmsg_sent & xnmsg_recv & inmsg_recv & xnbyt_sent & inbyt_sent & xnbyt_recv & inbyt_recv;
         }
     }; // struct WorldProfileEntry
 
@@ -134,12 +132,26 @@ namespace madness {
     /// Singleton-like class for holding profiling data and functionality
 
     /// Use the macros PROFILE_FUNC, PROFILE_BLOCK, PROFILE_MEMBER_FUNC
+    ///
+    /// Each thread accumulates into its own statistics indexed by id
+    /// without locking; these are merged into the entries by merge(),
+    /// which print() calls.  Threads may keep profiling during merge()
+    /// and clear(), which read the statistics of other threads with
+    /// relaxed atomic loads and never write them.
+    ///
+    /// To keep the overhead low enough to leave profiling on in production
+    /// runs, set the environment variable \c MAD_PROFILE_SAMPLE to \c N (or
+    /// call set_sample()) to record only 1 of every \c N outermost profiled
+    /// calls of each thread together with all the profiled calls made
+    /// within it.  The totals printed are scaled up by \c N and so are
+    /// estimates.
     class WorldProfile {
         //static ConcurrentHashMap<std::string,WorldProfileEntry> items;
         volatile static std::vector<WorldProfileEntry> items;
         static Spinlock mutex;
         static double cpu_start;
         static double wall_start;
+        static unsigned long sample;
 
         static std::vector<WorldProfileEntry>& nvitems();
 
@@ -147,8 +159,18 @@ namespace madness {
         /// Returns id of the entry associated with the name.  Returns -1 if not found;
         static int find(const std::string& name);
 
-
     public:
+        /// Maximum number of ids that can be registered
+        static const int MAX_NID = 1000;
+
+        /// Sets sampling to record 1 of every \c n outermost calls (1 records all)
+        static void set_sample(unsigned long n);
+
+        /// Returns the sampling interval
+        static unsigned long get_sample() {
+            return sample;
+        }
+
         /// Returns id for the name, registering if necessary.
         static int register_id(const char* name);
 
@@ -158,7 +180,12 @@ namespace madness {
         /// Clears all profiling information
         static void clear();
 
+        /// Sets the local values of the entries to the sum of the statistics of all threads since the last clear()
+        static void merge();
+
         /// Returns a reference to the specified entry.  Throws if id is invalid.
+
+        /// The statistics of the entry are only brought up to date by merge() or print().
         static WorldProfileEntry& get_entry(int id);
 
         /// Prints global profiling information.  Global fence involved.  Implemented in worldstuff.cc
@@ -172,13 +199,18 @@ namespace madness {
 
     class WorldProfileObj {
         static thread_local WorldProfileObj* call_stack;  ///< Current top of this thread's call stack
-        static thread_local int mythreadid; ///< My unique thread id
+        static thread_local unsigned long ncall; ///< No. of outermost calls made by this thread
+        static thread_local int nskip; ///< Depth of calls not being sampled by this thread
         WorldProfileObj* const prev; ///< Pointer to the entry that called me
-        const int id;                ///< My entry in the world profiler
+        const int id;                ///< My entry in the world profiler (-1 if not sampled)
         const double cpu_base;       ///< Time that I started executing
         RMIStats stats_base;         ///< Msg stats when I start executing
         double cpu_start;            ///< Time that I was at top of stack
         RMIStats stats_start;        ///< Msg stats when I was at top of stack;
+
+        /// Returns \c id if this call is to be recorded, or -1 if it is skipped by sampling
+        static int sampled(int id);
+
     public:
 
         WorldProfileObj(int id);
@@ -33,7 +33,9 @@
 #ifndef MADNESS_WORLD_WORLDRANGE_H__INCLUDED
 #define MADNESS_WORLD_WORLDRANGE_H__INCLUDED
 
+#include <algorithm>
 #include <iterator>
+#include <utility>
 #include <madness/world/enable_if.h>
 
 /// \file worldrange.h
@@ -48,16 +50,47 @@ namespace madness {
     class Split {};
 #endif /// HAVE_INTEL_TBB
 
+    namespace detail {
+        /// True if \c iteratorT has \c align_to_bin() (the iterators of the hash maps and containers)
+        template <typename iteratorT>
+        class has_align_to_bin {
+            template <typename U>
+            static char test(U*, decltype(std::declval<U&>().align_to_bin(0))* = 0);
+
+            template <typename U>
+            static long test(...);
+
+        public:
+            static const bool value = (sizeof(test<iteratorT>(0)) == 1);
+        };
+    }
+
     /// Range vaguely a la Intel TBB encapsulates random-access STL-like start and end iterators with chunksize
+
+    /// With a chunk size of \c AUTO, WorldTaskQueue::for_each() and
+    /// WorldTaskQueue::reduce() choose the chunk size from the measured
+    /// cost of the operation (see detail::GrainSize); until the operation
+    /// has been timed it gives each thread of the pool four chunks.  Ranges
+    /// over a hash map or a distributed container are split at the start
+    /// of a bin when that is within \c maxalign items of the middle and
+    /// moves it by at most an eighth of the left half, so that tasks do
+    /// not share bins but splits still halve the range.
     template <typename iteratorT>
     class Range {
         long n;
         iteratorT start;
         iteratorT finish;
         int chunksize;
+        bool adaptive;
     public:
         typedef iteratorT iterator;
 
+        /// Chunk size that is chosen by the task queue
+        static const int AUTO = 0;
+
+        /// Most items a split moves over to reach the start of a hash bin
+        static const int maxalign = 64;
+
         /// Makes the range [start,finish)
 
         /// The motivated reader should look at the Intel TBB range,
@@ -67,6 +100,7 @@ namespace madness {
             , start(start)
             , finish(finish)
             , chunksize(chunk)
+            , adaptive(chunk == AUTO)
         {
             if (chunksize < 1) chunksize = 1;
         }
@@ -77,20 +111,26 @@ namespace madness {
                 , start(r.start)
                 , finish(r.finish)
                 , chunksize(r.chunksize)
+                , adaptive(r.adaptive)
         {}
 
-        /// Splits range between new and old (r) objects ... cost is O(1)
+        /// Splits range between new and old (r) objects
+
+        /// The cost is that of advancing an iterator to the middle, plus
+        /// at most \c maxalign steps to find the start of a hash bin.
         Range(Range& left, const Split& /*split*/)
                 : n(0)
                 , start(left.finish)
                 , finish(left.finish)
                 , chunksize(left.chunksize)
+                , adaptive(left.adaptive)
         {
             if (left.n > chunksize) {
-                int nleft = (left.n+1)/2;
+                long nleft = (left.n+1)/2;
 
                 start = left.start;
                 advance(start,nleft);
+                nleft += align(start, std::min(std::min(nleft/8, left.n - nleft - 1), long(maxalign)));
                 finish = left.finish;
                 n = left.n - nleft;
 
@@ -113,7 +153,27 @@ namespace madness {
 
         unsigned int get_chunksize() const { return chunksize; }
 
+        /// Sets the chunk size (an adaptive range stays adaptive)
+        void set_chunksize(int chunk) { chunksize = (chunk < 1) ? 1 : chunk; }
+
+        /// Returns true if the range was made with chunk size \c AUTO
+        bool is_adaptive() const { return adaptive; }
+
     private:
+        /// Moves \c it to the start of the next hash bin if that is at most \c nmax items on
+
+        /// Returns the no. of items moved over
+        template <typename iterT>
+        inline static typename enable_if<detail::has_align_to_bin<iterT>, long>::type
+        align(iterT& it, long nmax) {
+            if (nmax <= 0) return 0;
+            return it.align_to_bin(int(nmax));
+        }
+
+        template <typename iterT>
+        inline static typename disable_if<detail::has_align_to_bin<iterT>, long>::type
+        align(iterT&, long) { return 0; }
+
         template<typename integralT, typename distanceT>
         inline static typename enable_if<std::is_integral<integralT>, void>::type
         advance(integralT& i, distanceT n) { i += n; }
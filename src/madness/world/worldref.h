@@ -45,6 +45,7 @@
 #include <madness/world/worldam.h>      // for new_am_arg
 #include <madness/world/worldptr.h>     // for WorldPtr
 #include <madness/world/worldhashmap.h> // for ConcurrentHashMap
+#include <madness/world/object_pool.h>  // for SmallObjectPool
 #include <iosfwd>               // for std::ostream
 
 //#define MADNESS_REMOTE_REFERENCE_DEBUG
@@ -157,9 +158,6 @@ namespace madness {
         template <typename T>
         class RemoteCounterImpl : public RemoteCounterBase {
         private:
-            // At some point this should probably be changed to a quick allocator
-            // When that happens, also uncomment the new and delete operators
-//            typedef std::allocator<RemoteCounterImpl<T> > A;
 
             // Keep a copy of the shared pointer to make sure it stays in memory
             // while we have outstanding remote references to it.
@@ -184,13 +182,13 @@ namespace madness {
             /// \return The pointer that is being counted.
             virtual void* key() const { return static_cast<void*>(pointer_.get()); }
 
-//            void* operator new(std::size_t) {
-//                return A().allocate(1);
-//            }
-//
-//            void operator delete(void * p) {
-//                A().deallocate(static_cast<RemoteCounterImpl<T> *>(p), 1);
-//            }
+            void* operator new(std::size_t size) {
+                return SmallObjectPool::allocate(size);
+            }
+
+            void operator delete(void * p, std::size_t size) {
+                SmallObjectPool::deallocate(p, size);
+            }
         }; // class RemoteCounterImpl
 
         /// Remote reference counter
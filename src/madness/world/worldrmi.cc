@@ -36,6 +36,7 @@
 #include <madness/world/timers.h>
 #include <iostream>
 #include <algorithm>
+#include <limits>
 #include <utility>
 #include <sstream>
 
@@ -44,6 +45,7 @@ namespace madness {
     RMI::RmiTask* RMI::task_ptr = NULL;
     RMIStats RMI::stats;
     volatile bool RMI::debugging = false;
+    volatile rmi_progressT RMI::progress_hooks[RMI::MAX_PROGRESS_HOOKS] = {NULL, NULL, NULL, NULL};
 
 #if HAVE_INTEL_TBB
     tbb::task* RMI::tbb_rmi_parent_task = NULL;
@@ -65,6 +67,8 @@ namespace madness {
         while((narrived == 0) && (iterations < 1000)) {
 	  narrived = SafeMPI::Request::Testsome(maxq_, recv_req.get(), ind.get(), status.get());
 	  ++iterations;
+	  for (int h=0; h<RMI::MAX_PROGRESS_HOOKS && RMI::progress_hooks[h]; ++h)
+	    RMI::progress_hooks[h]();
 	  myusleep(RMI::testsome_backoff_us);
         }
 	
@@ -102,7 +106,10 @@ namespace madness {
                                   << std::endl;
 
                     if (is_ordered(attr)) ++(recv_counters[src]);
-                    func(recv_buf[i], len);
+                    {
+                        TimelineScope event(Timeline::AM_RECV, 0, src, len);
+                        func(recv_buf[i], len);
+                    }
                     post_recv_buf(i);
                 }
                 else {
@@ -145,7 +152,10 @@ namespace madness {
                                   << std::endl;
 
                     ++(recv_counters[src]);
-                    q[m].func(recv_buf[q[m].i], q[m].len);
+                    {
+                        TimelineScope event(Timeline::AM_RECV, 0, src, q[m].len);
+                        q[m].func(recv_buf[q[m].i], q[m].len);
+                    }
                     post_recv_buf(q[m].i);
                 }
                 else {
@@ -172,8 +182,19 @@ namespace madness {
             int src = hugeq.front().first;
             size_t nbyte = hugeq.front().second;
             hugeq.pop_front();
-            if (posix_memalign(&recv_buf[nrecv_], ALIGNMENT, nbyte))
-                MADNESS_EXCEPTION("RMI: failed allocating huge message", 1);
+            if (huge_buf && huge_buf_size >= nbyte) {
+                // Recycle the buffer of the previous huge message
+                recv_buf[nrecv_] = huge_buf;
+            }
+            else {
+                free(huge_buf);
+                huge_buf = 0;
+                huge_buf_size = 0;
+                if (posix_memalign(&recv_buf[nrecv_], ALIGNMENT, nbyte))
+                    MADNESS_EXCEPTION("RMI: failed allocating huge message", 1);
+                huge_buf = recv_buf[nrecv_];
+                huge_buf_size = nbyte;
+            }
             recv_req[nrecv_] = comm.Irecv(recv_buf[nrecv_], nbyte, MPI_BYTE, src, SafeMPI::RMI_HUGE_DAT_TAG);
             int nada=0;
 #ifdef MADNESS_USE_BSEND_ACKS
@@ -189,7 +210,12 @@ namespace madness {
             recv_req[i] = comm.Irecv(recv_buf[i], max_msg_len_, MPI_BYTE, MPI_ANY_SOURCE, SafeMPI::RMI_TAG);
         }
         else if (i == (int)nrecv_) {
-            free(recv_buf[i]);
+            // Keep moderately sized buffers for the next huge message
+            if (huge_buf_size > HUGE_BUF_KEEP*max_msg_len_) {
+                free(huge_buf);
+                huge_buf = 0;
+                huge_buf_size = 0;
+            }
             recv_buf[i] = 0;
             post_pending_huge_msg();
         }
@@ -206,10 +232,14 @@ namespace madness {
         //             }
         //         }
         //for (int i=0; i<nrecv_; ++i) free(recv_buf[i]);
+        free(huge_buf);
     }
 
     RMI::RmiTask::RmiTask()
             : comm(SafeMPI::COMM_WORLD)
+            , rendezvous_comm(comm.Create(comm.Get_group()))
+            , rendezvous_tag_ub(32767)
+            , rendezvous_ntag(0)
             , nproc(comm.Get_size())
             , rank(comm.Get_rank())
             , finished(false)
@@ -219,12 +249,18 @@ namespace madness {
             , nrecv_(DEFAULT_NRECV)
             , maxq_(DEFAULT_NRECV + 1)
             , recv_buf()
+            , huge_buf(0)
+            , huge_buf_size(0)
             , recv_req()
             , status()
             , ind()
             , q()
             , n_in_q(0)
     {
+        int* tag_ub = 0;
+        if (rendezvous_comm.Get_attr(MPI_TAG_UB, &tag_ub) && tag_ub)
+            rendezvous_tag_ub = *tag_ub;
+
         // Get the maximum buffer size from the MAD_BUFFER_SIZE environment
         // variable.
         const char* mad_buffer_size = getenv("MAD_BUFFER_SIZE");
@@ -312,6 +348,7 @@ namespace madness {
 
     RMI::Request
     RMI::RmiTask::RmiTask::isend(const void* buf, size_t nbyte, ProcessID dest, rmi_handlerT func, attrT attr) {
+        TimelineScope event(Timeline::AM_SEND, 0, dest, nbyte);
         int tag = SafeMPI::RMI_TAG;
 
         if (nbyte > max_msg_len_) {
@@ -374,6 +411,49 @@ namespace madness {
         return result;
     }
 
+    int RMI::reserve_rendezvous_tags(unsigned int n) {
+        MADNESS_ASSERT(task_ptr);
+        return int(__sync_fetch_and_add(&task_ptr->rendezvous_ntag, n) %
+                   ((unsigned int)(task_ptr->rendezvous_tag_ub) + 1u));
+    }
+
+    int RMI::rendezvous_tag(int first, unsigned int k) {
+        MADNESS_ASSERT(task_ptr);
+        return int(((unsigned int)(first) + k) % ((unsigned int)(task_ptr->rendezvous_tag_ub) + 1u));
+    }
+
+    RMI::Request
+    RMI::isend_rendezvous(const void* buf, size_t nbyte, ProcessID dest, int tag) {
+        MADNESS_ASSERT(task_ptr);
+        MADNESS_ASSERT(nbyte <= size_t(std::numeric_limits<int>::max()));
+        __sync_fetch_and_add(&stats.nrendezvous_sent, uint64_t(1));
+        __sync_fetch_and_add(&stats.nbyte_rendezvous_sent, uint64_t(nbyte));
+
+        if (RMI::debugging)
+            std::cerr << task_ptr->rank
+                      << ":RMI: rendezvous send buf=" << buf
+                      << " nbyte=" << nbyte
+                      << " dest=" << dest
+                      << " tag=" << tag
+                      << std::endl;
+
+        return task_ptr->rendezvous_comm.Isend(buf, int(nbyte), MPI_BYTE, dest, tag);
+    }
+
+    bool RMI::iprobe_rendezvous(ProcessID src, int tag, size_t& nbyte) {
+        MADNESS_ASSERT(task_ptr);
+        MPI_Status status;
+        if (!task_ptr->rendezvous_comm.Iprobe(src, tag, status)) return false;
+        nbyte = size_t(SafeMPI::Status(status).Get_count(MPI_BYTE));
+        return true;
+    }
+
+    RMI::Request RMI::irecv_rendezvous(void* buf, size_t nbyte, ProcessID src, int tag) {
+        MADNESS_ASSERT(task_ptr);
+        MADNESS_ASSERT(nbyte <= size_t(std::numeric_limits<int>::max()));
+        return task_ptr->rendezvous_comm.Irecv(buf, int(nbyte), MPI_BYTE, src, tag);
+    }
+
   int RMI::testsome_backoff_us = 2;
 
 } // namespace madness
@@ -99,6 +99,9 @@ namespace madness {
     /// This is the generic low-level interface for a message handler
     typedef void (*rmi_handlerT)(void* buf, size_t nbyte);
 
+    /// Function polled by the server thread while it waits for messages
+    typedef void (*rmi_progressT)();
+
     struct qmsg {
         typedef uint16_t counterT;
         typedef uint32_t attrT;
@@ -126,9 +129,12 @@ namespace madness {
         uint64_t nbyte_sent;
         uint64_t nmsg_recv;
         uint64_t nbyte_recv;
+        uint64_t nrendezvous_sent;  ///< #arrays sent by rendezvous
+        uint64_t nbyte_rendezvous_sent;
 
         RMIStats()
-                : nmsg_sent(0), nbyte_sent(0), nmsg_recv(0), nbyte_recv(0) {}
+                : nmsg_sent(0), nbyte_sent(0), nmsg_recv(0), nbyte_recv(0)
+                , nrendezvous_sent(0), nbyte_rendezvous_sent(0) {}
     };
 
 
@@ -169,6 +175,9 @@ namespace madness {
             std::list< std::pair<int,size_t> > hugeq; // q for incoming huge messages
 
             SafeMPI::Intracomm comm;
+            SafeMPI::Intracomm rendezvous_comm; // Private copy of comm world so rendezvous may use any tag
+            int rendezvous_tag_ub;      // Largest tag on rendezvous_comm
+            volatile unsigned int rendezvous_ntag; // Counter used to make rendezvous tags
             const int nproc;            // No. of processes in comm world
             const ProcessID rank;       // Rank of this process
             volatile bool finished;     // True if finished
@@ -179,6 +188,8 @@ namespace madness {
             std::size_t nrecv_;
             std::size_t maxq_;
             ScopedArray<void*> recv_buf; // Will be at least ALIGNMENT aligned ... +1 for huge messages
+            void* huge_buf;             // Buffer kept for reuse by the next huge message
+            std::size_t huge_buf_size;  // Size of huge_buf
             ScopedArray<SafeMPI::Request> recv_req;
 
             ScopedArray<SafeMPI::Status> status;
@@ -207,6 +218,7 @@ namespace madness {
             }
 #else
             void run() {
+                Timeline::name_thread("rmi");
                 try {
                     while (! finished) process_some();
                     finished = false;
@@ -245,9 +257,12 @@ namespace madness {
         static RmiTask* task_ptr;    // Pointer to the singleton instance
         static RMIStats stats;
         static volatile bool debugging;    // True if debugging
+        static const int MAX_PROGRESS_HOOKS = 4;
+        static volatile rmi_progressT progress_hooks[MAX_PROGRESS_HOOKS]; // Polled by the server thread (null if unused)
 
         static const size_t DEFAULT_MAX_MSG_LEN = 3*512*1024;
         static const int DEFAULT_NRECV = 128;
+        static const std::size_t HUGE_BUF_KEEP = 16; // Keep huge recv buffers up to this many max_msg_len
 
         // Not allowed
         RMI(const RMI&);
@@ -286,6 +301,36 @@ namespace madness {
             return task_ptr->isend(buf, nbyte, dest, func, attr);
         }
 
+        /// Reserves \c n consecutive rendezvous tags and returns the first
+
+        /// Use rendezvous_tag to get the others, since tags wrap around.
+        static int reserve_rendezvous_tags(unsigned int n);
+
+        /// Returns tag \c k of a block that starts with \c first
+        static int rendezvous_tag(int first, unsigned int k);
+
+        /// Send an array directly from the user's memory (see BufferRendezvousSink)
+
+        /// The transfer uses a private communicator and a tag from
+        /// reserve_rendezvous_tags, which the receiver uses with
+        /// iprobe_rendezvous and irecv_rendezvous.  The buffer must not be
+        /// modified or freed until the request completes.
+        /// @param[in] buf Pointer to the data
+        /// @param[in] nbyte Size of the data in bytes
+        /// @param[in] dest Process (in COMM_WORLD) to receive the data
+        /// @param[in] tag Tag of the transfer
+        /// @return The status of the send
+        static Request isend_rendezvous(const void* buf, size_t nbyte, ProcessID dest, int tag);
+
+        /// Returns true (and its size in \c nbyte) if an array sent with isend_rendezvous can be received
+
+        /// Never waits, so the server thread may call it and try again
+        /// later if the array is yet to arrive.
+        static bool iprobe_rendezvous(ProcessID src, int tag, size_t& nbyte);
+
+        /// Receive an array sent with isend_rendezvous into \c buf
+        static Request irecv_rendezvous(void* buf, size_t nbyte, ProcessID src, int tag);
+
         static void begin() {
             testsome_backoff_us = 5;
             const char* buf = getenv("MAD_BACKOFF_US");
@@ -320,6 +365,20 @@ namespace madness {
             }
         }
 
+        /// Install a function the server thread calls while polling for messages
+
+        /// The hook runs in the server thread so, like a message handler,
+        /// it must be quick and careful about sending.  Adding a hook
+        /// that is already installed does nothing.
+        static void add_progress_hook(rmi_progressT hook) {
+            for (int i=0; i<MAX_PROGRESS_HOOKS; ++i) {
+                if (progress_hooks[i] == hook) return;
+                if (__sync_bool_compare_and_swap(&progress_hooks[i], rmi_progressT(0), hook)) return;
+                if (progress_hooks[i] == hook) return;
+            }
+            MADNESS_EXCEPTION("RMI: too many progress hooks", MAX_PROGRESS_HOOKS);
+        }
+
         static void set_debug(bool status) { debugging = status; }
 
         static bool get_debug() { return debugging; }
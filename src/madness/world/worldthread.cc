@@ -39,6 +39,7 @@
 #include <madness/world/worldpapi.h>
 #include <madness/world/safempi.h>
 #include <madness/world/atomicint.h>
+#include <madness/world/hardware.h>
 #include <cstring>
 #include <fstream>
 
@@ -71,6 +72,9 @@ namespace madness {
 
     ThreadPool* ThreadPool::instance_ptr = 0;
     double ThreadPool::await_timeout = 900.0;
+    uint64_t ThreadPool::spin_ns = 50000;
+    std::size_t ThreadPool::high_water = 0;
+    std::size_t ThreadPool::low_water = 0;
 #if HAVE_INTEL_TBB
     tbb::task_scheduler_init* ThreadPool::tbb_scheduler = 0;
     tbb::empty_task* ThreadPool::tbb_parent_task = 0;
@@ -260,6 +264,19 @@ namespace madness {
 #endif
     }
 
+    void ThreadBase::set_affinity_cpus(const std::vector<int>& cpus) {
+#ifndef ON_A_MAC
+        if (cpus.empty()) return;
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        for (std::size_t i=0; i<cpus.size(); ++i) CPU_SET(cpus[i],&mask);
+        if (sched_setaffinity(0, sizeof(mask), &mask) == -1) {
+            perror("system error message");
+            std::cout << "ThreadBase: set_affinity_cpus: Could not set cpu Affinity" << std::endl;
+        }
+#endif
+    }
+
 #if defined(HAVE_IBMBGQ) and defined(HPM)
   void ThreadBase::set_hpm_thread_env(int hpm_thread_id) {
     if (hpm_thread_id == ThreadBase::hpm_thread_id_all) {
@@ -333,9 +350,11 @@ namespace madness {
 
     /// The constructor is private to enforce the singleton model
     ThreadPool::ThreadPool(int nthread) :
-            threads(NULL), main_thread(), nthreads(nthread), finish(false)
+            threads(NULL), main_thread(), nthreads(nthread), finish(false),
+            work_stealing(false), nthrottle(0), ninline(0), nqueued(0), numa(false), nnodes(1), node_queue(NULL)
     {
         nfinished = 0;
+        next_deque = 0;
         instance_ptr = this;
         if (nthreads < 0) nthreads = default_nthread();
         MADNESS_ASSERT(nthreads >= 0);
@@ -374,6 +393,13 @@ namespace madness {
             MADNESS_EXCEPTION("memory allocation failed", 0);
         }
 
+        // Must be decided before the threads start looking for work
+        if (nthreads > 0) {
+            const SchedulerKind sched = default_scheduler();
+            work_stealing = (sched != SCHED_QUEUE);
+            if (sched == SCHED_NUMA) init_numa();
+        }
+
         for (int i=0; i<nthreads; ++i) {
             threads[i].set_pool_thread_index(i);
             threads[i].start(pool_thread_main, (void *)(threads+i));
@@ -406,9 +432,229 @@ namespace madness {
         return nthread;
     }
 
+    /// Get the scheduler choice from the environment
+    ThreadPool::SchedulerKind ThreadPool::default_scheduler() {
+        const char* sched = getenv("MAD_SCHEDULER");
+        if (!sched || strcmp(sched, "queue") == 0)
+            return SCHED_QUEUE;
+        if (strcmp(sched, "steal") == 0)
+            return SCHED_STEAL;
+        if (strcmp(sched, "numa") == 0)
+            return SCHED_NUMA;
+
+        if(SafeMPI::COMM_WORLD.Get_rank() == 0)
+            std::cerr << "!!! WARNING: MAD_SCHEDULER must be \"queue\", \"steal\" or \"numa\".\n"
+                      << "!!! WARNING: MAD_SCHEDULER = " << sched << ", using the shared queue.\n";
+        return SCHED_QUEUE;
+    }
+
+    /// Read the NUMA topology and assign pool threads to nodes
+    void ThreadPool::init_numa() {
+        Hardware hw;
+        hw.Initialize();
+
+        numa = true;
+        nnodes = std::min(hw.NumaNodes(), nthreads);
+        node_cpus.resize(nnodes);
+        for (int node=0; node<nnodes; ++node)
+            node_cpus[node] = hw.NumaCPUs(node);
+
+        // If MAD_BIND pins pool threads use the node of each thread's cpu
+        // (see set_affinity), otherwise deal the threads out to the nodes
+        thread_node.resize(nthreads);
+        node_threads.resize(nnodes);
+        for (int i=0; i<nthreads; ++i) {
+            int node = i % nnodes;
+            if (ThreadBase::bind[2]) {
+                const int cpu = ThreadBase::cpulo[2] + i % (ThreadBase::cpuhi[2] - ThreadBase::cpulo[2] + 1);
+                node = hw.NumaNodeOfCPU(cpu) % nnodes;
+            }
+            thread_node[i] = node;
+            node_threads[node].push_back(i);
+        }
+        node_queue = new WorkStealingDeque<PoolTaskInterface*>[nnodes];
+    }
+
+#if !HAVE_INTEL_TBB
+    void ThreadPool::push_to_deque(PoolTaskInterface* task) {
+        ThreadBase* me = ThreadBase::this_thread();
+        const int ind = me ? me->get_pool_thread_index() : -1;
+
+        WorkStealingDeque<PoolTaskInterface*>* dq = NULL;
+        if (numa) {
+            const int hint = task->get_locality();
+            int node = -1;
+            if (hint >= 0)
+                node = hint % nnodes;
+            else if (ind < 0)
+                node = static_cast<unsigned int>(next_deque++) % static_cast<unsigned int>(nnodes);
+
+            if (node >= 0 && (ind < 0 || thread_node[ind] != node))
+                dq = node_queue + node;
+        }
+
+        if (!dq) {
+            if (ind >= 0)
+                dq = &threads[ind].deque();
+            else
+                dq = &threads[static_cast<unsigned int>(next_deque++) % static_cast<unsigned int>(nthreads)].deque();
+        }
+
+        if (task->get_priority())
+            dq->push_priority(task, task->get_priority());
+        else if (task->is_generator())
+            dq->push_front(task);
+        else
+            dq->push_back(task);
+    }
+
+    bool ThreadPool::steal_from(const std::vector<int>& victims, int me, PoolTaskInterface*& task) {
+        const int n = victims.size();
+        if (n == 0) return false;
+
+        // Start after ourselves so that thieves spread over the victims
+        int first = 0;
+        for (int i=0; i<n; ++i) {
+            if (victims[i] == me) {
+                first = i + 1;
+                break;
+            }
+        }
+        for (int i=0; i<n; ++i) {
+            const int victim = victims[(first + i) % n];
+            if (victim == me) continue;
+            if (threads[victim].deque().steal_front(task))
+                return true;
+        }
+        return false;
+    }
+
+    bool ThreadPool::steal(int me, PoolTaskInterface*& task) {
+        if (numa) {
+            const int mynode = (me >= 0 ? thread_node[me] : 0);
+            for (int i=0; i<nnodes; ++i) {
+                const int node = (mynode + i) % nnodes;
+                if (node_queue[node].steal_front(task) || steal_from(node_threads[node], me, task))
+                    return true;
+            }
+            return false;
+        }
+
+        // Start with the next thread so that thieves spread over the victims
+        const int first = (me < 0 ? 0 : me + 1);
+        for (int i=0; i<nthreads; ++i) {
+            int victim = first + i;
+            if (victim >= nthreads) victim -= nthreads;
+            if (victim == me) continue;
+            if (threads[victim].deque().steal_front(task))
+                return true;
+        }
+        return false;
+    }
+
+    bool ThreadPool::has_work() {
+        if (!queue.empty()) return true;
+        if (work_stealing) {
+            for (int i=0; i<nthreads; ++i)
+                if (!threads[i].deque().empty()) return true;
+            if (numa) {
+                for (int i=0; i<nnodes; ++i)
+                    if (!node_queue[i].empty()) return true;
+            }
+        }
+        return false;
+    }
+
+    void ThreadPool::wait_for_work() {
+        const uint64_t start = ParkingLot::now_ns();
+        uint64_t now = start;
+        while (now - start < spin_ns) {
+            for (int i=0; i<32; ++i) cpu_relax();
+            if (finish || has_work()) {
+                parking.record_spin(ParkingLot::now_ns() - start, true);
+                return;
+            }
+            now = ParkingLot::now_ns();
+        }
+        parking.record_spin(now - start, false);
+
+        const int key = parking.prepare_park();
+        if (finish || has_work())
+            parking.cancel_park();
+        else
+            parking.park(key);
+    }
+
+    void ThreadPool::drain() {
+        // Tasks run here may submit more ... do not nest
+        static thread_local bool draining = false;
+        if (draining) return;
+        ThreadBase* me = ThreadBase::this_thread();
+        if (!me || (me->get_pool_thread_index() < 0 && me != &main_thread)) return;
+
+        draining = true;
+        __sync_fetch_and_add(&nthrottle, uint64_t(1));
+        uint64_t nrun = 0;
+        while (queue_size() > low_water && run_tasks(false, static_cast<ThreadPoolThread*>(me)))
+            ++nrun;
+        __sync_fetch_and_add(&ninline, nrun);
+        draining = false;
+    }
+#endif // !HAVE_INTEL_TBB
+
+#if !HAVE_INTEL_TBB
+    bool ThreadPool::run_tasks_stealing(bool wait, ThreadPoolThread* this_thread) {
+        ThreadBase* me_thread = ThreadBase::this_thread();
+        const int me = (me_thread ? me_thread->get_pool_thread_index() : -1);
+
+        while (true) {
+            // Shared queue first ... high-priority and multi-threaded tasks
+            if (!queue.empty()) {
+                PoolTaskInterface* taskbuf[nmax];
+                int ntask = queue.pop_front(nmax, taskbuf, false);
+                __sync_fetch_and_sub(&nqueued, long(ntask));
+#ifdef MADNESS_TASK_PROFILING
+                profiling::TaskEventList* event_list =
+                        this_thread->profiler().new_list(ntask);
+#endif // MADNESS_TASK_PROFILING
+                for (int i=0; i<ntask; ++i) {
+                    if (taskbuf[i]) { // Task pointer might be zero due to stealing
+#ifdef MADNESS_TASK_PROFILING
+                        taskbuf[i]->set_event(event_list->event());
+#endif // MADNESS_TASK_PROFILING
+                        if (taskbuf[i]->run_multi_threaded())
+                            delete taskbuf[i];
+                    }
+                }
+                if (ntask > 0) return true;
+            }
+
+            // Then our own deque (most recent first) or someone else's (oldest first)
+            PoolTaskInterface* task = NULL;
+            if ((me >= 0 && threads[me].deque().pop_back(task)) || steal(me, task)) {
+                __sync_fetch_and_sub(&nqueued, 1l);
+#ifdef MADNESS_TASK_PROFILING
+                task->set_event(this_thread->profiler().new_list(1)->event());
+#endif // MADNESS_TASK_PROFILING
+                if (task->run_multi_threaded())
+                    delete task;
+                return true;
+            }
+
+            if (!wait || finish) return false;
+            wait_for_work();
+        }
+    }
+#endif // !HAVE_INTEL_TBB
+
     void ThreadPool::thread_main(ThreadPoolThread* const thread) {
         PROFILE_MEMBER_FUNC(ThreadPool);
+        Timeline::name_thread("pool");
         thread->set_affinity(2, thread->get_pool_thread_index());
+        // Keep floating NUMA threads on their node so that first touch
+        // puts the data they allocate there
+        if (numa && !ThreadBase::bind[2])
+            ThreadBase::set_affinity_cpus(node_cpus[thread_node[thread->get_pool_thread_index()]]);
 
 #define MULTITASK
 #ifdef  MULTITASK
@@ -462,6 +708,48 @@ namespace madness {
             }
         }
 
+        const char* mad_high_water = getenv("MAD_QUEUE_HIGH_WATER");
+        if (mad_high_water) {
+            std::stringstream ss(mad_high_water);
+            long high = -1;
+            ss >> high;
+            if (ss.fail() || high < 0) {
+                if(SafeMPI::COMM_WORLD.Get_rank() == 0)
+                    std::cout << "!!MADNESS WARNING: Invalid queue high-water mark.\n"
+                              << "!!MADNESS WARNING: MAD_QUEUE_HIGH_WATER = " << mad_high_water << "\n";
+            }
+            else {
+                long low = high/2;
+                const char* mad_low_water = getenv("MAD_QUEUE_LOW_WATER");
+                if (mad_low_water) {
+                    std::stringstream sl(mad_low_water);
+                    sl >> low;
+                    if (sl.fail() || low < 0) {
+                        if(SafeMPI::COMM_WORLD.Get_rank() == 0)
+                            std::cout << "!!MADNESS WARNING: Invalid queue low-water mark.\n"
+                                      << "!!MADNESS WARNING: MAD_QUEUE_LOW_WATER = " << mad_low_water << "\n";
+                        low = high/2;
+                    }
+                }
+                set_water_marks(high, low);
+            }
+        }
+
+        const char* mad_spin_us = getenv("MAD_SPIN_US");
+        if (mad_spin_us) {
+            std::stringstream ss(mad_spin_us);
+            long us = -1;
+            ss >> us;
+            if (ss.fail() || us < 0) {
+                if(SafeMPI::COMM_WORLD.Get_rank() == 0)
+                    std::cout << "!!MADNESS WARNING: Invalid spin time.\n"
+                              << "!!MADNESS WARNING: MAD_SPIN_US = " << mad_spin_us << "\n";
+            }
+            else {
+                spin_ns = uint64_t(us)*1000;
+            }
+        }
+
 #ifdef MADNESS_TASK_PROFILING
         // Initialize the output file name for the task profiler.
         profiling::TaskProfiler::output_file_name_ =
@@ -496,9 +784,8 @@ namespace madness {
 #if !HAVE_INTEL_TBB
         if (!instance_ptr) return;
         instance()->finish = true;
-        for (int i=0; i<instance()->nthreads; ++i) {
-            add(new PoolTaskNull);
-        }
+        // Wake parked threads so they notice finish
+        instance()->parking.notify_all();
         while (instance_ptr->nfinished != instance_ptr->nthreads);
 
 #ifdef MADNESS_TASK_PROFILING
@@ -517,7 +804,37 @@ namespace madness {
 
     /// Returns queue statistics
     const DQStats& ThreadPool::get_stats() {
-        return instance()->queue.get_stats();
+        ThreadPool* pool = instance();
+        pool->stats = pool->queue.get_stats();
+        pool->stats.nsize = queue_size();
+        pool->stats.nthrottle = pool->nthrottle;
+        pool->stats.ninline = pool->ninline;
+        if (pool->work_stealing) {
+            for (int i=0; i<pool->nthreads; ++i) {
+                const DQStats& s = pool->threads[i].deque().get_stats();
+                // Generators pushed to the thief end of a deque are not
+                // high-priority tasks so count them with the others
+                pool->stats.npush_back += s.npush_back + s.npush_front;
+                pool->stats.npop_front += s.npop_front + s.nsteal;
+                pool->stats.npop_back += s.npop_back;
+                pool->stats.ngrow += s.ngrow;
+                pool->stats.nmax += s.nmax;
+                pool->stats.nsum += s.nsum;
+                pool->stats.nsteal += s.nsteal;
+            }
+        }
+        if (pool->numa) {
+            for (int i=0; i<pool->nnodes; ++i) {
+                const DQStats& s = pool->node_queue[i].get_stats();
+                pool->stats.npush_back += s.npush_back + s.npush_front;
+                pool->stats.npop_front += s.npop_front + s.nsteal;
+                pool->stats.npop_back += s.npop_back;
+                pool->stats.ngrow += s.ngrow;
+                pool->stats.nmax += s.nmax;
+                pool->stats.nsum += s.nsum;
+            }
+        }
+        return pool->stats;
     }
 
 } // namespace madness
@@ -38,8 +38,10 @@
 /// \ingroup threads
 
 #include <madness/world/dqueue.h>
+#include <madness/world/object_pool.h>
 #include <madness/world/enable_if.h>
 #include <madness/world/function_traits.h>
+#include <madness/world/worldtimeline.h>
 #include <vector>
 #include <cstddef>
 #include <cstdio>
@@ -155,6 +157,9 @@ namespace madness {
 
         static void set_affinity(int logical_id, int ind=-1);
 
+        /// Bind the calling thread to the given set of cpus
+        static void set_affinity_cpus(const std::vector<int>& cpus);
+
         static ThreadBase* this_thread() {
             return static_cast<ThreadBase*>(pthread_getspecific(thread_key));
         }
@@ -201,11 +206,21 @@ namespace madness {
     /// migrated to another process for dynamic load balancing.  The
     /// default value is false.
     ///
-    /// \c highpriority : indicates a high priority task. The default value is false.
+    /// \c highpriority : indicates a high priority task that runs ahead of
+    /// all others. The default value is false.
+    ///
+    /// \c priority : a level from 0 (the default) to \c NPRIORITY-1 ; ready
+    /// tasks with a higher level are run first, after high priority tasks.
+    /// Tree traversals can use \c tree_level() so that tasks near the root,
+    /// which unblock the most work, get ahead of those in the leaves.
     ///
     /// \c nthread : indicates number of threads. 0 threads is interpreted as 1 thread
     /// for backward compatibility and ease of specifying defaults. The default value
     /// is 0 (==1).
+    ///
+    /// \c locality : an optional hint (e.g., the hash bin of the data the
+    /// task works on) used by the NUMA-aware scheduler to run related tasks
+    /// on the same NUMA node.  The default is no hint.
     class TaskAttributes {
         unsigned long flags;
     public:
@@ -213,6 +228,9 @@ namespace madness {
         static const unsigned long GENERATOR    = 1ul<<8;        // Mask for generator bit
         static const unsigned long STEALABLE    = GENERATOR<<1;  // Mask for stealable bit
         static const unsigned long HIGHPRIORITY = GENERATOR<<2;  // Mask for priority bit
+        static const unsigned long PRIORITY     = 0x7ul<<11;     // Mask for priority level
+        static const unsigned long LOCALITY     = 0xfffful<<16;  // Mask for locality hint (+1, 0=none)
+        static const int NPRIORITY = 8;                           // No. of priority levels
 
         explicit TaskAttributes(unsigned long flags = 0) : flags(flags) {}
 
@@ -245,6 +263,16 @@ namespace madness {
                 flags &= ~HIGHPRIORITY;
         }
 
+        /// Set the priority level (0 is normal, the highest is \c NPRIORITY-1 )
+        void set_priority(int priority) {
+            MADNESS_ASSERT(priority>=0 && priority<NPRIORITY);
+            flags = (flags & (~PRIORITY)) | (static_cast<unsigned long>(priority) << 11);
+        }
+
+        int get_priority() const {
+            return int((flags & PRIORITY) >> 11);
+        }
+
         /// Are you sure this is what you want to call?
 
         /// Only call this for a \c TaskAttributes that is \em not a base class
@@ -266,6 +294,16 @@ namespace madness {
         	return n;
         }
 
+        /// Set the locality hint (any non-negative integer, reduced modulo 65535)
+        void set_locality(unsigned long hint) {
+            flags = (flags & (~LOCALITY)) | (((hint % 0xfffful) + 1) << 16);
+        }
+
+        /// Returns the locality hint or -1 if none was set
+        int get_locality() const {
+            return int((flags & LOCALITY) >> 16) - 1;
+        }
+
         template <typename Archive>
         void serialize(Archive& ar) {
             ar & flags;
@@ -279,6 +317,24 @@ namespace madness {
             return TaskAttributes(HIGHPRIORITY);
         }
 
+        static TaskAttributes priority(int priority) {
+            TaskAttributes t;
+            t.set_priority(priority);
+            return t;
+        }
+
+        /// Attributes for a task working on level \c n of a tree with levels 0 to \c nlevel-1
+
+        /// The levels are spread evenly over the priorities, from
+        /// \c NPRIORITY-1 at the root down to 0 (normal) at the deepest
+        /// level, so every level of a deep tree is still ordered.  Pass
+        /// e.g. one more than the maximum refinement level as \c nlevel .
+        static TaskAttributes tree_level(int n, int nlevel = 32) {
+            if (nlevel < 2) return priority(NPRIORITY-1);
+            n = std::min(std::max(n, 0), nlevel-1);
+            return priority((NPRIORITY-1)*(nlevel-1-n)/(nlevel-1));
+        }
+
         static TaskAttributes multi_threaded(int nthread) {
             TaskAttributes t;
             t.set_nthread(nthread);
@@ -700,6 +756,13 @@ namespace madness {
             id.second = 0ul;
         }
 
+        /// Adds this thread's run of the task, begun at \c start, to the timeline
+        void record_timeline(double start) const {
+            std::pair<void*,unsigned short> id;
+            get_id(id);
+            Timeline::record(Timeline::TASK, start, wall_time(), id.first, id.second);
+        }
+
     	/// Returns true for the one thread that should invoke the destructor
     	bool run_multi_threaded() {
 #ifdef HAVE_INTEL_TBB
@@ -710,6 +773,7 @@ namespace madness {
             // A downside is this does not preserve any relationships between thread
             // numbering and the architecture ... more work ahead.
             int nthread = get_nthread();
+            const double start = (Timeline::enabled() ? wall_time() : 0.0);
             if (nthread == 1) {
 #ifdef MADNESS_TASK_PROFILING
                 task_event_->start(id_, nthread, submit_time_);
@@ -718,6 +782,7 @@ namespace madness {
 #ifdef MADNESS_TASK_PROFILING
                 task_event_->stop();
 #endif // MADNESS_TASK_PROFILING
+                if (start != 0.0) record_timeline(start);
                 return true;
             }
             else {
@@ -731,6 +796,7 @@ namespace madness {
 #endif // MADNESS_TASK_PROFILING
 
                 run(TaskThreadEnv(nthread, id, barrier));
+                if (start != 0.0) record_timeline(start);
 
 #ifdef MADNESS_TASK_PROFILING
                 const bool cleanup = barrier->enter(id);
@@ -787,6 +853,13 @@ namespace madness {
 
         static inline void * operator new(std::size_t size) throw(std::bad_alloc);
 
+#else
+
+        /// Allocate task object from the small object pool
+        static inline void * operator new(std::size_t size) {
+            return SmallObjectPool::allocate(size);
+        }
+
 #endif // HAVE_INTEL_TBB
 
         /// Destroy task object
@@ -795,7 +868,7 @@ namespace madness {
 #ifdef HAVE_INTEL_TBB
                 tbb::task::destroy(*reinterpret_cast<tbb::task*>(p));
 #else
-                ::operator delete(p);
+                SmallObjectPool::deallocate(p, size);
 #endif // HAVE_INTEL_TBB
             }
         }
@@ -836,6 +909,7 @@ namespace madness {
 #ifdef MADNESS_TASK_PROFILING
         profiling::TaskProfiler profiler_;
 #endif // MADNESS_TASK_PROFILING
+        WorkStealingDeque<PoolTaskInterface*> deque_; ///< Tasks owned by this thread (work-stealing only)
 
     public:
         /// Default constructor
@@ -844,6 +918,9 @@ namespace madness {
         /// Virtual destructor
         virtual ~ThreadPoolThread() { }
 
+        /// Work-stealing deque accessor
+        WorkStealingDeque<PoolTaskInterface*>& deque() { return deque_; }
+
 #ifdef MADNESS_TASK_PROFILING
         /// Task profiler accessor
         profiling::TaskProfiler& profiler() { return profiler_; }
@@ -864,6 +941,21 @@ namespace madness {
         int nthreads; ///< No. of threads
         volatile bool finish; ///< Set to true when time to stop
         AtomicInt nfinished; ///< Thread pool exit counter
+        bool work_stealing; ///< True if tasks go to per-thread deques (MAD_SCHEDULER=steal or numa)
+        AtomicInt next_deque; ///< Round-robin counter for tasks submitted by non-pool threads
+        DQStats stats; ///< Aggregated queue statistics returned by get_stats()
+        ParkingLot parking; ///< Where idle threads sleep until a task is added
+        uint64_t nthrottle; ///< #times a submitter found the queue over its high-water mark
+        uint64_t ninline; ///< #tasks run by throttled submitters
+        volatile long nqueued; ///< No. of entries in the queue and deques (counted at add and pop)
+
+        // NUMA-aware work stealing (MAD_SCHEDULER=numa)
+        bool numa; ///< True if stealing prefers the local NUMA node
+        int nnodes; ///< No. of NUMA nodes used by the pool
+        std::vector<int> thread_node; ///< NUMA node of each pool thread
+        std::vector< std::vector<int> > node_threads; ///< Pool threads on each NUMA node
+        std::vector< std::vector<int> > node_cpus; ///< CPUs of each NUMA node
+        WorkStealingDeque<PoolTaskInterface*>* node_queue; ///< Per-node queues for tasks with a locality hint
 
         // Static data
         static ThreadPool* instance_ptr; ///< Singleton pointer
@@ -872,6 +964,11 @@ namespace madness {
 #endif
         static const int nmax=128; // WAS 100 !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! DEBUG
         static double await_timeout; ///< Waiter timeout
+        static uint64_t spin_ns; ///< Time idle threads spin before parking (MAD_SPIN_US)
+        static const long await_park_min_us = 10;  ///< First park timeout of await()
+        static const long await_park_max_us = 100; ///< Longest park timeout of await()
+        static std::size_t high_water; ///< Queue length that throttles submitters (MAD_QUEUE_HIGH_WATER, 0 = never)
+        static std::size_t low_water; ///< Queue length down to which they run tasks (MAD_QUEUE_LOW_WATER)
 
 #if defined(HAVE_IBMBGQ) and defined(HPM)
 	static unsigned int main_hpmctx; // HPM context for main thread
@@ -885,6 +982,58 @@ namespace madness {
         /// Get number of threads from the environment
         int default_nthread();
 
+        /// Scheduler choices for MAD_SCHEDULER
+        enum SchedulerKind { SCHED_QUEUE, SCHED_STEAL, SCHED_NUMA };
+
+        /// Get the scheduler choice from the environment
+        SchedulerKind default_scheduler();
+
+        /// Read the NUMA topology and assign pool threads to nodes
+        void init_numa();
+
+        /// Put a single-threaded task on a work-stealing deque
+
+        /// Pool threads push onto their own deque.  Other threads (main,
+        /// RMI server) distribute tasks round-robin over the pool.
+        /// Tasks with a priority go to the lane of their level, which the
+        /// owner and thieves empty highest level first.  Generators are
+        /// placed at the front (thief end) so that idle threads pick them
+        /// up first and fan out the work they produce.
+        ///
+        /// With the NUMA scheduler a task carrying a locality hint for
+        /// another node, or submitted by a non-pool thread, goes to the
+        /// queue of its node instead.
+        void push_to_deque(PoolTaskInterface* task);
+
+        /// Take a task from another queue ... returns true if one was taken
+
+        /// Steals the oldest task from some other pool thread.  The NUMA
+        /// scheduler first tries the queue and threads of our own node.
+        bool steal(int me, PoolTaskInterface*& task);
+
+        /// Steal from the pool threads in \c victims , starting after \c me
+        bool steal_from(const std::vector<int>& victims, int me, PoolTaskInterface*& task);
+
+        /// True if some queue or deque holds a task
+        bool has_work();
+
+        /// Run tasks on this thread until the queue is down to \c low_water
+        void drain();
+
+        /// Called by an idle pool thread ... returns when there may be work
+
+        /// Spins for \c spin_ns checking for work, then parks until
+        /// a task is added (or the pool finishes).
+        void wait_for_work();
+
+        /// Run the next available task with the work-stealing scheduler
+
+        /// Tasks in the shared queue (high-priority, multi-threaded and
+        /// migratable tasks) are run first, then this thread's own deque
+        /// (highest priority level first, LIFO within a level), and finally
+        /// a task stolen from another thread.
+        bool run_tasks_stealing(bool wait, ThreadPoolThread* this_thread);
+
         /// Run next task ... returns true if one was run ... blocks if wait is true
         bool run_task(bool wait, ThreadPoolThread* this_thread) {
 #if HAVE_INTEL_TBB
@@ -893,6 +1042,7 @@ namespace madness {
 
             if (!wait && queue.empty()) return false;
             std::pair<PoolTaskInterface*,bool> t = queue.pop_front(wait);
+            if (t.second) __sync_fetch_and_sub(&nqueued, 1l);
 #ifdef MADNESS_TASK_PROFILING
             profiling::TaskEventList* event_list =
                     this_thread->profiler().new_list(1);
@@ -924,8 +1074,15 @@ namespace madness {
             MADNESS_EXCEPTION("run_tasks should not be called when using Intel TBB", 1);
 #else
 
+            if (work_stealing) return run_tasks_stealing(wait, this_thread);
+
             PoolTaskInterface* taskbuf[nmax];
-            int ntask = queue.pop_front(nmax, taskbuf, wait);
+            int ntask = queue.pop_front(nmax, taskbuf, false);
+            __sync_fetch_and_sub(&nqueued, long(ntask));
+            if (ntask == 0) {
+                if (wait && !finish) wait_for_work();
+                return false;
+            }
 #ifdef MADNESS_TASK_PROFILING
             profiling::TaskEventList* event_list =
                     this_thread->profiler().new_list(ntask);
@@ -984,7 +1141,7 @@ namespace madness {
 #endif // MADNESS_TASK_PROFILING
 #if HAVE_INTEL_TBB
             ThreadPool::tbb_parent_task->increment_ref_count();
-            if (task->is_high_priority()) {
+            if (task->is_high_priority() || task->get_priority()) {
                 ThreadPool::tbb_parent_task->spawn(*task);
             }
             else {
@@ -993,14 +1150,25 @@ namespace madness {
 #else
             if (!task) MADNESS_EXCEPTION("ThreadPool: inserting a NULL task pointer", 1);
             int task_threads = task->get_nthread();
+            __sync_fetch_and_add(&instance()->nqueued, long(task_threads));
             // Currently multithreaded tasks must be shoved on the end of the q
             // to avoid a race condition as multithreaded task is starting up
             if (task->is_high_priority() && (task_threads == 1)) {
                 instance()->queue.push_front(task);
             }
+            else if (task->get_priority() && (task_threads == 1) && !instance()->work_stealing) {
+                instance()->queue.push_priority(task, task->get_priority());
+            }
+            else if (instance()->work_stealing && (task_threads == 1) && !task->is_stealable()) {
+                // Stealable tasks stay in the shared queue where scan() can
+                // find them for migration to another process
+                instance()->push_to_deque(task);
+            }
             else {
                 instance()->queue.push_back(task, task_threads);
             }
+            for (int i=0; i<task_threads; ++i)
+                instance()->parking.notify_one();
 #endif // HAVE_INTEL_TBB
         }
 
@@ -1038,14 +1206,66 @@ namespace madness {
             return instance()->nthreads;
         }
 
-        /// Returns number of tasks in the queue
+        /// Returns number of tasks in the queue (including work-stealing deques)
+
+        /// Read from a counter so this is cheap enough to call after every
+        /// submission.  A multi-threaded task counts once per thread.
         static std::size_t queue_size() {
-            return instance()->queue.size();
+            const long n = instance()->nqueued;
+            return n > 0 ? n : 0; // A pop may be counted before its add
+        }
+
+        /// Bound the queue by running tasks on the submitting thread
+
+        /// If more than \c high tasks are queued when \c throttle() is
+        /// called, the caller runs queued tasks until no more than \c low
+        /// are left.  This stops a loop that generates tasks much faster
+        /// than they run (e.g., apply over a 6-D tree) from holding
+        /// millions of tasks and their data in the queue.  \c high of zero
+        /// (the default, or set MAD_QUEUE_HIGH_WATER) turns this off;
+        /// \c low defaults to half of \c high (MAD_QUEUE_LOW_WATER).
+        static void set_water_marks(std::size_t high, std::size_t low) {
+            high_water = high;
+            low_water = (low < high ? low : high);
+        }
+
+        /// Runs tasks if the queue is over its high-water mark
+
+        /// Submitting a task never throttles by itself, since the
+        /// submitter may hold an accessor or lock that a queued task
+        /// needs.  Loops that submit many tasks (e.g., FunctionImpl::apply)
+        /// instead call this at points where they hold nothing.  Only the
+        /// main thread and pool threads run tasks here; other threads
+        /// (e.g., the RMI server) return at once.
+        static void throttle() {
+#if !HAVE_INTEL_TBB
+            if (high_water && queue_size() > high_water) instance()->drain();
+#endif
+        }
+
+        /// Returns true if the pool is using the work-stealing scheduler
+        static bool is_work_stealing() {
+            return instance()->work_stealing;
+        }
+
+        /// Returns true if work stealing is NUMA-aware
+        static bool is_numa() {
+            return instance()->numa;
+        }
+
+        /// Returns the number of NUMA nodes used by the pool (1 unless NUMA-aware)
+        static int num_numa_nodes() {
+            return instance()->nnodes;
         }
 
         /// Returns queue statistics
         static const DQStats& get_stats();
 
+        /// Returns statistics of idle threads spinning and parking
+        static const ParkStats& get_park_stats() {
+            return instance()->parking.get_stats();
+        }
+
         /// Gracefully wait for a condition to become true ... executes tasks if any in queue
 
         /// Probe should be an object that when called returns the status.
@@ -1055,7 +1275,10 @@ namespace madness {
             const double timeout = await_timeout;
             int counter = 0;
 
-            MutexWaiter waiter;
+            uint64_t spin_start = 0; // Start of the current spell of spinning
+            bool parked = false;     // True once this idle period has parked
+            long park_us = await_park_min_us;
+            double idle_start = 0.0; // Wall time the current idle period began (timeline only)
             while (!probe()) {
 
 #if HAVE_INTEL_TBB
@@ -1067,8 +1290,17 @@ namespace madness {
                 const double current_time = cpu_time();
 
                 if (working) {
+                    if (idle_start != 0.0) {
+                        Timeline::record(Timeline::IDLE, idle_start, wall_time());
+                        idle_start = 0.0;
+                    }
                     // Reset timeout logic
-                    waiter.reset();
+                    if (spin_start) {
+                        instance()->parking.record_spin(ParkingLot::now_ns() - spin_start, true);
+                        spin_start = 0;
+                    }
+                    parked = false;
+                    park_us = await_park_min_us;
                     start = current_time;
                     counter = 0;
                 } else {
@@ -1082,12 +1314,38 @@ namespace madness {
                                     0, 1, __LINE__, __FUNCTION__, __FILE__);
                     }
 
-                    waiter.wait();
+                    if (idle_start == 0.0 && Timeline::enabled()) idle_start = wall_time();
+
+                    // Spin, then park until a task is added.  Nothing
+                    // notifies us when the probe becomes true, so the park
+                    // times out after a period that grows while we are idle.
+                    // Once parked we do not spin again until there is work.
+                    if (!parked) {
+                        const uint64_t now = ParkingLot::now_ns();
+                        if (!spin_start) spin_start = now;
+                        if (now - spin_start < spin_ns) {
+                            for (int i=0; i<32; ++i) cpu_relax();
+                            continue;
+                        }
+                        instance()->parking.record_spin(now - spin_start, false);
+                        spin_start = 0;
+                        parked = true;
+                    }
+                    ParkingLot& parking = instance()->parking;
+                    const int key = parking.prepare_park();
+                    if (probe())
+                        parking.cancel_park();
+                    else
+                        parking.park(key, park_us);
+                    park_us = (2*park_us < await_park_max_us) ? 2*park_us : await_park_max_us;
                 }
             }
+            if (spin_start) instance()->parking.record_spin(ParkingLot::now_ns() - spin_start, true);
+            if (idle_start != 0.0) Timeline::record(Timeline::IDLE, idle_start, wall_time());
         }
 
         ~ThreadPool() {
+            delete [] node_queue;
 #if HAVE_INTEL_TBB
             tbb_parent_task->decrement_ref_count();
             tbb::task::destroy(*tbb_parent_task);
@@ -0,0 +1,270 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+#include <madness/world/worldtimeline.h>
+#include <madness/world/worldmutex.h>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+#ifdef __GNUC__
+#include <cxxabi.h>   // for abi::__cxa_demangle
+#include <execinfo.h> // for backtrace_symbols
+#endif
+
+namespace madness {
+
+    bool Timeline::enabled_ = false;
+
+    namespace {
+
+        struct Event {
+            const void* what;
+            double start;
+            double stop;
+            long arg;
+            std::size_t nbyte;
+            Timeline::Kind kind;
+        };
+
+        /// Events of one thread, the most recent overwriting the oldest
+        struct Ring {
+            std::vector<Event> events;  // Size is a power of two
+            unsigned long n;            // Events recorded so far
+            int tid;
+            std::string name;
+
+            Ring(std::size_t size, int tid) : events(size), n(0), tid(tid) {}
+        };
+
+        Spinlock rings_lock;        // Guards rings
+        std::vector<Ring*> rings;   // All rings, in the order made (never freed)
+        std::size_t ring_size = 65536;
+        std::string file_prefix;
+        int timeline_rank = 0;
+        double epoch_offset = 0.0;  // Add to wall_time() for seconds since the epoch
+
+        thread_local Ring* my_ring = 0; // Stays valid, so threads never see a freed ring
+
+        Ring* this_ring() {
+            if (!my_ring) {
+                ScopedMutex<Spinlock> hold(rings_lock);
+                my_ring = new Ring(ring_size, int(rings.size()));
+                rings.push_back(my_ring);
+            }
+            return my_ring;
+        }
+
+        const char* kind_name(Timeline::Kind kind) {
+            switch (kind) {
+            case Timeline::TASK: return "task";
+            case Timeline::AM_SEND: return "am_send";
+            case Timeline::AM_RECV: return "am_recv";
+            case Timeline::FENCE: return "fence";
+            case Timeline::IDLE: return "idle";
+            }
+            return "unknown";
+        }
+
+        std::string demangle(const char* symbol) {
+#ifdef __GNUC__
+            int status = 0;
+            char* name = abi::__cxa_demangle(symbol, 0, 0, &status);
+            if (status == 0 && name) {
+                std::string result(name);
+                free(name);
+                return result;
+            }
+#endif
+            return symbol;
+        }
+
+        /// Name of the task function from the id made by PoolTaskInterface::get_id()
+        std::string task_name(const void* what, long type) {
+            if (!what) return "task";
+            if (type == 2) return demangle(static_cast<const char*>(what));
+#ifdef __GNUC__
+            // Function pointer ... symbol as <file>(<mangled name>+<offset>) [<address>]
+            void* const ptr = const_cast<void*>(what);
+            char** bt_sym = backtrace_symbols(&ptr, 1);
+            std::string name;
+            if (bt_sym) {
+                const char* first = strchr(bt_sym[0],'(');
+                const char* last = (first ? strrchr(first,'+') : 0);
+                if (first && last && last > first+1)
+                    name = demangle(std::string(first+1, last).c_str());
+                free(bt_sym);
+            }
+            if (!name.empty()) return name;
+#endif
+            std::ostringstream s;
+            s << what;
+            return s.str();
+        }
+
+        /// Writes \c s as a JSON string
+        void write_string(std::ostream& out, const std::string& s) {
+            out << '"';
+            for (std::size_t i=0; i<s.size(); ++i) {
+                const char c = s[i];
+                if (c == '"' || c == '\\') out << '\\' << c;
+                else if (static_cast<unsigned char>(c) < 0x20) out << ' ';
+                else out << c;
+            }
+            out << '"';
+        }
+
+    }
+
+
+    void Timeline::record(Kind kind, double start, double stop, const void* what, long arg, std::size_t nbyte) {
+        Ring* ring = this_ring();
+        Event& e = ring->events[ring->n & (ring->events.size()-1)];
+        e.what = what;
+        e.start = start;
+        e.stop = stop;
+        e.arg = arg;
+        e.nbyte = nbyte;
+        e.kind = kind;
+        ++ring->n;
+    }
+
+
+    void Timeline::name_thread(const char* name) {
+        if (enabled_) this_ring()->name = name;
+    }
+
+
+    void Timeline::begin(int rank) {
+        const char* prefix = getenv("MAD_TIMELINE");
+        if (!prefix || !*prefix) return;
+
+        const char* sevents = getenv("MAD_TIMELINE_EVENTS");
+        if (sevents) {
+            std::istringstream s(sevents);
+            long n = 0;
+            s >> n;
+            if (s.fail() || n <= 0) {
+                std::cerr << "!!! WARNING: MAD_TIMELINE_EVENTS is not a positive number ... using "
+                          << ring_size << "\n";
+            }
+            else {
+                ring_size = 1;
+                while (ring_size < std::size_t(n)) ring_size <<= 1;
+            }
+        }
+
+        {
+            // Rings left by an earlier timeline are emptied by end(), but
+            // MAD_TIMELINE_EVENTS may have changed since
+            ScopedMutex<Spinlock> hold(rings_lock);
+            for (std::size_t r=0; r<rings.size(); ++r)
+                if (rings[r]->events.size() != ring_size) rings[r]->events.assign(ring_size, Event());
+        }
+
+        struct timeval tv;
+        gettimeofday(&tv,0);
+        epoch_offset = (tv.tv_sec + 1e-6*tv.tv_usec) - wall_time();
+        file_prefix = prefix;
+        timeline_rank = rank;
+        enabled_ = true;
+        name_thread("main");
+    }
+
+
+    void Timeline::end() {
+        if (!enabled_) return;
+        enabled_ = false;
+
+        std::ostringstream file_name;
+        file_name << file_prefix << "." << timeline_rank << ".json";
+        std::ofstream out(file_name.str().c_str());
+        if (out.fail()) {
+            std::cerr << "!!! WARNING: could not open timeline file " << file_name.str() << "\n";
+        }
+        else {
+            std::map<const void*, std::string> names;
+            out.precision(3);
+            out << std::fixed << "{\"traceEvents\":[\n";
+            bool first = true;
+            for (std::size_t r=0; r<rings.size(); ++r) {
+                const Ring& ring = *rings[r];
+                out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":"
+                    << timeline_rank << ",\"tid\":" << ring.tid << ",\"args\":{\"name\":";
+                std::ostringstream name;
+                name << (ring.name.empty() ? "thread" : ring.name.c_str()) << " " << ring.tid;
+                write_string(out, name.str());
+                out << "}}";
+                first = false;
+
+                const std::size_t size = ring.events.size();
+                const unsigned long lo = (ring.n > size ? ring.n - size : 0);
+                for (unsigned long i=lo; i<ring.n; ++i) {
+                    const Event& e = ring.events[i & (size-1)];
+                    out << ",\n{\"name\":";
+                    if (e.kind == TASK) {
+                        std::map<const void*, std::string>::iterator it = names.find(e.what);
+                        if (it == names.end())
+                            it = names.insert(std::make_pair(e.what, task_name(e.what, e.arg))).first;
+                        write_string(out, it->second);
+                    }
+                    else {
+                        write_string(out, kind_name(e.kind));
+                    }
+                    out << ",\"cat\":\"" << kind_name(e.kind) << "\",\"ph\":\"X\",\"ts\":"
+                        << (e.start + epoch_offset)*1e6 << ",\"dur\":" << (e.stop - e.start)*1e6
+                        << ",\"pid\":" << timeline_rank << ",\"tid\":" << ring.tid;
+                    if (e.kind == AM_SEND || e.kind == AM_RECV) {
+                        out << ",\"args\":{\"" << (e.kind == AM_SEND ? "dest" : "src") << "\":" << e.arg
+                            << ",\"nbyte\":" << e.nbyte << "}";
+                    }
+                    else if (e.kind == FENCE && e.what) {
+                        out << ",\"args\":{\"file\":";
+                        write_string(out, static_cast<const char*>(e.what));
+                        out << ",\"line\":" << e.arg << "}";
+                    }
+                    out << "}";
+                }
+            }
+            out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        }
+
+        // Threads keep their rings, since any of them may record again
+        // after the next begin(), so the rings are only emptied
+        for (std::size_t r=0; r<rings.size(); ++r) rings[r]->n = 0;
+    }
+
+}
@@ -0,0 +1,125 @@
+/*
+  This file is part of MADNESS.
+
+  Copyright (C) 2007,2010 Oak Ridge National Laboratory
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+  For more information please contact:
+
+  Robert J. Harrison
+  Oak Ridge National Laboratory
+  One Bethel Valley Road
+  P.O. Box 2008, MS-6367
+
+  email: harrisonrj@ornl.gov
+  tel:   865-241-3937
+  fax:   865-572-0680
+*/
+
+#ifndef MADNESS_WORLD_WORLDTIMELINE_H__INCLUDED
+#define MADNESS_WORLD_WORLDTIMELINE_H__INCLUDED
+
+/// \file worldtimeline.h
+/// \brief Timeline of runtime events in Chrome trace format
+
+#include <madness/world/timers.h>
+#include <cstddef>
+
+namespace madness {
+
+    /// Records a timeline of task, active message, fence and idle events
+
+    /// Set the environment variable \c MAD_TIMELINE to a file prefix to
+    /// enable it; each process then writes \c prefix.rank.json in the
+    /// Chrome trace format (load it in Perfetto or chrome://tracing) when
+    /// the runtime is finalized.  Every thread records into its own ring
+    /// buffer of \c MAD_TIMELINE_EVENTS events (default 65536) without
+    /// locking, so only the most recent events of each thread are kept.
+    /// When disabled, recording costs a test of a flag.
+    ///
+    /// Tasks are named after their function, which needs the executable
+    /// to be linked with \c -rdynamic (as for the task profiler);
+    /// otherwise the function address is given.
+    ///
+    /// Times are shifted to the epoch so that the files of different
+    /// processes line up when opened together.
+    class Timeline {
+    public:
+        /// Kinds of event
+        enum Kind {
+            TASK,       ///< A thread running a task
+            AM_SEND,    ///< Sending an active message
+            AM_RECV,    ///< Running the handler of an incoming active message
+            FENCE,      ///< Waiting in WorldGopInterface::fence()
+            IDLE        ///< ThreadPool::await() waiting with no work to do
+        };
+
+    private:
+        static bool enabled_;
+
+    public:
+        /// Returns true if events are being recorded
+        static bool enabled() {
+            return enabled_;
+        }
+
+        /// Records an event of this thread
+
+        /// @param[in] kind The kind of event
+        /// @param[in] start The wall_time() it started
+        /// @param[in] stop The wall_time() it ended
+        /// @param[in] what Function or type name pointer (TASK), or file name (FENCE)
+        /// @param[in] arg Id type (TASK), peer process (AM), or line (FENCE)
+        /// @param[in] nbyte Message size (AM)
+        static void record(Kind kind, double start, double stop,
+                           const void* what = 0, long arg = 0, std::size_t nbyte = 0);
+
+        /// Names this thread in the timeline (e.g., "rmi"), followed by its number
+        static void name_thread(const char* name);
+
+        /// Reads the environment and enables recording if asked for (called by initialize())
+        static void begin(int rank);
+
+        /// Writes the timeline of this process (called by finalize() once other threads stopped)
+        static void end();
+    };
+
+
+    /// Records an event from construction to destruction
+    class TimelineScope {
+        const double start;
+        const Timeline::Kind kind;
+        const void* const what;
+        const long arg;
+        const std::size_t nbyte;
+
+        TimelineScope(const TimelineScope&);
+        TimelineScope& operator=(const TimelineScope&);
+
+    public:
+        TimelineScope(Timeline::Kind kind, const void* what = 0, long arg = 0, std::size_t nbyte = 0)
+            : start(Timeline::enabled() ? wall_time() : 0.0)
+            , kind(kind), what(what), arg(arg), nbyte(nbyte)
+        {}
+
+        ~TimelineScope() {
+            if (start != 0.0) Timeline::record(kind, start, wall_time(), what, arg, nbyte);
+        }
+    };
+
+}
+
+#endif // MADNESS_WORLD_WORLDTIMELINE_H__INCLUDED